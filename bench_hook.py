@@ -0,0 +1,30 @@
+import os
+from SCons.Script import DefaultEnvironment
+
+env = DefaultEnvironment()
+
+# --- Configuration ---
+# `pio run -t boot_bench` boots the bootloader in the Espressif QEMU with a synthetic app and
+# compares its phase times with test/qemu/boot_baseline.json (see tools/betterota_qemu_bench.py);
+# `pio run -t boot_bench_update` records them there, which has to be done once on the reference QEMU.
+# Set `custom_betterota_bench_args` in platformio.ini to pass more options, e.g. `--runs 9`.
+BENCH = os.path.join(env.get("PROJECT_DIR"), "tools", "betterota_qemu_bench.py")
+ARGS = env.GetProjectOption("custom_betterota_bench_args", "")
+
+# --- SCRIPT EXECUTION ---
+
+env.AddCustomTarget(
+    name="boot_bench",
+    dependencies="$BUILD_DIR/bootloader.bin",
+    actions=f'"$PYTHONEXE" "{BENCH}" --bootloader "$BUILD_DIR/bootloader.bin" {ARGS}',
+    title="Boot benchmark",
+    description="Boot the bootloader in QEMU and compare its phase times with the baseline",
+)
+
+env.AddCustomTarget(
+    name="boot_bench_update",
+    dependencies="$BUILD_DIR/bootloader.bin",
+    actions=f'"$PYTHONEXE" "{BENCH}" --bootloader "$BUILD_DIR/bootloader.bin" --update {ARGS}',
+    title="Boot benchmark baseline",
+    description="Boot the bootloader in QEMU and record its phase times as the baseline",
+)
@@ -0,0 +1,206 @@
+/*
+ * Work loop on the APP CPU, see boot_app_cpu.h.
+ *
+ * Releasing the APP CPU follows start_other_core() from ESP-IDF's cpu_start.c: its clock is
+ * enabled, the stall and reset are released, and the ROM running on it jumps to the address
+ * set with ets_set_appcpu_boot_addr(), on a stack of its own in the ROM data area.
+ *
+ * The two CPUs share a mailbox in DRAM. The bootloader runs without interrupts, so both
+ * sides spin on its sequence numbers; memory barriers keep the job visible before its number.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_cpu.h"
+#include "esp_rom_sys.h"
+#include "esp_rom_spiflash.h"
+#include "esp_flash_encrypt.h"
+#include "esp32/rom/cache.h"
+#include "esp32/rom/ets_sys.h"
+#include "bootloader_flash_priv.h"
+#include "soc/dport_reg.h"
+#include "soc/efuse_reg.h"
+#include "boot_log.h"
+#include "boot_app_cpu.h"
+
+#if CONFIG_BETTEROTA_APP_CPU
+
+#if !CONFIG_IDF_TARGET_ESP32
+#error "The BetterOTA APP CPU work loop only supports the ESP32"
+#endif
+
+static const char *TAG = "BetterOTA";
+
+// The ROM on the APP CPU takes a few hundred microseconds to get to the work loop
+#define START_TIMEOUT_US 10000
+// Lets the APP CPU finish the APB access it may be in when it is stalled
+#define STALL_SETTLE_US 1
+
+typedef struct {
+    boot_app_cpu_job_t job;
+    void *arg;
+    volatile uint32_t posted;       // Jobs posted, written by CPU0
+    volatile uint32_t done;         // Jobs done, written by the APP CPU
+    volatile uint32_t busy_cycles;  // Written by the APP CPU
+    volatile bool started;          // Written by the APP CPU when it enters the work loop
+} mailbox_t;
+
+static mailbox_t s_box;
+static bool s_running;
+static uint32_t s_wait_cycles;
+
+static void __attribute__((noreturn)) app_cpu_main(void)
+{
+    // Don't come back here if the app resets this CPU without setting its own entry
+    ets_set_appcpu_boot_addr(0);
+    s_box.started = true;
+    __sync_synchronize();
+
+    for (;;) {
+        if (s_box.done == s_box.posted) {
+            continue;
+        }
+        __sync_synchronize();
+        const uint32_t start = esp_cpu_get_cycle_count();
+        s_box.job(s_box.arg);
+        s_box.busy_cycles += esp_cpu_get_cycle_count() - start;
+        __sync_synchronize();
+        s_box.done = s_box.done + 1;
+    }
+}
+
+/**
+ * @brief Holds the APP CPU in reset with its clock gated, as after power-on.
+ */
+static void hold_in_reset(void)
+{
+    DPORT_SET_PERI_REG_MASK(DPORT_APPCPU_CTRL_A_REG, DPORT_APPCPU_RESETTING);
+    DPORT_CLEAR_PERI_REG_MASK(DPORT_APPCPU_CTRL_B_REG, DPORT_APPCPU_CLKGATE_EN);
+}
+
+bool boot_app_cpu_start(void)
+{
+    if (REG_GET_BIT(EFUSE_BLK0_RDATA3_REG, EFUSE_RD_CHIP_VER_DIS_APP_CPU)) {
+        ESP_LOGW(TAG, "Single-core chip, loading without the APP CPU");
+        return false;
+    }
+
+    s_box = (mailbox_t){0};
+    s_wait_cycles = 0;
+    __sync_synchronize();
+
+    DPORT_SET_PERI_REG_MASK(DPORT_APPCPU_CTRL_B_REG, DPORT_APPCPU_CLKGATE_EN);
+    DPORT_CLEAR_PERI_REG_MASK(DPORT_APPCPU_CTRL_C_REG, DPORT_APPCPU_RUNSTALL);
+    DPORT_SET_PERI_REG_MASK(DPORT_APPCPU_CTRL_A_REG, DPORT_APPCPU_RESETTING);
+    DPORT_CLEAR_PERI_REG_MASK(DPORT_APPCPU_CTRL_A_REG, DPORT_APPCPU_RESETTING);
+    ets_set_appcpu_boot_addr((uint32_t)app_cpu_main);
+
+    const uint32_t timeout = START_TIMEOUT_US * esp_rom_get_cpu_ticks_per_us();
+    const uint32_t start = esp_cpu_get_cycle_count();
+    while (!s_box.started) {
+        if (esp_cpu_get_cycle_count() - start > timeout) {
+            hold_in_reset();
+            ets_set_appcpu_boot_addr(0);
+            ESP_LOGW(TAG, "APP CPU didn't start, loading without it");
+            return false;
+        }
+    }
+    __sync_synchronize();
+    s_running = true;
+    ESP_LOGD(TAG, "APP CPU started in %lu us",
+             (unsigned long)((esp_cpu_get_cycle_count() - start) / esp_rom_get_cpu_ticks_per_us()));
+    return true;
+}
+
+/**
+ * @brief Stalls the APP CPU wherever it is. DPORT_APPCPU_CTRL_C_REG holds nothing but the stall
+ * bit, so it is written without reading it first.
+ */
+static void stall(void)
+{
+    DPORT_REG_WRITE(DPORT_APPCPU_CTRL_C_REG, DPORT_APPCPU_RUNSTALL);
+    __asm__ __volatile__("memw");
+    esp_rom_delay_us(STALL_SETTLE_US);
+}
+
+static void unstall(void)
+{
+    DPORT_REG_WRITE(DPORT_APPCPU_CTRL_C_REG, 0);
+    __asm__ __volatile__("memw");
+}
+
+esp_err_t boot_app_cpu_flash_read(uint32_t src_addr, void *dest, uint32_t size)
+{
+    if (!s_running) {
+        return bootloader_flash_read(src_addr, dest, size, true);
+    }
+    if (esp_flash_encryption_enabled()) {
+        stall();
+        const esp_err_t err = bootloader_flash_read(src_addr, dest, size, true);
+        unstall();
+        return err;
+    }
+    if (src_addr % 4 != 0 || size % 4 != 0 || (uintptr_t)dest % 4 != 0) {
+        return ESP_FAIL;
+    }
+
+    // As bootloader_flash_read() without decryption, with only the cache control stalled
+    stall();
+    Cache_Read_Disable(0);
+    Cache_Flush(0);
+    unstall();
+    const esp_rom_spiflash_result_t r = esp_rom_spiflash_read(src_addr, dest, size);
+    stall();
+    Cache_Read_Enable(0);
+    unstall();
+    return r == ESP_ROM_SPIFLASH_RESULT_OK ? ESP_OK : ESP_FAIL;
+}
+
+bool boot_app_cpu_running(void)
+{
+    return s_running;
+}
+
+void boot_app_cpu_wait(void)
+{
+    if (!s_running || s_box.done == s_box.posted) {
+        return;
+    }
+    const uint32_t start = esp_cpu_get_cycle_count();
+    while (s_box.done != s_box.posted) {
+    }
+    __sync_synchronize();
+    s_wait_cycles += esp_cpu_get_cycle_count() - start;
+}
+
+void boot_app_cpu_run(boot_app_cpu_job_t job, void *arg)
+{
+    boot_app_cpu_wait();
+    s_box.job = job;
+    s_box.arg = arg;
+    __sync_synchronize();
+    s_box.posted = s_box.posted + 1;
+}
+
+void boot_app_cpu_stop(void)
+{
+    if (!s_running) {
+        return;
+    }
+    boot_app_cpu_wait();
+    hold_in_reset();
+    s_running = false;
+}
+
+uint32_t boot_app_cpu_busy_cycles(void)
+{
+    return s_box.busy_cycles;
+}
+
+uint32_t boot_app_cpu_wait_cycles(void)
+{
+    return s_wait_cycles;
+}
+
+#endif // CONFIG_BETTEROTA_APP_CPU
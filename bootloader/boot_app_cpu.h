@@ -0,0 +1,79 @@
+/*
+ * Work loop on the APP CPU, which the ROM otherwise holds in reset until the app starts it.
+ *
+ * CPU0 hands the APP CPU one job at a time while it goes on with its own work, e.g. hashing
+ * the chunk of the image that was just read while the next one is read and copied. Jobs run
+ * from the loader segment (see LOADER_IRAM_SOURCES in bootloader_hook.py) and on the APP CPU's
+ * ROM stack. They must not touch the flash, and must not read DPORT registers other than
+ * through boot_sha.h, as CPU0's flash reads meanwhile may corrupt such reads.
+ *
+ * The other way around, a DPORT read on CPU0 may return wrong data while a job accesses the
+ * APB, which boot_sha.h does. While a job may run, CPU0 reads flash through
+ * boot_app_cpu_flash_read() only.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+// DRAM the ROM uses for both CPUs, including the APP CPU's stack; never loaded while it runs
+#define BOOT_APP_CPU_ROM_DATA_LOW   0x3FFE0000U
+#define BOOT_APP_CPU_ROM_DATA_HIGH  0x3FFE8000U
+
+typedef void (*boot_app_cpu_job_t)(void *arg);
+
+/**
+ * @brief Releases the APP CPU from reset into the work loop.
+ *
+ * @return true if it runs, false on single-core chips or when it didn't come up, in which
+ *         case CPU0 has to do all the work itself.
+ */
+bool boot_app_cpu_start(void);
+
+/**
+ * @brief Returns whether the APP CPU runs the work loop.
+ */
+bool boot_app_cpu_running(void);
+
+/**
+ * @brief Hands a job to the APP CPU, once it is done with the previous one.
+ *
+ * @param job Function to run on the APP CPU
+ * @param arg Passed to @p job; must stay valid until boot_app_cpu_wait() returns
+ */
+void boot_app_cpu_run(boot_app_cpu_job_t job, void *arg);
+
+/**
+ * @brief Waits until the APP CPU is done with the last job. Returns right away when it is idle
+ * or not running.
+ */
+void boot_app_cpu_wait(void);
+
+/**
+ * @brief Reads flash on CPU0 while the APP CPU may run a job.
+ *
+ * On the ESP32 bootloader_flash_read() disables, flushes and enables the flash cache through
+ * DPORT registers. The APP CPU is stalled around those accesses, as ESP-IDF's
+ * DPORT_STALL_OTHER_CPU_START() does, but goes on with its job during the SPI transfer. With
+ * flash encryption the read goes through the cache, so the APP CPU is stalled all along.
+ *
+ * Takes the same arguments as bootloader_flash_read() with allow_decrypt set.
+ */
+esp_err_t boot_app_cpu_flash_read(uint32_t src_addr, void *dest, uint32_t size);
+
+/**
+ * @brief Waits for the last job and puts the APP CPU back in reset, as the app's startup
+ * code expects to find it.
+ */
+void boot_app_cpu_stop(void);
+
+/**
+ * @brief Returns the APP CPU cycles spent in jobs since boot_app_cpu_start().
+ */
+uint32_t boot_app_cpu_busy_cycles(void);
+
+/**
+ * @brief Returns the CPU0 cycles spent waiting for the APP CPU since boot_app_cpu_start().
+ */
+uint32_t boot_app_cpu_wait_cycles(void);
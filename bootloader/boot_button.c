@@ -0,0 +1,133 @@
+/*
+ * Boot button on GPIO 13.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+#include "esp_cpu.h"
+#include "esp_rom_sys.h"
+#include "soc/gpio_struct.h"
+#include "soc/io_mux_reg.h"
+#include "boot_button.h"
+
+// --- Button Configuration ---
+static const uint8_t BOOT_BUTTON_GPIO = 13;
+static volatile uint32_t * const IO_MUX_MTCK_REG = (volatile uint32_t *)PERIPHS_IO_MUX_MTCK_U;
+
+
+/**
+ * @brief Initializes the boot button on GPIO 13.
+ */
+static void button_init(void)
+{
+    uint32_t r = *IO_MUX_MTCK_REG;
+    r &= ~(0x7U << 12);           // clear MCU_SEL
+    r |= (2U << 12);              // set MCU_SEL = 2 (GPIO)
+    r &= ~(1U << 7);              // clear pulldown
+    r |= (1U << 8);               // set pullup
+    r |= (1U << 9);               // enable input (FUN_IE)
+    *IO_MUX_MTCK_REG = r;
+}
+
+/**
+ * @brief Samples the button once using the reliable "drive test" method.
+ *
+ * This function forces the pin high momentarily, which correctly initializes
+ * it, allowing for a reliable read. It then safely returns the pin to
+ * a high-impedance input state.
+ *
+ * @return true if the button is pressed (LOW), false if not pressed (HIGH).
+ */
+static bool button_sample(void)
+{
+    GPIO.enable_w1ts = (1u << BOOT_BUTTON_GPIO);    // Enable output for the pin
+    GPIO.out_w1ts = (1u << BOOT_BUTTON_GPIO);       // Set the output level to high
+
+    const bool pressed = !(GPIO.in & (1u << BOOT_BUTTON_GPIO));  // Read the pin state while it's being driven
+
+    GPIO.enable_w1tc = (1u << BOOT_BUTTON_GPIO);    // Immediately disable output, returning pin to a safe high-impedance state
+    GPIO.out_w1tc = (1u << BOOT_BUTTON_GPIO);       // Clear the output register just in case
+
+    return pressed;
+}
+
+/**
+ * @brief Waits until the cycle counter reaches the given value.
+ */
+static void wait_until(uint32_t deadline)
+{
+    while ((int32_t)(deadline - esp_cpu_get_cycle_count()) > 0) {
+    }
+}
+
+/**
+ * @brief Decides whether enough samples were taken to settle the button state.
+ *
+ * Majority vote: stops as soon as one level holds more than half of the N samples.
+ * Stable window: stops once the last N samples all read the same level.
+ */
+static bool decided(const button_result_t *r, uint32_t run_length)
+{
+    const uint32_t n = CONFIG_BETTEROTA_BUTTON_SAMPLES;
+#if CONFIG_BETTEROTA_BUTTON_DEBOUNCE_MAJORITY
+    (void)run_length;
+    return r->pressed_samples * 2 > n || (r->samples - r->pressed_samples) * 2 > n || r->samples >= n;
+#else
+    (void)r;
+    return run_length >= n;
+#endif
+}
+
+bool button_read(button_result_t *result)
+{
+    const uint32_t ticks_per_us = esp_rom_get_cpu_ticks_per_us();
+    const uint32_t interval = CONFIG_BETTEROTA_BUTTON_SAMPLE_INTERVAL_US * ticks_per_us;
+    const uint32_t start = esp_cpu_get_cycle_count();
+    const uint32_t deadline = start + CONFIG_BETTEROTA_BUTTON_BUDGET_US * ticks_per_us;
+
+    button_result_t r = {0};
+    uint32_t run_length = 0;
+    bool last = false;
+
+    button_init();          // Initial setup
+
+    for (;;) {
+        const bool pressed = button_sample();
+        run_length = (r.samples > 0 && pressed == last) ? run_length + 1 : 1;
+        last = pressed;
+        r.samples++;
+        r.pressed_samples += pressed;
+
+        if (decided(&r, run_length)) {
+#if CONFIG_BETTEROTA_BUTTON_DEBOUNCE_MAJORITY
+            r.pressed = r.pressed_samples * 2 > r.samples;
+#else
+            r.pressed = pressed;
+#endif
+            break;
+        }
+
+        // Never start a sample that would end past the budget
+        const uint32_t next = esp_cpu_get_cycle_count() + interval;
+        if ((int32_t)(deadline - next) < 0) {
+            // Out of time: go with the majority of what has been seen
+            r.timed_out = true;
+            r.pressed = r.pressed_samples * 2 > r.samples;
+            break;
+        }
+        wait_until(next);
+    }
+
+    button_init();          // Re-initialize the pin to ensure the pull-up is active again
+
+    r.elapsed_us = (esp_cpu_get_cycle_count() - start) / ticks_per_us;
+    if (result != NULL) {
+        *result = r;
+    }
+    return r.pressed;
+}
+
+bool button_pressed(void)
+{
+    return button_read(NULL);
+}
@@ -0,0 +1,35 @@
+/*
+ * Boot button on GPIO 13.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Outcome of a debounced button read.
+ */
+typedef struct {
+    bool pressed;               // Debounced button state
+    bool timed_out;             // The time budget ran out before the samples agreed
+    uint32_t samples;           // Number of samples taken
+    uint32_t pressed_samples;   // Number of samples that read LOW
+    uint32_t elapsed_us;        // Time taken by the decision
+} button_result_t;
+
+/**
+ * @brief Reads the boot button, debounced according to the BetterOTA button configuration.
+ *
+ * The read never takes (much) longer than CONFIG_BETTEROTA_BUTTON_BUDGET_US.
+ *
+ * @param[out] result Details about the decision, may be NULL
+ * @return true if the button is pressed (pin pulled LOW), false otherwise.
+ */
+bool button_read(button_result_t *result);
+
+/**
+ * @brief Reads the boot button.
+ *
+ * @return true if the button is pressed (pin pulled LOW), false otherwise.
+ */
+bool button_pressed(void);
@@ -0,0 +1,54 @@
+/*
+ * Faster CPU clock for the CPU-bound parts of the boot.
+ */
+#include <stdbool.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "soc/rtc.h"
+#include "boot_stats.h"
+#include "boot_timer.h"
+#include "boot_clock.h"
+
+static const char *TAG = "BetterOTA";
+
+static rtc_cpu_freq_config_t s_saved;
+static bool s_boosted;
+
+/**
+ * @brief Switches the CPU clock, accounting the time so far at the old frequency first.
+ */
+static void set_clock(const rtc_cpu_freq_config_t *config)
+{
+    boot_timer_now_us();
+    rtc_clk_cpu_freq_set_config(config);
+}
+
+void boot_clock_boost(void)
+{
+#if CONFIG_BETTEROTA_CLOCK_BOOST
+    if (s_boosted) {
+        return;
+    }
+    rtc_cpu_freq_config_t fast;
+    rtc_clk_cpu_freq_get_config(&s_saved);
+    if (s_saved.freq_mhz >= CONFIG_BETTEROTA_CLOCK_BOOST_MHZ) {
+        return;
+    }
+    if (!rtc_clk_cpu_freq_mhz_to_config(CONFIG_BETTEROTA_CLOCK_BOOST_MHZ, &fast)) {
+        ESP_LOGW(TAG, "Can't run the CPU at %d MHz", CONFIG_BETTEROTA_CLOCK_BOOST_MHZ);
+        return;
+    }
+    set_clock(&fast);
+    s_boosted = true;
+    boot_timer_stats()->flags |= BOOT_STATS_FLAG_CLOCK_BOOST;
+#endif
+}
+
+void boot_clock_restore(void)
+{
+    if (!s_boosted) {
+        return;
+    }
+    set_clock(&s_saved);
+    s_boosted = false;
+}
@@ -0,0 +1,21 @@
+/*
+ * Faster CPU clock for the CPU-bound parts of the boot.
+ *
+ * bootloader_init() runs the CPU at 80 MHz. With CONFIG_BETTEROTA_CLOCK_BOOST, the patch
+ * application and the image load run at CONFIG_BETTEROTA_CLOCK_BOOST_MHZ instead, which
+ * speeds up the LZ4 decompression, the checksum, the copies to RAM and the patching. The APB
+ * clock stays at 80 MHz, so the flash, the UART and the SHA accelerator keep their speed.
+ */
+#pragma once
+
+/**
+ * @brief Raises the CPU clock, if enabled and not already raised.
+ */
+void boot_clock_boost(void);
+
+/**
+ * @brief Returns to the CPU clock in effect before boot_clock_boost().
+ *
+ * Must be called before the app starts, which expects the bootloader's clock configuration.
+ */
+void boot_clock_restore(void);
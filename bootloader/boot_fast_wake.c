@@ -0,0 +1,70 @@
+/*
+ * Skipping the image verification when waking from deep sleep.
+ */
+#include <string.h>
+#include "esp_log.h"
+#include "boot_rtc.h"
+#include "boot_log.h"
+#include "boot_flash.h"
+#include "boot_fast_wake.h"
+
+static const char *TAG = "BetterOTA";
+
+static uint32_t record_crc(const boot_wake_record_t *record)
+{
+    return esp_rom_crc32_le(UINT32_MAX, (const uint8_t *)record, offsetof(boot_wake_record_t, crc));
+}
+
+bool boot_fast_wake_check(const esp_partition_pos_t *part)
+{
+    const boot_rtc_t *rtc = boot_rtc();
+    const boot_wake_record_t *record = &rtc->wake;
+
+    if (record->magic != BOOT_WAKE_RECORD_MAGIC || record->crc != record_crc(record)) {
+        ESP_LOGD(TAG, "No wake record");
+        return false;
+    }
+    if (record->part_offset != part->offset || record->part_size != part->size) {
+        ESP_LOGI(TAG, "Wake record is for another partition (0x%lx)", (unsigned long)record->part_offset);
+        return false;
+    }
+    if (record->flash_generation != rtc->flash_generation) {
+        ESP_LOGI(TAG, "Flash was written since the last verification");
+        return false;
+    }
+
+    // Catches images rewritten behind our back, e.g. by a host over serial
+    uint8_t digest[sizeof(record->digest)];
+    if (boot_flash_read(record->digest_offset, digest, sizeof(digest)) != ESP_OK ||
+        memcmp(digest, record->digest, sizeof(digest)) != 0) {
+        ESP_LOGI(TAG, "Image digest changed since the last verification");
+        return false;
+    }
+
+    return true;
+}
+
+void boot_fast_wake_record(const esp_partition_pos_t *part, const esp_image_metadata_t *data)
+{
+    boot_rtc_t *rtc = boot_rtc();
+    boot_wake_record_t *record = &rtc->wake;
+
+    if (!data->image.hash_appended) {
+        // Without a digest there is nothing cheap to compare against on wake
+        boot_fast_wake_clear();
+        return;
+    }
+
+    record->magic = BOOT_WAKE_RECORD_MAGIC;
+    record->part_offset = part->offset;
+    record->part_size = part->size;
+    record->digest_offset = data->start_addr + data->image_len - sizeof(record->digest);
+    memcpy(record->digest, data->image_digest, sizeof(record->digest));
+    record->flash_generation = rtc->flash_generation;
+    record->crc = record_crc(record);
+}
+
+void boot_fast_wake_clear(void)
+{
+    memset(&boot_rtc()->wake, 0, sizeof(boot_wake_record_t));
+}
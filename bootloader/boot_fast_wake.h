@@ -0,0 +1,33 @@
+/*
+ * Skipping the image verification when waking from deep sleep.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include "esp_flash_partitions.h"
+#include "esp_image_format.h"
+
+/**
+ * @brief Checks whether the image in a partition is unchanged since its last full verification.
+ *
+ * This is the case when the RTC wake record names this partition, the app has not written
+ * to flash since (see boot_rtc_note_flash_write()) and the digest appended to the image
+ * still reads back the same.
+ *
+ * @param part Partition about to be booted
+ * @return true if the verification can be skipped, false otherwise.
+ */
+bool boot_fast_wake_check(const esp_partition_pos_t *part);
+
+/**
+ * @brief Remembers a fully verified image for the next wake from deep sleep.
+ *
+ * @param part Partition the image was loaded from
+ * @param data Metadata of the verified image
+ */
+void boot_fast_wake_record(const esp_partition_pos_t *part, const esp_image_metadata_t *data);
+
+/**
+ * @brief Forgets the last verified image.
+ */
+void boot_fast_wake_clear(void);
@@ -0,0 +1,116 @@
+/*
+ * Buffered flash reads for the bootloader's parsers.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "bootloader_flash_priv.h"
+#include "boot_flash.h"
+
+#if CONFIG_BETTEROTA_READ_AHEAD
+#define WINDOW_SIZE CONFIG_BETTEROTA_READ_AHEAD_SIZE
+#define WINDOWS 2
+// Marks an empty window; no window starts there, as they are aligned to their size
+#define WINDOW_EMPTY UINT32_MAX
+// The flash cache of the ESP32 reads 32 byte lines
+#define CACHE_LINE_SIZE 32
+
+_Static_assert((WINDOW_SIZE & (WINDOW_SIZE - 1)) == 0 && WINDOW_SIZE >= CACHE_LINE_SIZE,
+               "the read-ahead windows must be a power of two of whole cache lines");
+_Static_assert(WINDOW_SIZE <= SPI_FLASH_SEC_SIZE, "a read-ahead window must not cross a flash sector");
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static uint32_t s_window[WINDOWS][WINDOW_SIZE / 4] __attribute__((aligned(CACHE_LINE_SIZE)));
+static uint32_t s_window_offset[WINDOWS] = { WINDOW_EMPTY, WINDOW_EMPTY };
+static int s_recent;    // Window used last
+#endif
+
+static boot_flash_stats_t s_stats;
+
+#if CONFIG_BETTEROTA_READ_AHEAD
+/**
+ * @brief Returns the window holding the block at @p base, filling one if there is none.
+ *
+ * @return The window index, -1 if the flash read failed.
+ */
+static int get_window(uint32_t base, bool *missed)
+{
+    for (int i = 0; i < WINDOWS; i++) {
+        if (s_window_offset[i] == base) {
+            return i;
+        }
+    }
+
+    const int i = (s_recent + 1) % WINDOWS;
+    s_window_offset[i] = WINDOW_EMPTY;
+    if (bootloader_flash_read(base, s_window[i], WINDOW_SIZE, true) != ESP_OK) {
+        return -1;
+    }
+    s_window_offset[i] = base;
+    *missed = true;
+    return i;
+}
+#endif
+
+esp_err_t boot_flash_read(uint32_t offset, void *buf, uint32_t len)
+{
+#if CONFIG_BETTEROTA_READ_AHEAD
+    if (len <= WINDOW_SIZE) {
+        uint8_t *out = buf;
+        bool missed = false;
+        while (len > 0) {
+            const uint32_t base = offset & ~(uint32_t)(WINDOW_SIZE - 1);
+            const int i = get_window(base, &missed);
+            if (i < 0) {
+                s_stats.misses++;
+                return ESP_FAIL;
+            }
+            s_recent = i;
+            const uint32_t n = MIN(len, base + WINDOW_SIZE - offset);
+            memcpy(out, (const uint8_t *)s_window[i] + (offset - base), n);
+            out += n;
+            offset += n;
+            len -= n;
+        }
+        if (missed) {
+            s_stats.misses++;
+        } else {
+            s_stats.hits++;
+        }
+        return ESP_OK;
+    }
+#endif
+
+    s_stats.misses++;
+    return bootloader_flash_read(offset, buf, len, true);
+}
+
+void boot_flash_invalidate(uint32_t offset, uint32_t len)
+{
+#if CONFIG_BETTEROTA_READ_AHEAD
+    for (int i = 0; i < WINDOWS; i++) {
+        if (s_window_offset[i] != WINDOW_EMPTY && s_window_offset[i] < offset + len &&
+            offset < s_window_offset[i] + WINDOW_SIZE) {
+            s_window_offset[i] = WINDOW_EMPTY;
+        }
+    }
+#endif
+}
+
+void boot_flash_reset(void)
+{
+#if CONFIG_BETTEROTA_READ_AHEAD
+    for (int i = 0; i < WINDOWS; i++) {
+        s_window_offset[i] = WINDOW_EMPTY;
+    }
+    s_recent = 0;
+#endif
+    memset(&s_stats, 0, sizeof(s_stats));
+}
+
+const boot_flash_stats_t *boot_flash_stats(void)
+{
+    return &s_stats;
+}
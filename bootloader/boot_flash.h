@@ -0,0 +1,51 @@
+/*
+ * Buffered flash reads for the bootloader's parsers.
+ *
+ * The partition table, otadata, wake record and patch header checks each read a few bytes
+ * of flash, every read being a separate SPI transaction. With CONFIG_BETTEROTA_READ_AHEAD
+ * they go through two read-ahead windows of CONFIG_BETTEROTA_READ_AHEAD_SIZE bytes instead:
+ * a read outside of both windows fills the least recently used one with the aligned block
+ * around it, and later reads within it are served from RAM.
+ *
+ * The image loader streams the image through its own buffers and doesn't use the windows.
+ */
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * @brief Counters of the reads served by boot_flash_read().
+ */
+typedef struct {
+    uint32_t hits;      // Served from the read-ahead windows
+    uint32_t misses;    // Needed a flash read, i.e. an SPI transaction
+} boot_flash_stats_t;
+
+/**
+ * @brief Reads flash through the read-ahead windows.
+ *
+ * Reads within a window need not be word aligned. Reads longer than a window, and all reads
+ * without CONFIG_BETTEROTA_READ_AHEAD, go to bootloader_flash_read() and must be.
+ *
+ * @param offset Flash offset to read from
+ * @param buf Filled with @p len bytes
+ * @param len Number of bytes to read
+ * @return ESP_OK, or an error if reading the flash failed.
+ */
+esp_err_t boot_flash_read(uint32_t offset, void *buf, uint32_t len);
+
+/**
+ * @brief Drops the windows overlapping a region of flash, after writing or erasing it.
+ */
+void boot_flash_invalidate(uint32_t offset, uint32_t len);
+
+/**
+ * @brief Drops all windows and clears the counters, as at the start of a boot.
+ */
+void boot_flash_reset(void);
+
+/**
+ * @brief Returns the counters of this boot so far.
+ */
+const boot_flash_stats_t *boot_flash_stats(void);
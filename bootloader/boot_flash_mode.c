@@ -0,0 +1,181 @@
+/*
+ * Faster flash reads for the image load, on flash chips known to support them.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_image_format.h"
+#include "esp_rom_spiflash.h"
+#include "bootloader_init.h"
+#include "bootloader_flash_config.h"
+#include "bootloader_flash_priv.h"
+#include "flash_qio_mode.h"
+#include "boot_flash_mode.h"
+
+static const char *TAG = "BetterOTA";
+
+static boot_flash_mode_t s_mode;
+
+#if CONFIG_BETTEROTA_FLASH_PROBE
+// Bytes read in both configurations, from the start of the bootloader image
+#define CHECK_LEN 64
+
+/*
+ * Chips that read in QIO at 80 MHz, by manufacturer << 8 | memory type; the capacity doesn't
+ * matter. bootloader_enable_qio_mode() knows how to set the QE bit of each of them, and all of
+ * them keep it in bit 1 of status register 2, written together with register 1 by WRSR.
+ */
+static const uint16_t QIO_80M_CHIPS[] = {
+    0xC840,     // GigaDevice GD25Q
+    0xEF40,     // Winbond W25Q
+    0x2040,     // XMC XM25QH
+};
+
+// Bits of status registers 2 << 8 | 1
+#define STATUS_WIP (1u << 0)
+#define STATUS_QE (1u << 9)
+#endif
+
+static uint8_t header_mhz(const esp_image_header_t *header)
+{
+    switch (header->spi_speed) {
+    case ESP_IMAGE_SPI_SPEED_DIV_1:
+        return 80;
+    case ESP_IMAGE_SPI_SPEED_DIV_3:
+        return 26;
+    case ESP_IMAGE_SPI_SPEED_DIV_4:
+        return 20;
+    default:
+        return 40;
+    }
+}
+
+static esp_rom_spiflash_read_mode_t rom_read_mode(uint8_t spi_mode)
+{
+    switch (spi_mode) {
+    case ESP_IMAGE_SPI_MODE_QIO:
+        return ESP_ROM_SPIFLASH_QIO_MODE;
+    case ESP_IMAGE_SPI_MODE_QOUT:
+        return ESP_ROM_SPIFLASH_QOUT_MODE;
+    case ESP_IMAGE_SPI_MODE_DOUT:
+        return ESP_ROM_SPIFLASH_DOUT_MODE;
+    case ESP_IMAGE_SPI_MODE_FAST_READ:
+        return ESP_ROM_SPIFLASH_FASTRD_MODE;
+    case ESP_IMAGE_SPI_MODE_SLOW_READ:
+        return ESP_ROM_SPIFLASH_SLOWRD_MODE;
+    default:
+        return ESP_ROM_SPIFLASH_DIO_MODE;
+    }
+}
+
+/**
+ * @brief Sets the SPI clock, pins and dummy cycles as the given image header asks for.
+ */
+static void configure(const esp_image_header_t *header)
+{
+    bootloader_flash_gpio_config(header);
+    bootloader_flash_dummy_config(header);
+    bootloader_flash_clock_config(header);
+}
+
+/**
+ * @brief Goes back to the read mode and clock of the bootloader's image header.
+ */
+static void apply_header(void)
+{
+    esp_rom_spiflash_config_readmode(rom_read_mode(bootloader_image_hdr.spi_mode));
+    configure(&bootloader_image_hdr);
+}
+
+#if CONFIG_BETTEROTA_FLASH_PROBE
+static uint32_t read_status(void)
+{
+    return bootloader_execute_flash_command(CMD_RDSR, 0, 0, 8) |
+           bootloader_execute_flash_command(CMD_RDSR2, 0, 0, 8) << 8;
+}
+
+/**
+ * @brief Clears the chip's non-volatile QE bit again, which gives the WP and HOLD pins back
+ * their function.
+ */
+static void clear_quad_enable(void)
+{
+    const uint32_t status = read_status();
+    bootloader_execute_flash_command(CMD_WREN, 0, 0, 0);
+    bootloader_execute_flash_command(CMD_WRSR, status & ~STATUS_QE, 16, 0);
+    while (read_status() & STATUS_WIP) {
+    }
+}
+
+static bool qio_80m_supported(uint32_t jedec_id)
+{
+    for (size_t i = 0; i < sizeof(QIO_80M_CHIPS) / sizeof(QIO_80M_CHIPS[0]); i++) {
+        if (jedec_id >> 8 == QIO_80M_CHIPS[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
+const boot_flash_mode_t *boot_flash_mode_probe(void)
+{
+    memset(&s_mode, 0, sizeof(s_mode));
+    s_mode.spi_mode = bootloader_image_hdr.spi_mode;
+    s_mode.spi_mhz = header_mhz(&bootloader_image_hdr);
+#if CONFIG_BETTEROTA_FLASH_PROBE
+    if (bootloader_image_hdr.spi_mode == ESP_IMAGE_SPI_MODE_QIO && s_mode.spi_mhz == 80) {
+        return &s_mode;
+    }
+    s_mode.jedec_id = bootloader_read_flash_id() & 0xFFFFFF;
+    if (!qio_80m_supported(s_mode.jedec_id)) {
+        ESP_LOGD(TAG, "Flash chip %06lx not known to support QIO at 80 MHz", (unsigned long)s_mode.jedec_id);
+        return &s_mode;
+    }
+
+    // Read without decryption, through the same SPI read mode but bypassing the flash cache
+    uint32_t before[CHECK_LEN / 4];
+    uint32_t after[CHECK_LEN / 4];
+    if (bootloader_flash_read(CONFIG_BOOTLOADER_OFFSET_IN_FLASH, before, CHECK_LEN, false) != ESP_OK) {
+        return &s_mode;
+    }
+
+    // A chip that came with QE set keeps it, the fallback below only undoes our own change
+    const bool quad_enabled = (read_status() & STATUS_QE) != 0;
+    esp_image_header_t fast = bootloader_image_hdr;
+    fast.spi_mode = ESP_IMAGE_SPI_MODE_QIO;
+    fast.spi_speed = ESP_IMAGE_SPI_SPEED_DIV_1;
+    configure(&fast);
+    // Sets the chip's QE bit where needed and switches the read mode
+    bootloader_enable_qio_mode();
+
+    if (bootloader_flash_read(CONFIG_BOOTLOADER_OFFSET_IN_FLASH, after, CHECK_LEN, false) != ESP_OK ||
+        memcmp(before, after, CHECK_LEN) != 0) {
+        ESP_LOGW(TAG, "Flash chip %06lx failed to read in QIO at 80 MHz", (unsigned long)s_mode.jedec_id);
+        apply_header();
+        if (!quad_enabled) {
+            // Where WP or HOLD are wired to something, QE left set would change what they do
+            // for good, also for the app and the next boots
+            clear_quad_enable();
+        }
+        return &s_mode;
+    }
+    s_mode.spi_mode = ESP_IMAGE_SPI_MODE_QIO;
+    s_mode.spi_mhz = 80;
+#endif
+    return &s_mode;
+}
+
+const boot_flash_mode_t *boot_flash_mode_get(void)
+{
+    return &s_mode;
+}
+
+void boot_flash_mode_restore(void)
+{
+    if (s_mode.spi_mode != bootloader_image_hdr.spi_mode || s_mode.spi_mhz != header_mhz(&bootloader_image_hdr)) {
+        apply_header();
+    }
+}
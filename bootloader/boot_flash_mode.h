@@ -0,0 +1,45 @@
+/*
+ * Faster flash reads for the image load, on flash chips known to support them.
+ *
+ * The bootloader's image header asks for DIO at 40 MHz, which every flash chip paired with the
+ * ESP32 supports. Many of them also read in QIO at 80 MHz, about four times as fast. With
+ * CONFIG_BETTEROTA_FLASH_PROBE, boot_flash_mode_probe() reads the JEDEC ID of the chip and,
+ * if it is on the whitelist in boot_flash_mode.c, switches the SPI read mode and clock over.
+ * A block read before the switch is read again after it; if the two differ, the header's
+ * configuration is restored.
+ *
+ * The app's startup code takes the clock and dummy cycles from the bootloader's image header
+ * again, but not the read mode, so boot_flash_mode_restore() goes back to the header's
+ * configuration before the jump.
+ */
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Flash configuration in effect for the image load.
+ */
+typedef struct {
+    uint32_t jedec_id;      // Manufacturer << 16 | memory type << 8 | capacity, 0 if not probed
+    uint8_t spi_mode;       // esp_image_spi_mode_t
+    uint8_t spi_mhz;        // SPI clock
+} boot_flash_mode_t;
+
+/**
+ * @brief Switches to the fastest flash configuration known to work with this chip.
+ *
+ * Call once the hardware is initialized, before loading the image.
+ *
+ * @return The configuration now in effect.
+ */
+const boot_flash_mode_t *boot_flash_mode_probe(void);
+
+/**
+ * @brief Returns the configuration chosen by boot_flash_mode_probe().
+ */
+const boot_flash_mode_t *boot_flash_mode_get(void);
+
+/**
+ * @brief Returns to the configuration of the bootloader's image header.
+ */
+void boot_flash_mode_restore(void);
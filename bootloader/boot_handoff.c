@@ -0,0 +1,95 @@
+/*
+ * Handoff to a loaded app image.
+ *
+ * Mirrors unpack_load_app()/set_cache_and_start_app() from ESP-IDF's
+ * bootloader_utility.c, which are not exported.
+ */
+#include <inttypes.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "bootloader_init.h"
+#include "bootloader_flash_priv.h"
+#include "esp32/rom/cache.h"
+#include "hal/mmu_hal.h"
+#include "hal/cache_ll.h"
+#include "soc/soc.h"
+#include "boot_log.h"
+#include "boot_image.h"
+
+#if !CONFIG_IDF_TARGET_ESP32
+#error "The BetterOTA image handoff only supports the ESP32"
+#endif
+
+static const char *TAG = "BetterOTA";
+
+#define MMU_FLASH_MASK (~(SPI_FLASH_MMU_PAGE_SIZE - 1))
+
+/**
+ * @brief A flash region to be mapped into the address space through the MMU.
+ */
+typedef struct {
+    uint32_t flash_addr;    // Offset of the segment data in flash
+    uint32_t load_addr;     // Virtual address the segment is linked at
+    uint32_t size;
+} flash_mapping_t;
+
+/**
+ * @brief Maps a segment into the address space of both CPUs and enables the buses it lives on.
+ */
+static void map_segment(const char *name, flash_mapping_t m)
+{
+    const uint32_t load_addr_aligned = m.load_addr & MMU_FLASH_MASK;
+    const uint32_t flash_addr_aligned = m.flash_addr & MMU_FLASH_MASK;
+    // The addresses are aligned down, so extend the size to still cover the whole segment
+    const uint32_t size = (m.load_addr - load_addr_aligned) + m.size;
+    uint32_t mapped = 0;
+
+    ESP_EARLY_LOGV(TAG, "Mapping %s paddr=0x%08" PRIx32 " vaddr=0x%08" PRIx32 " size=0x%" PRIx32,
+                   name, flash_addr_aligned, load_addr_aligned, size);
+
+    for (uint32_t mmu_id = 0; mmu_id < 2; mmu_id++) {
+        mmu_hal_map_region(mmu_id, MMU_TARGET_FLASH0, load_addr_aligned, flash_addr_aligned, size, &mapped);
+        cache_ll_l1_enable_bus(mmu_id, cache_ll_l1_get_bus(mmu_id, load_addr_aligned, size));
+    }
+}
+
+void boot_image_start(const esp_image_metadata_t *data)
+{
+    flash_mapping_t drom = {0};
+    flash_mapping_t irom = {0};
+
+    // Find the DROM and IROM segments, which run from flash instead of being copied to RAM
+    for (int i = 0; i < data->image.segment_count; i++) {
+        const esp_image_segment_header_t *header = &data->segments[i];
+        const flash_mapping_t m = {
+            .flash_addr = data->segment_data[i],
+            .load_addr = header->load_addr,
+            .size = header->data_len,
+        };
+
+        if (header->load_addr >= SOC_DROM_LOW && header->load_addr < SOC_DROM_HIGH) {
+            drom = m;
+        }
+        if (header->load_addr >= SOC_IROM_LOW && header->load_addr < SOC_IROM_HIGH) {
+            irom = m;
+        }
+    }
+
+    // The cache has to be off while the MMU table is rewritten
+    Cache_Read_Disable(0);
+    Cache_Flush(0);
+    mmu_hal_unmap_all();
+
+    map_segment("DROM", drom);
+    map_segment("IROM", irom);
+
+    // The application enables the cache of the APP CPU itself
+    Cache_Read_Enable(0);
+
+    ESP_LOGD(TAG, "Starting app at 0x%08" PRIx32, data->image.entry_addr);
+    bootloader_atexit();
+
+    typedef void (*entry_t)(void) __attribute__((noreturn));
+    entry_t entry = (entry_t)data->image.entry_addr;
+    (*entry)();
+}
@@ -0,0 +1,958 @@
+/*
+ * App image loading.
+ *
+ * Replaces bootloader_load_image(): the image is read once, in chunks, and every chunk is
+ * copied to its destination before the next one is read. The RAM segments of packed images
+ * (see boot_image.h) are decompressed on the way.
+ *
+ * With CONFIG_BETTEROTA_PIPELINED_VERIFY, a chunk is hashed while the next one is read: the
+ * chunk is read in 64 byte slices, and after each slice one SHA block of the previous chunk
+ * is handed to the accelerator, which works on it while the CPU waits for the next slice.
+ * Otherwise every chunk is hashed before the next one is read.
+ *
+ * With CONFIG_BETTEROTA_APP_CPU, the APP CPU hashes each chunk instead (see boot_app_cpu.h),
+ * while CPU0 reads the next one in one go and copies it to RAM. The digest is computed with
+ * boot_sha.h, whose accelerator reads hold up against CPU0's flash reads.
+ *
+ * The checks follow esp_image_format.c: segment headers, load addresses that would overwrite
+ * the running bootloader, the checksum byte and the appended SHA-256 digest.
+ *
+ * With CONFIG_BETTEROTA_LAZY_VERIFY, images carrying a digest of their RAM segments (see
+ * boot_image.h) are checked against it instead. Their flash-mapped segments are passed over
+ * without being read, and the app verifies them once it runs.
+ *
+ * With CONFIG_BETTEROTA_SEGMENT_INDEX, the segment headers of images carrying an index (see
+ * boot_image.h) are taken from it in a single read. The loader then moves from one segment's
+ * data straight on to the next, without a small read in between.
+ *
+ * Every load records the bytes and time spent per segment, split into flash reads,
+ * verification and copying, see boot_load_stats_t.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_cpu.h"
+#include "esp_rom_crc.h"
+#include "esp_rom_sys.h"
+#include "bootloader_common.h"
+#include "bootloader_flash_priv.h"
+#include "bootloader_sha.h"
+#include "soc/soc.h"
+#include "boot_rtc.h"
+#include "boot_lz4.h"
+#include "boot_app_cpu.h"
+#include "boot_log.h"
+#include "boot_sha.h"
+#include "boot_image.h"
+
+static const char *TAG = "BetterOTA";
+
+#define CHECKSUM_INITIAL 0xEF
+// The buffers below live in the bootloader's small DRAM segment
+#define CHUNK_SIZE CONFIG_BETTEROTA_LOAD_CHUNK_SIZE
+#define SHA_BLOCK_SIZE 64
+#if CONFIG_BETTEROTA_PIPELINED_VERIFY || CONFIG_BETTEROTA_APP_CPU
+// One chunk is read while the other one is still being hashed
+#define CHUNK_BUFFERS 2
+#else
+#define CHUNK_BUFFERS 1
+#endif
+// Room left below the bootloader's stack pointer, as in esp_image_format.c
+#define STACK_LOAD_HEADROOM 32768
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+_Static_assert(CHUNK_SIZE >= BOOT_IMAGE_LZ4_BLOCK_SIZE, "a stored LZ4 block must fit in a chunk");
+_Static_assert(CHUNK_SIZE % SHA_BLOCK_SIZE == 0, "chunks must be whole SHA blocks");
+_Static_assert(sizeof(boot_image_index_t) + ESP_IMAGE_MAX_SEGMENTS * sizeof(boot_image_index_entry_t) <= CHUNK_SIZE,
+               "a segment index must fit in a chunk");
+
+// The host build's soc/soc.h redirects the writes into simulated RAM
+#ifndef BOOT_IMAGE_RAM
+#define BOOT_IMAGE_RAM(addr) ((volatile uint32_t *)(uintptr_t)(addr))
+#endif
+// ...and places the linker script symbols where they are on the chip
+#ifndef BOOT_IMAGE_LINKER_ADDR
+#define BOOT_IMAGE_LINKER_ADDR(sym) ((uintptr_t)&(sym))
+#endif
+
+/**
+ * @brief Where a segment goes, by its load address.
+ */
+typedef enum {
+    REGION_INVALID = -1,
+    REGION_PADDING = BOOT_REGION_PADDING,   // Load address below 0x10000, never loaded
+    REGION_FLASH = BOOT_REGION_FLASH,       // IROM/DROM, mapped by boot_image_start() instead of being copied
+    REGION_IRAM = BOOT_REGION_IRAM,
+    REGION_DRAM = BOOT_REGION_DRAM,
+    REGION_RTC = BOOT_REGION_RTC,
+} region_t;
+
+/**
+ * @brief Bytes read but not hashed yet: a chunk, then the small reads after it, e.g. LZ4
+ * block headers, which would otherwise have to wait for the chunk to be hashed.
+ */
+typedef struct {
+    const uint8_t *chunk;
+    uint32_t chunk_len;
+    uint32_t staged[4];
+    uint32_t staged_len;
+} pending_t;
+
+/**
+ * @brief State of a single pass over an image.
+ */
+typedef struct {
+    const esp_partition_pos_t *part;
+    esp_image_metadata_t *data;
+    bootloader_sha256_handle_t sha;     // NULL when not verifying
+    bool lazy;                          // Only hashing the RAM segments, see BOOT_IMAGE_FLAG_RAM_DIGEST
+    bool indexed;                       // Segment headers taken from the index, see BOOT_IMAGE_FLAG_SEGMENT_INDEX
+    uint32_t checksum;                  // XOR of all segment data words
+    uint32_t offset;                    // Flash offset of the next byte to read
+    bool load_rtc;                      // RTC segments are kept across deep sleep
+    boot_segment_stats_t *seg;          // Segment being loaded, timed in CPU cycles until it is done
+    int chunk;                          // Index of the last s_chunk buffer handed out
+    pending_t pending;
+} load_ctx_t;
+
+#if CONFIG_BETTEROTA_APP_CPU
+/**
+ * @brief Bytes the APP CPU hashes while CPU0 reads the next chunk.
+ */
+typedef struct {
+    bootloader_sha256_handle_t sha;
+    pending_t pending;
+} hash_job_t;
+
+static hash_job_t s_hash_job;
+#endif
+
+// Flash data is read into s_chunk. Decompressed blocks are staged in s_block, as IRAM only
+// allows 32-bit accesses, while the decompressor works byte by byte.
+static uint32_t s_chunk[CHUNK_BUFFERS][CHUNK_SIZE / 4];
+static uint32_t s_block[BOOT_IMAGE_LZ4_BLOCK_SIZE / 4];
+static boot_load_stats_t s_stats;
+
+static const char *const REGION_NAMES[BOOT_REGION_MAX] = {
+    [BOOT_REGION_PADDING] = "pad",
+    [BOOT_REGION_FLASH] = "flash",
+    [BOOT_REGION_IRAM] = "iram",
+    [BOOT_REGION_DRAM] = "dram",
+    [BOOT_REGION_RTC] = "rtc",
+};
+
+static region_t segment_region(uint32_t addr)
+{
+    if (addr < 0x10000) {
+        return REGION_PADDING;
+    }
+    if ((addr >= SOC_IROM_LOW && addr < SOC_IROM_HIGH) || (addr >= SOC_DROM_LOW && addr < SOC_DROM_HIGH)) {
+        return REGION_FLASH;
+    }
+    if (addr >= SOC_IRAM_LOW && addr < SOC_IRAM_HIGH) {
+        return REGION_IRAM;
+    }
+    if (addr >= SOC_DRAM_LOW && addr < SOC_DRAM_HIGH) {
+        return REGION_DRAM;
+    }
+    if ((addr >= SOC_RTC_IRAM_LOW && addr < SOC_RTC_IRAM_HIGH) ||
+        (addr >= SOC_RTC_DRAM_LOW && addr < SOC_RTC_DRAM_HIGH) ||
+        (addr >= SOC_RTC_DATA_LOW && addr < SOC_RTC_DATA_HIGH)) {
+        return REGION_RTC;
+    }
+    return REGION_INVALID;
+}
+
+static bool is_ram(region_t region)
+{
+    return region == REGION_IRAM || region == REGION_DRAM || region == REGION_RTC;
+}
+
+static bool regions_overlap(uintptr_t a_start, uintptr_t a_end, uintptr_t b_start, uintptr_t b_end)
+{
+    return a_start < b_end && b_start < a_end;
+}
+
+/**
+ * @brief Checks that loading a segment doesn't overwrite the bootloader while it runs.
+ *
+ * The loader runs from the loader segment (see LOADER_IRAM_SOURCES in bootloader_hook.py);
+ * the rest of the bootloader's text is not needed anymore and may be overwritten.
+ */
+static bool verify_load_addresses(int index, region_t region, uint32_t load_addr, uint32_t len)
+{
+    // Defined by the bootloader's linker script
+    extern int _dram_start, _dram_end, _loader_text_start, _loader_text_end;
+    const uintptr_t start = load_addr;
+    const uintptr_t end = (uintptr_t)load_addr + len;
+    const char *reason = NULL;
+
+    if (len == 0) {
+        return true;
+    }
+
+    if (len > UINT32_MAX - load_addr || segment_region(load_addr + len - 1) != region) {
+        reason = "crosses a memory region boundary";
+    } else if (region == REGION_DRAM) {
+        const uintptr_t sp = (uintptr_t)esp_cpu_get_sp();
+        if (regions_overlap(sp - STACK_LOAD_HEADROOM, SOC_ROM_STACK_START, start, end)) {
+            reason = "overlaps bootloader stack";
+        } else if (regions_overlap(BOOT_IMAGE_LINKER_ADDR(_dram_start), BOOT_IMAGE_LINKER_ADDR(_dram_end), start, end)) {
+            reason = "overlaps bootloader data";
+#if CONFIG_BETTEROTA_APP_CPU
+        } else if (boot_app_cpu_running() &&
+                   regions_overlap(BOOT_APP_CPU_ROM_DATA_LOW, BOOT_APP_CPU_ROM_DATA_HIGH, start, end)) {
+            reason = "overlaps APP CPU stack";
+#endif
+        }
+    } else if (region == REGION_IRAM) {
+        if (regions_overlap(BOOT_IMAGE_LINKER_ADDR(_loader_text_start), BOOT_IMAGE_LINKER_ADDR(_loader_text_end), start, end)) {
+            reason = "overlaps loader IRAM";
+        }
+    }
+
+    if (reason != NULL) {
+        ESP_LOGE(TAG, "Segment %d 0x%08lx-0x%08lx invalid: %s",
+                 index, (unsigned long)start, (unsigned long)end, reason);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Hands out the chunk buffers in turn, so a chunk still being hashed is not overwritten.
+ */
+static uint32_t *next_chunk(load_ctx_t *ctx)
+{
+    ctx->chunk = (ctx->chunk + 1) % CHUNK_BUFFERS;
+    return s_chunk[ctx->chunk];
+}
+
+static esp_err_t check_in_partition(const load_ctx_t *ctx, uint32_t len)
+{
+    const uint32_t part_end = ctx->part->offset + ctx->part->size;
+    if (len > part_end - ctx->offset) {
+        ESP_LOGE(TAG, "Image at 0x%lx extends past the end of its partition", (unsigned long)ctx->part->offset);
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Reads the next bytes of the image, without hashing or timing them.
+ */
+static esp_err_t flash_read(load_ctx_t *ctx, void *buf, uint32_t len)
+{
+#if CONFIG_BETTEROTA_APP_CPU
+    // The APP CPU may be hashing the chunk before
+    const esp_err_t err = boot_app_cpu_flash_read(ctx->offset, buf, len);
+#else
+    const esp_err_t err = bootloader_flash_read(ctx->offset, buf, len, true);
+#endif
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to read 0x%lx bytes at 0x%lx", (unsigned long)len, (unsigned long)ctx->offset);
+        return ESP_ERR_IMAGE_FLASH_FAIL;
+    }
+    ctx->offset += len;
+    return ESP_OK;
+}
+
+/**
+ * @brief Feeds up to @p max_len of the pending chunk bytes to the digest, and the staged
+ * bytes once the chunk is done.
+ */
+static void sha_feed(bootloader_sha256_handle_t sha, pending_t *pending, uint32_t max_len)
+{
+    const uint32_t len = MIN(pending->chunk_len, max_len);
+    if (len > 0) {
+        boot_sha_data(sha, pending->chunk, len);
+        pending->chunk += len;
+        pending->chunk_len -= len;
+    }
+    if (pending->chunk_len == 0 && pending->staged_len > 0) {
+        boot_sha_data(sha, pending->staged, pending->staged_len);
+        pending->staged_len = 0;
+    }
+}
+
+#if CONFIG_BETTEROTA_APP_CPU
+static void hash_job(void *arg)
+{
+    hash_job_t *job = arg;
+    sha_feed(job->sha, &job->pending, UINT32_MAX);
+}
+#endif
+
+/**
+ * @brief Hashes all bytes read so far, which keeps the digest in image order.
+ */
+static void hash_pending(load_ctx_t *ctx)
+{
+    if (ctx->sha == NULL) {
+        return;
+    }
+    const uint32_t start = esp_cpu_get_cycle_count();
+#if CONFIG_BETTEROTA_APP_CPU
+    // The APP CPU may still be hashing the chunk before
+    boot_app_cpu_wait();
+#endif
+    sha_feed(ctx->sha, &ctx->pending, UINT32_MAX);
+    if (ctx->seg != NULL) {
+        ctx->seg->verify_us += esp_cpu_get_cycle_count() - start;
+    }
+}
+
+/**
+ * @brief Reads the next bytes of the image, feeding them to the digest when verifying.
+ */
+static esp_err_t read_stored(load_ctx_t *ctx, void *buf, uint32_t len)
+{
+    esp_err_t err = check_in_partition(ctx, len);
+    if (err != ESP_OK) {
+        return err;
+    }
+    // A small read within a segment queues up behind the pending chunk, which then still
+    // overlaps the next chunk read
+    pending_t *pending = &ctx->pending;
+    const bool stage = ctx->sha != NULL && pending->chunk_len > 0 && len <= sizeof(pending->staged) - pending->staged_len;
+    if (!stage) {
+        hash_pending(ctx);
+    }
+
+    const uint32_t start = esp_cpu_get_cycle_count();
+    err = flash_read(ctx, buf, len);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (ctx->seg != NULL) {
+        ctx->seg->flash_len += len;
+        ctx->seg->read_us += esp_cpu_get_cycle_count() - start;
+    }
+
+    if (stage) {
+        memcpy((uint8_t *)pending->staged + pending->staged_len, buf, len);
+        pending->staged_len += len;
+    } else if (ctx->sha != NULL) {
+        pending->chunk = buf;
+        pending->chunk_len = len;
+        hash_pending(ctx);
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Moves past bytes of the image known without reading them, feeding them to the
+ * digest as read_stored() would.
+ */
+static esp_err_t pass_known(load_ctx_t *ctx, const void *buf, uint32_t len)
+{
+    const esp_err_t err = check_in_partition(ctx, len);
+    if (err != ESP_OK) {
+        return err;
+    }
+    ctx->offset += len;
+    if (ctx->sha == NULL) {
+        return ESP_OK;
+    }
+
+    pending_t *pending = &ctx->pending;
+    if (pending->chunk_len > 0 && len <= sizeof(pending->staged) - pending->staged_len) {
+        memcpy((uint8_t *)pending->staged + pending->staged_len, buf, len);
+        pending->staged_len += len;
+    } else {
+        hash_pending(ctx);
+        pending->chunk = buf;
+        pending->chunk_len = len;
+        hash_pending(ctx);
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Reads the next bytes of the image into a chunk buffer; with pipelined verification
+ * or the APP CPU, they are hashed during the next read, or by hash_pending().
+ */
+static esp_err_t read_chunk(load_ctx_t *ctx, uint32_t *buf, uint32_t len)
+{
+    if (ctx->sha == NULL) {
+        return read_stored(ctx, buf, len);
+    }
+#if CONFIG_BETTEROTA_APP_CPU
+    if (boot_app_cpu_running()) {
+        esp_err_t err = check_in_partition(ctx, len);
+        if (err != ESP_OK) {
+            return err;
+        }
+        // The job before is done with the other buffer once the APP CPU takes this one
+        const uint32_t start = esp_cpu_get_cycle_count();
+        boot_app_cpu_wait();
+        if (ctx->pending.chunk_len > 0 || ctx->pending.staged_len > 0) {
+            s_hash_job.sha = ctx->sha;
+            s_hash_job.pending = ctx->pending;
+            boot_app_cpu_run(hash_job, &s_hash_job);
+        }
+        const uint32_t read = esp_cpu_get_cycle_count();
+        err = flash_read(ctx, buf, len);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (ctx->seg != NULL) {
+            ctx->seg->flash_len += len;
+            ctx->seg->verify_us += read - start;
+            ctx->seg->read_us += esp_cpu_get_cycle_count() - read;
+        }
+        ctx->pending = (pending_t){ .chunk = (const uint8_t *)buf, .chunk_len = len };
+        return ESP_OK;
+    }
+#endif
+#if CONFIG_BETTEROTA_PIPELINED_VERIFY
+    esp_err_t err = check_in_partition(ctx, len);
+    if (err != ESP_OK) {
+        return err;
+    }
+    // The accelerator starts a block and returns, so it hashes while the next slice is
+    // read. Hashing hidden this way counts as read time.
+    const uint32_t start = esp_cpu_get_cycle_count();
+    for (uint32_t done = 0; done < len; done += SHA_BLOCK_SIZE) {
+        err = flash_read(ctx, (uint8_t *)buf + done, MIN(len - done, SHA_BLOCK_SIZE));
+        if (err != ESP_OK) {
+            return err;
+        }
+        sha_feed(ctx->sha, &ctx->pending, SHA_BLOCK_SIZE);
+    }
+    if (ctx->seg != NULL) {
+        ctx->seg->flash_len += len;
+        ctx->seg->read_us += esp_cpu_get_cycle_count() - start;
+    }
+
+    hash_pending(ctx);
+    ctx->pending = (pending_t){ .chunk = (const uint8_t *)buf, .chunk_len = len };
+    return ESP_OK;
+#else
+    return read_stored(ctx, buf, len);
+#endif
+}
+
+static void add_checksum(load_ctx_t *ctx, const uint32_t *buf, uint32_t len)
+{
+    if (ctx->sha != NULL && !ctx->lazy) {
+        const uint32_t start = esp_cpu_get_cycle_count();
+        for (uint32_t i = 0; i < len / 4; i++) {
+            ctx->checksum ^= buf[i];
+        }
+        ctx->seg->verify_us += esp_cpu_get_cycle_count() - start;
+    }
+}
+
+/**
+ * @brief Reads the next bytes of segment data, which also count towards the checksum.
+ */
+static esp_err_t read_segment_data(load_ctx_t *ctx, uint32_t *buf, uint32_t len)
+{
+    const esp_err_t err = read_stored(ctx, buf, len);
+    if (err == ESP_OK) {
+        add_checksum(ctx, buf, len);
+    }
+    return err;
+}
+
+/**
+ * @brief Reads the next chunk of segment data into the next chunk buffer, see read_chunk().
+ */
+static esp_err_t read_segment_chunk(load_ctx_t *ctx, uint32_t len, const uint32_t **chunk)
+{
+    uint32_t *buf = next_chunk(ctx);
+    const esp_err_t err = read_chunk(ctx, buf, len);
+    if (err == ESP_OK) {
+        add_checksum(ctx, buf, len);
+        *chunk = buf;
+    }
+    return err;
+}
+
+/**
+ * @brief Moves past segment data without reading it.
+ */
+static esp_err_t seek_past(load_ctx_t *ctx, uint32_t len)
+{
+    const uint32_t part_end = ctx->part->offset + ctx->part->size;
+    if (len > part_end - ctx->offset) {
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    ctx->offset += len;
+    return ESP_OK;
+}
+
+/**
+ * @brief Passes over segment data that is not loaded; it only has to be read to be verified.
+ */
+static esp_err_t skip_segment_data(load_ctx_t *ctx, uint32_t len)
+{
+    if (ctx->sha == NULL) {
+        return seek_past(ctx, len);
+    }
+
+    for (uint32_t done = 0; done < len; ) {
+        const uint32_t n = MIN(len - done, CHUNK_SIZE);
+        const uint32_t *chunk;
+        const esp_err_t err = read_segment_chunk(ctx, n, &chunk);
+        if (err != ESP_OK) {
+            return err;
+        }
+        done += n;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Copies whole words to RAM.
+ */
+static void ram_write(load_ctx_t *ctx, uint32_t addr, const uint32_t *src, uint32_t len)
+{
+    const uint32_t start = esp_cpu_get_cycle_count();
+    volatile uint32_t *dst = BOOT_IMAGE_RAM(addr);
+    for (uint32_t i = 0; i < len / 4; i++) {
+        dst[i] = src[i];
+    }
+    ctx->seg->load_len += len;
+    ctx->seg->copy_us += esp_cpu_get_cycle_count() - start;
+}
+
+static esp_err_t load_raw_segment(load_ctx_t *ctx, const esp_image_segment_header_t *header)
+{
+    for (uint32_t done = 0; done < header->data_len; ) {
+        const uint32_t n = MIN(header->data_len - done, CHUNK_SIZE);
+        const uint32_t *chunk;
+        const esp_err_t err = read_segment_chunk(ctx, n, &chunk);
+        if (err != ESP_OK) {
+            return err;
+        }
+        ram_write(ctx, header->load_addr + done, chunk, n);
+        done += n;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Decompresses a segment of a packed image block by block, see boot_image.h.
+ */
+static esp_err_t load_lz4_segment(load_ctx_t *ctx, int index, region_t region, bool load)
+{
+    const esp_image_segment_header_t *header = &ctx->data->segments[index];
+    const uint32_t end = ctx->offset + header->data_len;
+    esp_err_t err;
+
+    uint32_t raw_len;
+    if (header->data_len < sizeof(raw_len)) {
+        goto corrupt;
+    }
+    err = read_segment_data(ctx, &raw_len, sizeof(raw_len));
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (raw_len % 4 != 0) {
+        goto corrupt;
+    }
+    if (load && !verify_load_addresses(index, region, header->load_addr, raw_len)) {
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    if (!load) {
+        return skip_segment_data(ctx, end - ctx->offset);
+    }
+
+    for (uint32_t done = 0; done < raw_len; ) {
+        const uint32_t expected = MIN(raw_len - done, BOOT_IMAGE_LZ4_BLOCK_SIZE);
+
+        uint32_t block_header;
+        if (end - ctx->offset < sizeof(block_header)) {
+            goto corrupt;
+        }
+        err = read_segment_data(ctx, &block_header, sizeof(block_header));
+        if (err != ESP_OK) {
+            return err;
+        }
+
+        const uint32_t stored = block_header & ~BOOT_IMAGE_LZ4_BLOCK_RAW;
+        const uint32_t padded = (stored + 3) & ~3U;
+        if (stored > CHUNK_SIZE || padded > end - ctx->offset) {
+            goto corrupt;
+        }
+        const uint32_t *chunk;
+        err = read_segment_chunk(ctx, padded, &chunk);
+        if (err != ESP_OK) {
+            return err;
+        }
+
+        const uint32_t *out = chunk;
+        if (block_header & BOOT_IMAGE_LZ4_BLOCK_RAW) {
+            if (stored != expected) {
+                goto corrupt;
+            }
+        } else {
+            const uint32_t start = esp_cpu_get_cycle_count();
+            if (boot_lz4_decompress((const uint8_t *)chunk, stored, (uint8_t *)s_block, expected) != (int)expected) {
+                goto corrupt;
+            }
+            ctx->seg->copy_us += esp_cpu_get_cycle_count() - start;
+            out = s_block;
+        }
+        ram_write(ctx, header->load_addr + done, out, expected);
+        done += expected;
+    }
+
+    if (ctx->offset != end) {
+        goto corrupt;
+    }
+    return ESP_OK;
+
+corrupt:
+    ESP_LOGE(TAG, "Segment %d has corrupt compressed data", index);
+    return ESP_ERR_IMAGE_INVALID;
+}
+
+static esp_err_t load_segment_data(load_ctx_t *ctx, int index, region_t region)
+{
+    const esp_image_segment_header_t *header = &ctx->data->segments[index];
+    if (!is_ram(region)) {
+        // Left out of the RAM digest, so there is nothing to read
+        return ctx->lazy ? seek_past(ctx, header->data_len) : skip_segment_data(ctx, header->data_len);
+    }
+
+    const bool load = region != REGION_RTC || ctx->load_rtc;
+    if (ctx->data->image.reserved[0] & BOOT_IMAGE_FLAG_LZ4) {
+        return load_lz4_segment(ctx, index, region, load);
+    }
+    if (!load) {
+        return skip_segment_data(ctx, header->data_len);
+    }
+    if (!verify_load_addresses(index, region, header->load_addr, header->data_len)) {
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    return load_raw_segment(ctx, header);
+}
+
+static esp_err_t load_segment(load_ctx_t *ctx, int index)
+{
+    esp_image_metadata_t *data = ctx->data;
+    esp_image_segment_header_t *header = &data->segments[index];
+
+    // Segment headers are not counted as segment data
+    ctx->seg = NULL;
+    esp_err_t err = ctx->indexed ? pass_known(ctx, header, sizeof(*header)) : read_stored(ctx, header, sizeof(*header));
+    if (err != ESP_OK) {
+        return err;
+    }
+    data->segment_data[index] = ctx->offset;
+
+    const region_t region = segment_region(header->load_addr);
+    if (region == REGION_INVALID) {
+        ESP_LOGE(TAG, "Segment %d has invalid load address 0x%08lx", index, (unsigned long)header->load_addr);
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    ctx->seg = &s_stats.segments[index];
+    ctx->seg->load_addr = header->load_addr;
+    ctx->seg->region = region;
+    if (data->image.reserved[0] & BOOT_IMAGE_FLAG_LZ4 && is_ram(region)) {
+        ctx->seg->flags |= BOOT_SEGMENT_FLAG_LZ4;
+    }
+    if (ctx->indexed) {
+        ctx->seg->flags |= BOOT_SEGMENT_FLAG_INDEXED;
+    }
+    if (header->data_len % 4 != 0 || header->data_len > ctx->part->offset + ctx->part->size - ctx->offset) {
+        ESP_LOGE(TAG, "Segment %d has invalid length 0x%lx", index, (unsigned long)header->data_len);
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    if (region == REGION_FLASH &&
+        ctx->offset % SPI_FLASH_MMU_PAGE_SIZE != header->load_addr % SPI_FLASH_MMU_PAGE_SIZE) {
+        ESP_LOGE(TAG, "Segment %d load address 0x%08lx doesn't match data 0x%08lx",
+                 index, (unsigned long)header->load_addr, (unsigned long)ctx->offset);
+        return ESP_ERR_IMAGE_INVALID;
+    }
+
+    err = load_segment_data(ctx, index, region);
+    // The last chunk is hashed as part of its segment
+    hash_pending(ctx);
+    return err;
+}
+
+static esp_err_t read_header(load_ctx_t *ctx)
+{
+    esp_image_header_t *image = &ctx->data->image;
+    const esp_err_t err = read_stored(ctx, image, sizeof(*image));
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    if (image->magic != ESP_IMAGE_HEADER_MAGIC) {
+        ESP_LOGE(TAG, "Image at 0x%lx has invalid magic byte 0x%02x", (unsigned long)ctx->part->offset, image->magic);
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    if (image->segment_count > ESP_IMAGE_MAX_SEGMENTS) {
+        ESP_LOGE(TAG, "Image at 0x%lx has too many segments (%d)", (unsigned long)ctx->part->offset, image->segment_count);
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    if (bootloader_common_check_chip_validity(image, ESP_IMAGE_APPLICATION) != ESP_OK) {
+        return ESP_ERR_IMAGE_INVALID;
+    }
+#if !CONFIG_BETTEROTA_COMPRESSED_IMAGES
+    if (image->reserved[0] & BOOT_IMAGE_FLAG_LZ4) {
+        ESP_LOGE(TAG, "Image at 0x%lx is compressed, which is disabled", (unsigned long)ctx->part->offset);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+#endif
+    return ESP_OK;
+}
+
+#if CONFIG_BETTEROTA_SEGMENT_INDEX
+/**
+ * @brief Takes the segment headers from the image's segment index, if it has a valid one.
+ *
+ * @return Whether ctx->data->segments now holds the headers from the index.
+ */
+static bool read_index(load_ctx_t *ctx)
+{
+    esp_image_metadata_t *data = ctx->data;
+    const uint32_t offset = boot_image_index_offset(&data->image);
+    if (offset == 0) {
+        return false;
+    }
+
+    const uint32_t count = data->image.segment_count;
+    const uint32_t len = sizeof(boot_image_index_t) + count * sizeof(boot_image_index_entry_t);
+    // The chunk buffers are free until the first segment is read
+    uint32_t *buf = s_chunk[0];
+    const boot_image_index_t *index = (const boot_image_index_t *)buf;
+    const boot_image_index_entry_t *entries = (const boot_image_index_entry_t *)(index + 1);
+    if (offset > ctx->part->size || len > ctx->part->size - offset ||
+        bootloader_flash_read(data->start_addr + offset, buf, len, true) != ESP_OK ||
+        index->magic != BOOT_IMAGE_INDEX_MAGIC || index->segment_count != count ||
+        index->crc != esp_rom_crc32_le(UINT32_MAX, (const uint8_t *)entries, count * sizeof(*entries))) {
+        goto invalid;
+    }
+
+    // The segments follow each other, each right after its header
+    uint32_t pos = sizeof(esp_image_header_t);
+    for (uint32_t i = 0; i < count; i++) {
+        pos += sizeof(esp_image_segment_header_t);
+        if (entries[i].data_offset != pos || entries[i].data_len > ctx->part->size - pos) {
+            goto invalid;
+        }
+        data->segments[i].load_addr = entries[i].load_addr;
+        data->segments[i].data_len = entries[i].data_len;
+        pos += entries[i].data_len;
+    }
+    return true;
+
+invalid:
+    ESP_LOGW(TAG, "Image at 0x%lx has an invalid segment index, reading the segment headers", (unsigned long)data->start_addr);
+    return false;
+}
+#endif
+
+/**
+ * @brief Checks the checksum byte after the segments and the appended SHA-256 digest.
+ */
+static esp_err_t verify_tail(load_ctx_t *ctx)
+{
+    esp_image_metadata_t *data = ctx->data;
+    const uint32_t unpadded = ctx->offset - data->start_addr;
+    // The checksum byte is the last byte of the next 16 byte boundary
+    const uint32_t padded = (unpadded + 1 + 15) & ~15U;
+
+    uint32_t tail[4];
+    esp_err_t err = read_stored(ctx, tail, padded - unpadded);
+    if (err != ESP_OK) {
+        return err;
+    }
+    const uint8_t stored = ((const uint8_t *)tail)[padded - unpadded - 1];
+    const uint8_t calc = (uint8_t)(ctx->checksum ^ (ctx->checksum >> 8) ^ (ctx->checksum >> 16) ^ (ctx->checksum >> 24));
+    if (stored != calc) {
+        ESP_LOGE(TAG, "Checksum failed: calculated 0x%02x, read 0x%02x", calc, stored);
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    data->image_len = padded;
+
+    if (!data->image.hash_appended) {
+        return ESP_OK;
+    }
+
+    uint32_t digest[ESP_IMAGE_HASH_LEN / 4];
+    hash_pending(ctx);
+    boot_sha_finish(ctx->sha, data->image_digest);
+    ctx->sha = NULL;
+    err = bootloader_flash_read(data->start_addr + padded, digest, sizeof(digest), true);
+    if (err != ESP_OK) {
+        return ESP_ERR_IMAGE_FLASH_FAIL;
+    }
+    data->image_len += ESP_IMAGE_HASH_LEN;
+    if (data->image_len > ctx->part->size || memcmp(digest, data->image_digest, sizeof(digest)) != 0) {
+        ESP_LOGE(TAG, "Image at 0x%lx has an invalid SHA-256 digest", (unsigned long)data->start_addr);
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Checks the digest of the header and RAM segments against the footer after the image.
+ */
+static esp_err_t verify_ram_digest(load_ctx_t *ctx)
+{
+    esp_image_metadata_t *data = ctx->data;
+    const uint32_t unpadded = ctx->offset - data->start_addr;
+    data->image_len = ((unpadded + 1 + 15) & ~15U) + ESP_IMAGE_HASH_LEN;
+
+    // The appended digest and the footer right after it, in one read
+    struct {
+        uint8_t digest[ESP_IMAGE_HASH_LEN];
+        boot_image_ram_digest_t footer;
+    } tail;
+    if (data->image_len + sizeof(tail.footer) > ctx->part->size) {
+        ESP_LOGE(TAG, "Image at 0x%lx extends past the end of its partition", (unsigned long)data->start_addr);
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    uint32_t calc[ESP_IMAGE_HASH_LEN / 4];
+    hash_pending(ctx);
+    boot_sha_finish(ctx->sha, (uint8_t *)calc);
+    ctx->sha = NULL;
+    if (bootloader_flash_read(data->start_addr + data->image_len - ESP_IMAGE_HASH_LEN, &tail, sizeof(tail), true) != ESP_OK) {
+        return ESP_ERR_IMAGE_FLASH_FAIL;
+    }
+    if (tail.footer.magic != BOOT_IMAGE_RAM_DIGEST_MAGIC || memcmp(calc, tail.footer.digest, sizeof(calc)) != 0) {
+        ESP_LOGE(TAG, "Image at 0x%lx has an invalid RAM segment digest", (unsigned long)data->start_addr);
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    memcpy(data->image_digest, tail.digest, sizeof(data->image_digest));
+    return ESP_OK;
+}
+
+/**
+ * @brief Turns the segment timings from CPU cycles into microseconds, once the load is over.
+ */
+static void finish_stats(uint32_t start_cycles, uint32_t segment_count)
+{
+    const uint32_t ticks_per_us = esp_rom_get_cpu_ticks_per_us();
+    for (uint32_t i = 0; i < segment_count; i++) {
+        boot_segment_stats_t *seg = &s_stats.segments[i];
+        seg->read_us /= ticks_per_us;
+        seg->verify_us /= ticks_per_us;
+        seg->copy_us /= ticks_per_us;
+    }
+    s_stats.segment_count = segment_count;
+    s_stats.total_us = (esp_cpu_get_cycle_count() - start_cycles) / ticks_per_us;
+}
+
+static esp_err_t load_image(const esp_partition_pos_t *part, esp_image_metadata_t *data, bool verify)
+{
+    if (part->size == 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    const uint32_t start_cycles = esp_cpu_get_cycle_count();
+#if CONFIG_BETTEROTA_APP_CPU
+    const uint32_t app_cpu_busy = boot_app_cpu_busy_cycles();
+    const uint32_t app_cpu_wait = boot_app_cpu_wait_cycles();
+#endif
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_stats.part_offset = part->offset;
+    memset(data, 0, sizeof(*data));
+    data->start_addr = part->offset;
+
+    load_ctx_t ctx = {
+        .part = part,
+        .data = data,
+        .sha = verify ? boot_sha_start() : NULL,
+        .checksum = CHECKSUM_INITIAL,
+        .offset = part->offset,
+        .load_rtc = esp_rom_get_reset_reason(0) != RESET_REASON_CORE_DEEP_SLEEP,
+    };
+
+    esp_err_t err = read_header(&ctx);
+#if CONFIG_BETTEROTA_LAZY_VERIFY
+    ctx.lazy = err == ESP_OK && verify && boot_image_has_ram_digest(&data->image);
+#endif
+#if CONFIG_BETTEROTA_SEGMENT_INDEX
+    ctx.indexed = err == ESP_OK && read_index(&ctx);
+#endif
+    for (int i = 0; err == ESP_OK && i < data->image.segment_count; i++) {
+        err = load_segment(&ctx, i);
+    }
+    ctx.seg = NULL;
+
+    if (err == ESP_OK && ctx.lazy) {
+        err = verify_ram_digest(&ctx);
+    } else if (err == ESP_OK && verify) {
+        err = verify_tail(&ctx);
+    } else if (err == ESP_OK) {
+        const uint32_t unpadded = ctx.offset - data->start_addr;
+        data->image_len = ((unpadded + 1 + 15) & ~15U) + (data->image.hash_appended ? ESP_IMAGE_HASH_LEN : 0);
+    }
+
+    if (ctx.sha != NULL) {
+#if CONFIG_BETTEROTA_APP_CPU
+        boot_app_cpu_wait();
+#endif
+        boot_sha_finish(ctx.sha, NULL);
+    }
+    finish_stats(start_cycles, err == ESP_OK ? data->image.segment_count : 0);
+#if CONFIG_BETTEROTA_APP_CPU
+    s_stats.app_cpu_us = (boot_app_cpu_busy_cycles() - app_cpu_busy) / esp_rom_get_cpu_ticks_per_us();
+    s_stats.app_cpu_wait_us = (boot_app_cpu_wait_cycles() - app_cpu_wait) / esp_rom_get_cpu_ticks_per_us();
+#endif
+    return err;
+}
+
+esp_err_t boot_image_load(const esp_partition_pos_t *part, esp_image_metadata_t *data)
+{
+    return load_image(part, data, true);
+}
+
+esp_err_t boot_image_load_unverified(const esp_partition_pos_t *part, esp_image_metadata_t *data)
+{
+    return load_image(part, data, false);
+}
+
+const boot_load_stats_t *boot_image_stats(void)
+{
+    return &s_stats;
+}
+
+void boot_image_stats_publish(void)
+{
+    uint32_t flash_len = 0, read_us = 0, verify_us = 0, copy_us = 0;
+    uint32_t region_len[BOOT_REGION_MAX] = {0};
+    uint32_t region_us[BOOT_REGION_MAX] = {0};
+    for (uint32_t i = 0; i < s_stats.segment_count; i++) {
+        const boot_segment_stats_t *seg = &s_stats.segments[i];
+        flash_len += seg->flash_len;
+        read_us += seg->read_us;
+        verify_us += seg->verify_us;
+        copy_us += seg->copy_us;
+        region_len[seg->region] += seg->flash_len;
+        region_us[seg->region] += seg->read_us;
+        ESP_LOGD(TAG, "Segment %lu %s 0x%08lx: %lu B read in %lu us, verify %lu us, copy %lu B in %lu us",
+                 (unsigned long)i, REGION_NAMES[seg->region], (unsigned long)seg->load_addr,
+                 (unsigned long)seg->flash_len, (unsigned long)seg->read_us, (unsigned long)seg->verify_us,
+                 (unsigned long)seg->load_len, (unsigned long)seg->copy_us);
+    }
+
+    const uint32_t rate = boot_stats_rate_x10(flash_len, read_us);
+    ESP_LOGI(TAG, "Load: %lu B read in %lu us (%lu.%lu MB/s), verify %lu us, copy %lu us, total %lu us",
+             (unsigned long)flash_len, (unsigned long)read_us, (unsigned long)(rate / 10), (unsigned long)(rate % 10),
+             (unsigned long)verify_us, (unsigned long)copy_us, (unsigned long)s_stats.total_us);
+    if (s_stats.app_cpu_us > 0) {
+        ESP_LOGI(TAG, "APP CPU hashed for %lu us, CPU0 waited %lu us for it",
+                 (unsigned long)s_stats.app_cpu_us, (unsigned long)s_stats.app_cpu_wait_us);
+    }
+    ESP_LOGI(TAG, "Load by region (B/us): %s=%lu/%lu %s=%lu/%lu %s=%lu/%lu %s=%lu/%lu",
+             REGION_NAMES[BOOT_REGION_FLASH], (unsigned long)region_len[BOOT_REGION_FLASH], (unsigned long)region_us[BOOT_REGION_FLASH],
+             REGION_NAMES[BOOT_REGION_IRAM], (unsigned long)region_len[BOOT_REGION_IRAM], (unsigned long)region_us[BOOT_REGION_IRAM],
+             REGION_NAMES[BOOT_REGION_DRAM], (unsigned long)region_len[BOOT_REGION_DRAM], (unsigned long)region_us[BOOT_REGION_DRAM],
+             REGION_NAMES[BOOT_REGION_RTC], (unsigned long)region_len[BOOT_REGION_RTC], (unsigned long)region_us[BOOT_REGION_RTC]);
+
+    s_stats.magic = BOOT_LOAD_STATS_MAGIC;
+    s_stats.crc = boot_load_stats_crc(&s_stats);
+    memcpy(&boot_rtc()->load, &s_stats, sizeof(s_stats));
+}
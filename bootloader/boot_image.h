@@ -0,0 +1,166 @@
+/*
+ * App image loading and handoff.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_image_format.h"
+#include "boot_stats.h"
+
+/*
+ * Packed images, as written by tools/betterota_pack.py, keep the app image layout but set
+ * BOOT_IMAGE_FLAG_LZ4 in esp_image_header_t.reserved[0]. Their RAM segments may then hold
+ * LZ4 blocks instead of the raw segment data:
+ *
+ *   uint32_t raw_len                   Length of the decompressed segment
+ *   repeated for each block:
+ *     uint32_t block_header            Stored length, | BOOT_IMAGE_LZ4_BLOCK_RAW if not compressed
+ *     uint8_t data[]                   Padded to a multiple of 4 bytes
+ *
+ * Every block decompresses to BOOT_IMAGE_LZ4_BLOCK_SIZE bytes, except the last one. The
+ * checksum and the appended digest cover the stored bytes, so a packed image still passes
+ * esp_image_verify() in the app. Flash-mapped segments are never compressed.
+ */
+#define BOOT_IMAGE_FLAG_LZ4         (1U << 0)
+#define BOOT_IMAGE_LZ4_BLOCK_SIZE   2048
+#define BOOT_IMAGE_LZ4_BLOCK_RAW    (1U << 31)
+
+/*
+ * Images with BOOT_IMAGE_FLAG_RAM_DIGEST, also written by tools/betterota_pack.py, are followed
+ * by a boot_image_ram_digest_t right after their appended SHA-256 digest. It holds the SHA-256
+ * of the image header, every segment header and the stored data of the segments loaded to
+ * RAM (IRAM, DRAM, RTC), in image order. With CONFIG_BETTEROTA_LAZY_VERIFY the bootloader
+ * checks only this digest and leaves the flash-mapped segments to the app (see boot_verify.h).
+ * The footer is not covered by the appended digest; esp_image_verify() ignores it.
+ */
+#define BOOT_IMAGE_FLAG_RAM_DIGEST  (1U << 1)
+#define BOOT_IMAGE_RAM_DIGEST_MAGIC 0x4D415242U     // "BRAM"
+
+typedef struct {
+    uint32_t magic;                 // BOOT_IMAGE_RAM_DIGEST_MAGIC
+    uint8_t digest[32];
+} boot_image_ram_digest_t;
+
+/*
+ * Images with BOOT_IMAGE_FLAG_MERKLE carry a Merkle tree of their 4 KB blocks, against which
+ * any subset of the blocks can be verified (see boot_merkle.h). The footer follows the image,
+ * after the RAM digest footer if there is one:
+ *
+ *   boot_image_merkle_t
+ *   uint8_t leaves[block_count][32]    SHA-256 of a uint32_t 0 followed by each block
+ *
+ * The blocks cover the image from its header up to and including the appended digest; the
+ * last one may be short. An inner node is the SHA-256 of a uint32_t 1 followed by its two
+ * children, and a node left without a sibling at the end of a level moves up unchanged. The
+ * prefixes are whole words, as the SHA accelerator only takes those.
+ */
+#define BOOT_IMAGE_FLAG_MERKLE          (1U << 2)
+#define BOOT_IMAGE_MERKLE_MAGIC         0x4B524D42U     // "BMRK"
+#define BOOT_IMAGE_MERKLE_BLOCK_SIZE    4096
+
+typedef struct {
+    uint32_t magic;                 // BOOT_IMAGE_MERKLE_MAGIC
+    uint32_t block_size;            // BOOT_IMAGE_MERKLE_BLOCK_SIZE
+    uint32_t block_count;
+    uint8_t root[32];
+} boot_image_merkle_t;
+
+/*
+ * Images with BOOT_IMAGE_FLAG_SEGMENT_INDEX carry an index of their segments, from which the
+ * bootloader takes all segment headers with a single read instead of one read per segment.
+ * It follows the other footers; esp_image_header_t.reserved[1..3] hold its offset from the
+ * start of the image in words, little endian:
+ *
+ *   boot_image_index_t
+ *   boot_image_index_entry_t entries[segment_count]
+ *
+ * An index that fails its CRC or doesn't match the image layout is ignored. The segment
+ * headers it stands for still go into the digests as if they had been read, so a verified
+ * load fails if they differ from those in the image. The per-segment digests let the app and
+ * the tools check a single segment without walking the image.
+ */
+#define BOOT_IMAGE_FLAG_SEGMENT_INDEX   (1U << 3)
+#define BOOT_IMAGE_INDEX_MAGIC          0x58444942U     // "BIDX"
+
+typedef struct {
+    uint32_t magic;                 // BOOT_IMAGE_INDEX_MAGIC
+    uint32_t segment_count;         // As esp_image_header_t.segment_count
+    uint32_t crc;                   // esp_rom_crc32_le(UINT32_MAX, ...) of the entries
+} boot_image_index_t;
+
+typedef struct {
+    uint32_t load_addr;
+    uint32_t data_len;
+    uint32_t data_offset;           // Of the segment data, from the start of the image
+    uint8_t digest[32];             // SHA-256 of the stored segment data
+} boot_image_index_entry_t;
+
+/**
+ * @brief Returns the offset of an image's segment index from its start, 0 if it has none.
+ */
+static inline uint32_t boot_image_index_offset(const esp_image_header_t *image)
+{
+    if (!(image->reserved[0] & BOOT_IMAGE_FLAG_SEGMENT_INDEX)) {
+        return 0;
+    }
+    return 4 * (image->reserved[1] | (uint32_t)image->reserved[2] << 8 | (uint32_t)image->reserved[3] << 16);
+}
+
+/**
+ * @brief Returns whether an image carries the digest of its RAM segments, see above.
+ */
+static inline bool boot_image_has_ram_digest(const esp_image_header_t *image)
+{
+    return image->hash_appended && (image->reserved[0] & BOOT_IMAGE_FLAG_RAM_DIGEST);
+}
+
+/**
+ * @brief Verifies an app image and loads its RAM segments, in a single pass over the partition.
+ *
+ * Unlike bootloader_utility_load_boot_image(), this returns on failure so the caller can decide
+ * which partition to try next.
+ *
+ * With CONFIG_BETTEROTA_LAZY_VERIFY, images with BOOT_IMAGE_FLAG_RAM_DIGEST are verified
+ * against that digest instead, without reading their flash-mapped segments. The checksum and
+ * the appended digest are then left unchecked, and data->image_digest is the stored one.
+ *
+ * With CONFIG_BETTEROTA_SEGMENT_INDEX, the segment headers of images with
+ * BOOT_IMAGE_FLAG_SEGMENT_INDEX come from their index instead.
+ *
+ * @param part Partition holding the image
+ * @param data Filled with the image metadata on success
+ * @return ESP_OK if the image is valid and loaded, an error code otherwise.
+ */
+esp_err_t boot_image_load(const esp_partition_pos_t *part, esp_image_metadata_t *data);
+
+/**
+ * @brief Loads the RAM segments of an app image without verifying its checksum and digest.
+ *
+ * Only for images known to be unchanged since their last full verification.
+ *
+ * @param part Partition holding the image
+ * @param data Filled with the image metadata on success
+ * @return ESP_OK if the image headers are valid and the image is loaded, an error code otherwise.
+ */
+esp_err_t boot_image_load_unverified(const esp_partition_pos_t *part, esp_image_metadata_t *data);
+
+/**
+ * @brief Returns the per-segment statistics of the last load.
+ *
+ * Only complete after a successful load; segment_count is 0 after a failed one.
+ */
+const boot_load_stats_t *boot_image_stats(void);
+
+/**
+ * @brief Logs the statistics of the last load and places them in RTC memory for the app.
+ */
+void boot_image_stats_publish(void);
+
+/**
+ * @brief Maps the flash segments of a loaded image and jumps to its entry point.
+ *
+ * @param data Metadata of an image previously loaded with boot_image_load()
+ */
+void __attribute__((noreturn)) boot_image_start(const esp_image_metadata_t *data);
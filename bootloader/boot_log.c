@@ -0,0 +1,155 @@
+/*
+ * Deferred log output and tokenized log lines, see boot_log.h.
+ *
+ * The bootloader logs through esp_rom_printf(), which hands each character to the ROM's
+ * putc channel 1; bootloader_init() sets it to the UART. Deferring the output installs a
+ * function writing to the ring buffer instead. Tokenized frames go the same way, so they
+ * end up in the ring buffer too.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "esp_rom_sys.h"
+#include "boot_rtc.h"
+#include "boot_log.h"
+
+#if CONFIG_BETTEROTA_DEFERRED_LOG
+
+// Replayed lines are copied to the stack in pieces of this size
+#define REPLAY_CHUNK 64
+
+static bool s_deferred;
+static uint32_t s_boot_start;   // Value of log.written when this boot's output began
+
+/**
+ * @brief The ROM's putc channel 1 while the output is deferred. Like everything the load calls
+ * it runs from the loader segment, see LOADER_IRAM_SOURCES in bootloader_hook.py.
+ */
+static void ring_putc(char c)
+{
+    boot_log_t *log = &boot_rtc()->log;
+    log->text[log->written % sizeof(log->text)] = c;
+    log->written++;
+}
+
+void boot_log_defer(void)
+{
+    boot_log_t *log = &boot_rtc()->log;
+    if (!boot_log_valid(log)) {
+        log->magic = BOOT_LOG_MAGIC;
+        log->size = sizeof(log->text);
+        log->written = 0;
+        log->drained = 0;
+    }
+    s_boot_start = log->written;
+    s_deferred = true;
+    esp_rom_install_channel_putc(1, ring_putc);
+}
+
+void boot_log_immediate(void)
+{
+    if (!s_deferred) {
+        return;
+    }
+    boot_log_finish();
+
+    const boot_log_t *log = &boot_rtc()->log;
+    uint32_t from = s_boot_start;
+    if (log->written - from > sizeof(log->text)) {
+        from = log->written - sizeof(log->text);
+        esp_rom_printf("... (%lu bytes of log lost)\n", (unsigned long)(from - s_boot_start));
+    }
+    char chunk[REPLAY_CHUNK + 1];
+    while (from != log->written) {
+        size_t len = 0;
+        while (len < REPLAY_CHUNK && from != log->written) {
+            chunk[len++] = log->text[from++ % sizeof(log->text)];
+        }
+        chunk[len] = '\0';
+        esp_rom_printf("%s", chunk);
+    }
+}
+
+void boot_log_finish(void)
+{
+    if (!s_deferred) {
+        return;
+    }
+    s_deferred = false;
+    esp_rom_install_uart_printf();
+}
+
+#endif // CONFIG_BETTEROTA_DEFERRED_LOG
+
+#if CONFIG_BETTEROTA_TOKENIZED_LOG
+
+static const char BASE64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+void boot_log_frame_begin(boot_log_frame_t *frame, uint32_t token)
+{
+    for (int i = 0; i < 4; i++) {
+        frame->data[i] = (uint8_t)(token >> (8 * i));
+    }
+    frame->len = 4;
+}
+
+void boot_log_frame_int(boot_log_frame_t *frame, uint32_t value)
+{
+    uint8_t buf[5];
+    uint32_t len = 0;
+    do {
+        buf[len] = value & 0x7F;
+        value >>= 7;
+        if (value != 0) {
+            buf[len] |= 0x80;
+        }
+        len++;
+    } while (value != 0);
+
+    // A value that doesn't fit ends the frame, so nothing after it is misread
+    if (frame->len + len > BOOT_LOG_FRAME_MAX) {
+        frame->len = BOOT_LOG_FRAME_MAX;
+        return;
+    }
+    memcpy(&frame->data[frame->len], buf, len);
+    frame->len += len;
+}
+
+void boot_log_frame_str(boot_log_frame_t *frame, const char *str)
+{
+    if (frame->len >= BOOT_LOG_FRAME_MAX) {
+        return;
+    }
+    // Long strings are cut to what fits
+    const uint32_t room = BOOT_LOG_FRAME_MAX - frame->len - 1;
+    const uint32_t max = room < UINT8_MAX ? room : UINT8_MAX;
+    uint8_t *len = &frame->data[frame->len++];
+    *len = 0;
+    while (str != NULL && *len < max && str[*len] != '\0') {
+        frame->data[frame->len++] = (uint8_t)str[*len];
+        (*len)++;
+    }
+}
+
+void boot_log_frame_end(const boot_log_frame_t *frame)
+{
+    char text[1 + (BOOT_LOG_FRAME_MAX + 2) / 3 * 4 + 2];
+    char *out = text;
+    *out++ = '$';
+    for (uint32_t i = 0; i < frame->len; i += 3) {
+        const uint32_t left = frame->len - i;
+        const uint32_t bits = (uint32_t)frame->data[i] << 16 |
+                              (left > 1 ? (uint32_t)frame->data[i + 1] << 8 : 0) |
+                              (left > 2 ? frame->data[i + 2] : 0);
+        *out++ = BASE64[bits >> 18];
+        *out++ = BASE64[(bits >> 12) & 0x3F];
+        *out++ = left > 1 ? BASE64[(bits >> 6) & 0x3F] : '=';
+        *out++ = left > 2 ? BASE64[bits & 0x3F] : '=';
+    }
+    *out++ = '\n';
+    *out = '\0';
+    esp_rom_printf("%s", text);
+}
+
+#endif // CONFIG_BETTEROTA_TOKENIZED_LOG
@@ -0,0 +1,137 @@
+/*
+ * Log output of the bootloader, which can cut down what goes to the UART in two ways:
+ *
+ * Deferred output: the log lines go to a ring buffer in RTC memory instead of the UART, and
+ * the app prints them once it is up (see boot_log_drain() in boot_rtc.h).
+ *
+ * Tokenized lines: each line is sent as a short frame instead of the formatted text, see below.
+ *
+ * At 115200 baud the UART takes almost 87 us per character, and the ROM's printf waits for it
+ * as soon as the FIFO is full, so every log line costs the boot several milliseconds.
+ */
+#pragma once
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+
+/**
+ * @brief Sends the log output to the RTC ring buffer from now on.
+ *
+ * Must come after bootloader_init(), which sets up the UART console. Sets up the ring buffer
+ * when the RTC memory doesn't hold a valid one, e.g. after a power loss.
+ */
+void boot_log_defer(void);
+
+/**
+ * @brief Sends the log output to the UART again, starting with what this boot has logged so far.
+ *
+ * For boots that are failing: their lines are needed right away, as there may be no app to
+ * print them. Does nothing unless the output is deferred.
+ */
+void boot_log_immediate(void);
+
+/**
+ * @brief Sends the log output to the UART again, leaving this boot's lines to the app.
+ *
+ * Must come before the jump to the app, as the ring buffer's output function lives in the
+ * bootloader's IRAM, which the app overwrites.
+ */
+void boot_log_finish(void);
+
+#if CONFIG_BETTEROTA_TOKENIZED_LOG
+/*
+ * Tokenized log lines (CONFIG_BETTEROTA_TOKENIZED_LOG): ESP_LOGx() in the bootloader's own
+ * sources sends a frame with the token of its level and format string and the raw arguments,
+ * instead of the formatted text. tools/betterota_log.py builds the dictionary of the formats
+ * from the sources and turns the frames back into text.
+ *
+ * A frame is one line of text, "$" and the base64 of:
+ *   - the token, see BOOT_LOG_TOKEN(), 4 bytes little-endian
+ *   - each argument in order: integers as unsigned LEB128 of their 32-bit value, strings as
+ *     a length byte and their characters
+ * Frames are cut short after BOOT_LOG_FRAME_MAX bytes, which the decoder marks.
+ *
+ * Include this header after esp_log.h; the IDF's own components keep logging text.
+ */
+#include "boot_log_token.h"
+
+#define BOOT_LOG_FRAME_MAX 96
+
+typedef struct {
+    uint32_t len;
+    uint8_t data[BOOT_LOG_FRAME_MAX];
+} boot_log_frame_t;
+
+void boot_log_frame_begin(boot_log_frame_t *frame, uint32_t token);
+void boot_log_frame_int(boot_log_frame_t *frame, uint32_t value);
+void boot_log_frame_str(boot_log_frame_t *frame, const char *str);
+void boot_log_frame_end(const boot_log_frame_t *frame);
+
+// Never called; lets the compiler check the arguments against the format as for ESP_LOGx()
+static inline __attribute__((format(printf, 1, 2))) void boot_log_check_format(const char *format, ...)
+{
+}
+
+#define BOOT_LOG_ARG(frame, arg) _Generic((arg),                     \
+        char *: boot_log_frame_str,                                 \
+        const char *: boot_log_frame_str,                           \
+        default: boot_log_frame_int)(frame, arg);
+
+#define BOOT_LOG_CAT_(a, b) a##b
+#define BOOT_LOG_CAT(a, b) BOOT_LOG_CAT_(a, b)
+#define BOOT_LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, n, ...) n
+#define BOOT_LOG_NARGS(...) \
+    BOOT_LOG_NARGS_(_, ##__VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define BOOT_LOG_ARGS_0(f)
+#define BOOT_LOG_ARGS_1(f, a) BOOT_LOG_ARG(f, a)
+#define BOOT_LOG_ARGS_2(f, a, ...) BOOT_LOG_ARG(f, a) BOOT_LOG_ARGS_1(f, __VA_ARGS__)
+#define BOOT_LOG_ARGS_3(f, a, ...) BOOT_LOG_ARG(f, a) BOOT_LOG_ARGS_2(f, __VA_ARGS__)
+#define BOOT_LOG_ARGS_4(f, a, ...) BOOT_LOG_ARG(f, a) BOOT_LOG_ARGS_3(f, __VA_ARGS__)
+#define BOOT_LOG_ARGS_5(f, a, ...) BOOT_LOG_ARG(f, a) BOOT_LOG_ARGS_4(f, __VA_ARGS__)
+#define BOOT_LOG_ARGS_6(f, a, ...) BOOT_LOG_ARG(f, a) BOOT_LOG_ARGS_5(f, __VA_ARGS__)
+#define BOOT_LOG_ARGS_7(f, a, ...) BOOT_LOG_ARG(f, a) BOOT_LOG_ARGS_6(f, __VA_ARGS__)
+#define BOOT_LOG_ARGS_8(f, a, ...) BOOT_LOG_ARG(f, a) BOOT_LOG_ARGS_7(f, __VA_ARGS__)
+#define BOOT_LOG_ARGS_9(f, a, ...) BOOT_LOG_ARG(f, a) BOOT_LOG_ARGS_8(f, __VA_ARGS__)
+#define BOOT_LOG_ARGS_10(f, a, ...) BOOT_LOG_ARG(f, a) BOOT_LOG_ARGS_9(f, __VA_ARGS__)
+#define BOOT_LOG_ARGS_11(f, a, ...) BOOT_LOG_ARG(f, a) BOOT_LOG_ARGS_10(f, __VA_ARGS__)
+#define BOOT_LOG_ARGS_12(f, a, ...) BOOT_LOG_ARG(f, a) BOOT_LOG_ARGS_11(f, __VA_ARGS__)
+#define BOOT_LOG_ARGS_13(f, a, ...) BOOT_LOG_ARG(f, a) BOOT_LOG_ARGS_12(f, __VA_ARGS__)
+#define BOOT_LOG_ARGS_14(f, a, ...) BOOT_LOG_ARG(f, a) BOOT_LOG_ARGS_13(f, __VA_ARGS__)
+#define BOOT_LOG_ARGS_15(f, a, ...) BOOT_LOG_ARG(f, a) BOOT_LOG_ARGS_14(f, __VA_ARGS__)
+#define BOOT_LOG_ARGS_16(f, a, ...) BOOT_LOG_ARG(f, a) BOOT_LOG_ARGS_15(f, __VA_ARGS__)
+
+#define BOOT_LOG_TOKENIZED(level, letter, tag, format, ...) do {                   \
+        if ((level) <= CONFIG_BOOTLOADER_LOG_LEVEL) {                               \
+            if (0) {                                                                \
+                boot_log_check_format(format, ##__VA_ARGS__);                       \
+            }                                                                       \
+            (void)(tag);                                                            \
+            boot_log_frame_t frame_;                                                \
+            boot_log_frame_begin(&frame_, BOOT_LOG_TOKEN(letter format));           \
+            BOOT_LOG_CAT(BOOT_LOG_ARGS_, BOOT_LOG_NARGS(__VA_ARGS__))(&frame_, ##__VA_ARGS__) \
+            boot_log_frame_end(&frame_);                                            \
+        }                                                                           \
+    } while (0)
+
+#undef ESP_LOGE
+#undef ESP_LOGW
+#undef ESP_LOGI
+#undef ESP_LOGD
+#undef ESP_LOGV
+#undef ESP_EARLY_LOGE
+#undef ESP_EARLY_LOGW
+#undef ESP_EARLY_LOGI
+#undef ESP_EARLY_LOGD
+#undef ESP_EARLY_LOGV
+#define ESP_LOGE(tag, format, ...) BOOT_LOG_TOKENIZED(1, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) BOOT_LOG_TOKENIZED(2, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) BOOT_LOG_TOKENIZED(3, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) BOOT_LOG_TOKENIZED(4, "D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) BOOT_LOG_TOKENIZED(5, "V", tag, format, ##__VA_ARGS__)
+#define ESP_EARLY_LOGE ESP_LOGE
+#define ESP_EARLY_LOGW ESP_LOGW
+#define ESP_EARLY_LOGI ESP_LOGI
+#define ESP_EARLY_LOGD ESP_LOGD
+#define ESP_EARLY_LOGV ESP_LOGV
+#endif // CONFIG_BETTEROTA_TOKENIZED_LOG
@@ -0,0 +1,149 @@
+/*
+ * Compile-time token of a log format string, see boot_log.h.
+ *
+ * The token is the length of the string plus each of its first BOOT_LOG_HASH_LEN characters
+ * times the next power of 65599, modulo 2^32. The compiler folds it into a constant, so the
+ * string itself is not kept in the bootloader. tools/betterota_log.py computes the same hash
+ * for its dictionary, which catches collisions.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define BOOT_LOG_HASH_LEN 128
+
+// Character i of the literal s times k, 0 past its end (the index is clamped, so that the
+// unused branch doesn't index past the literal either)
+#define BOOT_LOG_HASH_CHAR(s, i, k) \
+    ((uint32_t)(sizeof(s) - 1 > (i) ? (uint8_t)(s)[(i) < sizeof(s) ? (i) : 0] : 0) * (k))
+
+// The coefficients are 65599^1 to 65599^128 modulo 2^32
+#define BOOT_LOG_TOKEN(s) ((uint32_t)(sizeof(s) - 1) + \
+    BOOT_LOG_HASH_CHAR(s, 0, 0x0001003fU) + \
+    BOOT_LOG_HASH_CHAR(s, 1, 0x007e0f81U) + \
+    BOOT_LOG_HASH_CHAR(s, 2, 0x2e86d0bfU) + \
+    BOOT_LOG_HASH_CHAR(s, 3, 0x43ec5f01U) + \
+    BOOT_LOG_HASH_CHAR(s, 4, 0x162c613fU) + \
+    BOOT_LOG_HASH_CHAR(s, 5, 0xd62aee81U) + \
+    BOOT_LOG_HASH_CHAR(s, 6, 0xa311b1bfU) + \
+    BOOT_LOG_HASH_CHAR(s, 7, 0xd319be01U) + \
+    BOOT_LOG_HASH_CHAR(s, 8, 0xb156c23fU) + \
+    BOOT_LOG_HASH_CHAR(s, 9, 0x6698cd81U) + \
+    BOOT_LOG_HASH_CHAR(s, 10, 0x0d1b92bfU) + \
+    BOOT_LOG_HASH_CHAR(s, 11, 0xcc881d01U) + \
+    BOOT_LOG_HASH_CHAR(s, 12, 0x7280233fU) + \
+    BOOT_LOG_HASH_CHAR(s, 13, 0x50c7ac81U) + \
+    BOOT_LOG_HASH_CHAR(s, 14, 0x8da473bfU) + \
+    BOOT_LOG_HASH_CHAR(s, 15, 0x4f377c01U) + \
+    BOOT_LOG_HASH_CHAR(s, 16, 0xfaa8843fU) + \
+    BOOT_LOG_HASH_CHAR(s, 17, 0x33b78b81U) + \
+    BOOT_LOG_HASH_CHAR(s, 18, 0x45ac54bfU) + \
+    BOOT_LOG_HASH_CHAR(s, 19, 0x7a27db01U) + \
+    BOOT_LOG_HASH_CHAR(s, 20, 0xeacfe53fU) + \
+    BOOT_LOG_HASH_CHAR(s, 21, 0xae686a81U) + \
+    BOOT_LOG_HASH_CHAR(s, 22, 0x563335bfU) + \
+    BOOT_LOG_HASH_CHAR(s, 23, 0x6c593a01U) + \
+    BOOT_LOG_HASH_CHAR(s, 24, 0xe3f6463fU) + \
+    BOOT_LOG_HASH_CHAR(s, 25, 0x5fda4981U) + \
+    BOOT_LOG_HASH_CHAR(s, 26, 0xe03916bfU) + \
+    BOOT_LOG_HASH_CHAR(s, 27, 0x44cb9901U) + \
+    BOOT_LOG_HASH_CHAR(s, 28, 0x871ba73fU) + \
+    BOOT_LOG_HASH_CHAR(s, 29, 0xe70d2881U) + \
+    BOOT_LOG_HASH_CHAR(s, 30, 0x04bdf7bfU) + \
+    BOOT_LOG_HASH_CHAR(s, 31, 0x227ef801U) + \
+    BOOT_LOG_HASH_CHAR(s, 32, 0x7540083fU) + \
+    BOOT_LOG_HASH_CHAR(s, 33, 0xe3010781U) + \
+    BOOT_LOG_HASH_CHAR(s, 34, 0xe4c1d8bfU) + \
+    BOOT_LOG_HASH_CHAR(s, 35, 0x24735701U) + \
+    BOOT_LOG_HASH_CHAR(s, 36, 0x4f63693fU) + \
+    BOOT_LOG_HASH_CHAR(s, 37, 0xf2b5e681U) + \
+    BOOT_LOG_HASH_CHAR(s, 38, 0xa144b9bfU) + \
+    BOOT_LOG_HASH_CHAR(s, 39, 0x69a8b601U) + \
+    BOOT_LOG_HASH_CHAR(s, 40, 0xb685ca3fU) + \
+    BOOT_LOG_HASH_CHAR(s, 41, 0xb52bc581U) + \
+    BOOT_LOG_HASH_CHAR(s, 42, 0x5b469abfU) + \
+    BOOT_LOG_HASH_CHAR(s, 43, 0x111f1501U) + \
+    BOOT_LOG_HASH_CHAR(s, 44, 0x4ba72b3fU) + \
+    BOOT_LOG_HASH_CHAR(s, 45, 0xc962a481U) + \
+    BOOT_LOG_HASH_CHAR(s, 46, 0x33c77bbfU) + \
+    BOOT_LOG_HASH_CHAR(s, 47, 0x39d67401U) + \
+    BOOT_LOG_HASH_CHAR(s, 48, 0xafc78c3fU) + \
+    BOOT_LOG_HASH_CHAR(s, 49, 0xce5a8381U) + \
+    BOOT_LOG_HASH_CHAR(s, 50, 0x4bc75cbfU) + \
+    BOOT_LOG_HASH_CHAR(s, 51, 0x02ced301U) + \
+    BOOT_LOG_HASH_CHAR(s, 52, 0x83e6ed3fU) + \
+    BOOT_LOG_HASH_CHAR(s, 53, 0x63136281U) + \
+    BOOT_LOG_HASH_CHAR(s, 54, 0xc4463dbfU) + \
+    BOOT_LOG_HASH_CHAR(s, 55, 0x8b083201U) + \
+    BOOT_LOG_HASH_CHAR(s, 56, 0x69054e3fU) + \
+    BOOT_LOG_HASH_CHAR(s, 57, 0x268d4181U) + \
+    BOOT_LOG_HASH_CHAR(s, 58, 0xbe441ebfU) + \
+    BOOT_LOG_HASH_CHAR(s, 59, 0xf1829101U) + \
+    BOOT_LOG_HASH_CHAR(s, 60, 0x0022af3fU) + \
+    BOOT_LOG_HASH_CHAR(s, 61, 0xb7c82081U) + \
+    BOOT_LOG_HASH_CHAR(s, 62, 0x5ac0ffbfU) + \
+    BOOT_LOG_HASH_CHAR(s, 63, 0x553df001U) + \
+    BOOT_LOG_HASH_CHAR(s, 64, 0xea3f103fU) + \
+    BOOT_LOG_HASH_CHAR(s, 65, 0xb5c3ff81U) + \
+    BOOT_LOG_HASH_CHAR(s, 66, 0xbabce0bfU) + \
+    BOOT_LOG_HASH_CHAR(s, 67, 0xd53a4f01U) + \
+    BOOT_LOG_HASH_CHAR(s, 68, 0xc85a713fU) + \
+    BOOT_LOG_HASH_CHAR(s, 69, 0xbf80de81U) + \
+    BOOT_LOG_HASH_CHAR(s, 70, 0xff37c1bfU) + \
+    BOOT_LOG_HASH_CHAR(s, 71, 0x9077ae01U) + \
+    BOOT_LOG_HASH_CHAR(s, 72, 0x3b74d23fU) + \
+    BOOT_LOG_HASH_CHAR(s, 73, 0x73febd81U) + \
+    BOOT_LOG_HASH_CHAR(s, 74, 0x4931a2bfU) + \
+    BOOT_LOG_HASH_CHAR(s, 75, 0xa5f60d01U) + \
+    BOOT_LOG_HASH_CHAR(s, 76, 0xe48e333fU) + \
+    BOOT_LOG_HASH_CHAR(s, 77, 0x723d9c81U) + \
+    BOOT_LOG_HASH_CHAR(s, 78, 0xb9aa83bfU) + \
+    BOOT_LOG_HASH_CHAR(s, 79, 0x34b56c01U) + \
+    BOOT_LOG_HASH_CHAR(s, 80, 0x64a6943fU) + \
+    BOOT_LOG_HASH_CHAR(s, 81, 0x593d7b81U) + \
+    BOOT_LOG_HASH_CHAR(s, 82, 0x71a264bfU) + \
+    BOOT_LOG_HASH_CHAR(s, 83, 0x5bb5cb01U) + \
+    BOOT_LOG_HASH_CHAR(s, 84, 0x5cbdf53fU) + \
+    BOOT_LOG_HASH_CHAR(s, 85, 0xc7fe5a81U) + \
+    BOOT_LOG_HASH_CHAR(s, 86, 0x921945bfU) + \
+    BOOT_LOG_HASH_CHAR(s, 87, 0x39f72a01U) + \
+    BOOT_LOG_HASH_CHAR(s, 88, 0x6dd4563fU) + \
+    BOOT_LOG_HASH_CHAR(s, 89, 0x5d803981U) + \
+    BOOT_LOG_HASH_CHAR(s, 90, 0x3c0f26bfU) + \
+    BOOT_LOG_HASH_CHAR(s, 91, 0xee798901U) + \
+    BOOT_LOG_HASH_CHAR(s, 92, 0x38e9b73fU) + \
+    BOOT_LOG_HASH_CHAR(s, 93, 0xb8c31881U) + \
+    BOOT_LOG_HASH_CHAR(s, 94, 0x908407bfU) + \
+    BOOT_LOG_HASH_CHAR(s, 95, 0x983ce801U) + \
+    BOOT_LOG_HASH_CHAR(s, 96, 0x5efe183fU) + \
+    BOOT_LOG_HASH_CHAR(s, 97, 0x78c6f781U) + \
+    BOOT_LOG_HASH_CHAR(s, 98, 0xb077e8bfU) + \
+    BOOT_LOG_HASH_CHAR(s, 99, 0x56414701U) + \
+    BOOT_LOG_HASH_CHAR(s, 100, 0x8111793fU) + \
+    BOOT_LOG_HASH_CHAR(s, 101, 0x3c8bd681U) + \
+    BOOT_LOG_HASH_CHAR(s, 102, 0xbceac9bfU) + \
+    BOOT_LOG_HASH_CHAR(s, 103, 0x4786a601U) + \
+    BOOT_LOG_HASH_CHAR(s, 104, 0x4023da3fU) + \
+    BOOT_LOG_HASH_CHAR(s, 105, 0xa311b581U) + \
+    BOOT_LOG_HASH_CHAR(s, 106, 0xd6dcaabfU) + \
+    BOOT_LOG_HASH_CHAR(s, 107, 0x8b0d0501U) + \
+    BOOT_LOG_HASH_CHAR(s, 108, 0x3d353b3fU) + \
+    BOOT_LOG_HASH_CHAR(s, 109, 0x4b589481U) + \
+    BOOT_LOG_HASH_CHAR(s, 110, 0x1f4d8bbfU) + \
+    BOOT_LOG_HASH_CHAR(s, 111, 0x3fd46401U) + \
+    BOOT_LOG_HASH_CHAR(s, 112, 0x19459c3fU) + \
+    BOOT_LOG_HASH_CHAR(s, 113, 0xd4607381U) + \
+    BOOT_LOG_HASH_CHAR(s, 114, 0xb73d6cbfU) + \
+    BOOT_LOG_HASH_CHAR(s, 115, 0x84dcc301U) + \
+    BOOT_LOG_HASH_CHAR(s, 116, 0x7554fd3fU) + \
+    BOOT_LOG_HASH_CHAR(s, 117, 0xdd295281U) + \
+    BOOT_LOG_HASH_CHAR(s, 118, 0xbfac4dbfU) + \
+    BOOT_LOG_HASH_CHAR(s, 119, 0x79262201U) + \
+    BOOT_LOG_HASH_CHAR(s, 120, 0xf2635e3fU) + \
+    BOOT_LOG_HASH_CHAR(s, 121, 0x04b33181U) + \
+    BOOT_LOG_HASH_CHAR(s, 122, 0x599a2ebfU) + \
+    BOOT_LOG_HASH_CHAR(s, 123, 0x3bb08101U) + \
+    BOOT_LOG_HASH_CHAR(s, 124, 0x3170bf3fU) + \
+    BOOT_LOG_HASH_CHAR(s, 125, 0xe9fe1081U) + \
+    BOOT_LOG_HASH_CHAR(s, 126, 0xa6070fbfU) + \
+    BOOT_LOG_HASH_CHAR(s, 127, 0xeb7be001U))
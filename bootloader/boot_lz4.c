@@ -0,0 +1,80 @@
+/*
+ * LZ4 block decompression for compressed app segments.
+ *
+ * Sequence layout: token (literal length << 4 | match length - 4), optional literal length
+ * bytes, literals, 2 byte little-endian match offset, optional match length bytes. The last
+ * sequence of a block only has literals.
+ */
+#include <stdbool.h>
+#include "boot_lz4.h"
+
+#define MIN_MATCH 4
+
+/**
+ * @brief Reads an extended LZ4 length: bytes of 255 continue, anything else terminates.
+ */
+static bool read_length(const uint8_t **ip, const uint8_t *end, size_t *len)
+{
+    uint8_t b;
+    do {
+        if (*ip >= end) {
+            return false;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+int boot_lz4_decompress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len)
+{
+    const uint8_t *ip = src;
+    const uint8_t *const ip_end = src + src_len;
+    uint8_t *op = dst;
+    uint8_t *const op_end = dst + dst_len;
+
+    while (ip < ip_end) {
+        const uint8_t token = *ip++;
+
+        size_t literals = token >> 4;
+        if (literals == 15 && !read_length(&ip, ip_end, &literals)) {
+            return -1;
+        }
+        if (literals > (size_t)(ip_end - ip) || literals > (size_t)(op_end - op)) {
+            return -1;
+        }
+        for (size_t i = 0; i < literals; i++) {
+            *op++ = *ip++;
+        }
+
+        if (ip == ip_end) {
+            break;  // The last sequence has no match
+        }
+
+        if (ip_end - ip < 2) {
+            return -1;
+        }
+        const size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) {
+            return -1;
+        }
+
+        size_t match = token & 0x0F;
+        if (match == 15 && !read_length(&ip, ip_end, &match)) {
+            return -1;
+        }
+        match += MIN_MATCH;
+        if (match > (size_t)(op_end - op)) {
+            return -1;
+        }
+
+        // Byte by byte, as the match may overlap the bytes it produces
+        const uint8_t *mp = op - offset;
+        for (size_t i = 0; i < match; i++) {
+            *op++ = *mp++;
+        }
+    }
+
+    return (int)(op - dst);
+}
@@ -0,0 +1,20 @@
+/*
+ * LZ4 block decompression for compressed app segments.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Decompresses one LZ4 block (raw block format, no frame header).
+ *
+ * All reads and writes are bounds checked, so corrupt input can't overrun either buffer.
+ *
+ * @param src Compressed data
+ * @param src_len Length of the compressed data
+ * @param dst Output buffer
+ * @param dst_len Size of the output buffer
+ * @return int Number of bytes written to dst, or -1 if the input is malformed.
+ */
+int boot_lz4_decompress(const uint8_t *src, size_t src_len, uint8_t *dst, size_t dst_len);
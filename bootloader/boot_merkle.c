@@ -0,0 +1,181 @@
+/*
+ * Verification of app images block by block, see boot_merkle.h.
+ *
+ * The root is rebuilt from the leaves in one pass, keeping one pending node per tree level:
+ * two nodes of the same level merge into their parent as soon as both are known, and the
+ * nodes left over at the end merge from the right, as their promotion up the levels does.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "bootloader_flash_priv.h"
+#include "bootloader_sha.h"
+#include "boot_image.h"
+#include "boot_log.h"
+#include "boot_merkle.h"
+
+#if CONFIG_BETTEROTA_MERKLE
+
+static const char *TAG = "BetterOTA";
+
+#define HASH_LEN 32
+#define HASH_WORDS (HASH_LEN / 4)
+// Domain prefixes of the leaves and inner nodes, one word each (see boot_image.h)
+#define LEAF_PREFIX 0x00000000U
+#define NODE_PREFIX 0x00000001U
+// Enough for 2^24 blocks, far more than a flash chip holds
+#define MAX_LEVELS 24
+// Leaf hashes read from flash at a time
+#define LEAVES_PER_READ 8
+
+// Hashes are kept in words: flash reads and the SHA driver only take word aligned buffers
+static uint32_t s_nodes[MAX_LEVELS][HASH_WORDS];
+
+static void hash_node(const uint32_t *left, const uint32_t *right, uint32_t *out)
+{
+    const uint32_t prefix = NODE_PREFIX;
+    bootloader_sha256_handle_t sha = bootloader_sha256_start();
+    bootloader_sha256_data(sha, &prefix, sizeof(prefix));
+    bootloader_sha256_data(sha, left, HASH_LEN);
+    bootloader_sha256_data(sha, right, HASH_LEN);
+    bootloader_sha256_finish(sha, (uint8_t *)out);
+}
+
+/**
+ * @brief Rebuilds the root from the leaf hashes stored in flash.
+ */
+static esp_err_t compute_root(uint32_t leaves_offset, uint32_t count, uint32_t *root)
+{
+    // Bit n of pending is set while s_nodes[n] holds a node waiting for its right sibling
+    uint32_t pending = 0;
+    uint32_t leaves[LEAVES_PER_READ][HASH_WORDS];
+    for (uint32_t done = 0; done < count; ) {
+        const uint32_t n = count - done < LEAVES_PER_READ ? count - done : LEAVES_PER_READ;
+        if (bootloader_flash_read(leaves_offset + done * HASH_LEN, leaves, n * HASH_LEN, true) != ESP_OK) {
+            return ESP_ERR_IMAGE_FLASH_FAIL;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t node[HASH_WORDS];
+            memcpy(node, leaves[i], HASH_LEN);
+            int level = 0;
+            while (pending & (1U << level)) {
+                hash_node(s_nodes[level], node, node);
+                pending &= ~(1U << level);
+                level++;
+            }
+            memcpy(s_nodes[level], node, HASH_LEN);
+            pending |= 1U << level;
+        }
+        done += n;
+    }
+
+    // Merge what is left from the lowest level up: each is the right child of the one above
+    int level = 0;
+    while (!(pending & (1U << level))) {
+        level++;
+    }
+    uint32_t node[HASH_WORDS];
+    memcpy(node, s_nodes[level], HASH_LEN);
+    for (level++; level < MAX_LEVELS; level++) {
+        if (pending & (1U << level)) {
+            hash_node(s_nodes[level], node, node);
+        }
+    }
+    memcpy(root, node, HASH_LEN);
+    return ESP_OK;
+}
+
+esp_err_t boot_merkle_open(const esp_partition_pos_t *part, const esp_image_metadata_t *data, boot_merkle_t *tree)
+{
+    if (!(data->image.reserved[0] & BOOT_IMAGE_FLAG_MERKLE)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    uint32_t footer_offset = data->start_addr + data->image_len;
+    if (boot_image_has_ram_digest(&data->image)) {
+        footer_offset += sizeof(boot_image_ram_digest_t);
+    }
+    const uint32_t part_end = part->offset + part->size;
+    boot_image_merkle_t footer;
+    if (footer_offset + sizeof(footer) > part_end) {
+        ESP_LOGE(TAG, "Image at 0x%lx has no room for its Merkle tree", (unsigned long)data->start_addr);
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    if (bootloader_flash_read(footer_offset, &footer, sizeof(footer), true) != ESP_OK) {
+        return ESP_ERR_IMAGE_FLASH_FAIL;
+    }
+
+    const uint32_t blocks = (data->image_len + BOOT_IMAGE_MERKLE_BLOCK_SIZE - 1) / BOOT_IMAGE_MERKLE_BLOCK_SIZE;
+    const uint32_t leaves_offset = footer_offset + sizeof(footer);
+    if (footer.magic != BOOT_IMAGE_MERKLE_MAGIC || footer.block_size != BOOT_IMAGE_MERKLE_BLOCK_SIZE ||
+        footer.block_count != blocks || blocks == 0 || blocks * HASH_LEN > part_end - leaves_offset) {
+        ESP_LOGE(TAG, "Image at 0x%lx has an invalid Merkle tree footer", (unsigned long)data->start_addr);
+        return ESP_ERR_IMAGE_INVALID;
+    }
+
+    uint32_t root[HASH_WORDS];
+    const esp_err_t err = compute_root(leaves_offset, blocks, root);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (memcmp(root, footer.root, sizeof(root)) != 0) {
+        ESP_LOGE(TAG, "Image at 0x%lx has a corrupt Merkle tree", (unsigned long)data->start_addr);
+        return ESP_ERR_IMAGE_INVALID;
+    }
+
+    tree->image_offset = data->start_addr;
+    tree->image_len = data->image_len;
+    tree->leaves_offset = leaves_offset;
+    tree->block_count = blocks;
+    memcpy(tree->root, root, sizeof(tree->root));
+    return ESP_OK;
+}
+
+esp_err_t boot_merkle_verify_blocks(const boot_merkle_t *tree, uint32_t first, uint32_t count)
+{
+    if (first > tree->block_count || count > tree->block_count - first) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (uint32_t block = first; block < first + count; block++) {
+        uint32_t leaf[HASH_WORDS];
+        if (bootloader_flash_read(tree->leaves_offset + block * HASH_LEN, leaf, sizeof(leaf), true) != ESP_OK) {
+            return ESP_ERR_IMAGE_FLASH_FAIL;
+        }
+
+        const uint32_t start = block * BOOT_IMAGE_MERKLE_BLOCK_SIZE;
+        const uint32_t len = tree->image_len - start < BOOT_IMAGE_MERKLE_BLOCK_SIZE ?
+                             tree->image_len - start : BOOT_IMAGE_MERKLE_BLOCK_SIZE;
+        const void *mapped = bootloader_mmap(tree->image_offset + start, len);
+        if (mapped == NULL) {
+            return ESP_ERR_IMAGE_FLASH_FAIL;
+        }
+        const uint32_t prefix = LEAF_PREFIX;
+        uint32_t calc[HASH_WORDS];
+        bootloader_sha256_handle_t sha = bootloader_sha256_start();
+        bootloader_sha256_data(sha, &prefix, sizeof(prefix));
+        bootloader_sha256_data(sha, mapped, len);
+        bootloader_sha256_finish(sha, (uint8_t *)calc);
+        bootloader_munmap(mapped);
+
+        if (memcmp(calc, leaf, sizeof(calc)) != 0) {
+            ESP_LOGE(TAG, "Block %lu of the image at 0x%lx doesn't match its Merkle leaf",
+                     (unsigned long)block, (unsigned long)tree->image_offset);
+            return ESP_ERR_IMAGE_INVALID;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t boot_merkle_verify_range(const boot_merkle_t *tree, uint32_t offset, uint32_t len)
+{
+    if (len == 0 || offset >= tree->image_len || len > tree->image_len - offset) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const uint32_t first = offset / BOOT_IMAGE_MERKLE_BLOCK_SIZE;
+    const uint32_t last = (offset + len - 1) / BOOT_IMAGE_MERKLE_BLOCK_SIZE;
+    return boot_merkle_verify_blocks(tree, first, last - first + 1);
+}
+#endif // CONFIG_BETTEROTA_MERKLE
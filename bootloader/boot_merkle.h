@@ -0,0 +1,57 @@
+/*
+ * Verification of app images block by block, against the Merkle tree in their footer
+ * (BOOT_IMAGE_FLAG_MERKLE, see boot_image.h).
+ *
+ * Unlike the appended digest, which only confirms the whole image at once, the tree lets a
+ * caller check any blocks in any order: only those changed since an earlier verification,
+ * a share of them per CPU, or the rest of them after an interruption.
+ */
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_image_format.h"
+
+/**
+ * @brief An image whose Merkle tree has been checked, ready for verifying its blocks.
+ */
+typedef struct {
+    uint32_t image_offset;      // Flash offset of the image
+    uint32_t image_len;         // Bytes covered by the tree
+    uint32_t leaves_offset;     // Flash offset of the leaf hashes
+    uint32_t block_count;
+    uint8_t root[32];
+} boot_merkle_t;
+
+/**
+ * @brief Finds the Merkle tree of an image and checks that its leaves hash to its root.
+ *
+ * Reads the footer and the leaf hashes, none of the image blocks.
+ *
+ * @param part Partition holding the image
+ * @param data Metadata of the image, from one of the boot_image_load*() functions
+ * @param[out] tree The tree, for boot_merkle_verify_blocks()
+ * @return ESP_OK if the tree is intact, ESP_ERR_NOT_FOUND if the image has no tree,
+ *         ESP_ERR_IMAGE_INVALID if the tree is corrupt, ESP_ERR_IMAGE_FLASH_FAIL on a read error.
+ */
+esp_err_t boot_merkle_open(const esp_partition_pos_t *part, const esp_image_metadata_t *data, boot_merkle_t *tree);
+
+/**
+ * @brief Verifies a run of blocks against their leaf hashes.
+ *
+ * @param tree Tree opened with boot_merkle_open()
+ * @param first Index of the first block
+ * @param count Number of blocks
+ * @return ESP_OK if all blocks match, ESP_ERR_INVALID_ARG if they are not all in the image,
+ *         ESP_ERR_IMAGE_INVALID if one doesn't match, ESP_ERR_IMAGE_FLASH_FAIL on a read error.
+ */
+esp_err_t boot_merkle_verify_blocks(const boot_merkle_t *tree, uint32_t first, uint32_t count);
+
+/**
+ * @brief Verifies the blocks holding a range of the image, see boot_merkle_verify_blocks().
+ *
+ * @param tree Tree opened with boot_merkle_open()
+ * @param offset Start of the range, from the start of the image
+ * @param len Length of the range
+ */
+esp_err_t boot_merkle_verify_range(const boot_merkle_t *tree, uint32_t offset, uint32_t len);
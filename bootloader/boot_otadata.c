@@ -0,0 +1,277 @@
+/*
+ * Parsing of the otadata partition, which records the OTA slot selected by the app.
+ */
+#include <stddef.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "bootloader_flash_priv.h"
+#include "boot_log.h"
+#include "boot_flash.h"
+#include "boot_otadata.h"
+
+static const char *TAG = "BetterOTA";
+
+// Words of the boot counter, up to the end of the sector
+#define COUNTER_WORDS ((BOOT_OTADATA_SECTOR_SIZE - BOOT_OTADATA_COUNTER_OFFSET) / 4)
+
+static boot_otadata_t s_otadata;
+static bool s_otadata_loaded;
+
+bool boot_otadata_entry_valid(const esp_ota_select_entry_t *entry)
+{
+    // Same CRC as bootloader_common_ota_select_crc(): it only covers the sequence number
+    return entry->ota_seq != UINT32_MAX &&
+           entry->crc == esp_rom_crc32_le(UINT32_MAX, (const uint8_t *)&entry->ota_seq, sizeof(entry->ota_seq));
+}
+
+bool boot_otadata_entry_bootable(const esp_ota_select_entry_t *entry)
+{
+    return boot_otadata_entry_valid(entry) &&
+           entry->ota_state != ESP_OTA_IMG_INVALID &&
+           entry->ota_state != ESP_OTA_IMG_ABORTED;
+}
+
+void boot_otadata_parse(const esp_ota_select_entry_t entries[2], uint32_t app_count, boot_otadata_t *out)
+{
+    memcpy(out->entries, entries, sizeof(out->entries));
+    out->active_entry = -1;
+    out->slot = -1;
+    out->seq = UINT32_MAX;
+    out->state = ESP_OTA_IMG_UNDEFINED;
+
+    const bool bootable[2] = { boot_otadata_entry_bootable(&entries[0]), boot_otadata_entry_bootable(&entries[1]) };
+    if (bootable[0] && bootable[1]) {
+        out->active_entry = entries[0].ota_seq >= entries[1].ota_seq ? 0 : 1;
+    } else if (bootable[0] || bootable[1]) {
+        out->active_entry = bootable[0] ? 0 : 1;
+    }
+
+    if (out->active_entry < 0 || app_count == 0) {
+        return;
+    }
+
+    const esp_ota_select_entry_t *active = &entries[out->active_entry];
+    out->seq = active->ota_seq;
+    out->state = active->ota_state;
+    // Sequence numbers start at 1 and cycle through the OTA slots
+    out->slot = (int)((active->ota_seq - 1) % app_count);
+}
+
+const boot_otadata_t *boot_otadata_get(const bootloader_state_t *bs)
+{
+    if (s_otadata_loaded) {
+        return &s_otadata;
+    }
+
+    esp_ota_select_entry_t entries[2];
+    memset(entries, 0xFF, sizeof(entries));
+
+    if (bs->ota_info.size >= 2 * BOOT_OTADATA_SECTOR_SIZE &&
+        (boot_flash_read(bs->ota_info.offset, &entries[0], sizeof(entries[0])) != ESP_OK ||
+         boot_flash_read(bs->ota_info.offset + BOOT_OTADATA_SECTOR_SIZE, &entries[1], sizeof(entries[1])) != ESP_OK)) {
+        ESP_LOGE(TAG, "Failed to read otadata at 0x%lx", (unsigned long)bs->ota_info.offset);
+        memset(entries, 0xFF, sizeof(entries));
+    }
+
+    boot_otadata_parse(entries, bs->app_count, &s_otadata);
+    s_otadata_loaded = true;
+    return &s_otadata;
+}
+
+void boot_otadata_invalidate(void)
+{
+    s_otadata_loaded = false;
+}
+
+/**
+ * @brief Returns the flash offset of the active entry's sector, 0 if there is no active entry.
+ */
+static uint32_t active_sector(const bootloader_state_t *bs)
+{
+    const boot_otadata_t *otadata = boot_otadata_get(bs);
+    if (otadata->active_entry < 0) {
+        return 0;
+    }
+    return bs->ota_info.offset + otadata->active_entry * BOOT_OTADATA_SECTOR_SIZE;
+}
+
+static uint32_t verified_crc(const boot_otadata_verified_t *record)
+{
+    return esp_rom_crc32_le(UINT32_MAX, (const uint8_t *)record, offsetof(boot_otadata_verified_t, crc));
+}
+
+static bool blank(const void *data, size_t len)
+{
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        if (bytes[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool boot_otadata_read_verified(const bootloader_state_t *bs, boot_otadata_verified_t *out)
+{
+    const uint32_t sector = active_sector(bs);
+    if (sector == 0) {
+        return false;
+    }
+
+    bool found = false;
+    for (int i = 0; i < BOOT_OTADATA_VERIFIED_SLOTS; i++) {
+        boot_otadata_verified_t record;
+        const uint32_t offset = sector + BOOT_OTADATA_VERIFIED_OFFSET + i * BOOT_OTADATA_VERIFIED_STRIDE;
+        if (boot_flash_read(offset, &record, sizeof(record)) != ESP_OK || blank(&record, sizeof(record))) {
+            break;
+        }
+        // A torn write leaves a slot that is neither blank nor valid; later slots may still be
+        if (record.magic == BOOT_OTADATA_VERIFIED_MAGIC && record.crc == verified_crc(&record) &&
+            record.ota_seq == boot_otadata_get(bs)->seq) {
+            *out = record;
+            found = true;
+        }
+    }
+    return found;
+}
+
+esp_err_t boot_otadata_write_verified(const bootloader_state_t *bs, boot_otadata_verified_t *record)
+{
+    const uint32_t sector = active_sector(bs);
+    if (sector == 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    record->magic = BOOT_OTADATA_VERIFIED_MAGIC;
+    record->ota_seq = boot_otadata_get(bs)->seq;
+    record->crc = verified_crc(record);
+
+    for (int i = 0; i < BOOT_OTADATA_VERIFIED_SLOTS; i++) {
+        boot_otadata_verified_t slot;
+        const uint32_t offset = sector + BOOT_OTADATA_VERIFIED_OFFSET + i * BOOT_OTADATA_VERIFIED_STRIDE;
+        if (boot_flash_read(offset, &slot, sizeof(slot)) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        if (blank(&slot, sizeof(slot))) {
+            const esp_err_t err = bootloader_flash_write(offset, record, sizeof(*record), false);
+            boot_flash_invalidate(offset, sizeof(*record));
+            return err;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+uint32_t boot_otadata_count_boot(const bootloader_state_t *bs)
+{
+    const uint32_t sector = active_sector(bs);
+    if (sector == 0) {
+        return 0;
+    }
+    const uint32_t counter = sector + BOOT_OTADATA_COUNTER_OFFSET;
+
+    // Bits are cleared in order, so the words read all zeros up to the one being used
+    uint32_t low = 0;
+    uint32_t high = COUNTER_WORDS;
+    while (low < high) {
+        const uint32_t mid = (low + high) / 2;
+        uint32_t word;
+        if (boot_flash_read(counter + mid * 4, &word, sizeof(word)) != ESP_OK) {
+            return 0;
+        }
+        if (word == 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low == COUNTER_WORDS) {
+        return 0;
+    }
+
+    uint32_t word;
+    if (boot_flash_read(counter + low * 4, &word, sizeof(word)) != ESP_OK) {
+        return 0;
+    }
+    const uint32_t used = word == UINT32_MAX ? 0 : (uint32_t)__builtin_ctz(word);
+    uint32_t next = used == 31 ? 0 : UINT32_MAX << (used + 1);
+    const esp_err_t err = bootloader_flash_write(counter + low * 4, &next, sizeof(next), false);
+    boot_flash_invalidate(counter + low * 4, sizeof(next));
+    if (err != ESP_OK) {
+        return 0;
+    }
+    return low * 32 + used + 1;
+}
+
+/**
+ * @brief Reads the trial boot counter of the active entry; all ones if there is none.
+ */
+static uint32_t read_trial_word(const bootloader_state_t *bs, uint32_t *offset)
+{
+    uint32_t word = UINT32_MAX;
+    const uint32_t sector = active_sector(bs);
+    *offset = sector + BOOT_OTADATA_TRIAL_OFFSET;
+    if (sector != 0 && boot_flash_read(*offset, &word, sizeof(word)) != ESP_OK) {
+        word = UINT32_MAX;
+    }
+    return word;
+}
+
+uint32_t boot_otadata_trial_boots(const bootloader_state_t *bs)
+{
+    uint32_t offset;
+    return (uint32_t)__builtin_popcount(~read_trial_word(bs, &offset));
+}
+
+esp_err_t boot_otadata_count_trial(const bootloader_state_t *bs)
+{
+    if (active_sector(bs) == 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    uint32_t offset;
+    const uint32_t word = read_trial_word(bs, &offset);
+    if (word == 0) {
+        return ESP_ERR_NO_MEM;
+    }
+    // Clears the lowest bit still set
+    uint32_t next = word & (word - 1);
+    const esp_err_t err = bootloader_flash_write(offset, &next, sizeof(next), false);
+    boot_flash_invalidate(offset, sizeof(next));
+    return err;
+}
+
+esp_err_t boot_otadata_write_entry(const bootloader_state_t *bs, int index, const esp_ota_select_entry_t *entry)
+{
+    const uint32_t sector = bs->ota_info.offset + index * BOOT_OTADATA_SECTOR_SIZE;
+    esp_err_t err = bootloader_flash_erase_sector(sector / BOOT_OTADATA_SECTOR_SIZE);
+    if (err == ESP_OK) {
+        esp_ota_select_entry_t copy = *entry;
+        err = bootloader_flash_write(sector, &copy, sizeof(copy), false);
+    }
+    boot_flash_invalidate(sector, BOOT_OTADATA_SECTOR_SIZE);
+    boot_otadata_invalidate();
+    return err;
+}
+
+esp_err_t boot_otadata_drop_active(const bootloader_state_t *bs, esp_ota_img_states_t state)
+{
+    const boot_otadata_t *otadata = boot_otadata_get(bs);
+    const int active = otadata->active_entry;
+    if (active < 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_ota_select_entry_t dropped = otadata->entries[active];
+    const esp_ota_select_entry_t other = otadata->entries[1 - active];
+    dropped.ota_state = state;
+    esp_err_t err = boot_otadata_write_entry(bs, active, &dropped);
+    if (err != ESP_OK || boot_otadata_entry_bootable(&other)) {
+        return err;
+    }
+
+    // The first update of a device leaves the other entry blank: select the previous slot there
+    esp_ota_select_entry_t previous;
+    memset(&previous, 0xFF, sizeof(previous));
+    previous.ota_seq = dropped.ota_seq > 1 ? dropped.ota_seq - 1 : dropped.ota_seq + bs->app_count - 1;
+    // Same CRC as bootloader_common_ota_select_crc()
+    previous.crc = esp_rom_crc32_le(UINT32_MAX, (const uint8_t *)&previous.ota_seq, sizeof(previous.ota_seq));
+    return boot_otadata_write_entry(bs, 1 - active, &previous);
+}
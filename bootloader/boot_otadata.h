@@ -0,0 +1,164 @@
+/*
+ * Parsing of the otadata partition, which records the OTA slot selected by the app.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_flash_partitions.h"
+#include "bootloader_utility.h"
+
+// Each otadata entry sits at the start of its own flash sector
+#define BOOT_OTADATA_SECTOR_SIZE 0x1000
+
+/*
+ * esp_ota_set_boot_partition() erases an otadata sector whenever it writes its entry, and
+ * leaves the rest of it blank. The bootloader counts the trial boots of a new image there (see
+ * boot_trial.h), keeps a record of the image it verified for the entry (see boot_verified.h),
+ * and counts the boots since:
+ *
+ *   0x000  esp_ota_select_entry_t
+ *   0x080  Trial boot counter, one bit cleared per trial boot
+ *   0x100  boot_otadata_verified_t, up to BOOT_OTADATA_VERIFIED_SLOTS of them
+ *          BOOT_OTADATA_VERIFIED_STRIDE apart
+ *   0x300  Boot counter up to the end of the sector, one bit cleared per boot
+ *
+ * Records are only ever appended, the last valid one counts. Writing the entry again erases
+ * them along with the counter.
+ */
+#define BOOT_OTADATA_TRIAL_OFFSET       0x080
+#define BOOT_OTADATA_TRIAL_MAX          32
+#define BOOT_OTADATA_VERIFIED_MAGIC     0x46525642U     // "BVRF"
+#define BOOT_OTADATA_VERIFIED_OFFSET    0x100
+#define BOOT_OTADATA_VERIFIED_STRIDE    0x80
+#define BOOT_OTADATA_VERIFIED_SLOTS     4
+#define BOOT_OTADATA_COUNTER_OFFSET     0x300
+
+typedef struct {
+    uint32_t magic;                 // BOOT_OTADATA_VERIFIED_MAGIC
+    uint32_t ota_seq;               // Sequence number of the entry the record belongs to
+    uint32_t part_offset;           // Partition the image was verified in
+    uint32_t image_len;             // Length of the image, including the appended digest
+    uint8_t digest[32];             // The image's appended SHA-256 digest
+    uint8_t quick_digest[32];       // SHA-256 of the image's first and last flash sectors
+    uint32_t crc;                   // CRC32 of all preceding fields
+} boot_otadata_verified_t;
+
+/**
+ * @brief Parsed contents of the otadata partition.
+ */
+typedef struct {
+    esp_ota_select_entry_t entries[2];  // Raw copy of the entry at the start of each sector
+    int active_entry;                   // Entry that selects the slot (0 or 1), -1 if none is usable
+    int slot;                           // OTA slot index selected by otadata, -1 if none
+    uint32_t seq;                       // Sequence number of the active entry
+    uint32_t state;                     // esp_ota_img_states_t of the active entry
+} boot_otadata_t;
+
+/**
+ * @brief Checks that an otadata entry has been written and is intact.
+ */
+bool boot_otadata_entry_valid(const esp_ota_select_entry_t *entry);
+
+/**
+ * @brief Checks whether an entry is valid and its image wasn't marked invalid or aborted.
+ */
+bool boot_otadata_entry_bootable(const esp_ota_select_entry_t *entry);
+
+/**
+ * @brief Parses the two otadata entries.
+ *
+ * The valid entry with the highest sequence number wins, except that entries whose image
+ * was marked invalid or aborted are skipped in favour of the other one.
+ *
+ * @param entries The entries at the start of the two otadata sectors
+ * @param app_count Number of OTA slots in the partition table
+ * @param[out] out The parsed result
+ */
+void boot_otadata_parse(const esp_ota_select_entry_t entries[2], uint32_t app_count, boot_otadata_t *out);
+
+/**
+ * @brief Returns the parsed otadata partition.
+ *
+ * The two entries are read through the read-ahead windows (see boot_flash.h) on the first
+ * call only; later calls return the cached result until boot_otadata_invalidate() is called.
+ *
+ * @param bs Pointer to the bootloader_state_t with the loaded partition table
+ * @return const boot_otadata_t* The parsed otadata, never NULL.
+ */
+const boot_otadata_t *boot_otadata_get(const bootloader_state_t *bs);
+
+/**
+ * @brief Drops the cached otadata, e.g. after it was written.
+ */
+void boot_otadata_invalidate(void);
+
+/**
+ * @brief Reads the last verified-image record of the active otadata entry.
+ *
+ * @param bs Pointer to the bootloader_state_t with the loaded partition table
+ * @param[out] out The record
+ * @return true if there is an intact record for the active entry.
+ */
+bool boot_otadata_read_verified(const bootloader_state_t *bs, boot_otadata_verified_t *out);
+
+/**
+ * @brief Appends a verified-image record to the active otadata entry.
+ *
+ * @param bs Pointer to the bootloader_state_t with the loaded partition table
+ * @param record The record; its magic, sequence number and CRC are filled in here
+ * @return ESP_OK, ESP_ERR_NOT_FOUND without an active entry, ESP_ERR_NO_MEM if all record
+ *         slots are used, or the error of the flash write.
+ */
+esp_err_t boot_otadata_write_verified(const bootloader_state_t *bs, boot_otadata_verified_t *record);
+
+/**
+ * @brief Counts a boot in the active otadata entry.
+ *
+ * @param bs Pointer to the bootloader_state_t with the loaded partition table
+ * @return The number of boots counted since the entry was written, this one included; 0 if
+ *         there is no active entry, the counter is full or the flash write failed.
+ */
+uint32_t boot_otadata_count_boot(const bootloader_state_t *bs);
+
+/**
+ * @brief Returns the number of trial boots counted for the active otadata entry.
+ *
+ * @param bs Pointer to the bootloader_state_t with the loaded partition table
+ * @return The count, BOOT_OTADATA_TRIAL_MAX at most; 0 without an active entry.
+ */
+uint32_t boot_otadata_trial_boots(const bootloader_state_t *bs);
+
+/**
+ * @brief Counts a trial boot for the active otadata entry.
+ *
+ * @param bs Pointer to the bootloader_state_t with the loaded partition table
+ * @return ESP_OK, ESP_ERR_NOT_FOUND without an active entry, ESP_ERR_NO_MEM if the counter is
+ *         full, or the error of the flash write.
+ */
+esp_err_t boot_otadata_count_trial(const bootloader_state_t *bs);
+
+/**
+ * @brief Writes an otadata entry as esp_ota_set_boot_partition() does, erasing its sector first.
+ *
+ * Drops the cached otadata.
+ *
+ * @param bs Pointer to the bootloader_state_t with the loaded partition table
+ * @param index Entry to write, 0 or 1
+ * @param entry The new entry
+ * @return ESP_OK, or the error of the flash erase or write.
+ */
+esp_err_t boot_otadata_write_entry(const bootloader_state_t *bs, int index, const esp_ota_select_entry_t *entry);
+
+/**
+ * @brief Marks the image of the active entry, so that otadata selects the previous slot again.
+ *
+ * The first update of a device leaves the other entry blank; it is then written to select
+ * the slot before the active one. Drops the cached otadata.
+ *
+ * @param bs Pointer to the bootloader_state_t with the loaded partition table
+ * @param state ESP_OTA_IMG_ABORTED or ESP_OTA_IMG_INVALID
+ * @return ESP_OK, ESP_ERR_NOT_FOUND without an active entry, or the error of the flash write.
+ */
+esp_err_t boot_otadata_drop_active(const bootloader_state_t *bs, esp_ota_img_states_t state);
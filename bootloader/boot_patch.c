@@ -0,0 +1,371 @@
+/*
+ * Rebuilding an OTA slot from a delta patch, see boot_patch_format.h.
+ *
+ * The patch data is streamed: one LZ4 block of it is decompressed at a time, and the new
+ * image is written out in small chunks, erasing each flash sector as it is reached.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "bootloader_flash_priv.h"
+#include "bootloader_sha.h"
+#include "hal/wdt_hal.h"
+#include "boot_rtc.h"
+#include "boot_lz4.h"
+#include "boot_image.h"
+#include "boot_otadata.h"
+#include "boot_patch_format.h"
+#include "boot_log.h"
+#include "boot_flash.h"
+#include "boot_timer.h"
+#include "boot_ptable.h"
+#include "boot_patch.h"
+
+#if CONFIG_BETTEROTA_PATCH
+
+static const char *TAG = "BetterOTA";
+
+#define IO_CHUNK 256
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+_Static_assert(SPI_FLASH_SEC_SIZE % IO_CHUNK == 0, "every sector has to start a new chunk");
+_Static_assert(sizeof(boot_patch_header_t) % 4 == 0, "the patch data has to stay word aligned");
+
+/**
+ * @brief Reader of the decompressed patch data.
+ */
+typedef struct {
+    uint32_t offset;                                    // Flash offset of the next stored block
+    uint32_t end;                                       // End of the stored patch data
+    uint32_t remaining;                                 // Decompressed bytes not produced yet
+    uint32_t stored[BOOT_IMAGE_LZ4_BLOCK_SIZE / 4];
+    uint8_t block[BOOT_IMAGE_LZ4_BLOCK_SIZE];
+    uint32_t block_len;
+    uint32_t block_pos;
+} patch_stream_t;
+
+/**
+ * @brief Writer of the new image into the target slot.
+ */
+typedef struct {
+    uint32_t offset;                    // Flash offset of the target slot
+    uint32_t written;                   // Bytes passed to writer_put()
+    uint32_t flushed;                   // Bytes written to flash
+    bootloader_sha256_handle_t sha;
+    uint32_t buf[IO_CHUNK / 4];
+} target_writer_t;
+
+/**
+ * @brief Keeps the RTC watchdog armed by the bootloader from resetting a long patch run, and
+ * the boot timer from missing a wrap of the cycle counter (see boot_timer.h).
+ */
+static void feed_watchdog(void)
+{
+    boot_timer_now_us();
+    wdt_hal_context_t rtc_wdt_ctx = RWDT_HAL_CONTEXT_DEFAULT();
+    wdt_hal_write_protect_disable(&rtc_wdt_ctx);
+    wdt_hal_feed(&rtc_wdt_ctx);
+    wdt_hal_write_protect_enable(&rtc_wdt_ctx);
+}
+
+static esp_err_t stream_next_block(patch_stream_t *s)
+{
+    const uint32_t expected = MIN(s->remaining, BOOT_IMAGE_LZ4_BLOCK_SIZE);
+    uint32_t header;
+    if (expected == 0 || s->end - s->offset < sizeof(header)) {
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    if (bootloader_flash_read(s->offset, &header, sizeof(header), true) != ESP_OK) {
+        return ESP_ERR_IMAGE_FLASH_FAIL;
+    }
+    s->offset += sizeof(header);
+
+    const uint32_t stored = header & ~BOOT_IMAGE_LZ4_BLOCK_RAW;
+    const uint32_t padded = (stored + 3) & ~3U;
+    if (stored > BOOT_IMAGE_LZ4_BLOCK_SIZE || padded > s->end - s->offset) {
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    if (bootloader_flash_read(s->offset, s->stored, padded, true) != ESP_OK) {
+        return ESP_ERR_IMAGE_FLASH_FAIL;
+    }
+    s->offset += padded;
+
+    if (header & BOOT_IMAGE_LZ4_BLOCK_RAW) {
+        if (stored != expected) {
+            return ESP_ERR_IMAGE_INVALID;
+        }
+        memcpy(s->block, s->stored, stored);
+    } else if (boot_lz4_decompress((const uint8_t *)s->stored, stored, s->block, expected) != (int)expected) {
+        return ESP_ERR_IMAGE_INVALID;
+    }
+    s->remaining -= expected;
+    s->block_len = expected;
+    s->block_pos = 0;
+    return ESP_OK;
+}
+
+static esp_err_t stream_read(patch_stream_t *s, void *out, uint32_t len)
+{
+    uint8_t *p = out;
+    while (len > 0) {
+        if (s->block_pos == s->block_len) {
+            const esp_err_t err = stream_next_block(s);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+        const uint32_t n = MIN(len, s->block_len - s->block_pos);
+        memcpy(p, s->block + s->block_pos, n);
+        s->block_pos += n;
+        p += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t writer_flush(target_writer_t *w)
+{
+    const uint32_t len = w->written - w->flushed;
+    const uint32_t addr = w->offset + w->flushed;
+    if (len == 0) {
+        return ESP_OK;
+    }
+
+    if (addr % SPI_FLASH_SEC_SIZE == 0) {
+        feed_watchdog();
+        const esp_err_t err = bootloader_flash_erase_sector(addr / SPI_FLASH_SEC_SIZE);
+        boot_flash_invalidate(addr, SPI_FLASH_SEC_SIZE);
+        if (err != ESP_OK) {
+            return ESP_ERR_IMAGE_FLASH_FAIL;
+        }
+    }
+    // The image length is a multiple of 4, so only whole words are ever written
+    const esp_err_t err = bootloader_flash_write(addr, w->buf, (len + 3) & ~3U, false);
+    boot_flash_invalidate(addr, len);
+    if (err != ESP_OK) {
+        return ESP_ERR_IMAGE_FLASH_FAIL;
+    }
+    bootloader_sha256_data(w->sha, w->buf, len);
+    w->flushed = w->written;
+    return ESP_OK;
+}
+
+static esp_err_t writer_put(target_writer_t *w, const uint8_t *data, uint32_t len)
+{
+    while (len > 0) {
+        const uint32_t fill = w->written - w->flushed;
+        const uint32_t n = MIN(len, IO_CHUNK - fill);
+        memcpy((uint8_t *)w->buf + fill, data, n);
+        w->written += n;
+        data += n;
+        len -= n;
+        if (w->written - w->flushed == IO_CHUNK) {
+            const esp_err_t err = writer_flush(w);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Reads source bytes at any offset; bootloader_flash_read() only takes whole words.
+ */
+static esp_err_t read_source(uint32_t addr, uint8_t *out, uint32_t len)
+{
+    uint32_t words[IO_CHUNK / 4 + 2];
+    const uint32_t start = addr & ~3U;
+    const uint32_t skip = addr - start;
+    if (bootloader_flash_read(start, words, (skip + len + 3) & ~3U, true) != ESP_OK) {
+        return ESP_ERR_IMAGE_FLASH_FAIL;
+    }
+    memcpy(out, (const uint8_t *)words + skip, len);
+    return ESP_OK;
+}
+
+/**
+ * @brief Checks the SHA-256 of a region of flash; @p size must be a multiple of 4.
+ */
+static esp_err_t verify_digest(uint32_t offset, uint32_t size, const uint8_t expected[32], uint32_t *buf, uint32_t buf_size)
+{
+    bootloader_sha256_handle_t sha = bootloader_sha256_start();
+    for (uint32_t done = 0; done < size; ) {
+        const uint32_t n = MIN(size - done, buf_size);
+        if (bootloader_flash_read(offset + done, buf, n, true) != ESP_OK) {
+            bootloader_sha256_finish(sha, NULL);
+            return ESP_ERR_IMAGE_FLASH_FAIL;
+        }
+        bootloader_sha256_data(sha, buf, n);
+        done += n;
+        feed_watchdog();
+    }
+
+    uint8_t digest[32];
+    bootloader_sha256_finish(sha, digest);
+    return memcmp(digest, expected, sizeof(digest)) == 0 ? ESP_OK : ESP_ERR_IMAGE_INVALID;
+}
+
+/**
+ * @brief Rebuilds the target image from the source image and the patch data.
+ */
+static esp_err_t apply(const esp_partition_pos_t *part, const boot_patch_header_t *header,
+                       const esp_partition_pos_t *source, const esp_partition_pos_t *target)
+{
+    patch_stream_t stream = {
+        .offset = part->offset + sizeof(boot_patch_header_t),
+        .end = part->offset + sizeof(boot_patch_header_t) + header->patch_len,
+        .remaining = header->stream_len,
+    };
+
+    // Nothing is written before the source is known to be the image the patch was made for
+    esp_err_t err = verify_digest(source->offset, header->source_size, header->source_digest,
+                                  stream.stored, sizeof(stream.stored));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Patch source in slot %lu doesn't match", (unsigned long)header->source_slot);
+        return err;
+    }
+
+    target_writer_t out = { .offset = target->offset, .sha = bootloader_sha256_start() };
+    uint32_t src_pos = 0;
+    while (err == ESP_OK && out.written < header->target_size) {
+        uint32_t control[3];
+        err = stream_read(&stream, control, sizeof(control));
+        if (err != ESP_OK) {
+            break;
+        }
+        const uint32_t diff_len = control[0];
+        const uint32_t extra_len = control[1];
+        const int32_t seek = (int32_t)control[2];
+        const uint32_t left = header->target_size - out.written;
+        // Seeks may leave the source position out of range, as long as nothing is read from there
+        if (diff_len > left || extra_len > left - diff_len ||
+            (diff_len > 0 && (src_pos > header->source_size || diff_len > header->source_size - src_pos))) {
+            err = ESP_ERR_IMAGE_INVALID;
+            break;
+        }
+
+        uint8_t diff[IO_CHUNK];
+        uint8_t src[IO_CHUNK];
+        for (uint32_t done = 0; err == ESP_OK && done < diff_len; ) {
+            const uint32_t n = MIN(diff_len - done, IO_CHUNK);
+            err = stream_read(&stream, diff, n);
+            if (err == ESP_OK) {
+                err = read_source(source->offset + src_pos + done, src, n);
+            }
+            if (err == ESP_OK) {
+                for (uint32_t i = 0; i < n; i++) {
+                    diff[i] += src[i];
+                }
+                err = writer_put(&out, diff, n);
+            }
+            done += n;
+        }
+        for (uint32_t done = 0; err == ESP_OK && done < extra_len; ) {
+            const uint32_t n = MIN(extra_len - done, IO_CHUNK);
+            err = stream_read(&stream, diff, n);
+            if (err == ESP_OK) {
+                err = writer_put(&out, diff, n);
+            }
+            done += n;
+        }
+        src_pos += diff_len + (uint32_t)seek;
+    }
+    if (err == ESP_OK) {
+        err = writer_flush(&out);
+    }
+
+    uint8_t digest[32];
+    bootloader_sha256_finish(out.sha, digest);
+    if (err == ESP_OK && memcmp(digest, header->target_digest, sizeof(digest)) != 0) {
+        ESP_LOGE(TAG, "Patched image in slot %lu doesn't match its digest", (unsigned long)header->target_slot);
+        err = ESP_ERR_IMAGE_INVALID;
+    }
+    return err;
+}
+
+static void set_state(const esp_partition_pos_t *part, uint32_t state)
+{
+    const uint32_t offset = part->offset + offsetof(boot_patch_header_t, state);
+    if (bootloader_flash_write(offset, &state, sizeof(state), false) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to update the patch state");
+    }
+    boot_flash_invalidate(offset, sizeof(state));
+}
+
+/**
+ * @brief Gives up on a patch. The slot otadata selects doesn't hold the new image, whether it
+ * was left alone or partly rewritten, so its entry is marked invalid and the previous slot boots.
+ */
+static void give_up(const esp_partition_pos_t *part, const bootloader_state_t *bs)
+{
+    set_state(part, BOOT_PATCH_STATE_FAILED);
+    const esp_err_t err = boot_otadata_drop_active(bs, ESP_OTA_IMG_INVALID);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to deselect the patched slot (err=0x%x)", err);
+    }
+}
+
+/**
+ * @brief Checks the header of a pending patch against the partition table and otadata.
+ */
+static bool header_valid(const boot_patch_header_t *h, const esp_partition_pos_t *part, const bootloader_state_t *bs,
+                         const boot_otadata_t *otadata)
+{
+    return h->magic == BOOT_PATCH_MAGIC &&
+           h->crc == boot_patch_header_crc(h) &&
+           h->source_slot < bs->app_count &&
+           h->target_slot < bs->app_count &&
+           h->source_slot != h->target_slot &&
+           (int)h->target_slot == otadata->slot &&
+           h->source_size % 4 == 0 && h->source_size <= bs->ota[h->source_slot].size &&
+           h->target_size % 4 == 0 && h->target_size <= bs->ota[h->target_slot].size &&
+           h->patch_len <= part->size - sizeof(boot_patch_header_t);
+}
+
+esp_err_t boot_patch_apply_pending(const bootloader_state_t *bs)
+{
+    const boot_otadata_t *otadata = boot_otadata_get(bs);
+    if (otadata->active_entry < 0 ||
+        memcmp(otadata->entries[otadata->active_entry].seq_label, BOOT_PATCH_LABEL, sizeof(BOOT_PATCH_LABEL)) != 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    esp_partition_pos_t part;
+    if (!boot_ptable_find(PART_TYPE_DATA, BOOT_PATCH_PARTITION_SUBTYPE, &part) || part.size < sizeof(boot_patch_header_t)) {
+        ESP_LOGE(TAG, "No patch partition in the partition table");
+        boot_otadata_drop_active(bs, ESP_OTA_IMG_INVALID);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    boot_patch_header_t header;
+    if (boot_flash_read(part.offset, &header, sizeof(header)) != ESP_OK) {
+        return ESP_ERR_IMAGE_FLASH_FAIL;
+    }
+    if (header.state != BOOT_PATCH_STATE_PENDING) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (!header_valid(&header, &part, bs, otadata)) {
+        ESP_LOGE(TAG, "Invalid patch header at 0x%lx", (unsigned long)part.offset);
+        give_up(&part, bs);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    ESP_LOGI(TAG, "Applying patch from slot %lu to slot %lu (%lu bytes)", (unsigned long)header.source_slot,
+             (unsigned long)header.target_slot, (unsigned long)header.patch_len);
+    const esp_err_t err = apply(&part, &header, &bs->ota[header.source_slot], &bs->ota[header.target_slot]);
+    // The target slot was (partly) rewritten, whatever the outcome
+    boot_rtc_note_flash_write();
+
+    if (err == ESP_OK) {
+        set_state(&part, BOOT_PATCH_STATE_APPLIED);
+    } else if (err == ESP_ERR_IMAGE_INVALID) {
+        // Retrying can't help
+        give_up(&part, bs);
+    }
+    return err;
+}
+
+#endif // CONFIG_BETTEROTA_PATCH
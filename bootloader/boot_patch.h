@@ -0,0 +1,22 @@
+/*
+ * Rebuilding an OTA slot from a delta patch, see boot_patch_format.h.
+ */
+#pragma once
+
+#include "esp_err.h"
+#include "bootloader_utility.h"
+
+/**
+ * @brief Applies the patch in the patch partition, if otadata marks one as pending.
+ *
+ * The source image is checked against the digest in the patch header before the target
+ * slot is touched, and the rebuilt image against its digest before the patch is marked
+ * as applied. A flash error leaves the patch pending, so it is applied again from the start
+ * on the next boot; the source slot is never written. A patch that can't be applied marks
+ * the otadata entry of the target slot invalid, so the previous slot is selected again.
+ *
+ * @param bs Pointer to the bootloader_state_t with the loaded partition table
+ * @return ESP_OK if the target slot was rebuilt, ESP_ERR_NOT_FOUND if no patch is pending,
+ *         an error code otherwise.
+ */
+esp_err_t boot_patch_apply_pending(const bootloader_state_t *bs);
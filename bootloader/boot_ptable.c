@@ -0,0 +1,143 @@
+/*
+ * Partition table loading with an RTC memory cache.
+ */
+#include <string.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_flash_partitions.h"
+#include "boot_rtc.h"
+#include "boot_log.h"
+#include "boot_flash.h"
+#include "boot_ptable.h"
+
+static const char *TAG = "BetterOTA";
+
+// The MD5 entry is 0xEBEB, 14 bytes of padding and the 16 byte MD5 of the preceding entries
+#define MD5_ENTRY_DIGEST_OFFSET 16
+
+static uint32_t cache_crc(const boot_ptable_cache_t *cache)
+{
+    return esp_rom_crc32_le(UINT32_MAX, (const uint8_t *)cache, offsetof(boot_ptable_cache_t, crc));
+}
+
+/**
+ * @brief Restores the bootloader state from the cache, if the table in flash is still the cached one.
+ */
+static bool load_cached(bootloader_state_t *bs)
+{
+    const boot_rtc_t *rtc = boot_rtc();
+    const boot_ptable_cache_t *cache = &rtc->ptable;
+
+    if (cache->magic != BOOT_PTABLE_CACHE_MAGIC || cache->crc != cache_crc(cache)) {
+        return false;
+    }
+    if (cache->ptable_generation != rtc->ptable_generation) {
+        ESP_LOGI(TAG, "Partition table was written since it was cached");
+        return false;
+    }
+
+    esp_partition_info_t md5_entry;
+    if (boot_flash_read(cache->md5_offset, &md5_entry, sizeof(md5_entry)) != ESP_OK ||
+        md5_entry.magic != ESP_PARTITION_MAGIC_MD5 ||
+        memcmp((const uint8_t *)&md5_entry + MD5_ENTRY_DIGEST_OFFSET, cache->md5, sizeof(cache->md5)) != 0) {
+        ESP_LOGI(TAG, "Partition table changed since it was cached");
+        return false;
+    }
+
+    memset(bs, 0, sizeof(*bs));
+    bs->ota_info = cache->ota_info;
+    bs->factory = cache->factory;
+    bs->test = cache->test;
+    memcpy(bs->ota, cache->ota, sizeof(cache->ota));
+    bs->app_count = cache->app_count;
+    return true;
+}
+
+/**
+ * @brief Caches a freshly loaded partition table, keyed by its MD5 entry.
+ */
+static void store(const bootloader_state_t *bs)
+{
+    boot_rtc_t *rtc = boot_rtc();
+    boot_ptable_cache_t *cache = &rtc->ptable;
+
+    boot_ptable_cache_clear();
+    if (bs->app_count > BOOT_PTABLE_CACHE_SLOTS) {
+        return;
+    }
+
+    // Entry by entry, most of them from the read-ahead windows
+    bool found = false;
+    for (size_t i = 0; i < ESP_PARTITION_TABLE_MAX_ENTRIES; i++) {
+        esp_partition_info_t entry;
+        const uint32_t offset = ESP_PARTITION_TABLE_OFFSET + i * sizeof(entry);
+        if (boot_flash_read(offset, &entry, sizeof(entry)) != ESP_OK) {
+            return;
+        }
+        if (entry.magic == ESP_PARTITION_MAGIC_MD5) {
+            cache->md5_offset = offset;
+            memcpy(cache->md5, (const uint8_t *)&entry + MD5_ENTRY_DIGEST_OFFSET, sizeof(cache->md5));
+            found = true;
+            break;
+        }
+        if (entry.magic != ESP_PARTITION_MAGIC) {
+            break;
+        }
+    }
+
+    if (!found) {
+        // Without an MD5 entry there is no cheap way to tell the table changed
+        ESP_LOGD(TAG, "Partition table has no MD5 entry, not caching it");
+        return;
+    }
+
+    cache->ptable_generation = rtc->ptable_generation;
+    cache->ota_info = bs->ota_info;
+    cache->factory = bs->factory;
+    cache->test = bs->test;
+    memcpy(cache->ota, bs->ota, sizeof(cache->ota));
+    cache->app_count = bs->app_count;
+    cache->magic = BOOT_PTABLE_CACHE_MAGIC;
+    cache->crc = cache_crc(cache);
+}
+
+bool boot_ptable_load(bootloader_state_t *bs)
+{
+#if CONFIG_BETTEROTA_PTABLE_CACHE
+    if (load_cached(bs)) {
+        ESP_LOGI(TAG, "Partition table loaded from RTC cache");
+        return true;
+    }
+#endif
+
+    if (!bootloader_utility_load_partition_table(bs)) {
+        boot_ptable_cache_clear();
+        return false;
+    }
+
+#if CONFIG_BETTEROTA_PTABLE_CACHE
+    store(bs);
+#endif
+    return true;
+}
+
+bool boot_ptable_find(uint8_t type, uint8_t subtype, esp_partition_pos_t *pos)
+{
+    for (size_t i = 0; i < ESP_PARTITION_TABLE_MAX_ENTRIES; i++) {
+        esp_partition_info_t entry;
+        if (boot_flash_read(ESP_PARTITION_TABLE_OFFSET + i * sizeof(entry), &entry, sizeof(entry)) != ESP_OK ||
+            entry.magic != ESP_PARTITION_MAGIC) {
+            break;
+        }
+        if (entry.type == type && entry.subtype == subtype) {
+            *pos = entry.pos;
+            return true;
+        }
+    }
+    return false;
+}
+
+void boot_ptable_cache_clear(void)
+{
+    memset(&boot_rtc()->ptable, 0, sizeof(boot_ptable_cache_t));
+}
@@ -0,0 +1,38 @@
+/*
+ * Partition table loading with an RTC memory cache.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_flash_partitions.h"
+#include "bootloader_utility.h"
+
+/**
+ * @brief Loads the partition table, from the RTC cache when the table is unchanged.
+ *
+ * Drop-in replacement for bootloader_utility_load_partition_table(): on a cache miss the
+ * table is read and checked by the IDF, then cached for the following boots.
+ *
+ * @param[out] bs The bootloader state to fill in
+ * @return true on success, false if the partition table is invalid.
+ */
+bool boot_ptable_load(bootloader_state_t *bs);
+
+/**
+ * @brief Looks up a partition the IDF's parser doesn't keep in the bootloader_state_t.
+ *
+ * Reads the entries of the table in flash, which boot_ptable_load() checked, through the
+ * read-ahead windows.
+ *
+ * @param type Partition type, e.g. PART_TYPE_DATA
+ * @param subtype Partition subtype
+ * @param[out] pos Position of the first partition of that type and subtype
+ * @return true if the table has one, false otherwise.
+ */
+bool boot_ptable_find(uint8_t type, uint8_t subtype, esp_partition_pos_t *pos);
+
+/**
+ * @brief Drops the cached partition table.
+ */
+void boot_ptable_cache_clear(void);
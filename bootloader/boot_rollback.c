@@ -0,0 +1,69 @@
+/*
+ * Trial boots of new images, and the rollback of those the app never confirms.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "boot_rtc.h"
+#include "boot_log.h"
+#include "boot_otadata.h"
+#include "boot_timer.h"
+#include "boot_rollback.h"
+
+static const char *TAG = "BetterOTA";
+
+/**
+ * @brief Returns the trial boots of an entry recorded in RTC memory, 0 if there is no record of it.
+ */
+static uint32_t rtc_boots(const boot_trial_record_t *record, uint32_t seq)
+{
+    if (record->magic != BOOT_TRIAL_MAGIC || record->crc != boot_trial_record_crc(record) ||
+        record->ota_seq != seq) {
+        return 0;
+    }
+    return record->boots;
+}
+
+boot_trial_t boot_rollback_check(const bootloader_state_t *bs, int boot_index)
+{
+    const boot_otadata_t *otadata = boot_otadata_get(bs);
+    if (otadata->slot != boot_index ||
+        (otadata->state != ESP_OTA_IMG_NEW && otadata->state != ESP_OTA_IMG_PENDING_VERIFY)) {
+        return BOOT_TRIAL_NONE;
+    }
+
+    boot_trial_record_t *record = &boot_rtc()->trial;
+    uint32_t boots = boot_otadata_trial_boots(bs);
+    const uint32_t rtc = rtc_boots(record, otadata->seq);
+    if (rtc > boots) {
+        boots = rtc;
+    }
+
+    if (boots >= CONFIG_BETTEROTA_TRIAL_BOOT_ATTEMPTS) {
+        memset(record, 0, sizeof(*record));
+        ESP_LOGE(TAG, "Slot %d wasn't confirmed in %lu trial boots, rolling back", boot_index, (unsigned long)boots);
+        const esp_err_t err = boot_otadata_drop_active(bs, ESP_OTA_IMG_ABORTED);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to roll back otadata (err=0x%x)", err);
+        }
+        boot_timer_stats()->flags |= BOOT_STATS_FLAG_ROLLED_BACK;
+        return BOOT_TRIAL_ROLLED_BACK;
+    }
+
+    const esp_err_t err = boot_otadata_count_trial(bs);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to count the trial boot in otadata (err=0x%x)", err);
+    }
+    boots++;
+    record->magic = BOOT_TRIAL_MAGIC;
+    record->ota_seq = otadata->seq;
+    record->slot = boot_index;
+    record->boots = boots;
+    record->max_boots = CONFIG_BETTEROTA_TRIAL_BOOT_ATTEMPTS;
+    record->crc = boot_trial_record_crc(record);
+    ESP_LOGI(TAG, "Trial boot %lu of %d of slot %d", (unsigned long)boots, CONFIG_BETTEROTA_TRIAL_BOOT_ATTEMPTS, boot_index);
+    boot_timer_stats()->flags |= BOOT_STATS_FLAG_TRIAL;
+    return BOOT_TRIAL_COUNTED;
+}
@@ -0,0 +1,33 @@
+/*
+ * Trial boots of new images, and the rollback of those the app never confirms.
+ *
+ * With CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE, esp_ota_set_boot_partition() writes the otadata
+ * entry of a new image in the ESP_OTA_IMG_NEW state. boot_rollback_check() counts each boot of
+ * such an image, in the entry's otadata sector (see boot_otadata.h) and in RTC memory (see
+ * boot_rtc.h), until the app confirms the image with boot_trial_confirm() (see boot_trial.h),
+ * which marks the entry ESP_OTA_IMG_VALID. An image that used up
+ * CONFIG_BETTEROTA_TRIAL_BOOT_ATTEMPTS boots without that is marked ESP_OTA_IMG_ABORTED, as
+ * the IDF bootloader does, and otadata selects the previous slot again.
+ */
+#pragma once
+
+#include "bootloader_utility.h"
+
+/**
+ * @brief Outcome of boot_rollback_check().
+ */
+typedef enum {
+    BOOT_TRIAL_NONE = 0,        // Not a trial boot: the image is confirmed, or another slot is booted
+    BOOT_TRIAL_COUNTED,         // Counted a trial boot of the image
+    BOOT_TRIAL_ROLLED_BACK,     // The image used up its trial boots, otadata now selects the previous slot
+} boot_trial_t;
+
+/**
+ * @brief Counts a trial boot of the image about to be booted, or rolls it back.
+ *
+ * @param bs Pointer to the bootloader_state_t with the loaded partition table
+ * @param boot_index Slot chosen by choose_ota_partition()
+ * @return boot_trial_t What was done; after BOOT_TRIAL_ROLLED_BACK, choose the slot again
+ *         with boot_select_after_rollback().
+ */
+boot_trial_t boot_rollback_check(const bootloader_state_t *bs, int boot_index);
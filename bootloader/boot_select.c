@@ -0,0 +1,142 @@
+/*
+ * Selection of the OTA partition to boot.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_image_format.h"
+#include "bootloader_flash_priv.h"
+#include "boot_button.h"
+#include "boot_otadata.h"
+#include "boot_log.h"
+#include "boot_timer.h"
+#include "boot_select.h"
+
+static const char *TAG = "BetterOTA";
+
+// Partition booted while the button is held: the manual fallback
+static const int BUTTON_BOOT_INDEX = 0;
+// Partition booted when otadata does not select one (e.g. a factory-fresh device)
+static const int DEFAULT_BOOT_INDEX = 1;
+
+/**
+ * @brief Checks a segment header whose data starts @p data_offset bytes into the slot.
+ */
+static bool segment_plausible(const esp_image_segment_header_t *segment, uint32_t data_offset,
+                              const esp_partition_pos_t *part)
+{
+    // Erased flash reads as UINT32_MAX for both fields
+    return segment->load_addr != UINT32_MAX && segment->data_len % 4 == 0 &&
+           data_offset <= part->size && segment->data_len <= part->size - data_offset;
+}
+
+boot_slot_probe_t boot_select_probe_slot(const esp_partition_pos_t *part)
+{
+    struct {
+        esp_image_header_t image;
+        esp_image_segment_header_t segment;
+    } head;
+    if (part->size < sizeof(head) || bootloader_flash_read(part->offset, &head, sizeof(head), true) != ESP_OK) {
+        return BOOT_SLOT_IMAGE;
+    }
+    if (head.image.magic != ESP_IMAGE_HEADER_MAGIC) {
+        return BOOT_SLOT_BLANK;
+    }
+    if (head.image.segment_count == 0 || head.image.segment_count > ESP_IMAGE_MAX_SEGMENTS ||
+        !segment_plausible(&head.segment, sizeof(head), part)) {
+        return BOOT_SLOT_PARTIAL;
+    }
+    if (head.image.segment_count == 1) {
+        return BOOT_SLOT_IMAGE;
+    }
+
+    // The next segment header follows the first segment's data
+    esp_image_segment_header_t next;
+    const uint32_t next_offset = sizeof(head) + head.segment.data_len;
+    if (next_offset > part->size - sizeof(next)) {
+        return BOOT_SLOT_PARTIAL;
+    }
+    if (bootloader_flash_read(part->offset + next_offset, &next, sizeof(next), true) != ESP_OK) {
+        return BOOT_SLOT_IMAGE;
+    }
+    return segment_plausible(&next, next_offset + sizeof(next), part) ? BOOT_SLOT_IMAGE : BOOT_SLOT_PARTIAL;
+}
+
+/**
+ * @brief Takes the other slot if the chosen one holds no image, and the other one does.
+ */
+static int skip_blank_slot(const bootloader_state_t *bs, int boot_index, boot_select_reason_t *reason)
+{
+#if CONFIG_BETTEROTA_BLANK_PROBE
+    // Rather than failing to load an empty or half-written slot, go straight for the other one
+    const boot_slot_probe_t probe = boot_select_probe_slot(&bs->ota[boot_index]);
+    if (probe != BOOT_SLOT_IMAGE && bs->app_count > 1) {
+        const int other = (boot_index + 1) % (int)bs->app_count;
+        if (boot_select_probe_slot(&bs->ota[other]) == BOOT_SLOT_IMAGE) {
+            ESP_LOGW(TAG, "Slot %d is %s, taking slot %d", boot_index,
+                     probe == BOOT_SLOT_BLANK ? "blank" : "half written", other);
+            boot_index = other;
+            *reason = BOOT_SELECT_BLANK_SLOT;
+        }
+    }
+#endif
+    return boot_index;
+}
+
+int choose_ota_partition(const bootloader_state_t *bs)
+{
+    // Read button
+    button_result_t result;
+    bool button = button_read(&result);
+
+    ESP_LOGI(TAG, "Button state is: %d (%s)", button, button ? "PRESSED" : "NOT PRESSED");
+    ESP_LOGI(TAG, "Button decided in %lu us from %lu samples (%lu pressed)%s",
+             (unsigned long)result.elapsed_us, (unsigned long)result.samples,
+             (unsigned long)result.pressed_samples, result.timed_out ? ", budget exhausted" : "");
+
+    // OTA selection: pressed → OTA_0, otherwise the slot selected in otadata, OTA_1 if there is none
+    int boot_index;
+    boot_select_reason_t reason;
+    if (button) {
+        boot_index = BUTTON_BOOT_INDEX;
+        reason = BOOT_SELECT_BUTTON;
+        ESP_LOGI(TAG, "Button overrides otadata");
+    } else {
+        const boot_otadata_t *otadata = boot_otadata_get(bs);
+        if (otadata->slot >= 0) {
+            boot_index = otadata->slot;
+            reason = BOOT_SELECT_OTADATA;
+            ESP_LOGI(TAG, "otadata selects slot %d (seq %lu, state 0x%lx)",
+                     otadata->slot, (unsigned long)otadata->seq, (unsigned long)otadata->state);
+        } else {
+            boot_index = DEFAULT_BOOT_INDEX;
+            reason = BOOT_SELECT_DEFAULT;
+            ESP_LOGI(TAG, "No valid otadata, using the default slot");
+        }
+    }
+
+    boot_index = skip_blank_slot(bs, boot_index, &reason);
+
+    ESP_LOGI(TAG, "Selected boot partition index: %d", boot_index);
+    boot_timer_stats()->select_reason = reason;
+
+    return boot_index;
+}
+
+int boot_select_after_rollback(const bootloader_state_t *bs, int boot_index)
+{
+    // The button, if it chose the slot, still holds
+    if (boot_timer_stats()->select_reason == BOOT_SELECT_BUTTON) {
+        return boot_index;
+    }
+
+    const boot_otadata_t *otadata = boot_otadata_get(bs);
+    boot_select_reason_t reason = BOOT_SELECT_ROLLBACK;
+    boot_index = otadata->slot >= 0 ? otadata->slot : DEFAULT_BOOT_INDEX;
+    boot_index = skip_blank_slot(bs, boot_index, &reason);
+
+    ESP_LOGI(TAG, "Selected boot partition index after the rollback: %d", boot_index);
+    boot_timer_stats()->select_reason = reason;
+    return boot_index;
+}
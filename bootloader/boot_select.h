@@ -0,0 +1,53 @@
+/*
+ * Selection of the OTA partition to boot.
+ */
+#pragma once
+
+#include "esp_flash_partitions.h"
+#include "bootloader_utility.h"
+
+/**
+ * @brief What a quick look at the start of an OTA slot found there.
+ */
+typedef enum {
+    BOOT_SLOT_IMAGE = 0,    // Starts like an app image; only loading it tells whether it is one
+    BOOT_SLOT_BLANK,        // No image header, e.g. never written or erased
+    BOOT_SLOT_PARTIAL,      // An image header, but the segment headers after it are erased or garbage
+} boot_slot_probe_t;
+
+/**
+ * @brief Checks whether an OTA slot holds something that may be an app image.
+ *
+ * Reads the image header and the headers of the first two segments, in two small flash
+ * reads: enough to tell a slot that was never written, or whose update stopped early, from
+ * one worth loading.
+ *
+ * @param part The OTA slot
+ * @return boot_slot_probe_t What the slot holds; BOOT_SLOT_IMAGE if reading it failed.
+ */
+boot_slot_probe_t boot_select_probe_slot(const esp_partition_pos_t *part);
+
+/**
+ * @brief Chooses the OTA partition index based on otadata and the boot button.
+ *
+ * The slot selected in otadata is booted unless the button is held, which forces OTA_0.
+ * Without valid otadata, OTA_1 is booted. With CONFIG_BETTEROTA_BLANK_PROBE, a chosen slot
+ * that holds no image (see boot_select_probe_slot()) gives way to the other one, if that
+ * does. The reason for the choice goes into the boot statistics.
+ *
+ * @param bs Pointer to the bootloader_state_t with the loaded partition table
+ * @return int Index of the partition to boot (0 = OTA_0, 1 = OTA_1)
+ */
+int choose_ota_partition(const bootloader_state_t *bs);
+
+/**
+ * @brief Chooses the OTA partition again after boot_rollback_check() rolled back the chosen one.
+ *
+ * Only otadata is read again, and the slot it now selects probed as by choose_ota_partition();
+ * the button isn't sampled again. A slot the button forced stays chosen.
+ *
+ * @param bs Pointer to the bootloader_state_t with the loaded partition table
+ * @param boot_index Index choose_ota_partition() returned
+ * @return int Index of the partition to boot
+ */
+int boot_select_after_rollback(const bootloader_state_t *bs, int boot_index);
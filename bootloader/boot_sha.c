@@ -0,0 +1,113 @@
+/*
+ * SHA-256 on the accelerator with the DPORT read workaround, see boot_sha.h.
+ *
+ * Follows bootloader_sha.c from ESP-IDF for the ESP32, which keeps the whole digest state in
+ * the accelerator and only counts the words fed to it.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "soc/dport_reg.h"
+#include "soc/hwcrypto_reg.h"
+#include "bootloader_sha.h"
+#include "boot_sha.h"
+
+#if !CONFIG_IDF_TARGET_ESP32
+#error "The BetterOTA SHA driver only supports the ESP32"
+#endif
+
+#define BLOCK_WORDS (64 / 4)
+#define DIGEST_WORDS (32 / 4)
+// The APB register ESP-IDF's DPORT_SEQUENCE_REG_READ() reads first
+#define APB_DUMMY_ADDR 0x3FF40078
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static uint32_t s_words;
+
+/**
+ * @brief Reads a DPORT register right after an APB register, which can't be disturbed by the
+ * other CPU's APB accesses. The bootloader runs with interrupts disabled, so nothing comes in
+ * between the two loads.
+ */
+static inline uint32_t dport_read(uint32_t addr)
+{
+    uint32_t apb = APB_DUMMY_ADDR;
+    uint32_t val;
+    __asm__ __volatile__(
+        "l32i %[apb], %[apb], 0\n"
+        "l32i %[val], %[addr], 0\n"
+        : [apb] "+a"(apb), [val] "=a"(val)
+        : [addr] "a"(addr)
+        : "memory");
+    return val;
+}
+
+static void wait_idle(void)
+{
+    while (dport_read(SHA_256_BUSY_REG) != 0) {
+    }
+}
+
+bootloader_sha256_handle_t boot_sha_start(void)
+{
+    s_words = 0;
+    // Enables the accelerator
+    return bootloader_sha256_start();
+}
+
+void boot_sha_data(bootloader_sha256_handle_t sha, const void *data, size_t data_len)
+{
+    const uint32_t *w = data;
+    size_t word_len = data_len / 4;
+    volatile uint32_t *text = (volatile uint32_t *)SHA_TEXT_BASE;
+
+    while (word_len > 0) {
+        size_t block_count = s_words % BLOCK_WORDS;
+        const size_t copy_words = MIN(word_len, BLOCK_WORDS - block_count);
+
+        wait_idle();
+        for (size_t i = 0; i < copy_words; i++) {
+            text[block_count + i] = __builtin_bswap32(w[i]);
+        }
+        __asm__ __volatile__("memw");
+
+        s_words += copy_words;
+        block_count += copy_words;
+        word_len -= copy_words;
+        w += copy_words;
+
+        if (block_count == BLOCK_WORDS) {
+            DPORT_REG_WRITE(s_words == BLOCK_WORDS ? SHA_256_START_REG : SHA_256_CONTINUE_REG, 1);
+        }
+    }
+}
+
+void boot_sha_finish(bootloader_sha256_handle_t sha, uint8_t *digest)
+{
+    if (digest != NULL) {
+        static const uint32_t padding[BLOCK_WORDS] = { 0x00000080 };
+        const uint32_t bits = s_words * 32;
+
+        // 0x80, zeros up to the last 8 bytes of a block, then the bit count, big endian
+        int pad_bytes = 55 - (int)(s_words % BLOCK_WORDS) * 4;
+        if (pad_bytes < 0) {
+            pad_bytes += 64;
+        }
+        boot_sha_data(sha, padding, pad_bytes + 5);
+        const uint32_t count = __builtin_bswap32(bits);
+        boot_sha_data(sha, &count, sizeof(count));
+
+        wait_idle();
+        DPORT_REG_WRITE(SHA_256_LOAD_REG, 1);
+        wait_idle();
+
+        uint32_t *out = (uint32_t *)digest;
+        for (int i = 0; i < DIGEST_WORDS; i++) {
+            out[i] = __builtin_bswap32(dport_read(SHA_TEXT_BASE + i * 4));
+        }
+        __asm__ __volatile__("memw");
+    }
+    // Nothing to free, as with bootloader_sha256_finish()
+    (void)sha;
+}
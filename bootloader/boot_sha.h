@@ -0,0 +1,40 @@
+/*
+ * SHA-256 on the accelerator, safe to drive from one CPU while the other one accesses the APB.
+ *
+ * On the ESP32 a read from the DPORT address range (0x3FF00000-0x3FF3FFFF, which holds the SHA
+ * accelerator) may return wrong data while the other CPU accesses the APB (0x3FF40000 and up),
+ * e.g. to read flash through the SPI controller. bootloader_sha256_*() read the accelerator's
+ * busy flag and digest registers plainly, which is fine while only one CPU runs. These functions
+ * read them the way ESP-IDF's DPORT_SEQUENCE_REG_READ() does instead, right after a read from
+ * the APB, so the APP CPU can hash while CPU0 reads flash (see boot_app_cpu.h).
+ *
+ * Only one digest can be computed at a time, as with bootloader_sha256_*(); the two must not be
+ * mixed on one digest.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "bootloader_sha.h"
+
+/**
+ * @brief Starts a digest, enabling the accelerator.
+ */
+bootloader_sha256_handle_t boot_sha_start(void);
+
+/**
+ * @brief Feeds whole words to the digest.
+ *
+ * @param sha Digest from boot_sha_start()
+ * @param data Word aligned data
+ * @param data_len Multiple of 4
+ */
+void boot_sha_data(bootloader_sha256_handle_t sha, const void *data, size_t data_len);
+
+/**
+ * @brief Finishes a digest.
+ *
+ * @param sha Digest from boot_sha_start()
+ * @param digest Word aligned buffer for the 32 byte digest, or NULL to only release it
+ */
+void boot_sha_finish(bootloader_sha256_handle_t sha, uint8_t *digest);
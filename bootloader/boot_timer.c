@@ -0,0 +1,91 @@
+/*
+ * Boot phase timer based on the CPU cycle counter.
+ */
+#include <string.h>
+#include "esp_log.h"
+#include "esp_cpu.h"
+#include "esp_image_format.h"
+#include "esp_rom_sys.h"
+#include "boot_rtc.h"
+#include "boot_log.h"
+#include "boot_timer.h"
+
+static const char *TAG = "BetterOTA";
+
+static boot_stats_t s_stats;
+static uint32_t s_last_cycles;
+static uint32_t s_elapsed_us;
+static uint32_t s_leftover_cycles;  // Not yet a whole microsecond, carried to the next call
+
+// Short phase names used in the summary line, indexed by boot_phase_t
+static const char *const PHASE_NAMES[BOOT_PHASE_MAX] = {
+    [BOOT_PHASE_INIT] = "init",
+    [BOOT_PHASE_PARTITION_TABLE] = "ptable",
+    [BOOT_PHASE_PATCH] = "patch",
+    [BOOT_PHASE_SELECT] = "select",
+    [BOOT_PHASE_LOAD] = "load",
+};
+
+void boot_timer_start(void)
+{
+    // The cycle counter is reset together with the CPU, so at this point it holds the time spent in ROM
+    s_last_cycles = esp_cpu_get_cycle_count();
+    s_elapsed_us = 0;
+    s_leftover_cycles = 0;
+
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_stats.rom_us = s_last_cycles / esp_rom_get_cpu_ticks_per_us();
+    s_stats.boot_index = -1;
+}
+
+uint32_t boot_timer_now_us(void)
+{
+    /*
+     * The CPU clock is switched during bootloader_init(), so cycles can't be converted
+     * from a single starting point. Instead the elapsed time is accumulated at every call,
+     * using the frequency in effect at that moment.
+     *
+     * The counter wraps after 2^32 cycles, about 17.9 s at 240 MHz, so long loops have to
+     * call this now and then (see boot_timer.h).
+     */
+    const uint32_t now = esp_cpu_get_cycle_count();
+    const uint32_t ticks_per_us = esp_rom_get_cpu_ticks_per_us();
+    const uint64_t cycles = (uint64_t)(now - s_last_cycles) + s_leftover_cycles;
+    s_elapsed_us += (uint32_t)(cycles / ticks_per_us);
+    s_leftover_cycles = (uint32_t)(cycles % ticks_per_us);
+    s_last_cycles = now;
+    return s_elapsed_us;
+}
+
+void boot_timer_mark(boot_phase_t phase)
+{
+    s_stats.phase_end_us[phase] = boot_timer_now_us();
+}
+
+boot_stats_t *boot_timer_stats(void)
+{
+    return &s_stats;
+}
+
+void boot_timer_publish(void)
+{
+    ESP_LOGI(TAG, "Boot timing (us): rom=%lu %s=%lu %s=%lu %s=%lu %s=%lu %s=%lu total=%lu",
+             (unsigned long)s_stats.rom_us,
+             PHASE_NAMES[BOOT_PHASE_INIT], (unsigned long)boot_stats_phase_us(&s_stats, BOOT_PHASE_INIT),
+             PHASE_NAMES[BOOT_PHASE_PARTITION_TABLE], (unsigned long)boot_stats_phase_us(&s_stats, BOOT_PHASE_PARTITION_TABLE),
+             PHASE_NAMES[BOOT_PHASE_PATCH], (unsigned long)boot_stats_phase_us(&s_stats, BOOT_PHASE_PATCH),
+             PHASE_NAMES[BOOT_PHASE_SELECT], (unsigned long)boot_stats_phase_us(&s_stats, BOOT_PHASE_SELECT),
+             PHASE_NAMES[BOOT_PHASE_LOAD], (unsigned long)boot_stats_phase_us(&s_stats, BOOT_PHASE_LOAD),
+             (unsigned long)boot_timer_now_us());
+    ESP_LOGI(TAG, "Parser reads: %lu from read-ahead, %lu from flash",
+             (unsigned long)s_stats.read_hits, (unsigned long)s_stats.read_misses);
+    ESP_LOGI(TAG, "Flash %06lx read in %s at %u MHz", (unsigned long)s_stats.flash_id,
+             s_stats.flash_mode == ESP_IMAGE_SPI_MODE_QIO ? "QIO" : "DIO", (unsigned)s_stats.flash_mhz);
+
+    s_stats.magic = BOOT_STATS_MAGIC;
+    s_stats.version = BOOT_STATS_VERSION;
+    s_stats.size = sizeof(boot_stats_t);
+    s_stats.crc = boot_stats_crc(&s_stats);
+
+    memcpy(&boot_rtc()->stats, &s_stats, sizeof(s_stats));
+}
@@ -0,0 +1,38 @@
+/*
+ * Boot phase timer based on the CPU cycle counter.
+ */
+#pragma once
+
+#include "boot_stats.h"
+
+/**
+ * @brief Starts the boot timer. Must be the first thing called in call_start_cpu0.
+ */
+void boot_timer_start(void);
+
+/**
+ * @brief Records the end of a boot phase at the current time.
+ *
+ * @param phase The phase that has just completed
+ */
+void boot_timer_mark(boot_phase_t phase);
+
+/**
+ * @brief Returns the microseconds elapsed since boot_timer_start().
+ *
+ * The CPU cycle counter behind it wraps after about 17.9 s at 240 MHz. Loops that may run
+ * longer than that, such as applying a patch, call this every so often to keep the time.
+ */
+uint32_t boot_timer_now_us(void);
+
+/**
+ * @brief Returns the statistics recorded so far.
+ */
+boot_stats_t *boot_timer_stats(void);
+
+/**
+ * @brief Prints the one-line timing summary and hands the statistics to the app through RTC memory.
+ *
+ * Call right before jumping to the application.
+ */
+void boot_timer_publish(void);
@@ -0,0 +1,150 @@
+/*
+ * Skipping the image verification on cold boots, for images verified on an earlier boot.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "bootloader_flash_priv.h"
+#include "bootloader_sha.h"
+#include "boot_log.h"
+#include "boot_merkle.h"
+#include "boot_otadata.h"
+#include "boot_verified.h"
+
+static const char *TAG = "BetterOTA";
+
+#define DIGEST_LEN 32
+#define CHECK_BLOCKS (CONFIG_BETTEROTA_MERKLE && CONFIG_BETTEROTA_VERIFIED_CACHE_INTERVAL > 0 && \
+                      CONFIG_BETTEROTA_VERIFIED_CACHE_MERKLE_BLOCKS > 0)
+
+static esp_err_t hash_range(bootloader_sha256_handle_t sha, uint32_t offset, uint32_t len)
+{
+    const void *mapped = bootloader_mmap(offset, len);
+    if (mapped == NULL) {
+        return ESP_FAIL;
+    }
+    bootloader_sha256_data(sha, mapped, len);
+    bootloader_munmap(mapped);
+    return ESP_OK;
+}
+
+/**
+ * @brief Hashes the first and last flash sectors of an image, or the one sector it fits in.
+ *
+ * Partitions are sector aligned, so the image's sectors are the flash's.
+ */
+static esp_err_t quick_digest(uint32_t offset, uint32_t len, uint8_t digest[DIGEST_LEN])
+{
+    const uint32_t first_len = len < SPI_FLASH_SEC_SIZE ? len : SPI_FLASH_SEC_SIZE;
+    const uint32_t last_start = (len - 1) & ~(uint32_t)(SPI_FLASH_SEC_SIZE - 1);
+
+    bootloader_sha256_handle_t sha = bootloader_sha256_start();
+    if (hash_range(sha, offset, first_len) != ESP_OK ||
+        (last_start >= first_len && hash_range(sha, offset + last_start, len - last_start) != ESP_OK)) {
+        bootloader_sha256_finish(sha, NULL);
+        return ESP_FAIL;
+    }
+    bootloader_sha256_finish(sha, digest);
+    return ESP_OK;
+}
+
+#if CHECK_BLOCKS
+/**
+ * @brief Checks the next run of blocks of an image carrying a Merkle tree, a different run on
+ * every boot, until the boots have been through all of them.
+ *
+ * @return false if a block doesn't match its leaf, or the tree doesn't check out.
+ */
+static bool check_blocks(const esp_partition_pos_t *part, uint32_t image_len, uint32_t boots)
+{
+    esp_image_metadata_t data = { .start_addr = part->offset, .image_len = image_len };
+    if (bootloader_flash_read(part->offset, &data.image, sizeof(data.image), true) != ESP_OK) {
+        return false;
+    }
+    boot_merkle_t tree;
+    esp_err_t err = boot_merkle_open(part, &data, &tree);
+    if (err == ESP_ERR_NOT_FOUND) {
+        // Packed without a tree, only the full verification catches what the quick digest misses
+        return true;
+    }
+    if (err == ESP_OK) {
+        const uint32_t per_boot = CONFIG_BETTEROTA_VERIFIED_CACHE_MERKLE_BLOCKS;
+        const uint32_t runs = (tree.block_count + per_boot - 1) / per_boot;
+        const uint32_t first = boots % runs * per_boot;
+        const uint32_t count = tree.block_count - first < per_boot ? tree.block_count - first : per_boot;
+        err = boot_merkle_verify_blocks(&tree, first, count);
+        ESP_LOGD(TAG, "Checked Merkle blocks %lu-%lu of %lu (err=0x%x)", (unsigned long)first,
+                 (unsigned long)(first + count - 1), (unsigned long)tree.block_count, err);
+    }
+    return err == ESP_OK;
+}
+#endif
+
+bool boot_verified_check(const bootloader_state_t *bs, int index)
+{
+    if (boot_otadata_get(bs)->slot != index) {
+        return false;
+    }
+    boot_otadata_verified_t record;
+    if (!boot_otadata_read_verified(bs, &record)) {
+        ESP_LOGD(TAG, "No verified record in otadata");
+        return false;
+    }
+    const esp_partition_pos_t *part = &bs->ota[index];
+    if (record.part_offset != part->offset || record.image_len == 0 || record.image_len > part->size) {
+        ESP_LOGI(TAG, "Verified record is for another partition (0x%lx)", (unsigned long)record.part_offset);
+        return false;
+    }
+
+#if CONFIG_BETTEROTA_VERIFIED_CACHE_INTERVAL > 0
+    // A full counter reads as 0 too, and verifies on every boot until otadata is written again
+    const uint32_t boots = boot_otadata_count_boot(bs);
+    if (boots % CONFIG_BETTEROTA_VERIFIED_CACHE_INTERVAL == 0) {
+        ESP_LOGI(TAG, "Full verification due (boot %lu of this otadata entry)", (unsigned long)boots);
+        return false;
+    }
+#endif
+
+    uint8_t digest[DIGEST_LEN];
+    if (quick_digest(part->offset, record.image_len, digest) != ESP_OK ||
+        memcmp(digest, record.quick_digest, sizeof(digest)) != 0) {
+        ESP_LOGI(TAG, "Image changed since its verification");
+        return false;
+    }
+#if CHECK_BLOCKS
+    if (!check_blocks(part, record.image_len, boots)) {
+        ESP_LOGI(TAG, "Image changed since its verification");
+        return false;
+    }
+#endif
+    return true;
+}
+
+void boot_verified_record(const bootloader_state_t *bs, int index, const esp_image_metadata_t *data)
+{
+    if (boot_otadata_get(bs)->slot != index || !data->image.hash_appended) {
+        // Without a digest a rewritten image might go unnoticed in the quick digest
+        return;
+    }
+
+    boot_otadata_verified_t record;
+    if (boot_otadata_read_verified(bs, &record) && record.part_offset == data->start_addr &&
+        record.image_len == data->image_len && memcmp(record.digest, data->image_digest, DIGEST_LEN) == 0) {
+        // The periodic full verification of an image recorded before
+        return;
+    }
+
+    memset(&record, 0, sizeof(record));
+    record.part_offset = data->start_addr;
+    record.image_len = data->image_len;
+    memcpy(record.digest, data->image_digest, DIGEST_LEN);
+    esp_err_t err = quick_digest(data->start_addr, data->image_len, record.quick_digest);
+    if (err == ESP_OK) {
+        err = boot_otadata_write_verified(bs, &record);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to record the verified image in otadata (err=0x%x)", err);
+    }
+}
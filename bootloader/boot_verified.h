@@ -0,0 +1,42 @@
+/*
+ * Skipping the image verification on cold boots, for images verified on an earlier boot.
+ *
+ * After fully verifying the image in the slot otadata selects, boot_verified_record() keeps
+ * its digest in the otadata sector of the active entry (see boot_otadata.h), along with a
+ * quick digest: the SHA-256 of the image's first and last flash sectors. These hold the
+ * image header, the segment headers at the start and the appended digest at the end, so a
+ * rewritten image doesn't match anymore. On later boots boot_verified_check() only compares
+ * the quick digest, and the image is loaded without verification.
+ *
+ * Writing otadata, as every OTA update does, erases the record. A change the quick digest
+ * misses, in the middle of the image, is caught by the full verification every
+ * CONFIG_BETTEROTA_VERIFIED_CACHE_INTERVAL boots. Images with a Merkle tree (see boot_merkle.h)
+ * also have CONFIG_BETTEROTA_VERIFIED_CACHE_MERKLE_BLOCKS of their blocks checked on every
+ * boot in between, a different run each time, which catches such a change sooner.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include "esp_image_format.h"
+#include "bootloader_utility.h"
+
+/**
+ * @brief Checks whether the image in a slot was verified on an earlier boot and is unchanged.
+ *
+ * Only the slot otadata selects has a record. Counts the boot towards the next full
+ * verification.
+ *
+ * @param bs Pointer to the bootloader_state_t with the loaded partition table
+ * @param index Slot about to be booted
+ * @return true if the verification can be skipped, false otherwise.
+ */
+bool boot_verified_check(const bootloader_state_t *bs, int index);
+
+/**
+ * @brief Records a fully verified image in otadata, unless it is recorded already.
+ *
+ * @param bs Pointer to the bootloader_state_t with the loaded partition table
+ * @param index Slot the image was loaded from
+ * @param data Metadata of the verified image
+ */
+void boot_verified_record(const bootloader_state_t *bs, int index, const esp_image_metadata_t *data);
@@ -10,58 +10,23 @@
 #include "bootloader_utility.h"
 #include "bootloader_common.h"
 #include "bootloader_hooks.h"
-#include "soc/gpio_struct.h"
+#include "boot_timer.h"
+#include "boot_image.h"
+#include "boot_select.h"
+#include "boot_fast_wake.h"
+#include "boot_ptable.h"
+#include "boot_patch.h"
+#include "boot_app_cpu.h"
+#include "boot_log.h"
+#include "boot_flash.h"
+#include "boot_flash_mode.h"
+#include "boot_clock.h"
+#include "boot_verified.h"
+#include "boot_rollback.h"
 
 static const char *TAG = "BetterOTA";
 
-static int choose_ota_partition(const bootloader_state_t *bs);
-
-// --- Button Configuration ---
-static const uint8_t BOOT_BUTTON_GPIO = 13;
-static const uintptr_t IO_MUX_MTCK_REG_ADDR = 0x3FF49038U;
-static volatile uint32_t * const IO_MUX_MTCK_REG = (volatile uint32_t *)IO_MUX_MTCK_REG_ADDR;
-
-
-/**
- * @brief Initializes the boot button on GPIO 13.
- */
-static void button_init(void)
-{
-    uint32_t r = *IO_MUX_MTCK_REG;
-    r &= ~(0x7U << 12);           // clear MCU_SEL
-    r |= (2U << 12);              // set MCU_SEL = 2 (GPIO)
-    r &= ~(1U << 7);              // clear pulldown
-    r |= (1U << 8);               // set pullup
-    r |= (1U << 9);               // enable input (FUN_IE)
-    *IO_MUX_MTCK_REG = r;
-}
-
-/**
- * @brief Reads button state using the reliable "drive test" method.
- *
- * This function forces the pin high momentarily, which correctly initializes
- * it, allowing for a reliable read. It then safely returns the pin to
- * a high-impedance input state with the pull-up re-enabled.
- *
- * @return int 0 if the button is pressed (LOW), 1 if not pressed (HIGH).
- */
-static bool button_pressed(void)
-{
-    button_init();          // Initial setup
-
-    GPIO.enable_w1ts = (1u << BOOT_BUTTON_GPIO);    // Enable output for the pin
-    GPIO.out_w1ts = (1u << BOOT_BUTTON_GPIO);       // Set the output level to high
-
-    const bool pressed = !(GPIO.in & (1u << BOOT_BUTTON_GPIO));  // Read the pin state while it's being driven
-
-    GPIO.enable_w1tc = (1u << BOOT_BUTTON_GPIO);    // Immediately disable output, returning pin to a safe high-impedance state
-    GPIO.out_w1tc = (1u << BOOT_BUTTON_GPIO);       // Clear the output register just in case
-
-    button_init();          // Re-initialize the pin to ensure the pull-up is active again
-
-    return pressed;
-}
-
+static void __attribute__((noreturn)) load_boot_image(const bootloader_state_t *bs, int boot_index, bool deep_sleep_wake);
 
 /*
  * We arrive here after the ROM bootloader finished loading this second stage bootloader from flash.
@@ -70,6 +35,8 @@ static bool button_pressed(void)
  */
 void __attribute__((noreturn)) call_start_cpu0(void)
 {
+    boot_timer_start();
+
     // (0. Call the before-init hook, if available)
     if (bootloader_before_init) {
         bootloader_before_init();
@@ -79,48 +46,203 @@ void __attribute__((noreturn)) call_start_cpu0(void)
     if (bootloader_init() != ESP_OK) {
         bootloader_reset();
     }
+    // The image header asks for DIO at 40 MHz; the flash chip may well do better
+    boot_flash_mode_probe();
+    boot_timer_mark(BOOT_PHASE_INIT);
 
     // (1.1 Call the after-init hook, if available)
     if (bootloader_after_init) {
         bootloader_after_init();
     }
 
+#if CONFIG_BETTEROTA_DEFERRED_LOG
+    // From here on the log goes to RTC memory, for the app to print
+    boot_log_defer();
+#endif
+
     ESP_LOGE(TAG, "BetterOTA Bootloader v0.1 loaded successfully");
 
     // --- Select the OTA partition based on button ---
     bootloader_state_t bs = {0};
-    if (!bootloader_utility_load_partition_table(&bs)) {
+    if (!boot_ptable_load(&bs)) {
+#if CONFIG_BETTEROTA_DEFERRED_LOG
+        boot_log_immediate();
+#endif
         ESP_LOGE(TAG, "Failed to load partition table!");
         bootloader_reset();
     }
+    boot_timer_mark(BOOT_PHASE_PARTITION_TABLE);
+
+    // 2. Rebuild the slot selected by otadata, if the app left a delta patch for it
+#if CONFIG_BETTEROTA_PATCH
+    boot_clock_boost();
+    const esp_err_t patch_err = boot_patch_apply_pending(&bs);
+    boot_clock_restore();
+    if (patch_err == ESP_OK) {
+        ESP_LOGI(TAG, "Applied delta patch in %lu us",
+                 (unsigned long)(boot_timer_now_us() - boot_timer_stats()->phase_end_us[BOOT_PHASE_PARTITION_TABLE]));
+        boot_timer_stats()->flags |= BOOT_STATS_FLAG_PATCHED;
+    } else if (patch_err != ESP_ERR_NOT_FOUND) {
+        ESP_LOGE(TAG, "Failed to apply delta patch (err=0x%x)", patch_err);
+    }
+#endif
+    boot_timer_mark(BOOT_PHASE_PATCH);
 
     int boot_index = choose_ota_partition(&bs);
+#if CONFIG_BETTEROTA_TRIAL_BOOT
+    // A new image gets a few boots to be confirmed by the app, then the previous one comes back
+    if (boot_rollback_check(&bs, boot_index) == BOOT_TRIAL_ROLLED_BACK) {
+        boot_index = boot_select_after_rollback(&bs, boot_index);
+    }
+#endif
+    boot_timer_mark(BOOT_PHASE_SELECT);
+
+    // 3. Load the app image for booting; a wake from deep sleep may skip its verification
+    const bool deep_sleep_wake = esp_rom_get_reset_reason(0) == RESET_REASON_CORE_DEEP_SLEEP;
+    load_boot_image(&bs, boot_index, deep_sleep_wake);
+}
 
-    // Boot the selected partition
-    bootloader_utility_load_boot_image(&bs, boot_index);
-    // 3. Load the app image for booting
-    bootloader_utility_load_boot_image(&bs, boot_index);
+/**
+ * @brief Returns the OTA slot to fall over to when the given one fails to load.
+ */
+static int next_ota_index(const bootloader_state_t *bs, int index)
+{
+    return bs->app_count > 0 ? (index + 1) % (int)bs->app_count : index;
 }
 
 /**
- * @brief Chooses the OTA partition index based on the boot button.
+ * @brief Records the outcome of the load in the boot statistics and jumps to the loaded app.
+ */
+static void __attribute__((noreturn)) start_app(int index, int attempts, uint32_t flags, const esp_image_metadata_t *data)
+{
+    boot_stats_t *stats = boot_timer_stats();
+    stats->boot_index = index;
+    stats->load_attempts = attempts;
+    stats->flags |= flags;
+    stats->read_hits = boot_flash_stats()->hits;
+    stats->read_misses = boot_flash_stats()->misses;
+    stats->flash_id = boot_flash_mode_get()->jedec_id;
+    stats->flash_mode = boot_flash_mode_get()->spi_mode;
+    stats->flash_mhz = boot_flash_mode_get()->spi_mhz;
+    boot_timer_mark(BOOT_PHASE_LOAD);
+    boot_timer_publish();
+    boot_image_stats_publish();
+#if CONFIG_BETTEROTA_DEFERRED_LOG
+    boot_log_finish();
+#endif
+
+#if CONFIG_BETTEROTA_APP_CPU
+    // The app's startup code releases the APP CPU again
+    boot_app_cpu_stop();
+#endif
+    // The app doesn't set the read mode again, see boot_flash_mode.h
+    boot_flash_mode_restore();
+    boot_clock_restore();
+    boot_image_start(data);
+}
+
+/**
+ * @brief Loads the selected app and jumps to it, falling over to the other OTA slot on failure.
+ *
+ * Every attempt verifies and loads the image exactly once. The number of attempts is bounded
+ * by CONFIG_BETTEROTA_LOAD_ATTEMPTS, after which the chip is reset.
+ *
+ * When waking from deep sleep and the selected image is unchanged since its last full
+ * verification, it is loaded without verifying it again first.
+ *
+ * With CONFIG_BETTEROTA_VERIFIED_CACHE, the same goes for a cold boot of the image otadata
+ * selects, if it was verified on an earlier boot (see boot_verified.h).
  *
- * @param bs Pointer to the bootloader_state_t (for partition table info if needed)
- * @return int Index of the partition to boot (0 = OTA_0, 1 = OTA_1)
+ * With CONFIG_BETTEROTA_LAZY_VERIFY, an image carrying a digest of its RAM segments is only
+ * checked against that digest; the app verifies its flash-mapped segments in the background.
+ *
+ * With CONFIG_BETTEROTA_CLOCK_BOOST the CPU runs at a higher clock until the jump.
+ *
+ * The app's IRAM segments overwrite the bootloader's own text, so this and everything it calls
+ * runs from the loader segment, see LOADER_IRAM_SOURCES in bootloader_hook.py.
+ *
+ * @param bs Pointer to the bootloader_state_t with the loaded partition table
+ * @param boot_index Index of the partition to try first
+ * @param deep_sleep_wake Whether this boot is a wake from deep sleep
  */
-static int choose_ota_partition(const bootloader_state_t *bs)
+static void load_boot_image(const bootloader_state_t *bs, int boot_index, bool deep_sleep_wake)
 {
-    // Read button
-    bool button = button_pressed();
+    esp_image_metadata_t data = {0};
+    int index = boot_index;
+
+    // Decompressing, checking and copying the image is mostly CPU work
+    boot_clock_boost();
+
+#if CONFIG_BETTEROTA_FAST_WAKE
+    if (deep_sleep_wake && boot_fast_wake_check(&bs->ota[index])) {
+        const uint32_t start_us = boot_timer_now_us();
+        if (boot_image_load_unverified(&bs->ota[index], &data) == ESP_OK) {
+            ESP_LOGI(TAG, "Fast wake: loaded partition index %d without verification in %lu us",
+                     index, (unsigned long)(boot_timer_now_us() - start_us));
+            start_app(index, 1, BOOT_STATS_FLAG_FAST_WAKE, &data);
+        }
+        // Doesn't count as an attempt: fall back to the full verification of the same image
+        boot_fast_wake_clear();
+    }
+#else
+    (void)deep_sleep_wake;
+#endif
+
+#if CONFIG_BETTEROTA_VERIFIED_CACHE
+    if (boot_verified_check(bs, index)) {
+        const uint32_t start_us = boot_timer_now_us();
+        if (boot_image_load_unverified(&bs->ota[index], &data) == ESP_OK) {
+            ESP_LOGI(TAG, "Loaded partition index %d, verified on an earlier boot, in %lu us",
+                     index, (unsigned long)(boot_timer_now_us() - start_us));
+            start_app(index, 1, BOOT_STATS_FLAG_VERIFIED, &data);
+        }
+        // Doesn't count as an attempt either
+    }
+#endif
 
-    ESP_LOGI(TAG, "Button state is: %d (%s)", button, button ? "PRESSED" : "NOT PRESSED");
+#if CONFIG_BETTEROTA_APP_CPU
+    // Hashes the image while CPU0 reads and copies it
+    boot_app_cpu_start();
+#endif
 
-    // OTA selection: pressed → OTA_0, not pressed → OTA_1
-    int boot_index = button ? 0 : 1;
+    for (int attempt = 1; attempt <= CONFIG_BETTEROTA_LOAD_ATTEMPTS; attempt++) {
+        const uint32_t start_us = boot_timer_now_us();
+        const esp_err_t err = boot_image_load(&bs->ota[index], &data);
+        const uint32_t elapsed_us = boot_timer_now_us() - start_us;
+
+        if (err == ESP_OK) {
+            ESP_LOGI(TAG, "Loaded partition index %d in %lu us (attempt %d)", index, (unsigned long)elapsed_us, attempt);
+            uint32_t flags = 0;
+#if CONFIG_BETTEROTA_LAZY_VERIFY
+            if (boot_image_has_ram_digest(&data.image)) {
+                // Not fully verified, so not remembered for the next wake either
+                flags |= BOOT_STATS_FLAG_LAZY_VERIFY;
+            }
+#endif
+#if CONFIG_BETTEROTA_FAST_WAKE
+            if (!(flags & BOOT_STATS_FLAG_LAZY_VERIFY)) {
+                boot_fast_wake_record(&bs->ota[index], &data);
+            }
+#endif
+#if CONFIG_BETTEROTA_VERIFIED_CACHE
+            if (!(flags & BOOT_STATS_FLAG_LAZY_VERIFY)) {
+                boot_verified_record(bs, index, &data);
+            }
+#endif
+            start_app(index, attempt, flags, &data);
+        }
 
-    ESP_LOGI(TAG, "Selected boot partition index: %d", boot_index);
+#if CONFIG_BETTEROTA_DEFERRED_LOG
+        // Whatever boots in the end, the failure is seen on the UART right away
+        boot_log_immediate();
+#endif
+        ESP_LOGE(TAG, "Failed to load partition index %d (err=0x%x) after %lu us (attempt %d)",
+                 index, err, (unsigned long)elapsed_us, attempt);
+        index = next_ota_index(bs, index);
+    }
 
-    return boot_index;
+    ESP_LOGE(TAG, "No bootable app partition after %d attempts!", CONFIG_BETTEROTA_LOAD_ATTEMPTS);
+    bootloader_reset();
 }
 
 #if CONFIG_LIBC_NEWLIB
@@ -1,5 +1,7 @@
 import os
+import re
 import shutil
+import sys
 from SCons.Script import DefaultEnvironment
 
 env = DefaultEnvironment()
@@ -8,45 +10,213 @@ platform = env.PioPlatform()
 # --- Configuration ---
 FRAMEWORK_DIR = platform.get_package_dir("framework-espidf")
 
-ORIGINAL_BOOTLOADER_SRC = os.path.join(
-    FRAMEWORK_DIR, "components", "bootloader", "subproject", "main", "bootloader_start.c"
+BOOTLOADER_MAIN_DIR = os.path.join(
+    FRAMEWORK_DIR, "components", "bootloader", "subproject", "main"
 )
+ORIGINAL_BOOTLOADER_SRC = os.path.join(BOOTLOADER_MAIN_DIR, "bootloader_start.c")
+ORIGINAL_BOOTLOADER_CMAKE = os.path.join(BOOTLOADER_MAIN_DIR, "CMakeLists.txt")
+# bootloader.ld.in since IDF 5.3, bootloader.ld before
+BOOTLOADER_LD_DIR = os.path.join(BOOTLOADER_MAIN_DIR, "ld", "esp32")
+BOOTLOADER_LD_NAMES = ("bootloader.ld.in", "bootloader.ld")
 
+CUSTOM_BOOTLOADER_DIR = os.path.join(env.get("PROJECT_DIR"), "bootloader")
+# Headers in include/ are shared between the bootloader and the application
+# (e.g. the RTC memory layout), so they are copied alongside the bootloader sources.
+SHARED_INCLUDE_DIR = os.path.join(env.get("PROJECT_DIR"), "include")
+
+sys.path.insert(0, os.path.join(env.get("PROJECT_DIR"), "tools"))
+import betterota_log  # noqa: E402
+
+# Dictionary of the tokenized log lines (CONFIG_BETTEROTA_TOKENIZED_LOG), read by the
+# betterota_log monitor filter
+LOG_DICT = os.path.join(env.subst("$BUILD_DIR"), "betterota_log_dict.json")
+
+BACKUP_SUFFIX = ".bak"
+# Written next to the bootloader sources to remember which files we added, so
+# they can be removed again even if the build was interrupted.
+ADDED_FILES_LIST = os.path.join(BOOTLOADER_MAIN_DIR, "betterota_added_files.txt")
+
+# Sources whose code runs once the app image started loading. The bootloader's own text
+# (iram_seg, from 0x40080400) lies where the app's IRAM segments go, so these are linked into
+# the loader segment (iram_loader_seg, 32 KB at 0x40078000) next to IDF's own loader code.
+# Code in any other source must not be called after the first segment is copied.
+LOADER_IRAM_SOURCES = (
+    "bootloader_start",
+    "boot_app_cpu",
+    "boot_clock",
+    "boot_fast_wake",
+    "boot_flash",
+    "boot_flash_mode",
+    "boot_handoff",
+    "boot_image",
+    "boot_log",
+    "boot_lz4",
+    "boot_merkle",
+    "boot_otadata",
+    "boot_sha",
+    "boot_timer",
+    "boot_verified",
+)
+
+
+def custom_files():
+    """
+    Returns (source path, destination path) pairs for every file that has to be
+    placed into the bootloader subproject.
+    """
+    files = []
+    for directory, extensions in ((CUSTOM_BOOTLOADER_DIR, (".c", ".h")), (SHARED_INCLUDE_DIR, (".h",))):
+        if not os.path.isdir(directory):
+            continue
+        for name in sorted(os.listdir(directory)):
+            if name.endswith(extensions):
+                files.append((os.path.join(directory, name), os.path.join(BOOTLOADER_MAIN_DIR, name)))
+    return files
+
+
+def backup(path):
+    if not os.path.exists(path + BACKUP_SUFFIX):
+        print(f"Backing up original file to: {path + BACKUP_SUFFIX}")
+        shutil.copy(path, path + BACKUP_SUFFIX)
+    else:
+        print(f"Backup of {path} already exists. Skipping backup.")
+
+
+def patch_component_sources(sources):
+    """
+    The bootloader's main component only lists bootloader_start.c, so add the
+    remaining custom sources to its SRCS.
+    """
+    with open(ORIGINAL_BOOTLOADER_CMAKE, "r") as f:
+        cmake = f.read()
+
+    extra = " ".join(f'"{name}"' for name in sources if name != "bootloader_start.c")
+    if not extra:
+        return
+
+    patched, count = re.subn(r'SRCS\s+"bootloader_start.c"', f'SRCS "bootloader_start.c" {extra}', cmake, count=1)
+    if count != 1:
+        print(f"ERROR: Could not find the SRCS list in: {ORIGINAL_BOOTLOADER_CMAKE}")
+        return
+
+    with open(ORIGINAL_BOOTLOADER_CMAKE, "w") as f:
+        f.write(patched)
+
+
+def bootloader_ld():
+    for name in BOOTLOADER_LD_NAMES:
+        path = os.path.join(BOOTLOADER_LD_DIR, name)
+        if os.path.exists(path):
+            return path
+    return None
+
+
+def patch_loader_iram():
+    """
+    Adds LOADER_IRAM_SOURCES to the .iram_loader.text output section of the bootloader's
+    linker script, right where it collects stray IRAM_ATTR functions.
+    """
+    path = bootloader_ld()
+    if path is None:
+        print(f"ERROR: Could not find the bootloader linker script in: {BOOTLOADER_LD_DIR}")
+        env.Exit(1)
+        return
+
+    backup(path)
+    with open(path, "r") as f:
+        script = f.read()
+
+    def add_sources(match):
+        indent = match.group(1)
+        return match.group(0) + "".join(
+            f"{indent}*libmain.a:{name}.*(.literal .text .literal.* .text.*)\n" for name in LOADER_IRAM_SOURCES
+        )
+
+    patched, count = re.subn(r"^([ \t]*)\*\(\.iram1 \.iram1\.\*\).*\n", add_sources, script, count=1, flags=re.MULTILINE)
+    if count != 1:
+        print(f"ERROR: Could not find the IRAM_ATTR input section in: {path}")
+        env.Exit(1)
+        return
+
+    with open(path, "w") as f:
+        f.write(patched)
 
-BACKUP_BOOTLOADER_SRC = ORIGINAL_BOOTLOADER_SRC + ".bak"
-CUSTOM_BOOTLOADER_SRC = os.path.join(env.get("PROJECT_DIR"), "bootloader", "bootloader_start.c")
 
 def backup_and_replace():
     """
-    Backs up the original bootloader file and replaces it with the custom one.
+    Backs up the original bootloader files and replaces them with the custom ones.
     This function is called immediately when the script is loaded by PlatformIO.
     """
     if not os.path.exists(ORIGINAL_BOOTLOADER_SRC):
         print(f"ERROR: Original bootloader source not found at: {ORIGINAL_BOOTLOADER_SRC}")
         return
 
-    # If a backup doesn't already exist, create one.
-    if not os.path.exists(BACKUP_BOOTLOADER_SRC):
-        print(f"Backing up original file to: {BACKUP_BOOTLOADER_SRC}")
-        shutil.copy(ORIGINAL_BOOTLOADER_SRC, BACKUP_BOOTLOADER_SRC)
-    else:
-        print("Backup file already exists. Skipping backup.")
+    # A previous build may have been interrupted; start again from the originals.
+    restore_original(None, None, env)
+
+    backup(ORIGINAL_BOOTLOADER_CMAKE)
+
+    added = []
+    sources = []
+    for src, dst in custom_files():
+        if os.path.exists(dst):
+            backup(dst)
+        else:
+            added.append(dst)
+        print(f"Replacing original bootloader with custom file: {src}")
+        shutil.copy(src, dst)
+        if dst.endswith(".c"):
+            sources.append(os.path.basename(dst))
 
-    # Copy our custom file over the original one.
-    print(f"Replacing original bootloader with custom file: {CUSTOM_BOOTLOADER_SRC}")
-    shutil.copy(CUSTOM_BOOTLOADER_SRC, ORIGINAL_BOOTLOADER_SRC)
+    with open(ADDED_FILES_LIST, "w") as f:
+        f.write("\n".join(added))
+
+    patch_component_sources(sources)
+    patch_loader_iram()
+    write_log_dictionary([src for src, _ in custom_files() if src.endswith(".c")])
     print("Replacement complete. Proceeding with build.")
 
+
+def write_log_dictionary(sources):
+    """
+    Writes the token dictionary of the log calls in the custom bootloader sources.
+    """
+    try:
+        os.makedirs(os.path.dirname(LOG_DICT), exist_ok=True)
+        betterota_log.write_dictionary(LOG_DICT, sources)
+    except (betterota_log.LogDictError, OSError) as e:
+        print(f"ERROR: Could not build the log dictionary: {e}")
+        env.Exit(1)
+
+
 def restore_original(source, target, env):
     """
     This function runs after the build is complete (on success or failure).
-    It restores the original bootloader file from the backup.
+    It restores the original bootloader files from the backups and removes the added ones.
     """
-    if os.path.exists(BACKUP_BOOTLOADER_SRC):
-        print(f"Restoring original bootloader file from: {BACKUP_BOOTLOADER_SRC}")
-        shutil.copy(BACKUP_BOOTLOADER_SRC, ORIGINAL_BOOTLOADER_SRC)
-        os.remove(BACKUP_BOOTLOADER_SRC)
-        print("Restore complete. Backup file removed.")
+    restored = False
+    for directory in (BOOTLOADER_MAIN_DIR, BOOTLOADER_LD_DIR):
+        if not os.path.isdir(directory):
+            continue
+        for name in os.listdir(directory):
+            if not name.endswith(BACKUP_SUFFIX):
+                continue
+            backup_path = os.path.join(directory, name)
+            original_path = backup_path[:-len(BACKUP_SUFFIX)]
+            print(f"Restoring original bootloader file from: {backup_path}")
+            shutil.copy(backup_path, original_path)
+            os.remove(backup_path)
+            restored = True
+
+    if os.path.exists(ADDED_FILES_LIST):
+        with open(ADDED_FILES_LIST, "r") as f:
+            for path in f.read().splitlines():
+                if path and os.path.exists(path):
+                    os.remove(path)
+        os.remove(ADDED_FILES_LIST)
+
+    if restored:
+        print("Restore complete. Backup files removed.")
     else:
         # This might happen if the pre-action failed
         print("No backup file found to restore.")
@@ -62,4 +232,4 @@ env.AddPostAction("upload", restore_original)
 
 # 3. Also register a pre-action for 'clean' to restore the original file
 #    just in case a previous build failed and didn't clean up properly.
-env.AddPreAction("clean", restore_original)
\ No newline at end of file
+env.AddPreAction("clean", restore_original)
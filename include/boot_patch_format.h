@@ -0,0 +1,62 @@
+/*
+ * Delta patches applied by the BetterOTA bootloader, shared with the application.
+ *
+ * Instead of a full image, the app downloads a patch made by tools/betterota_diff.py into
+ * the "patch" partition (data, BOOT_PATCH_PARTITION_SUBTYPE) and selects the target slot in
+ * otadata as for a regular update, with BOOT_PATCH_LABEL in the seq_label of the new entry.
+ * On the next boot the bootloader rebuilds the target image from the source slot and the
+ * patch, then boots it.
+ *
+ * The patch partition holds a boot_patch_header_t followed by the patch data: LZ4 blocks,
+ * framed as the RAM segments of packed images (see bootloader/boot_image.h), that
+ * decompress to a sequence of
+ *
+ *   uint32_t diff_len      Bytes of target that are source bytes plus a difference
+ *   uint32_t extra_len     Bytes of target taken from the patch as they are
+ *   int32_t seek           Move of the source position after the diff bytes
+ *   uint8_t diff[diff_len]
+ *   uint8_t extra[extra_len]
+ *
+ * starting at the beginning of the source image, as in bsdiff.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_rom_crc.h"
+
+#define BOOT_PATCH_MAGIC 0x48435042U    // "BPCH"
+// Subtype of the data partition holding the patch, found through the partition table
+#define BOOT_PATCH_PARTITION_SUBTYPE 0x40
+// Marks an otadata entry whose slot still has to be built from a patch
+#define BOOT_PATCH_LABEL "betterota-patch"
+
+// boot_patch_header_t.state, only ever advanced by clearing bits
+#define BOOT_PATCH_STATE_PENDING 0xFFFFFFFFU    // As written by the app
+#define BOOT_PATCH_STATE_APPLIED 0xFFFF0000U    // Target slot rebuilt and verified
+#define BOOT_PATCH_STATE_FAILED  0x00000000U    // Source or patch did not check out
+
+/**
+ * @brief Header at the start of the patch partition.
+ */
+typedef struct {
+    uint32_t magic;                 // BOOT_PATCH_MAGIC
+    uint32_t source_slot;           // OTA slot holding the image the patch applies to
+    uint32_t target_slot;           // OTA slot the new image is written to
+    uint32_t source_size;           // Length of the source image
+    uint8_t source_digest[32];      // SHA-256 of the source image
+    uint32_t target_size;           // Length of the new image, a multiple of 4
+    uint8_t target_digest[32];      // SHA-256 of the new image
+    uint32_t stream_len;            // Length of the decompressed patch data
+    uint32_t patch_len;             // Length of the stored patch data after the header
+    uint32_t crc;                   // CRC32 of all preceding fields
+    uint32_t state;                 // BOOT_PATCH_STATE_*
+} boot_patch_header_t;
+
+/**
+ * @brief Computes the CRC protecting a boot_patch_header_t.
+ */
+static inline uint32_t boot_patch_header_crc(const boot_patch_header_t *header)
+{
+    return esp_rom_crc32_le(UINT32_MAX, (const uint8_t *)header, offsetof(boot_patch_header_t, crc));
+}
@@ -0,0 +1,217 @@
+/*
+ * Layout of the RTC memory shared between the BetterOTA bootloader and the application.
+ *
+ * Everything lives in the custom part of the RTC retain memory
+ * (CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC), which survives resets and deep sleep
+ * but not a power loss. Each record carries its own CRC.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "sdkconfig.h"
+#include "esp_rom_crc.h"
+#include "bootloader_common.h"
+#include "esp_flash_partitions.h"
+#include "boot_stats.h"
+
+#define BOOT_WAKE_RECORD_MAGIC 0x4B415742U  // "BWAK"
+#define BOOT_PTABLE_CACHE_MAGIC 0x54504342U // "BCPT"
+#define BOOT_LOG_MAGIC 0x474F4C42U          // "BLOG"
+#define BOOT_TRIAL_MAGIC 0x4C525442U        // "BTRL"
+
+// Partition tables with more OTA slots than this are not cached
+#define BOOT_PTABLE_CACHE_SLOTS 4
+
+/**
+ * @brief The last app image the bootloader fully verified, for skipping verification on deep-sleep wake.
+ */
+typedef struct {
+    uint32_t magic;             // BOOT_WAKE_RECORD_MAGIC
+    uint32_t part_offset;       // Partition the image was loaded from
+    uint32_t part_size;
+    uint32_t digest_offset;     // Flash offset of the SHA-256 digest appended to the image
+    uint8_t digest[32];         // The digest itself
+    uint32_t flash_generation;  // boot_rtc_t.flash_generation at the time of verification
+    uint32_t crc;               // CRC32 of all preceding fields
+} boot_wake_record_t;
+
+/**
+ * @brief The app partitions of the partition table, as last parsed by the bootloader.
+ *
+ * The table ends with an MD5 entry; as long as that entry reads back the same, the
+ * table is unchanged and doesn't need to be read and checked again.
+ */
+typedef struct {
+    uint32_t magic;                 // BOOT_PTABLE_CACHE_MAGIC
+    uint32_t md5_offset;            // Flash offset of the MD5 entry of the table
+    uint8_t md5[16];                // MD5 of the table, as stored in that entry
+    uint32_t ptable_generation;     // boot_rtc_t.ptable_generation at the time of parsing
+    esp_partition_pos_t ota_info;
+    esp_partition_pos_t factory;
+    esp_partition_pos_t test;
+    esp_partition_pos_t ota[BOOT_PTABLE_CACHE_SLOTS];
+    uint32_t app_count;
+    uint32_t crc;                   // CRC32 of all preceding fields
+} boot_ptable_cache_t;
+
+/**
+ * @brief Trial boots of the image otadata selects, until the app confirms it (see boot_trial.h).
+ *
+ * otadata counts the trial boots as well, so they survive a power loss; this copy keeps
+ * counting if writing otadata fails.
+ */
+typedef struct {
+    uint32_t magic;                 // BOOT_TRIAL_MAGIC
+    uint32_t ota_seq;               // Sequence number of the otadata entry on trial
+    int32_t slot;                   // OTA slot of the image on trial
+    uint32_t boots;                 // Trial boots so far, this one included
+    uint32_t max_boots;             // CONFIG_BETTEROTA_TRIAL_BOOT_ATTEMPTS
+    uint32_t crc;                   // CRC32 of all preceding fields
+} boot_trial_record_t;
+
+/**
+ * @brief Computes the CRC protecting a boot_trial_record_t.
+ */
+static inline uint32_t boot_trial_record_crc(const boot_trial_record_t *record)
+{
+    return esp_rom_crc32_le(UINT32_MAX, (const uint8_t *)record, offsetof(boot_trial_record_t, crc));
+}
+
+#if CONFIG_BETTEROTA_DEFERRED_LOG
+/**
+ * @brief Log output of the bootloader, kept for the app to print (CONFIG_BETTEROTA_DEFERRED_LOG).
+ *
+ * A ring buffer of text: byte n of the output is at text[n % size]. The counters only grow, so
+ * the ring keeps the lines of earlier boots until they are overwritten or drained by the app.
+ * Written one character at a time, so it has no CRC; the counters are checked instead.
+ */
+typedef struct {
+    uint32_t magic;                 // BOOT_LOG_MAGIC
+    uint32_t size;                  // sizeof(text)
+    uint32_t written;               // Bytes ever written
+    uint32_t drained;               // Value of written when the app last drained the ring
+    char text[CONFIG_BETTEROTA_DEFERRED_LOG_SIZE];
+} boot_log_t;
+#endif
+
+/**
+ * @brief Contents of the custom RTC retain memory.
+ */
+typedef struct {
+    boot_stats_t stats;             // Statistics of the current boot
+    boot_wake_record_t wake;        // Last verified image
+    boot_ptable_cache_t ptable;     // Parsed partition table
+    boot_load_stats_t load;         // Segments of the current boot's image
+    boot_trial_record_t trial;      // Image on trial
+    uint32_t flash_generation;      // Bumped by the app whenever it writes an app partition or otadata
+    uint32_t ptable_generation;     // Bumped by the app whenever it writes the partition table
+#if CONFIG_BETTEROTA_DEFERRED_LOG
+    boot_log_t log;                 // Log output of the bootloader
+#endif
+} boot_rtc_t;
+
+_Static_assert(sizeof(boot_rtc_t) <= CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE,
+               "boot_rtc_t does not fit into CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE");
+
+/**
+ * @brief Returns the BetterOTA area of the RTC retain memory (not validated).
+ */
+static inline boot_rtc_t *boot_rtc(void)
+{
+    return (boot_rtc_t *)bootloader_common_get_rtc_retain_mem()->custom;
+}
+
+/**
+ * @brief Returns the statistics of the current boot, as left behind by the bootloader.
+ *
+ * @return const boot_stats_t* The statistics, or NULL if none are available.
+ */
+static inline const boot_stats_t *boot_stats_get(void)
+{
+    const boot_stats_t *stats = &boot_rtc()->stats;
+    if (stats->magic != BOOT_STATS_MAGIC || stats->version != BOOT_STATS_VERSION ||
+        stats->size != sizeof(boot_stats_t) || stats->crc != boot_stats_crc(stats)) {
+        return NULL;
+    }
+    return stats;
+}
+
+/**
+ * @brief Returns how the segments of the booted image were loaded, as left behind by the bootloader.
+ *
+ * @return const boot_load_stats_t* The statistics, or NULL if none are available.
+ */
+static inline const boot_load_stats_t *boot_load_stats_get(void)
+{
+    const boot_load_stats_t *stats = &boot_rtc()->load;
+    if (stats->magic != BOOT_LOAD_STATS_MAGIC || stats->segment_count > BOOT_LOAD_STATS_SEGMENTS ||
+        stats->crc != boot_load_stats_crc(stats)) {
+        return NULL;
+    }
+    return stats;
+}
+
+/**
+ * @brief Tells the bootloader that the app has written to an app partition or to otadata.
+ *
+ * Must be called before every such write (e.g. before esp_ota_begin()), so the next
+ * wake from deep sleep verifies the image again instead of trusting the last verification.
+ */
+static inline void boot_rtc_note_flash_write(void)
+{
+    boot_rtc()->flash_generation++;
+}
+
+/**
+ * @brief Tells the bootloader that the app has written to the partition table region.
+ *
+ * Must be called before such a write, so the next boot parses the table again.
+ */
+static inline void boot_rtc_note_partition_table_write(void)
+{
+    boot_rtc()->ptable_generation++;
+}
+
+#if CONFIG_BETTEROTA_DEFERRED_LOG
+/**
+ * @brief Returns whether the log ring holds consistent counters, i.e. survived since it was set up.
+ */
+static inline bool boot_log_valid(const boot_log_t *log)
+{
+    return log->magic == BOOT_LOG_MAGIC && log->size == sizeof(log->text) &&
+           (int32_t)(log->written - log->drained) >= 0;
+}
+
+/**
+ * @brief Hands the bootloader log output the app hasn't printed yet to @p emit, oldest first.
+ *
+ * Call once early in the app, e.g. with a function that writes the text to stdout. The output
+ * of every boot since the last call is included, also of boots that never reached an app.
+ *
+ * @param emit Called with up to two spans of the ring, in order
+ * @return uint32_t Number of bytes that were overwritten before they could be drained
+ */
+static inline uint32_t boot_log_drain(void (*emit)(const char *text, size_t len))
+{
+    boot_log_t *log = &boot_rtc()->log;
+    if (!boot_log_valid(log)) {
+        return 0;
+    }
+
+    uint32_t pending = log->written - log->drained;
+    const uint32_t lost = pending > log->size ? pending - log->size : 0;
+    pending -= lost;
+    const uint32_t start = (log->written - pending) % log->size;
+    const uint32_t first = pending < log->size - start ? pending : log->size - start;
+    if (first > 0) {
+        emit(&log->text[start], first);
+    }
+    if (pending > first) {
+        emit(log->text, pending - first);
+    }
+    log->drained = log->written;
+    return lost;
+}
+#endif
@@ -0,0 +1,159 @@
+/*
+ * Boot statistics shared between the BetterOTA bootloader and the application.
+ *
+ * The bootloader fills in a boot_stats_t and places it in RTC memory (see boot_rtc.h)
+ * right before handing over to the app, which can then read it back with boot_stats_get().
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_rom_crc.h"
+
+#define BOOT_STATS_MAGIC   0x4F544142U   // "BATO"
+#define BOOT_STATS_VERSION 7
+#define BOOT_LOAD_STATS_MAGIC 0x44414C42U   // "BLAD"
+
+// Segments recorded in boot_load_stats_t, as many as an image can have (ESP_IMAGE_MAX_SEGMENTS)
+#define BOOT_LOAD_STATS_SEGMENTS 16
+
+// boot_stats_t.flags
+#define BOOT_STATS_FLAG_FAST_WAKE   (1U << 0)   // Woke from deep sleep and skipped the image verification
+#define BOOT_STATS_FLAG_PATCHED     (1U << 1)   // Rebuilt the selected OTA slot from a delta patch
+#define BOOT_STATS_FLAG_LAZY_VERIFY (1U << 2)   // Verified the RAM segments only, the app verifies the rest
+#define BOOT_STATS_FLAG_CLOCK_BOOST (1U << 3)   // Raised the CPU clock to patch and load, see bootloader/boot_clock.h
+#define BOOT_STATS_FLAG_VERIFIED    (1U << 4)   // Skipped the verification of an image verified on an earlier boot
+#define BOOT_STATS_FLAG_TRIAL       (1U << 5)   // Trial boot of a new image, see boot_trial.h
+#define BOOT_STATS_FLAG_ROLLED_BACK (1U << 6)   // A new image used up its trial boots, otadata went back to the previous one
+
+/**
+ * @brief Why the bootloader chose the slot it tried first, see boot_stats_t.select_reason.
+ */
+typedef enum {
+    BOOT_SELECT_DEFAULT = 0,        // No valid otadata, the default slot OTA_1
+    BOOT_SELECT_OTADATA,            // The slot otadata selects
+    BOOT_SELECT_BUTTON,             // The button forced OTA_0
+    BOOT_SELECT_BLANK_SLOT,         // The slot chosen by any of the above held no image, the other one was taken
+    BOOT_SELECT_ROLLBACK,           // The slot otadata selected was rolled back, the one it selects now was taken
+} boot_select_reason_t;
+
+/**
+ * @brief Boot phases timed by the bootloader, in execution order.
+ */
+typedef enum {
+    BOOT_PHASE_INIT = 0,            // bootloader_init()
+    BOOT_PHASE_PARTITION_TABLE,     // boot_ptable_load(), from its RTC cache when the table is unchanged
+    BOOT_PHASE_PATCH,               // boot_patch_apply_pending()
+    BOOT_PHASE_SELECT,              // choose_ota_partition()
+    BOOT_PHASE_LOAD,                // loading the app image, up to the jump
+    BOOT_PHASE_MAX,
+} boot_phase_t;
+
+/**
+ * @brief Timing record of a single boot.
+ *
+ * All timestamps are in microseconds since the bootloader entry point
+ * (call_start_cpu0); a phase that has not completed has a timestamp of 0.
+ */
+typedef struct {
+    uint32_t magic;                         // BOOT_STATS_MAGIC
+    uint16_t version;                       // BOOT_STATS_VERSION
+    uint16_t size;                          // sizeof(boot_stats_t)
+    uint32_t rom_us;                        // Time spent in ROM code before call_start_cpu0
+    uint32_t phase_end_us[BOOT_PHASE_MAX];  // End timestamp of each phase
+    int32_t boot_index;                     // Partition index that was booted
+    uint32_t load_attempts;                 // Number of images tried, including the booted one
+    uint32_t flags;                         // BOOT_STATS_FLAG_*
+    uint32_t read_hits;                     // Parser reads served from the read-ahead windows
+    uint32_t read_misses;                   // Parser reads that went to flash
+    uint32_t flash_id;                      // JEDEC ID of the flash chip, 0 if not probed
+    uint8_t flash_mode;                     // SPI read mode of the image load, esp_image_spi_mode_t
+    uint8_t flash_mhz;                      // SPI clock of the image load
+    uint8_t select_reason;                  // boot_select_reason_t
+    uint8_t reserved;
+    uint32_t crc;                           // CRC32 of all preceding fields
+} boot_stats_t;
+
+/**
+ * @brief Computes the CRC protecting a boot_stats_t.
+ */
+static inline uint32_t boot_stats_crc(const boot_stats_t *stats)
+{
+    return esp_rom_crc32_le(UINT32_MAX, (const uint8_t *)stats, offsetof(boot_stats_t, crc));
+}
+
+/**
+ * @brief Returns the duration of a phase in microseconds.
+ */
+static inline uint32_t boot_stats_phase_us(const boot_stats_t *stats, boot_phase_t phase)
+{
+    if (stats->phase_end_us[phase] == 0) {
+        return 0;
+    }
+    return stats->phase_end_us[phase] - (phase == 0 ? 0 : stats->phase_end_us[phase - 1]);
+}
+
+/**
+ * @brief Where an image segment goes, by its load address.
+ */
+typedef enum {
+    BOOT_REGION_PADDING = 0,        // Fills the gaps between flash-mapped segments, never loaded
+    BOOT_REGION_FLASH,              // IROM/DROM, mapped by the MMU instead of copied
+    BOOT_REGION_IRAM,
+    BOOT_REGION_DRAM,
+    BOOT_REGION_RTC,
+    BOOT_REGION_MAX,
+} boot_region_t;
+
+// boot_segment_stats_t.flags
+#define BOOT_SEGMENT_FLAG_LZ4       (1U << 0)   // Stored as LZ4 blocks, see bootloader/boot_image.h
+#define BOOT_SEGMENT_FLAG_INDEXED   (1U << 1)   // Header taken from the image's segment index
+
+/**
+ * @brief How a single segment of the booted image was loaded.
+ *
+ * Flash-mapped segments are only read to be verified; a load without verification
+ * (see BOOT_STATS_FLAG_FAST_WAKE) doesn't read them at all.
+ */
+typedef struct {
+    uint32_t load_addr;
+    uint32_t flash_len;     // Bytes read from flash
+    uint32_t load_len;      // Bytes written to RAM, after decompression
+    uint32_t read_us;       // Time spent reading flash
+    uint32_t verify_us;     // Time spent on the SHA-256 digest and the checksum
+    uint32_t copy_us;       // Time spent decompressing and copying to RAM
+    uint8_t region;         // boot_region_t
+    uint8_t flags;          // BOOT_SEGMENT_FLAG_*
+    uint16_t reserved;
+} boot_segment_stats_t;
+
+/**
+ * @brief Per-segment record of loading the booted image.
+ */
+typedef struct {
+    uint32_t magic;                         // BOOT_LOAD_STATS_MAGIC
+    uint32_t part_offset;                   // Partition the image was loaded from
+    uint32_t total_us;                      // Time of the whole load, including the header and digest
+    uint32_t segment_count;
+    boot_segment_stats_t segments[BOOT_LOAD_STATS_SEGMENTS];
+    uint32_t app_cpu_us;                    // Time the APP CPU spent hashing, 0 without it
+    uint32_t app_cpu_wait_us;               // Time CPU0 waited for the APP CPU, part of the segments' verify_us
+    uint32_t crc;                           // CRC32 of all preceding fields
+} boot_load_stats_t;
+
+/**
+ * @brief Computes the CRC protecting a boot_load_stats_t.
+ */
+static inline uint32_t boot_load_stats_crc(const boot_load_stats_t *stats)
+{
+    return esp_rom_crc32_le(UINT32_MAX, (const uint8_t *)stats, offsetof(boot_load_stats_t, crc));
+}
+
+/**
+ * @brief Returns a throughput in tenths of MB/s (bytes per microsecond), 0 if nothing was timed.
+ */
+static inline uint32_t boot_stats_rate_x10(uint32_t bytes, uint32_t us)
+{
+    return us == 0 ? 0 : (uint32_t)((uint64_t)bytes * 10 / us);
+}
@@ -0,0 +1,49 @@
+/*
+ * Confirmation of a new image by the app, after its trial boots.
+ *
+ * With CONFIG_BETTEROTA_TRIAL_BOOT, the bootloader boots an image newly selected with
+ * esp_ota_set_boot_partition() up to CONFIG_BETTEROTA_TRIAL_BOOT_ATTEMPTS times, setting
+ * BOOT_STATS_FLAG_TRIAL. Once the app knows the image works, e.g. after reaching its server,
+ * it calls boot_trial_confirm(). If it doesn't within those boots, say because the image
+ * crashes or hangs into the watchdog, the bootloader goes back to the previous slot and sets
+ * BOOT_STATS_FLAG_ROLLED_BACK.
+ *
+ * Every boot counts, wakes from deep sleep included: confirm before going to sleep.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include "esp_err.h"
+#include "boot_rtc.h"
+
+/**
+ * @brief Returns the trial boot record of the running image, NULL if it isn't on trial.
+ */
+static inline const boot_trial_record_t *boot_trial_get(void)
+{
+    const boot_stats_t *stats = boot_stats_get();
+    const boot_trial_record_t *record = &boot_rtc()->trial;
+    if (stats == NULL || !(stats->flags & BOOT_STATS_FLAG_TRIAL) || record->magic != BOOT_TRIAL_MAGIC ||
+        record->crc != boot_trial_record_crc(record) || record->slot != stats->boot_index) {
+        return NULL;
+    }
+    return record;
+}
+
+/**
+ * @brief Returns whether the running image is on trial and waits for boot_trial_confirm().
+ */
+static inline bool boot_trial_pending(void)
+{
+    return boot_trial_get() != NULL;
+}
+
+/**
+ * @brief Confirms the running image, ending its trial.
+ *
+ * Marks its otadata entry ESP_OTA_IMG_VALID, as esp_ota_mark_app_valid_cancel_rollback() does.
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_STATE if the image isn't on trial, or the error of
+ *         writing otadata.
+ */
+esp_err_t boot_trial_confirm(void);
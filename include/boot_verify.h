@@ -0,0 +1,41 @@
+/*
+ * Verification of the running image by the app, when the bootloader left part of it to the app.
+ *
+ * With CONFIG_BETTEROTA_LAZY_VERIFY the bootloader only checks the header and RAM segments of
+ * images that carry a digest of them (see bootloader/boot_image.h), and sets
+ * BOOT_STATS_FLAG_LAZY_VERIFY. The flash-mapped segments run unverified until the app has
+ * checked the whole image.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include "esp_err.h"
+#include "boot_rtc.h"
+
+/**
+ * @brief Called with the outcome of the verification, from the verification task.
+ */
+typedef void (*boot_verify_done_t)(esp_err_t result);
+
+/**
+ * @brief Returns whether the bootloader left the verification of the running image to the app.
+ */
+static inline bool boot_verify_pending(void)
+{
+    const boot_stats_t *stats = boot_stats_get();
+    return stats != NULL && (stats->flags & BOOT_STATS_FLAG_LAZY_VERIFY);
+}
+
+/**
+ * @brief Verifies the whole running image in a low-priority background task.
+ *
+ * The checksum and the appended SHA-256 digest are checked as esp_image_verify() does. When
+ * they don't match and @p fall_back is set, otadata is switched to the next OTA slot, if that
+ * one holds a valid image, and the chip restarts.
+ *
+ * @param fall_back Whether to boot the other OTA slot when the image is corrupt
+ * @param done Called with the result before falling back, may be NULL
+ * @return ESP_OK if the task was started, ESP_ERR_INVALID_STATE if there is nothing to verify,
+ *         ESP_ERR_NO_MEM if the task could not be created.
+ */
+esp_err_t boot_verify_start(bool fall_back, boot_verify_done_t done);
@@ -0,0 +1,52 @@
+"""
+PlatformIO monitor filter that decodes the BetterOTA bootloader's tokenized log lines
+(CONFIG_BETTEROTA_TOKENIZED_LOG) with the dictionary written by the build, see
+tools/betterota_log.py. All other output passes through unchanged.
+
+Enable with "monitor_filters = betterota_log" in platformio.ini.
+"""
+import os
+import sys
+
+from platformio.public import DeviceMonitorFilterBase
+
+DICT_NAME = "betterota_log_dict.json"
+
+
+class BetterOtaLog(DeviceMonitorFilterBase):
+    NAME = "betterota_log"
+
+    def __call__(self):
+        sys.path.insert(0, os.path.join(self.project_dir, "tools"))
+        import betterota_log
+
+        self.betterota_log = betterota_log
+        self.buffer = ""
+        self.tokens = None
+        try:
+            build_dir = self.config.get("platformio", "build_dir")
+        except Exception:
+            build_dir = os.path.join(self.project_dir, ".pio", "build")
+        path = os.path.join(build_dir, self.environment, DICT_NAME)
+        if os.path.isfile(path):
+            try:
+                self.tokens = betterota_log.load_dictionary(path)
+            except (betterota_log.LogDictError, ValueError) as e:
+                sys.stderr.write(f"betterota_log: {e}\n")
+        return self
+
+    def rx(self, text):
+        if self.tokens is None:
+            return text
+        # Frames are decoded by the line; only a line that may still turn into one is held back
+        self.buffer += text
+        lines = self.buffer.split("\n")
+        self.buffer = lines.pop()
+        out = "".join(self.betterota_log.decode_line(self.tokens, line + "\n") for line in lines)
+        if "$" not in self.buffer:
+            out += self.buffer
+            self.buffer = ""
+        return out
+
+    def tx(self, text):
+        return text
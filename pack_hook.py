@@ -0,0 +1,43 @@
+import os
+import shutil
+import sys
+from SCons.Script import DefaultEnvironment
+
+env = DefaultEnvironment()
+
+# --- Configuration ---
+# Set `custom_betterota_compress = yes` in platformio.ini to pack the app image
+# with LZ4-compressed RAM segments (see tools/betterota_pack.py).
+# Set `custom_betterota_lazy_verify = yes` to append the digest of the RAM segments, which the
+# bootloader checks instead of the whole image with CONFIG_BETTEROTA_LAZY_VERIFY.
+COMPRESS = env.GetProjectOption("custom_betterota_compress", "no").lower() in ("yes", "true", "1")
+RAM_DIGEST = env.GetProjectOption("custom_betterota_lazy_verify", "no").lower() in ("yes", "true", "1")
+# Set `custom_betterota_merkle = yes` to append a Merkle tree of the image's 4 KiB blocks, for
+# CONFIG_BETTEROTA_MERKLE.
+MERKLE = env.GetProjectOption("custom_betterota_merkle", "no").lower() in ("yes", "true", "1")
+# Set `custom_betterota_segment_index = yes` to append an index of the segments, from which the
+# bootloader takes all segment headers in one read with CONFIG_BETTEROTA_SEGMENT_INDEX.
+SEGMENT_INDEX = env.GetProjectOption("custom_betterota_segment_index", "no").lower() in ("yes", "true", "1")
+
+sys.path.insert(0, os.path.join(env.get("PROJECT_DIR"), "tools"))
+import betterota_pack  # noqa: E402
+
+
+def pack_firmware(source, target, env):
+    """
+    Runs after the app image has been generated and packs it in place, so upload and
+    OTA both use the packed image. The plain image is kept next to it as *.raw.bin.
+    """
+    path = target[0].get_abspath()
+    raw_path = os.path.splitext(path)[0] + ".raw.bin"
+    shutil.copy(path, raw_path)
+    try:
+        betterota_pack.pack_file(raw_path, path, COMPRESS, RAM_DIGEST, MERKLE, SEGMENT_INDEX)
+    except betterota_pack.PackError as e:
+        print(f"ERROR: Could not pack {path}: {e}")
+        env.Exit(1)
+
+# --- SCRIPT EXECUTION ---
+
+if COMPRESS or RAM_DIGEST or MERKLE or SEGMENT_INDEX:
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.bin", pack_firmware)
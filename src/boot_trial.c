@@ -0,0 +1,29 @@
+/*
+ * Confirmation of a new image after its trial boots, see boot_trial.h.
+ */
+#include <string.h>
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "boot_trial.h"
+
+static const char *TAG = "BetterOTA";
+
+esp_err_t boot_trial_confirm(void)
+{
+    const boot_trial_record_t *record = boot_trial_get();
+    if (record == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    const uint32_t boots = record->boots;
+
+    // Rewrites the otadata entry
+    boot_rtc_note_flash_write();
+    const esp_err_t err = esp_ota_mark_app_valid_cancel_rollback();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Can't confirm the running image (err=0x%x)", err);
+        return err;
+    }
+    memset(&boot_rtc()->trial, 0, sizeof(boot_trial_record_t));
+    ESP_LOGI(TAG, "Confirmed the running image after %lu trial boots", (unsigned long)boots);
+    return ESP_OK;
+}
@@ -0,0 +1,75 @@
+/*
+ * Background verification of the running image, see boot_verify.h.
+ */
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_image_format.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "boot_verify.h"
+
+static const char *TAG = "BetterOTA";
+
+#define VERIFY_TASK_STACK_SIZE 4096
+// Just above idle, so the hashing only takes time the app doesn't use
+#define VERIFY_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+
+static bool s_fall_back;
+static boot_verify_done_t s_done;
+
+static void fall_back_to_next_slot(const esp_partition_t *running)
+{
+    const esp_partition_t *next = esp_ota_get_next_update_partition(running);
+    if (next == NULL) {
+        ESP_LOGE(TAG, "No other OTA slot to fall back to");
+        return;
+    }
+    // Verifies the image in the next slot and refuses to select an invalid one
+    boot_rtc_note_flash_write();
+    const esp_err_t err = esp_ota_set_boot_partition(next);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Can't fall back to %s (err=0x%x)", next->label, err);
+        return;
+    }
+    ESP_LOGE(TAG, "Falling back to %s", next->label);
+    esp_restart();
+}
+
+static void verify_task(void *arg)
+{
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    const esp_partition_pos_t pos = { .offset = running->address, .size = running->size };
+    esp_image_metadata_t data;
+
+    const int64_t start_us = esp_timer_get_time();
+    const esp_err_t err = esp_image_verify(ESP_IMAGE_VERIFY, &pos, &data);
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Image in %s verified in %lld us", running->label, (long long)(esp_timer_get_time() - start_us));
+    } else {
+        ESP_LOGE(TAG, "Image in %s failed verification (err=0x%x)", running->label, err);
+    }
+
+    if (s_done != NULL) {
+        s_done(err);
+    }
+    if (err != ESP_OK && s_fall_back) {
+        fall_back_to_next_slot(running);
+    }
+    vTaskDelete(NULL);
+}
+
+esp_err_t boot_verify_start(bool fall_back, boot_verify_done_t done)
+{
+    if (!boot_verify_pending()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_fall_back = fall_back;
+    s_done = done;
+    if (xTaskCreate(verify_task, "boot_verify", VERIFY_TASK_STACK_SIZE, NULL, VERIFY_TASK_PRIORITY, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
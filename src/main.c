@@ -1,5 +1,124 @@
 #include <stdio.h>
+#include "esp_image_format.h"
+#include "boot_rtc.h"
+#include "boot_verify.h"
+#include "boot_trial.h"
+
+#if CONFIG_BETTEROTA_DEFERRED_LOG
+static void print_log_text(const char *text, size_t len)
+{
+    fwrite(text, 1, len, stdout);
+}
+
+/**
+ * @brief Prints the log lines the bootloader kept in RTC memory instead of sending them to the UART.
+ */
+static void report_boot_log(void)
+{
+    printf("Bootloader log:\n");
+    const uint32_t lost = boot_log_drain(print_log_text);
+    if (lost > 0) {
+        printf("(%lu earlier bytes of the bootloader log were overwritten)\n", (unsigned long)lost);
+    }
+}
+#endif
+
+/**
+ * @brief Prints the boot timing left behind by the bootloader.
+ */
+static void report_boot_stats(void)
+{
+    const boot_stats_t *stats = boot_stats_get();
+    if (stats == NULL) {
+        printf("No boot statistics available from the bootloader\n");
+        return;
+    }
+
+    static const char *const SELECT_REASONS[] = { "no otadata", "otadata", "button", "other slot blank", "rollback" };
+    printf("Boot partition index: %ld (after %lu load attempts)\n",
+           (long)stats->boot_index, (unsigned long)stats->load_attempts);
+    printf("Slot chosen by: %s\n", stats->select_reason < sizeof(SELECT_REASONS) / sizeof(SELECT_REASONS[0]) ?
+           SELECT_REASONS[stats->select_reason] : "?");
+    printf("Boot timing (us): rom=%lu init=%lu ptable=%lu patch=%lu select=%lu load=%lu\n",
+           (unsigned long)stats->rom_us,
+           (unsigned long)boot_stats_phase_us(stats, BOOT_PHASE_INIT),
+           (unsigned long)boot_stats_phase_us(stats, BOOT_PHASE_PARTITION_TABLE),
+           (unsigned long)boot_stats_phase_us(stats, BOOT_PHASE_PATCH),
+           (unsigned long)boot_stats_phase_us(stats, BOOT_PHASE_SELECT),
+           (unsigned long)boot_stats_phase_us(stats, BOOT_PHASE_LOAD));
+    if (stats->flags & BOOT_STATS_FLAG_FAST_WAKE) {
+        printf("Woke from deep sleep, image verification was skipped\n");
+    }
+    if (stats->flags & BOOT_STATS_FLAG_VERIFIED) {
+        printf("The image was verified on an earlier boot, its verification was skipped\n");
+    }
+    if (stats->flags & BOOT_STATS_FLAG_ROLLED_BACK) {
+        printf("A new image wasn't confirmed in its trial boots, the bootloader rolled back to this one\n");
+    }
+    if (stats->flags & BOOT_STATS_FLAG_PATCHED) {
+        printf("The booted slot was rebuilt from a delta patch\n");
+    }
+    if (stats->flags & BOOT_STATS_FLAG_CLOCK_BOOST) {
+        printf("The bootloader raised the CPU clock to load this app\n");
+    }
+    printf("Bootloader parser reads: %lu from read-ahead, %lu from flash\n",
+           (unsigned long)stats->read_hits, (unsigned long)stats->read_misses);
+    printf("Bootloader loaded the app from flash %06lx in %s at %u MHz\n", (unsigned long)stats->flash_id,
+           stats->flash_mode == ESP_IMAGE_SPI_MODE_QIO ? "QIO" : "DIO", (unsigned)stats->flash_mhz);
+}
+
+/**
+ * @brief Prints how each segment of this app was loaded, with the flash throughput.
+ */
+static void report_load_stats(void)
+{
+    static const char *const REGION_NAMES[BOOT_REGION_MAX] = { "pad", "flash", "iram", "dram", "rtc" };
+    const boot_load_stats_t *stats = boot_load_stats_get();
+    if (stats == NULL) {
+        printf("No load statistics available from the bootloader\n");
+        return;
+    }
+
+    printf("Image load (%lu us total):\n", (unsigned long)stats->total_us);
+    for (uint32_t i = 0; i < stats->segment_count; i++) {
+        const boot_segment_stats_t *seg = &stats->segments[i];
+        const uint32_t rate = boot_stats_rate_x10(seg->flash_len, seg->read_us);
+        printf("  %2lu %-5s 0x%08lx %7lu B read in %6lu us (%lu.%lu MB/s), verify %6lu us, copy %6lu us%s\n",
+               (unsigned long)i, seg->region < BOOT_REGION_MAX ? REGION_NAMES[seg->region] : "?",
+               (unsigned long)seg->load_addr, (unsigned long)seg->flash_len, (unsigned long)seg->read_us,
+               (unsigned long)(rate / 10), (unsigned long)(rate % 10), (unsigned long)seg->verify_us,
+               (unsigned long)seg->copy_us, (seg->flags & BOOT_SEGMENT_FLAG_LZ4) ? " (lz4)" : "");
+    }
+    if (stats->app_cpu_us > 0) {
+        printf("  APP CPU hashing %lu us, waited for %lu us\n",
+               (unsigned long)stats->app_cpu_us, (unsigned long)stats->app_cpu_wait_us);
+    }
+}
+
+/**
+ * @brief Prints the outcome of the background verification of a lazily verified image.
+ */
+static void report_verify_result(esp_err_t result)
+{
+    printf("Background verification of the image: %s\n", result == ESP_OK ? "passed" : "FAILED");
+}
 
 void app_main(void) {
     printf("Hello from the main application!\n");
-}
\ No newline at end of file
+#if CONFIG_BETTEROTA_DEFERRED_LOG
+    report_boot_log();
+#endif
+    report_boot_stats();
+    report_load_stats();
+    if (boot_trial_pending()) {
+        // A real app confirms only once it knows it works, e.g. after reaching its server
+        const boot_trial_record_t *trial = boot_trial_get();
+        printf("Trial boot %lu of %lu of this image, confirming it\n",
+               (unsigned long)trial->boots, (unsigned long)trial->max_boots);
+        boot_trial_confirm();
+    }
+    if (boot_verify_pending()) {
+        printf("The bootloader verified the RAM segments only, checking the rest in the background\n");
+        boot_verify_start(true, report_verify_result);
+    }
+}
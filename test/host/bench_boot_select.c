@@ -0,0 +1,68 @@
+/*
+ * Micro-benchmark of the boot partition decision over many simulated boots.
+ *
+ * Reports both the host time per decision and the simulated on-target time,
+ * i.e. the share of the boot budget spent deciding.
+ *
+ * Usage: bench_boot_select [boots]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "esp_log.h"
+#include "mock_hw.h"
+#include "mock_flash.h"
+#include "fixtures.h"
+#include "boot_otadata.h"
+#include "boot_select.h"
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+    const unsigned long boots = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000000UL;
+    const bootloader_state_t bs = fixture_state();
+
+    mock_hw_reset();
+    mock_flash_reset();
+    fixture_put_otadata(0, 2, ESP_OTA_IMG_VALID);
+    mock_log_enable(false);
+
+    // xorshift32, so the button pattern is not trivially predictable
+    uint32_t rng = 0x12345678U;
+    unsigned long selected[2] = {0};
+    uint64_t simulated_us = 0;
+    uint32_t simulated_max_us = 0;
+
+    const uint64_t start = now_ns();
+    for (unsigned long i = 0; i < boots; i++) {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        mock_button_set(rng & 1);
+        // Every boot starts without the cached otadata
+        boot_otadata_invalidate();
+
+        const uint32_t start_us = mock_time_us();
+        selected[choose_ota_partition(&bs) & 1]++;
+        const uint32_t decision_us = mock_time_us() - start_us;
+
+        simulated_us += decision_us;
+        if (decision_us > simulated_max_us) {
+            simulated_max_us = decision_us;
+        }
+    }
+    const uint64_t elapsed = now_ns() - start;
+
+    printf("boots=%lu total=%.3f ms per_decision=%.2f ns ota_0=%lu ota_1=%lu\n",
+           boots, elapsed / 1e6, boots ? (double)elapsed / boots : 0.0, selected[0], selected[1]);
+    printf("simulated decision time: mean=%.1f us max=%lu us\n",
+           boots ? (double)simulated_us / boots : 0.0, (unsigned long)simulated_max_us);
+    return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * Boots a flash dump on the host: partition table, otadata, slot choice and image load run as
+ * in the bootloader, and the jump to the app is reported instead of taken (see mock_boot.h).
+ *
+ * The dump is a whole 4 MB chip laid out per partitions.csv, e.g. read from a device with
+ * "esptool.py read_flash 0 0x400000 dump.bin". Writes of the bootloader (e.g. applying a
+ * patch) only go back to the file with --write-back.
+ *
+ * Usage: emulate_boot [options] FLASH_DUMP
+ *   --boots N          Boot N times in a row, keeping the RTC memory between boots (default 1)
+ *   --deep-sleep       Boots after the first one are wakes from deep sleep
+ *   --button           Hold the boot button
+ *   --flash-speed N    Flash throughput in bytes/us for the simulated time (default 10, DIO 40 MHz)
+ *   --sha-cycles N     CPU cycles the SHA accelerator takes per 64 byte block (default 0)
+ *   --single-core      Boot as a single-core chip, without the APP CPU
+ *   --expect-slot N    Fail unless every boot starts OTA slot N (-1: unless every boot resets)
+ *   --write-back       Write flash changes back to FLASH_DUMP
+ *   --verbose          Print the bootloader log, including what it left in RTC memory for the app
+ *   --log FILE         Write the bootloader log to FILE instead of printing it
+ */
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "esp_log.h"
+#include "mock_boot.h"
+#include "mock_hw.h"
+#include "mock_flash.h"
+#include "boot_rtc.h"
+
+#define DEFAULT_FLASH_BYTES_PER_US 10
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static FILE *s_log = NULL;
+
+#if CONFIG_BETTEROTA_DEFERRED_LOG
+static void print_log_text(const char *text, size_t len)
+{
+    fwrite(text, 1, len, s_log != NULL ? s_log : stdout);
+}
+#endif
+
+static int usage(void)
+{
+    fprintf(stderr, "Usage: emulate_boot [--boots N] [--deep-sleep] [--button] [--flash-speed N] "
+            "[--sha-cycles N] [--single-core] [--expect-slot N] [--write-back] [--verbose] [--log FILE] FLASH_DUMP\n");
+    return 2;
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        { "boots", required_argument, NULL, 'n' },
+        { "deep-sleep", no_argument, NULL, 'd' },
+        { "button", no_argument, NULL, 'b' },
+        { "flash-speed", required_argument, NULL, 's' },
+        { "sha-cycles", required_argument, NULL, 'c' },
+        { "single-core", no_argument, NULL, '1' },
+        { "expect-slot", required_argument, NULL, 'e' },
+        { "write-back", no_argument, NULL, 'w' },
+        { "verbose", no_argument, NULL, 'v' },
+        { "log", required_argument, NULL, 'l' },
+        { NULL, 0, NULL, 0 },
+    };
+    unsigned long boots = 1;
+    bool deep_sleep = false, button = false, write_back = false, verbose = false, expect = false;
+    bool single_core = false;
+    unsigned long flash_speed = DEFAULT_FLASH_BYTES_PER_US;
+    unsigned long sha_cycles = 0;
+    int expected_slot = 0;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", options, NULL)) != -1) {
+        switch (opt) {
+        case 'n': boots = strtoul(optarg, NULL, 0); break;
+        case 'd': deep_sleep = true; break;
+        case 'b': button = true; break;
+        case 's': flash_speed = strtoul(optarg, NULL, 0); break;
+        case 'c': sha_cycles = strtoul(optarg, NULL, 0); break;
+        case '1': single_core = true; break;
+        case 'e': expect = true; expected_slot = atoi(optarg); break;
+        case 'w': write_back = true; break;
+        case 'v': verbose = true; break;
+        case 'l':
+            s_log = fopen(optarg, "w");
+            if (s_log == NULL) {
+                perror(optarg);
+                return 1;
+            }
+            verbose = true;
+            break;
+        default: return usage();
+        }
+    }
+    if (optind != argc - 1 || boots == 0) {
+        return usage();
+    }
+
+    mock_log_enable(verbose);
+    mock_uart_set_output(s_log);
+    mock_rtc_power_loss();
+    if (!mock_flash_map_file(argv[optind], write_back)) {
+        return 1;
+    }
+    mock_flash_set_read_speed(flash_speed);
+
+    int failures = 0;
+    uint64_t host_ns = 0;
+    for (unsigned long i = 1; i <= boots; i++) {
+        mock_hw_reset();
+        mock_button_set(button);
+        mock_sha_set_block_cycles(sha_cycles);
+        mock_app_cpu_set_present(!single_core);
+        if (deep_sleep && i > 1) {
+            mock_reset_reason_set(RESET_REASON_CORE_DEEP_SLEEP);
+        }
+
+        mock_boot_result_t result;
+        const uint64_t start = now_ns();
+        mock_boot_run(&result);
+        host_ns += now_ns() - start;
+#if CONFIG_BETTEROTA_DEFERRED_LOG
+        // Printed by the app, or on the next boot that gets there
+        if (verbose && result.started) {
+            const uint32_t lost = boot_log_drain(print_log_text);
+            if (lost > 0) {
+                fprintf(s_log != NULL ? s_log : stdout, "(%lu bytes of the bootloader log lost)\n", (unsigned long)lost);
+            }
+        }
+#endif
+
+        if (result.started) {
+            printf("boot %lu: slot %d at 0x%lx, entry 0x%08lx, %lu byte image, %lu us simulated\n",
+                   i, result.boot_index, (unsigned long)result.image.start_addr,
+                   (unsigned long)result.image.image.entry_addr, (unsigned long)result.image.image_len,
+                   (unsigned long)result.elapsed_us);
+        } else {
+            printf("boot %lu: reset, %lu us simulated\n", i, (unsigned long)result.elapsed_us);
+        }
+        if (expect && result.boot_index != expected_slot) {
+            failures++;
+        }
+    }
+    printf("%lu boots, host %.1f us/boot\n", boots, host_ns / 1e3 / boots);
+
+    mock_flash_reset();
+    if (s_log != NULL) {
+        mock_uart_set_output(NULL);
+        fclose(s_log);
+    }
+    if (failures > 0) {
+        fprintf(stderr, "%d of %lu boots did not boot slot %d\n", failures, boots, expected_slot);
+        return 1;
+    }
+    return 0;
+}
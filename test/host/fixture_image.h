@@ -0,0 +1,264 @@
+/*
+ * Builds app images in the ESP-IDF image format for the loader tests.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include "bootloader_sha.h"
+#include "esp_image_format.h"
+#include "esp_rom_crc.h"
+#include "boot_image.h"
+
+#define FIXTURE_IMAGE_ENTRY 0x40080400
+#define FIXTURE_MMU_PAGE_SIZE 0x10000
+#define FIXTURE_MERKLE_MAX_BLOCKS 256
+
+/**
+ * @brief A segment to place in an image; data_len must be a multiple of 4.
+ */
+typedef struct {
+    uint32_t load_addr;
+    const uint8_t *data;
+    uint32_t data_len;
+} fixture_segment_t;
+
+static inline size_t fixture_image_put_segment(uint8_t *out, size_t pos, uint32_t load_addr, const uint8_t *data, uint32_t len)
+{
+    const esp_image_segment_header_t header = { .load_addr = load_addr, .data_len = len };
+    memcpy(out + pos, &header, sizeof(header));
+    if (data != NULL) {
+        memcpy(out + pos + sizeof(header), data, len);
+    } else {
+        memset(out + pos + sizeof(header), 0, len);
+    }
+    return pos + sizeof(header) + len;
+}
+
+/**
+ * @brief Writes an app image with an appended SHA-256 digest, as esptool's elf2image does.
+ *
+ * Flash-mapped segments get a padding segment in front where needed, so their data lines up
+ * with their address within an MMU page.
+ *
+ * @return Length of the image written to @p out, which must be large enough.
+ */
+static inline size_t fixture_build_image(uint8_t *out, const fixture_segment_t *segments, int count)
+{
+    esp_image_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = ESP_IMAGE_HEADER_MAGIC;
+    header.entry_addr = FIXTURE_IMAGE_ENTRY;
+    header.chip_id = ESP_CHIP_ID_ESP32;
+    header.hash_appended = 1;
+
+    size_t pos = sizeof(header);
+    int placed = 0;
+    for (int i = 0; i < count; i++) {
+        const uint32_t addr = segments[i].load_addr;
+        const int mapped = (addr >= 0x3F400000 && addr < 0x3F800000) || (addr >= 0x400D0000 && addr < 0x40400000);
+        if (mapped) {
+            uint32_t gap = (uint32_t)(addr - pos - sizeof(esp_image_segment_header_t)) % FIXTURE_MMU_PAGE_SIZE;
+            if (gap > 0 && gap < sizeof(esp_image_segment_header_t)) {
+                gap += FIXTURE_MMU_PAGE_SIZE;
+            }
+            if (gap > 0) {
+                pos = fixture_image_put_segment(out, pos, 0, NULL, gap - sizeof(esp_image_segment_header_t));
+                placed++;
+            }
+        }
+        pos = fixture_image_put_segment(out, pos, addr, segments[i].data, segments[i].data_len);
+        placed++;
+    }
+    header.segment_count = (uint8_t)placed;
+    memcpy(out, &header, sizeof(header));
+
+    uint8_t checksum = 0xEF;
+    size_t seg_pos = sizeof(header);
+    for (int i = 0; i < placed; i++) {
+        esp_image_segment_header_t seg;
+        memcpy(&seg, out + seg_pos, sizeof(seg));
+        for (uint32_t j = 0; j < seg.data_len; j++) {
+            checksum ^= out[seg_pos + sizeof(seg) + j];
+        }
+        seg_pos += sizeof(seg) + seg.data_len;
+    }
+    while (pos % 16 != 15) {
+        out[pos++] = 0;
+    }
+    out[pos++] = checksum;
+
+    bootloader_sha256_handle_t sha = bootloader_sha256_start();
+    bootloader_sha256_data(sha, out, pos);
+    bootloader_sha256_finish(sha, out + pos);
+    return pos + ESP_IMAGE_HASH_LEN;
+}
+
+/**
+ * @brief Turns an image written by fixture_build_image() into one with BOOT_IMAGE_FLAG_RAM_DIGEST,
+ * as betterota_pack.py --no-compress --ram-digest does.
+ *
+ * @return Length of the image including its footer; @p out must have room for the footer.
+ */
+static inline size_t fixture_add_ram_digest(uint8_t *out, size_t len)
+{
+    esp_image_header_t header;
+    memcpy(&header, out, sizeof(header));
+    header.reserved[0] |= BOOT_IMAGE_FLAG_RAM_DIGEST;
+    memcpy(out, &header, sizeof(header));
+
+    bootloader_sha256_handle_t ram_sha = bootloader_sha256_start();
+    bootloader_sha256_data(ram_sha, out, sizeof(header));
+    size_t pos = sizeof(header);
+    for (int i = 0; i < header.segment_count; i++) {
+        esp_image_segment_header_t seg;
+        memcpy(&seg, out + pos, sizeof(seg));
+        const uint32_t addr = seg.load_addr;
+        const int mapped = (addr >= 0x3F400000 && addr < 0x3F800000) || (addr >= 0x400D0000 && addr < 0x40400000);
+        bootloader_sha256_data(ram_sha, out + pos, sizeof(seg));
+        if (!mapped && addr >= 0x10000) {
+            bootloader_sha256_data(ram_sha, out + pos + sizeof(seg), seg.data_len);
+        }
+        pos += sizeof(seg) + seg.data_len;
+    }
+    boot_image_ram_digest_t footer = { .magic = BOOT_IMAGE_RAM_DIGEST_MAGIC };
+    bootloader_sha256_finish(ram_sha, footer.digest);
+
+    // The flag is part of the header, so the appended digest changes too
+    bootloader_sha256_handle_t sha = bootloader_sha256_start();
+    bootloader_sha256_data(sha, out, len - ESP_IMAGE_HASH_LEN);
+    bootloader_sha256_finish(sha, out + len - ESP_IMAGE_HASH_LEN);
+    memcpy(out + len, &footer, sizeof(footer));
+    return len + sizeof(footer);
+}
+
+/**
+ * @brief Appends a segment index to an image written by fixture_build_image(), as
+ * betterota_pack.py --no-compress --segment-index does.
+ *
+ * @return Length of the image including the index; @p out must have room for it.
+ */
+static inline size_t fixture_add_segment_index(uint8_t *out, size_t len)
+{
+    esp_image_header_t header;
+    memcpy(&header, out, sizeof(header));
+    header.reserved[0] |= BOOT_IMAGE_FLAG_SEGMENT_INDEX;
+    header.reserved[1] = (uint8_t)(len / 4);
+    header.reserved[2] = (uint8_t)(len / 4 >> 8);
+    header.reserved[3] = (uint8_t)(len / 4 >> 16);
+    memcpy(out, &header, sizeof(header));
+
+    boot_image_index_entry_t entries[ESP_IMAGE_MAX_SEGMENTS];
+    size_t pos = sizeof(header);
+    for (int i = 0; i < header.segment_count; i++) {
+        esp_image_segment_header_t seg;
+        memcpy(&seg, out + pos, sizeof(seg));
+        pos += sizeof(seg);
+        entries[i].load_addr = seg.load_addr;
+        entries[i].data_len = seg.data_len;
+        entries[i].data_offset = (uint32_t)pos;
+        bootloader_sha256_handle_t sha = bootloader_sha256_start();
+        bootloader_sha256_data(sha, out + pos, seg.data_len);
+        bootloader_sha256_finish(sha, entries[i].digest);
+        pos += seg.data_len;
+    }
+    const uint32_t entries_len = header.segment_count * sizeof(entries[0]);
+    const boot_image_index_t index = {
+        .magic = BOOT_IMAGE_INDEX_MAGIC,
+        .segment_count = header.segment_count,
+        .crc = esp_rom_crc32_le(UINT32_MAX, (const uint8_t *)entries, entries_len),
+    };
+
+    // The header is covered by the appended digest
+    bootloader_sha256_handle_t sha = bootloader_sha256_start();
+    bootloader_sha256_data(sha, out, len - ESP_IMAGE_HASH_LEN);
+    bootloader_sha256_finish(sha, out + len - ESP_IMAGE_HASH_LEN);
+    memcpy(out + len, &index, sizeof(index));
+    memcpy(out + len + sizeof(index), entries, entries_len);
+    return len + sizeof(index) + entries_len;
+}
+
+/**
+ * @brief Appends a Merkle tree of its blocks to an image written by fixture_build_image(), as
+ * betterota_pack.py --no-compress --merkle does, for images of up to FIXTURE_MERKLE_MAX_BLOCKS blocks.
+ *
+ * @return Length of the image including the tree; @p out must have room for it.
+ */
+static inline size_t fixture_add_merkle(uint8_t *out, size_t len)
+{
+    esp_image_header_t header;
+    memcpy(&header, out, sizeof(header));
+    header.reserved[0] |= BOOT_IMAGE_FLAG_MERKLE;
+    memcpy(out, &header, sizeof(header));
+    bootloader_sha256_handle_t sha = bootloader_sha256_start();
+    bootloader_sha256_data(sha, out, len - ESP_IMAGE_HASH_LEN);
+    bootloader_sha256_finish(sha, out + len - ESP_IMAGE_HASH_LEN);
+
+    const uint32_t count = (len + BOOT_IMAGE_MERKLE_BLOCK_SIZE - 1) / BOOT_IMAGE_MERKLE_BLOCK_SIZE;
+    boot_image_merkle_t footer = { .magic = BOOT_IMAGE_MERKLE_MAGIC, .block_size = BOOT_IMAGE_MERKLE_BLOCK_SIZE, .block_count = count };
+    uint8_t *leaves = out + len + sizeof(footer);
+    for (uint32_t i = 0; i < count; i++) {
+        const uint32_t start = i * BOOT_IMAGE_MERKLE_BLOCK_SIZE;
+        const uint32_t prefix = 0;
+        sha = bootloader_sha256_start();
+        bootloader_sha256_data(sha, &prefix, sizeof(prefix));
+        bootloader_sha256_data(sha, out + start, len - start < BOOT_IMAGE_MERKLE_BLOCK_SIZE ? len - start : BOOT_IMAGE_MERKLE_BLOCK_SIZE);
+        bootloader_sha256_finish(sha, leaves + i * 32);
+    }
+
+    // The levels are built in place of the root, which goes into the footer
+    uint32_t nodes[FIXTURE_MERKLE_MAX_BLOCKS][8];
+    memcpy(nodes, leaves, count * 32);
+    for (uint32_t level = count; level > 1; level = (level + 1) / 2) {
+        for (uint32_t i = 0; i < level; i += 2) {
+            if (i + 1 < level) {
+                const uint32_t prefix = 1;
+                sha = bootloader_sha256_start();
+                bootloader_sha256_data(sha, &prefix, sizeof(prefix));
+                bootloader_sha256_data(sha, nodes[i], 32);
+                bootloader_sha256_data(sha, nodes[i + 1], 32);
+                bootloader_sha256_finish(sha, (uint8_t *)nodes[i / 2]);
+            } else {
+                memcpy(nodes[i / 2], nodes[i], 32);
+            }
+        }
+    }
+    memcpy(footer.root, nodes[0], sizeof(footer.root));
+    memcpy(out + len, &footer, sizeof(footer));
+    return len + sizeof(footer) + count * 32;
+}
+
+/**
+ * @brief Fills a buffer with pseudo-random data that compresses about as well as Xtensa code.
+ *
+ * Picks instruction-sized words from a small, per-seed vocabulary, with occasional literal
+ * constants, like compiled code with its repeated prologues and register moves.
+ */
+static inline void fixture_code_like(uint8_t *buf, size_t len, uint32_t seed)
+{
+    uint32_t rng = seed | 1;
+    uint8_t vocabulary[64][3];
+    for (int i = 0; i < 64; i++) {
+        for (int j = 0; j < 3; j++) {
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            vocabulary[i][j] = (uint8_t)rng;
+        }
+    }
+
+    size_t pos = 0;
+    while (pos < len) {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        if ((rng & 0x7) == 0) {
+            buf[pos++] = (uint8_t)(rng >> 8);     // A literal byte
+        } else {
+            const uint8_t *word = vocabulary[(rng >> 8) & ((rng & 0x8) ? 0x0F : 0x3F)];
+            for (int j = 0; j < 3 && pos < len; j++) {
+                buf[pos++] = word[j];
+            }
+        }
+    }
+}
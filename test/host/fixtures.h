@@ -0,0 +1,109 @@
+/*
+ * Flash layout of partitions.csv and helpers to populate the simulated flash with it.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include "bootloader_utility.h"
+#include "esp_flash_partitions.h"
+#include "esp_rom_crc.h"
+#include "mock_flash.h"
+#include "boot_patch_format.h"
+
+// Offsets as assigned by gen_esp32part.py for partitions.csv
+#define FIXTURE_OTA_0_OFFSET    0x10000
+#define FIXTURE_OTA_0_SIZE      0x180000
+#define FIXTURE_OTA_1_OFFSET    0x190000
+#define FIXTURE_OTA_1_SIZE      0x200000
+#define FIXTURE_OTADATA_OFFSET  0x390000
+#define FIXTURE_OTADATA_SIZE    0x2000
+#define FIXTURE_PATCH_OFFSET    0x3AB000
+#define FIXTURE_PATCH_SIZE      0x55000
+
+/**
+ * @brief Returns the bootloader_state_t the partition table of partitions.csv loads into.
+ */
+static inline bootloader_state_t fixture_state(void)
+{
+    bootloader_state_t bs = {0};
+    bs.ota_info = (esp_partition_pos_t){ .offset = FIXTURE_OTADATA_OFFSET, .size = FIXTURE_OTADATA_SIZE };
+    bs.ota[0] = (esp_partition_pos_t){ .offset = FIXTURE_OTA_0_OFFSET, .size = FIXTURE_OTA_0_SIZE };
+    bs.ota[1] = (esp_partition_pos_t){ .offset = FIXTURE_OTA_1_OFFSET, .size = FIXTURE_OTA_1_SIZE };
+    bs.app_count = 2;
+    return bs;
+}
+
+/**
+ * @brief Writes the partition table of partitions.csv, ending with an MD5 entry.
+ *
+ * The MD5 entry holds a stand-in digest derived from @p md5_seed; the host build does not check it.
+ */
+static inline void fixture_put_partition_table(uint8_t md5_seed)
+{
+    static const struct {
+        const char *label;
+        uint8_t type;
+        uint8_t subtype;
+        uint32_t offset;
+        uint32_t size;
+    } parts[] = {
+        { "ota_0", PART_TYPE_APP, PART_SUBTYPE_OTA_FLAG | 0, FIXTURE_OTA_0_OFFSET, FIXTURE_OTA_0_SIZE },
+        { "ota_1", PART_TYPE_APP, PART_SUBTYPE_OTA_FLAG | 1, FIXTURE_OTA_1_OFFSET, FIXTURE_OTA_1_SIZE },
+        { "otadata", PART_TYPE_DATA, PART_SUBTYPE_DATA_OTA, FIXTURE_OTADATA_OFFSET, FIXTURE_OTADATA_SIZE },
+        { "nvs", PART_TYPE_DATA, 0x02, 0x392000, 0x9000 },
+        { "coredump", PART_TYPE_DATA, 0x03, 0x39B000, 0x10000 },
+        { "patch", PART_TYPE_DATA, BOOT_PATCH_PARTITION_SUBTYPE, FIXTURE_PATCH_OFFSET, FIXTURE_PATCH_SIZE },
+    };
+    const size_t count = sizeof(parts) / sizeof(parts[0]);
+
+    esp_partition_info_t table[sizeof(parts) / sizeof(parts[0]) + 1];
+    memset(table, 0xFF, sizeof(table));
+    for (size_t i = 0; i < count; i++) {
+        table[i].magic = ESP_PARTITION_MAGIC;
+        table[i].type = parts[i].type;
+        table[i].subtype = parts[i].subtype;
+        table[i].pos = (esp_partition_pos_t){ .offset = parts[i].offset, .size = parts[i].size };
+        memset(table[i].label, 0, sizeof(table[i].label));
+        strncpy((char *)table[i].label, parts[i].label, sizeof(table[i].label));
+        table[i].flags = 0;
+    }
+    table[count].magic = ESP_PARTITION_MAGIC_MD5;
+    uint8_t *md5 = (uint8_t *)&table[count] + 16;
+    for (int i = 0; i < 16; i++) {
+        md5[i] = (uint8_t)(md5_seed + i);
+    }
+    mock_flash_put(ESP_PARTITION_TABLE_OFFSET, table, sizeof(table));
+}
+
+/**
+ * @brief Flash offset of the MD5 entry written by fixture_put_partition_table().
+ */
+#define FIXTURE_PTABLE_MD5_OFFSET (ESP_PARTITION_TABLE_OFFSET + 6 * sizeof(esp_partition_info_t))
+
+/**
+ * @brief Builds an otadata entry the way esp_ota_set_boot_partition() writes it.
+ */
+static inline esp_ota_select_entry_t fixture_otadata_entry(uint32_t seq, uint32_t state)
+{
+    esp_ota_select_entry_t entry;
+    memset(&entry, 0xFF, sizeof(entry));
+    entry.ota_seq = seq;
+    entry.ota_state = state;
+    entry.crc = esp_rom_crc32_le(UINT32_MAX, (const uint8_t *)&entry.ota_seq, sizeof(entry.ota_seq));
+    return entry;
+}
+
+/**
+ * @brief Writes an otadata entry into one of the two otadata sectors.
+ *
+ * Like esp_ota_set_boot_partition(), erases the rest of the sector.
+ */
+static inline void fixture_put_otadata(int sector, uint32_t seq, uint32_t state)
+{
+    const esp_ota_select_entry_t entry = fixture_otadata_entry(seq, state);
+    uint8_t data[0x1000];
+    memset(data, 0xFF, sizeof(data));
+    memcpy(data, &entry, sizeof(entry));
+    mock_flash_put(FIXTURE_OTADATA_OFFSET + sector * 0x1000, data, sizeof(data));
+}
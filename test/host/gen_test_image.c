@@ -0,0 +1,74 @@
+/*
+ * Writes a synthetic app image with the segment sizes of a typical ESP32 app, for the
+ * packing tool to compress (see CMakeLists.txt).
+ *
+ * With "v2", writes the next version of the same app instead, for the delta patch tool:
+ * some code inserted into IROM, scattered words changed as relocated addresses would be,
+ * and a run of DROM data replaced.
+ *
+ * Usage: gen_test_image OUTPUT [v2]
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fixture_image.h"
+#include "gen_test_image.h"
+
+#define V2_IROM_INSERT_AT (200 * 1024)
+#define V2_IROM_INSERT_LEN (6 * 1024)
+#define V2_WORD_INTERVAL 1024
+#define V2_DROM_EDIT_AT (40 * 1024)
+#define V2_DROM_EDIT_LEN 2048
+
+/**
+ * @brief Turns the segments of the first version into those of v2.
+ */
+static void make_v2(fixture_segment_t *segments, uint8_t data[][GEN_TEST_IMAGE_MAX_SEGMENT_LEN])
+{
+    uint8_t *drom = data[0];
+    fixture_code_like(drom + V2_DROM_EDIT_AT, V2_DROM_EDIT_LEN, 0x2000);
+
+    fixture_segment_t *irom = &segments[GEN_TEST_IMAGE_SEGMENT_COUNT - 1];
+    uint8_t *code = data[GEN_TEST_IMAGE_SEGMENT_COUNT - 1];
+    memmove(code + V2_IROM_INSERT_AT + V2_IROM_INSERT_LEN, code + V2_IROM_INSERT_AT,
+            irom->data_len - V2_IROM_INSERT_AT);
+    fixture_code_like(code + V2_IROM_INSERT_AT, V2_IROM_INSERT_LEN, 0x2001);
+    irom->data_len += V2_IROM_INSERT_LEN;
+
+    for (int i = 0; i < GEN_TEST_IMAGE_SEGMENT_COUNT; i++) {
+        for (size_t pos = V2_WORD_INTERVAL / 2; pos + 4 <= segments[i].data_len; pos += V2_WORD_INTERVAL) {
+            data[i][pos] += V2_IROM_INSERT_LEN & 0xFF;
+            data[i][pos + 1] += V2_IROM_INSERT_LEN >> 8;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const bool v2 = argc == 3 && strcmp(argv[2], "v2") == 0;
+    if (argc != 2 && !v2) {
+        fprintf(stderr, "Usage: gen_test_image OUTPUT [v2]\n");
+        return 2;
+    }
+
+    static uint8_t image[GEN_TEST_IMAGE_MAX_LEN];
+    static uint8_t data[GEN_TEST_IMAGE_SEGMENT_COUNT][GEN_TEST_IMAGE_MAX_SEGMENT_LEN];
+    fixture_segment_t segments[GEN_TEST_IMAGE_SEGMENT_COUNT];
+    for (int i = 0; i < GEN_TEST_IMAGE_SEGMENT_COUNT; i++) {
+        segments[i] = gen_test_image_segments[i];
+        fixture_code_like(data[i], segments[i].data_len, 0x1000 + i);
+        segments[i].data = data[i];
+    }
+    if (v2) {
+        make_v2(segments, data);
+    }
+    const size_t len = fixture_build_image(image, segments, GEN_TEST_IMAGE_SEGMENT_COUNT);
+
+    FILE *f = fopen(argv[1], "wb");
+    if (f == NULL || fwrite(image, 1, len, f) != len || fclose(f) != 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,19 @@
+/*
+ * Segment layout of the synthetic app image written by gen_test_image.
+ */
+#pragma once
+
+#include "fixture_image.h"
+
+#define GEN_TEST_IMAGE_SEGMENT_COUNT 5
+#define GEN_TEST_IMAGE_MAX_SEGMENT_LEN (640 * 1024)
+#define GEN_TEST_IMAGE_MAX_LEN (1024 * 1024)
+
+// DROM first, as it starts with the app description, then the RAM segments and IROM
+static const fixture_segment_t gen_test_image_segments[GEN_TEST_IMAGE_SEGMENT_COUNT] = {
+    { .load_addr = 0x3F400020, .data_len = 150 * 1024 },
+    { .load_addr = 0x3FFB0000, .data_len = 20 * 1024 },
+    { .load_addr = 0x40080000, .data_len = 90 * 1024 },
+    { .load_addr = 0x400C0000, .data_len = 1024 },
+    { .load_addr = 0x400D0020, .data_len = 600 * 1024 },
+};
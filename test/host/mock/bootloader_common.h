@@ -0,0 +1,25 @@
+/*
+ * Host stand-in for bootloader_common.h. The RTC retain memory is a plain variable, see mock_hw.h.
+ */
+#pragma once
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_flash_partitions.h"
+#include "esp_image_format.h"
+
+typedef struct {
+    esp_partition_pos_t partition;
+    uint16_t reboot_counter;
+    uint8_t flags;
+    uint8_t reserve;
+    uint8_t custom[CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE];
+    uint32_t crc;
+} rtc_retain_mem_t;
+
+rtc_retain_mem_t *bootloader_common_get_rtc_retain_mem(void);
+
+/**
+ * @brief Accepts images built for the ESP32, with any chip revision.
+ */
+esp_err_t bootloader_common_check_chip_validity(const esp_image_header_t *img_hdr, esp_image_type type);
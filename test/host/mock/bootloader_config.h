@@ -0,0 +1,18 @@
+/*
+ * Host stand-in for bootloader_config.h.
+ */
+#pragma once
+
+#include <stdint.h>
+#include "esp_flash_partitions.h"
+
+#define MAX_OTA_SLOTS 16
+
+typedef struct {
+    esp_partition_pos_t ota_info;
+    esp_partition_pos_t factory;
+    esp_partition_pos_t test;
+    esp_partition_pos_t ota[MAX_OTA_SLOTS];
+    uint32_t app_count;
+    uint32_t selected_subtype;
+} bootloader_state_t;
@@ -0,0 +1,10 @@
+/*
+ * Host stand-in for bootloader_flash_config.h. The SPI clock is simulated, see mock_flash.h.
+ */
+#pragma once
+
+#include "esp_image_format.h"
+
+void bootloader_flash_clock_config(const esp_image_header_t *pfhdr);
+void bootloader_flash_gpio_config(const esp_image_header_t *pfhdr);
+void bootloader_flash_dummy_config(const esp_image_header_t *pfhdr);
@@ -0,0 +1,24 @@
+/*
+ * Host stand-in for bootloader_flash_priv.h. Flash is simulated, see mock_flash.h.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#define SPI_FLASH_SEC_SIZE 0x1000
+#define SPI_FLASH_MMU_PAGE_SIZE 0x10000
+
+#define CMD_WRSR 0x01
+#define CMD_WREN 0x06
+#define CMD_RDSR 0x05
+#define CMD_RDSR2 0x35
+
+const void *bootloader_mmap(uint32_t src_addr, uint32_t size);
+void bootloader_munmap(const void *mapping);
+esp_err_t bootloader_flash_read(size_t src_addr, void *dest, size_t size, bool allow_decrypt);
+esp_err_t bootloader_flash_write(size_t dest_addr, void *src, size_t size, bool write_encrypted);
+esp_err_t bootloader_flash_erase_sector(size_t sector);
+uint32_t bootloader_execute_flash_command(uint8_t command, uint32_t mosi_data, uint8_t mosi_len, uint8_t miso_len);
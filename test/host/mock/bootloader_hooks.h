@@ -0,0 +1,7 @@
+/*
+ * Host stand-in for bootloader_hooks.h. The hooks are left undefined, as in a project without them.
+ */
+#pragma once
+
+void __attribute__((weak)) bootloader_before_init(void);
+void __attribute__((weak)) bootloader_after_init(void);
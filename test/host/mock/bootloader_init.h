@@ -0,0 +1,12 @@
+/*
+ * Host stand-in for bootloader_init.h. There is no hardware to initialize, see mock_boot.h.
+ */
+#pragma once
+
+#include "esp_err.h"
+#include "esp_image_format.h"
+
+// The bootloader's own image header, as read from CONFIG_BOOTLOADER_OFFSET_IN_FLASH by bootloader_init()
+extern esp_image_header_t bootloader_image_hdr;
+
+esp_err_t bootloader_init(void);
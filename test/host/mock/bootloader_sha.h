@@ -0,0 +1,14 @@
+/*
+ * Host stand-in for bootloader_sha.h, backed by a plain software SHA-256.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void *bootloader_sha256_handle_t;
+
+bootloader_sha256_handle_t bootloader_sha256_start(void);
+void bootloader_sha256_data(bootloader_sha256_handle_t handle, const void *data, size_t data_len);
+// A NULL digest only releases the handle
+void bootloader_sha256_finish(bootloader_sha256_handle_t handle, uint8_t *digest);
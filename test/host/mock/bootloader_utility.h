@@ -0,0 +1,14 @@
+/*
+ * Host stand-in for bootloader_utility.h.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include "bootloader_config.h"
+
+bool bootloader_utility_load_partition_table(bootloader_state_t *bs);
+
+/**
+ * @brief Ends the emulated boot, see mock_boot.h.
+ */
+void __attribute__((noreturn)) bootloader_reset(void);
@@ -0,0 +1,15 @@
+/*
+ * Host stand-in for esp_cpu.h. The cycle counter is simulated, see mock_hw.h.
+ */
+#pragma once
+
+#include <stdint.h>
+
+typedef uint32_t esp_cpu_cycle_count_t;
+
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void);
+
+/**
+ * @brief Returns the simulated stack pointer, MOCK_STACK_POINTER.
+ */
+void *esp_cpu_get_sp(void);
@@ -0,0 +1,68 @@
+/*
+ * Host stand-in for esp_image_format.h, with the same image layout as ESP-IDF.
+ */
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_flash_partitions.h"
+
+#define ESP_IMAGE_HEADER_MAGIC 0xE9
+#define ESP_IMAGE_MAX_SEGMENTS 16
+#define ESP_IMAGE_HASH_LEN 32
+#define ESP_CHIP_ID_ESP32 0x0000
+
+typedef enum {
+    ESP_IMAGE_SPI_MODE_QIO,
+    ESP_IMAGE_SPI_MODE_QOUT,
+    ESP_IMAGE_SPI_MODE_DIO,
+    ESP_IMAGE_SPI_MODE_DOUT,
+    ESP_IMAGE_SPI_MODE_FAST_READ,
+    ESP_IMAGE_SPI_MODE_SLOW_READ,
+} esp_image_spi_mode_t;
+
+typedef enum {
+    ESP_IMAGE_SPI_SPEED_DIV_2 = 0x0,    // 40 MHz
+    ESP_IMAGE_SPI_SPEED_DIV_3 = 0x1,    // 26 MHz
+    ESP_IMAGE_SPI_SPEED_DIV_4 = 0x2,    // 20 MHz
+    ESP_IMAGE_SPI_SPEED_DIV_1 = 0xF,    // 80 MHz
+} esp_image_spi_freq_t;
+
+typedef enum {
+    ESP_IMAGE_BOOTLOADER,
+    ESP_IMAGE_APPLICATION,
+} esp_image_type;
+
+typedef struct {
+    uint8_t magic;
+    uint8_t segment_count;
+    uint8_t spi_mode;
+    uint8_t spi_speed: 4;
+    uint8_t spi_size: 4;
+    uint32_t entry_addr;
+    uint8_t wp_pin;
+    uint8_t spi_pin_drv[3];
+    uint16_t chip_id;
+    uint8_t min_chip_rev;
+    uint16_t min_chip_rev_full;
+    uint16_t max_chip_rev_full;
+    uint8_t reserved[4];
+    uint8_t hash_appended;
+} __attribute__((packed)) esp_image_header_t;
+
+_Static_assert(sizeof(esp_image_header_t) == 24, "binary image header should be 24 bytes");
+
+typedef struct {
+    uint32_t load_addr;
+    uint32_t data_len;
+} esp_image_segment_header_t;
+
+typedef struct {
+    uint32_t start_addr;
+    esp_image_header_t image;
+    esp_image_segment_header_t segments[ESP_IMAGE_MAX_SEGMENTS];
+    uint32_t segment_data[ESP_IMAGE_MAX_SEGMENTS];
+    uint32_t image_len;
+    uint8_t image_digest[32];
+    uint32_t secure_version;
+} esp_image_metadata_t;
@@ -0,0 +1,22 @@
+/*
+ * Host stand-in for esp_log.h. Log lines go through esp_rom_printf() as on the chip, i.e. to the
+ * simulated UART, which prints them to stdout unless muted with mock_log_enable().
+ */
+#pragma once
+
+#include <stdbool.h>
+#include "sdkconfig.h"
+
+void mock_log(char level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+void mock_log_enable(bool enable);
+
+#define ESP_LOGE(tag, format, ...) mock_log('E', tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) mock_log('W', tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) mock_log('I', tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) mock_log('D', tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) mock_log('V', tag, format, ##__VA_ARGS__)
+#define ESP_EARLY_LOGE ESP_LOGE
+#define ESP_EARLY_LOGW ESP_LOGW
+#define ESP_EARLY_LOGI ESP_LOGI
+#define ESP_EARLY_LOGD ESP_LOGD
+#define ESP_EARLY_LOGV ESP_LOGV
@@ -0,0 +1,18 @@
+/*
+ * Host stand-in for esp_rom_sys.h.
+ */
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+    RESET_REASON_CHIP_POWER_ON = 0x01,
+    RESET_REASON_CORE_DEEP_SLEEP = 0x05,
+} soc_reset_reason_t;
+
+uint32_t esp_rom_get_cpu_ticks_per_us(void);
+soc_reset_reason_t esp_rom_get_reset_reason(int cpu_no);
+
+int esp_rom_printf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+void esp_rom_install_channel_putc(int channel, void (*putc)(char c));
+void esp_rom_install_uart_printf(void);
@@ -0,0 +1,9 @@
+/*
+ * Host stand-in for flash_qio_mode.h. The flash chip is simulated, see mock_flash.h.
+ */
+#pragma once
+
+#include <stdint.h>
+
+uint32_t bootloader_read_flash_id(void);
+void bootloader_enable_qio_mode(void);
@@ -0,0 +1,14 @@
+/*
+ * Host stand-in for hal/wdt_hal.h. Feeding the RTC watchdog is counted, see mock_hw.h.
+ */
+#pragma once
+
+typedef struct {
+    int inst;
+} wdt_hal_context_t;
+
+#define RWDT_HAL_CONTEXT_DEFAULT() ((wdt_hal_context_t){ .inst = 1 })
+
+void wdt_hal_write_protect_disable(wdt_hal_context_t *hal);
+void wdt_hal_write_protect_enable(wdt_hal_context_t *hal);
+void wdt_hal_feed(wdt_hal_context_t *hal);
@@ -0,0 +1,104 @@
+/*
+ * Host stand-in for boot_app_cpu.c: the simulated APP CPU runs on a clock of its own.
+ *
+ * A job runs when CPU0 next waits for it, but on the APP CPU's clock from the moment it was
+ * posted, so the simulated time of both CPUs overlaps as on the chip. Running it late also
+ * makes it see any buffer CPU0 overwrote too early, as the real APP CPU might.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "boot_app_cpu.h"
+#include "mock_hw.h"
+
+static bool s_running;
+static bool s_in_job;
+static boot_app_cpu_job_t s_job;
+static void *s_arg;
+static uint32_t s_posted_cycles;
+static uint32_t s_done_cycles;      // When the APP CPU finished the last job, on CPU0's time line
+static uint32_t s_busy_cycles;
+static uint32_t s_wait_cycles;
+
+void mock_app_cpu_reset(void)
+{
+    s_running = false;
+    s_job = NULL;
+}
+
+bool boot_app_cpu_start(void)
+{
+    if (!mock_app_cpu_present()) {
+        return false;
+    }
+    s_running = true;
+    s_job = NULL;
+    s_done_cycles = mock_time_cycles();
+    s_busy_cycles = 0;
+    s_wait_cycles = 0;
+    return true;
+}
+
+bool mock_app_cpu_in_job(void)
+{
+    return s_in_job;
+}
+
+bool mock_app_cpu_busy(void)
+{
+    return s_running && s_job != NULL;
+}
+
+bool boot_app_cpu_running(void)
+{
+    return s_running;
+}
+
+void boot_app_cpu_wait(void)
+{
+    if (!s_running) {
+        return;
+    }
+    const uint32_t now = mock_time_cycles();
+    if (s_job != NULL) {
+        // Starts when posted, or when the job before is done
+        const uint32_t start = (int32_t)(s_done_cycles - s_posted_cycles) > 0 ? s_done_cycles : s_posted_cycles;
+        mock_time_set_cycles(start);
+        const boot_app_cpu_job_t job = s_job;
+        s_job = NULL;
+        s_in_job = true;
+        job(s_arg);
+        s_in_job = false;
+        s_done_cycles = mock_time_cycles();
+        s_busy_cycles += s_done_cycles - start;
+        mock_time_set_cycles(now);
+    }
+    if ((int32_t)(s_done_cycles - now) > 0) {
+        s_wait_cycles += s_done_cycles - now;
+        mock_time_set_cycles(s_done_cycles);
+    }
+}
+
+void boot_app_cpu_run(boot_app_cpu_job_t job, void *arg)
+{
+    boot_app_cpu_wait();
+    s_job = job;
+    s_arg = arg;
+    s_posted_cycles = mock_time_cycles();
+}
+
+void boot_app_cpu_stop(void)
+{
+    boot_app_cpu_wait();
+    s_running = false;
+}
+
+uint32_t boot_app_cpu_busy_cycles(void)
+{
+    return s_busy_cycles;
+}
+
+uint32_t boot_app_cpu_wait_cycles(void)
+{
+    return s_wait_cycles;
+}
@@ -0,0 +1,79 @@
+/*
+ * Host stand-ins for the ends of the boot flow: hardware init, the jump to the app and the reset.
+ */
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bootloader_init.h"
+#include "bootloader_utility.h"
+#include "boot_flash.h"
+#include "boot_image.h"
+#include "boot_otadata.h"
+#include "boot_timer.h"
+#include "mock_boot.h"
+#include "mock_flash.h"
+#include "mock_hw.h"
+#include "soc/rtc.h"
+
+void call_start_cpu0(void);
+
+static jmp_buf s_exit;
+static mock_boot_result_t *s_result;
+
+esp_image_header_t bootloader_image_hdr = {
+    .magic = ESP_IMAGE_HEADER_MAGIC,
+    .spi_mode = ESP_IMAGE_SPI_MODE_DIO,
+    .spi_speed = ESP_IMAGE_SPI_SPEED_DIV_2,
+};
+
+esp_err_t bootloader_init(void)
+{
+    // As bootloader_clock_configure()
+    rtc_cpu_freq_config_t config;
+    rtc_clk_cpu_freq_mhz_to_config(MOCK_CPU_MHZ, &config);
+    rtc_clk_cpu_freq_set_config(&config);
+    return ESP_OK;
+}
+
+static void __attribute__((noreturn)) finish(bool started)
+{
+    if (s_result == NULL) {
+        fprintf(stderr, "%s called outside of mock_boot_run()\n", started ? "boot_image_start()" : "bootloader_reset()");
+        abort();
+    }
+    s_result->started = started;
+    longjmp(s_exit, 1);
+}
+
+void bootloader_reset(void)
+{
+    mock_app_cpu_reset();
+    finish(false);
+}
+
+void boot_image_start(const esp_image_metadata_t *data)
+{
+    if (s_result != NULL) {
+        s_result->image = *data;
+    }
+    finish(true);
+}
+
+void mock_boot_run(mock_boot_result_t *result)
+{
+    memset(result, 0, sizeof(*result));
+    s_result = result;
+    // The bootloader's .bss starts out zeroed
+    boot_otadata_invalidate();
+    boot_flash_reset();
+    mock_flash_spi_reset();
+
+    const uint32_t start_us = mock_time_us();
+    if (setjmp(s_exit) == 0) {
+        call_start_cpu0();
+    }
+    result->elapsed_us = mock_time_us() - start_us;
+    result->boot_index = result->started ? boot_timer_stats()->boot_index : -1;
+    s_result = NULL;
+}
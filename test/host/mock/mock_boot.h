@@ -0,0 +1,30 @@
+/*
+ * Runs the whole bootloader on the host, from call_start_cpu0() up to the jump to the app.
+ *
+ * The jump (boot_image_start()) and bootloader_reset() end the run and are recorded
+ * instead. The flash is the simulated one, which can also be backed by a flash dump,
+ * see mock_flash_map_file().
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_image_format.h"
+
+/**
+ * @brief Outcome of an emulated boot.
+ */
+typedef struct {
+    bool started;                   // Jumped to an app; false if the bootloader reset the chip
+    int boot_index;                 // OTA slot that was booted, -1 if none
+    esp_image_metadata_t image;     // The image handed to boot_image_start()
+    uint32_t elapsed_us;            // Simulated time from call_start_cpu0() to the jump or reset
+} mock_boot_result_t;
+
+/**
+ * @brief Runs call_start_cpu0() until it jumps to the app or resets the chip.
+ *
+ * Like a real boot, this starts from a clean bootloader state; only the RTC retain memory
+ * (see mock_hw.h) and the flash carry over from earlier runs.
+ */
+void mock_boot_run(mock_boot_result_t *result);
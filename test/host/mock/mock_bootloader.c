@@ -0,0 +1,76 @@
+/*
+ * Host implementations of the IDF bootloader_support functions, working on the simulated flash.
+ */
+#include <string.h>
+#include "esp_log.h"
+#include "esp_flash_partitions.h"
+#include "bootloader_flash_priv.h"
+#include "bootloader_utility.h"
+#include "bootloader_common.h"
+#include "mock_bootloader.h"
+
+static const char *TAG = "mock";
+
+static mock_bootloader_stats_t s_stats;
+
+void mock_bootloader_reset(void)
+{
+    memset(&s_stats, 0, sizeof(s_stats));
+}
+
+const mock_bootloader_stats_t *mock_bootloader_stats(void)
+{
+    return &s_stats;
+}
+
+esp_err_t bootloader_common_check_chip_validity(const esp_image_header_t *img_hdr, esp_image_type type)
+{
+    (void)type;
+    if (img_hdr->chip_id != ESP_CHIP_ID_ESP32) {
+        ESP_LOGE(TAG, "Image is for chip id 0x%04x, not the ESP32", img_hdr->chip_id);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// Same classification as the IDF, without the MD5 check of the table
+bool bootloader_utility_load_partition_table(bootloader_state_t *bs)
+{
+    s_stats.partition_table_loads++;
+
+    const esp_partition_info_t *table = bootloader_mmap(ESP_PARTITION_TABLE_OFFSET, ESP_PARTITION_TABLE_MAX_LEN);
+    if (table == NULL) {
+        ESP_LOGE(TAG, "Failed to map partition table");
+        return false;
+    }
+
+    memset(bs, 0, sizeof(*bs));
+    bool ok = false;
+    for (size_t i = 0; i < ESP_PARTITION_TABLE_MAX_ENTRIES; i++) {
+        const esp_partition_info_t *part = &table[i];
+        if (part->magic == ESP_PARTITION_MAGIC_MD5 || part->magic == 0xFFFF) {
+            ok = i > 0;
+            break;
+        }
+        if (part->magic != ESP_PARTITION_MAGIC) {
+            ESP_LOGE(TAG, "Invalid partition table entry %u", (unsigned)i);
+            break;
+        }
+
+        if (part->type == PART_TYPE_APP) {
+            if (part->subtype == PART_SUBTYPE_FACTORY) {
+                bs->factory = part->pos;
+            } else if (part->subtype == PART_SUBTYPE_TEST) {
+                bs->test = part->pos;
+            } else if ((part->subtype & ~PART_SUBTYPE_OTA_MASK) == PART_SUBTYPE_OTA_FLAG) {
+                bs->ota[part->subtype & PART_SUBTYPE_OTA_MASK] = part->pos;
+                bs->app_count++;
+            }
+        } else if (part->type == PART_TYPE_DATA && part->subtype == PART_SUBTYPE_DATA_OTA) {
+            bs->ota_info = part->pos;
+        }
+    }
+
+    bootloader_munmap(table);
+    return ok;
+}
@@ -0,0 +1,16 @@
+/*
+ * Controls for the host implementations of the IDF bootloader_support functions.
+ */
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Call counters, reset by mock_bootloader_reset().
+ */
+typedef struct {
+    uint32_t partition_table_loads;     // bootloader_utility_load_partition_table() calls
+} mock_bootloader_stats_t;
+
+void mock_bootloader_reset(void);
+const mock_bootloader_stats_t *mock_bootloader_stats(void);
@@ -0,0 +1,350 @@
+/*
+ * Simulated flash chip of the host build.
+ */
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bootloader_flash_config.h"
+#include "bootloader_flash_priv.h"
+#include "esp_rom_spiflash.h"
+#include "flash_qio_mode.h"
+#include "boot_flash.h"
+#include "boot_app_cpu.h"
+#include "mock_flash.h"
+#include "mock_hw.h"
+
+static uint8_t s_flash_mem[MOCK_FLASH_SIZE];
+// Points to s_flash_mem, or to a flash dump mapped by mock_flash_map_file()
+static uint8_t *s_flash = s_flash_mem;
+static mock_flash_stats_t s_stats;
+// Like the real bootloader, only one mapping may be active at a time
+static bool s_mapped;
+static uint32_t s_read_speed;
+// Bytes read that have not yet added up to a whole simulated microsecond, times 80 (see account_read())
+static uint64_t s_read_remainder;
+// Writes and erases left before they start failing, UINT32_MAX for no limit
+static uint32_t s_writes_left = UINT32_MAX;
+static uint32_t s_jedec_id;
+// Set by boot_app_cpu_flash_read(), which stalls the APP CPU around the DPORT accesses
+static bool s_app_cpu_stalled;
+
+/**
+ * @brief Fails the test when CPU0 goes through the flash cache's DPORT registers while the
+ * APP CPU may run a job (see boot_app_cpu_flash_read()).
+ */
+static void check_app_cpu_idle(const char *func)
+{
+    if (mock_app_cpu_busy() && !s_app_cpu_stalled) {
+        fprintf(stderr, "%s() while the APP CPU runs a job, see boot_app_cpu_flash_read()\n", func);
+        abort();
+    }
+}
+static bool s_quad_enable;      // The QE bit of the chip's status register
+static bool s_write_enable;     // The write enable latch, set by WREN
+static bool s_quad_broken;
+// SPI configuration, see mock_flash_spi_reset()
+static bool s_quad;
+static uint32_t s_spi_mhz = 40;
+
+static bool in_range(size_t offset, size_t size)
+{
+    return offset <= MOCK_FLASH_SIZE && size <= MOCK_FLASH_SIZE - offset;
+}
+
+static void account_read(size_t size)
+{
+    s_stats.bytes_read += size;
+    if (s_read_speed != 0) {
+        // The read speed is that of DIO at 40 MHz; four lines double it, and so does 80 MHz
+        const uint64_t per_us = (uint64_t)s_read_speed * s_spi_mhz * (s_quad ? 4 : 2);
+        s_read_remainder += (uint64_t)size * 80;
+        mock_time_advance_us((uint32_t)(s_read_remainder / per_us));
+        s_read_remainder %= per_us;
+    }
+}
+
+static bool write_allowed(void)
+{
+    if (s_writes_left == 0) {
+        return false;
+    }
+    if (s_writes_left != UINT32_MAX) {
+        s_writes_left--;
+    }
+    return true;
+}
+
+void mock_flash_fail_writes_after(uint32_t count)
+{
+    s_writes_left = count;
+}
+
+void mock_flash_set_jedec_id(uint32_t id)
+{
+    s_jedec_id = id;
+}
+
+void mock_flash_set_quad_broken(bool broken)
+{
+    s_quad_broken = broken;
+}
+
+void mock_flash_set_quad_enable(bool enabled)
+{
+    s_quad_enable = enabled;
+}
+
+bool mock_flash_quad_enable(void)
+{
+    return s_quad_enable;
+}
+
+void mock_flash_spi_reset(void)
+{
+    s_quad = false;
+    s_spi_mhz = 40;
+}
+
+bool mock_flash_spi_quad(void)
+{
+    return s_quad;
+}
+
+uint32_t mock_flash_spi_mhz(void)
+{
+    return s_spi_mhz;
+}
+
+void mock_flash_set_read_speed(uint32_t bytes_per_us)
+{
+    s_read_speed = bytes_per_us;
+    s_read_remainder = 0;
+}
+
+static void unmap_file(void)
+{
+    if (s_flash != s_flash_mem) {
+        munmap(s_flash, MOCK_FLASH_SIZE);
+        s_flash = s_flash_mem;
+    }
+}
+
+bool mock_flash_map_file(const char *path, bool write_back)
+{
+    const int fd = open(path, write_back ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size != MOCK_FLASH_SIZE) {
+        fprintf(stderr, "%s: not a %u byte flash dump\n", path, (unsigned)MOCK_FLASH_SIZE);
+        close(fd);
+        return false;
+    }
+    // A private mapping keeps the writes of the boot (e.g. otadata, patches) out of the file
+    void *data = mmap(NULL, MOCK_FLASH_SIZE, PROT_READ | PROT_WRITE, write_back ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror(path);
+        return false;
+    }
+
+    mock_flash_reset();
+    s_flash = data;
+    return true;
+}
+
+void mock_flash_reset(void)
+{
+    unmap_file();
+    memset(s_flash, 0xFF, MOCK_FLASH_SIZE);
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_mapped = false;
+    s_read_speed = 0;
+    s_read_remainder = 0;
+    s_writes_left = UINT32_MAX;
+    s_jedec_id = 0;
+    s_quad_enable = false;
+    s_write_enable = false;
+    s_quad_broken = false;
+    mock_flash_spi_reset();
+    // A new chip; the read-ahead windows must not outlive the contents they were filled from
+    boot_flash_reset();
+}
+
+void mock_flash_put(uint32_t offset, const void *data, size_t size)
+{
+    if (in_range(offset, size)) {
+        memcpy(s_flash + offset, data, size);
+        boot_flash_invalidate(offset, size);
+    }
+}
+
+uint8_t *mock_flash_data(void)
+{
+    // The caller may change anything behind the bootloader's back
+    boot_flash_invalidate(0, MOCK_FLASH_SIZE);
+    return s_flash;
+}
+
+const mock_flash_stats_t *mock_flash_stats(void)
+{
+    return &s_stats;
+}
+
+const void *bootloader_mmap(uint32_t src_addr, uint32_t size)
+{
+    check_app_cpu_idle(__func__);
+    if (s_mapped || !in_range(src_addr, size)) {
+        return NULL;
+    }
+    s_mapped = true;
+    s_stats.mmaps++;
+    account_read(size);
+    return s_flash + src_addr;
+}
+
+void bootloader_munmap(const void *mapping)
+{
+    (void)mapping;
+    s_mapped = false;
+}
+
+esp_err_t bootloader_flash_read(size_t src_addr, void *dest, size_t size, bool allow_decrypt)
+{
+    (void)allow_decrypt;
+    check_app_cpu_idle(__func__);
+    if (!in_range(src_addr, size)) {
+        return ESP_FAIL;
+    }
+    // As on the chip, only whole words go to a word aligned buffer
+    if (src_addr % 4 != 0 || size % 4 != 0 || (uintptr_t)dest % 4 != 0) {
+        return ESP_FAIL;
+    }
+    s_stats.reads++;
+    account_read(size);
+    memcpy(dest, s_flash + src_addr, size);
+    if (s_quad && (!s_quad_enable || s_quad_broken)) {
+        // Two of the four data lines float
+        uint8_t *out = dest;
+        for (size_t i = 0; i < size; i++) {
+            out[i] |= 0xCC;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t bootloader_flash_write(size_t dest_addr, void *src, size_t size, bool write_encrypted)
+{
+    (void)write_encrypted;
+    if (!in_range(dest_addr, size) || !write_allowed()) {
+        return ESP_FAIL;
+    }
+    s_stats.writes++;
+    // NOR flash can only clear bits
+    const uint8_t *in = src;
+    for (size_t i = 0; i < size; i++) {
+        s_flash[dest_addr + i] &= in[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t bootloader_flash_erase_sector(size_t sector)
+{
+    const size_t offset = sector * SPI_FLASH_SEC_SIZE;
+    if (!in_range(offset, SPI_FLASH_SEC_SIZE) || !write_allowed()) {
+        return ESP_FAIL;
+    }
+    s_stats.erases++;
+    memset(s_flash + offset, 0xFF, SPI_FLASH_SEC_SIZE);
+    return ESP_OK;
+}
+
+uint32_t bootloader_read_flash_id(void)
+{
+    return s_jedec_id;
+}
+
+void bootloader_enable_qio_mode(void)
+{
+    s_quad_enable = true;
+    s_quad = true;
+}
+
+/*
+ * Status register 1 always reads 0: writes complete at once. Register 2 holds QE in bit 1.
+ */
+uint32_t bootloader_execute_flash_command(uint8_t command, uint32_t mosi_data, uint8_t mosi_len, uint8_t miso_len)
+{
+    (void)miso_len;
+    switch (command) {
+    case CMD_RDSR:
+        return 0;
+    case CMD_RDSR2:
+        return s_quad_enable ? 1u << 1 : 0;
+    case CMD_WREN:
+        s_write_enable = true;
+        return 0;
+    case CMD_WRSR:
+        if (mosi_len != 16) {
+            fprintf(stderr, "WRSR of %u bits would leave status register 2 alone\n", mosi_len);
+            abort();
+        }
+        if (s_write_enable) {
+            s_quad_enable = (mosi_data & 1u << 9) != 0;
+            s_write_enable = false;
+        }
+        return 0;
+    default:
+        fprintf(stderr, "Unexpected flash command %02x\n", command);
+        abort();
+    }
+}
+
+esp_rom_spiflash_result_t esp_rom_spiflash_config_readmode(esp_rom_spiflash_read_mode_t mode)
+{
+    s_quad = mode == ESP_ROM_SPIFLASH_QIO_MODE || mode == ESP_ROM_SPIFLASH_QOUT_MODE;
+    return ESP_ROM_SPIFLASH_RESULT_OK;
+}
+
+void bootloader_flash_clock_config(const esp_image_header_t *pfhdr)
+{
+    switch (pfhdr->spi_speed) {
+    case ESP_IMAGE_SPI_SPEED_DIV_1:
+        s_spi_mhz = 80;
+        break;
+    case ESP_IMAGE_SPI_SPEED_DIV_3:
+        s_spi_mhz = 26;
+        break;
+    case ESP_IMAGE_SPI_SPEED_DIV_4:
+        s_spi_mhz = 20;
+        break;
+    default:
+        s_spi_mhz = 40;
+        break;
+    }
+}
+
+void bootloader_flash_gpio_config(const esp_image_header_t *pfhdr)
+{
+    (void)pfhdr;
+}
+
+void bootloader_flash_dummy_config(const esp_image_header_t *pfhdr)
+{
+    (void)pfhdr;
+}
+
+esp_err_t boot_app_cpu_flash_read(uint32_t src_addr, void *dest, uint32_t size)
+{
+    s_app_cpu_stalled = true;
+    const esp_err_t err = bootloader_flash_read(src_addr, dest, size, true);
+    s_app_cpu_stalled = false;
+    return err;
+}
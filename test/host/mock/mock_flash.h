@@ -0,0 +1,111 @@
+/*
+ * Controls for the simulated flash chip of the host build.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MOCK_FLASH_SIZE (4 * 1024 * 1024)
+
+/**
+ * @brief Access counters, reset by mock_flash_reset().
+ */
+typedef struct {
+    uint32_t mmaps;         // bootloader_mmap() calls
+    uint32_t reads;         // bootloader_flash_read() calls
+    uint32_t writes;        // bootloader_flash_write() calls
+    uint32_t erases;        // bootloader_flash_erase_sector() calls
+    uint64_t bytes_read;    // Bytes mapped or read
+} mock_flash_stats_t;
+
+/**
+ * @brief Simulated read throughput of the flash chip, in bytes per microsecond; reset to 0 by mock_flash_reset().
+ *
+ * Every mapped or read byte then advances the simulated time (see mock_hw.h). The default
+ * of 0 makes flash access free. The speed is that of DIO at 40 MHz, QIO at 80 MHz reads four
+ * times as fast.
+ */
+void mock_flash_set_read_speed(uint32_t bytes_per_us);
+
+/**
+ * @brief Sets the JEDEC ID read by bootloader_read_flash_id(); 0 after mock_flash_reset().
+ */
+void mock_flash_set_jedec_id(uint32_t id);
+
+/**
+ * @brief Simulates a board whose WP and HD lines don't reach the flash: reads in a quad mode
+ * come back garbled. Cleared by mock_flash_reset().
+ *
+ * The same happens before bootloader_enable_qio_mode() set the chip's QE bit.
+ */
+void mock_flash_set_quad_broken(bool broken);
+
+/**
+ * @brief Sets the chip's non-volatile QE bit, as some chips leave the factory; cleared by mock_flash_reset().
+ */
+void mock_flash_set_quad_enable(bool enabled);
+
+/**
+ * @brief Returns the chip's QE bit, set by bootloader_enable_qio_mode() or a WRSR command.
+ */
+bool mock_flash_quad_enable(void);
+
+/**
+ * @brief Puts the SPI read mode and clock back to DIO at 40 MHz, as the ROM leaves them.
+ */
+void mock_flash_spi_reset(void);
+
+/**
+ * @brief Returns whether the SPI read mode uses four data lines.
+ */
+bool mock_flash_spi_quad(void);
+
+/**
+ * @brief Returns the SPI clock in MHz.
+ */
+uint32_t mock_flash_spi_mhz(void);
+
+/**
+ * @brief Makes writes and erases fail once @p count more of them have succeeded; reset by mock_flash_reset().
+ */
+void mock_flash_fail_writes_after(uint32_t count);
+
+/**
+ * @brief Erases the whole simulated flash (all 0xFF) and clears the counters.
+ *
+ * A mapped flash dump is unmapped first, the dump itself is left as it is.
+ */
+void mock_flash_reset(void);
+
+/**
+ * @brief Backs the simulated flash with a flash dump file instead, until the next mock_flash_reset().
+ *
+ * The file must hold the whole MOCK_FLASH_SIZE chip, as read with
+ * "esptool.py read_flash 0 0x400000". The counters are cleared as by mock_flash_reset().
+ *
+ * @param path The flash dump
+ * @param write_back Whether writes to the simulated flash go to the file as well
+ * @return true if the file is mapped.
+ */
+bool mock_flash_map_file(const char *path, bool write_back);
+
+/**
+ * @brief Places data in the simulated flash, bypassing the counters.
+ *
+ * Drops the bootloader's read-ahead windows over the data (see boot_flash.h).
+ */
+void mock_flash_put(uint32_t offset, const void *data, size_t size);
+
+/**
+ * @brief Direct pointer to the simulated flash contents.
+ *
+ * Drops all of the bootloader's read-ahead windows, as the caller may change anything.
+ */
+uint8_t *mock_flash_data(void);
+
+/**
+ * @brief Returns the access counters.
+ */
+const mock_flash_stats_t *mock_flash_stats(void);
@@ -0,0 +1,377 @@
+/*
+ * Simulated hardware of the host build.
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "bootloader_common.h"
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_rom_sys.h"
+#include "hal/wdt_hal.h"
+#include "soc/gpio_struct.h"
+#include "soc/io_mux_reg.h"
+#include "soc/rtc.h"
+#include "soc/soc.h"
+#include "mock_hw.h"
+
+// IO_MUX_MTCK_REG reset value: MCU_SEL = 0, FUN_IE clear, pull-down enabled
+#define IO_MUX_MTCK_RESET 0x00000080U
+
+gpio_dev_t GPIO;
+volatile uint32_t mock_io_mux_mtck = IO_MUX_MTCK_RESET;
+
+static bool s_log_enabled = true;
+static uint32_t s_cycles;
+static uint32_t s_cpu_mhz = MOCK_CPU_MHZ;
+// Simulated time at the last change of the CPU clock, and the cycle counter then
+static uint32_t s_clock_base_us;
+static uint32_t s_clock_base_cycles;
+static bool (*s_button_script)(uint32_t us);
+static rtc_retain_mem_t s_rtc_retain_mem;
+static soc_reset_reason_t s_reset_reason = RESET_REASON_CHIP_POWER_ON;
+static uint32_t s_wdt_feeds;
+static uint32_t s_sha_block_cycles;
+static uint32_t s_sha_busy_until;
+static bool s_app_cpu_present = true;
+static uint32_t s_uart_idle_at;     // When the UART has sent all characters in its FIFO
+static uint32_t s_uart_bytes;
+static FILE *s_uart_output;
+
+static void uart_putc(char c);
+static void (*s_putc)(char c) = uart_putc;
+
+static uint32_t s_iram[(SOC_IRAM_HIGH - SOC_IRAM_LOW) / 4];
+static uint32_t s_dram[(SOC_DRAM_HIGH - SOC_DRAM_LOW) / 4];
+// RTC fast memory is seen at two addresses, from the instruction and the data bus
+static uint32_t s_rtc_fast[(SOC_RTC_IRAM_HIGH - SOC_RTC_IRAM_LOW) / 4];
+static uint32_t s_rtc_slow[(SOC_RTC_DATA_HIGH - SOC_RTC_DATA_LOW) / 4];
+
+// Stand-ins for the symbols of the bootloader's linker script, see mock_linker_addr()
+int _dram_start, _dram_end, _loader_text_start, _loader_text_end;
+
+void mock_hw_reset(void)
+{
+    memset((void *)&GPIO, 0, sizeof(GPIO));
+    GPIO.in = (1u << MOCK_BUTTON_GPIO);
+    mock_io_mux_mtck = IO_MUX_MTCK_RESET;
+    s_cycles = 0;
+    s_cpu_mhz = MOCK_CPU_MHZ;
+    s_clock_base_us = 0;
+    s_clock_base_cycles = 0;
+    s_button_script = NULL;
+    s_reset_reason = RESET_REASON_CHIP_POWER_ON;
+    s_wdt_feeds = 0;
+    s_sha_block_cycles = 0;
+    s_sha_busy_until = 0;
+    s_app_cpu_present = true;
+    s_uart_idle_at = 0;
+    s_uart_bytes = 0;
+    s_putc = uart_putc;
+    mock_app_cpu_reset();
+}
+
+void mock_reset_reason_set(soc_reset_reason_t reason)
+{
+    s_reset_reason = reason;
+}
+
+soc_reset_reason_t esp_rom_get_reset_reason(int cpu_no)
+{
+    (void)cpu_no;
+    return s_reset_reason;
+}
+
+void wdt_hal_write_protect_disable(wdt_hal_context_t *hal)
+{
+}
+
+void wdt_hal_write_protect_enable(wdt_hal_context_t *hal)
+{
+}
+
+void wdt_hal_feed(wdt_hal_context_t *hal)
+{
+    s_wdt_feeds++;
+}
+
+uint32_t mock_wdt_feeds(void)
+{
+    return s_wdt_feeds;
+}
+
+void *esp_cpu_get_sp(void)
+{
+    return (void *)(uintptr_t)MOCK_STACK_POINTER;
+}
+
+void mock_ram_fill(uint8_t value)
+{
+    memset(s_iram, value, sizeof(s_iram));
+    memset(s_dram, value, sizeof(s_dram));
+    memset(s_rtc_fast, value, sizeof(s_rtc_fast));
+    memset(s_rtc_slow, value, sizeof(s_rtc_slow));
+}
+
+uint32_t *mock_ram(uint32_t addr)
+{
+    if (addr >= SOC_IRAM_LOW && addr < SOC_IRAM_HIGH) {
+        return &s_iram[(addr - SOC_IRAM_LOW) / 4];
+    }
+    if (addr >= SOC_DRAM_LOW && addr < SOC_DRAM_HIGH) {
+        return &s_dram[(addr - SOC_DRAM_LOW) / 4];
+    }
+    if (addr >= SOC_RTC_IRAM_LOW && addr < SOC_RTC_IRAM_HIGH) {
+        return &s_rtc_fast[(addr - SOC_RTC_IRAM_LOW) / 4];
+    }
+    if (addr >= SOC_RTC_DRAM_LOW && addr < SOC_RTC_DRAM_HIGH) {
+        return &s_rtc_fast[(addr - SOC_RTC_DRAM_LOW) / 4];
+    }
+    if (addr >= SOC_RTC_DATA_LOW && addr < SOC_RTC_DATA_HIGH) {
+        return &s_rtc_slow[(addr - SOC_RTC_DATA_LOW) / 4];
+    }
+    return NULL;
+}
+
+uintptr_t mock_linker_addr(const int *sym)
+{
+    // The loader segment and the bootloader's data, as laid out by bootloader.ld
+    if (sym == &_loader_text_start) {
+        return MOCK_LOADER_TEXT_START;
+    }
+    if (sym == &_loader_text_end) {
+        return MOCK_LOADER_TEXT_END;
+    }
+    if (sym == &_dram_start) {
+        return MOCK_DRAM_START;
+    }
+    if (sym == &_dram_end) {
+        return MOCK_DRAM_END;
+    }
+    return (uintptr_t)sym;
+}
+
+void mock_rtc_power_loss(void)
+{
+    uint8_t *p = (uint8_t *)&s_rtc_retain_mem;
+    for (size_t i = 0; i < sizeof(s_rtc_retain_mem); i++) {
+        p[i] = (uint8_t)(i * 131 + 7);
+    }
+}
+
+rtc_retain_mem_t *bootloader_common_get_rtc_retain_mem(void)
+{
+    return &s_rtc_retain_mem;
+}
+
+void mock_button_set_script(bool (*script)(uint32_t us))
+{
+    s_button_script = script;
+}
+
+uint32_t mock_time_us(void)
+{
+    // The simulated APP CPU may set the counter back to before the last clock change
+    return s_clock_base_us + (uint32_t)((int32_t)(s_cycles - s_clock_base_cycles) / (int32_t)s_cpu_mhz);
+}
+
+void mock_time_advance_us(uint32_t us)
+{
+    s_cycles += us * s_cpu_mhz;
+}
+
+/**
+ * @brief Converts cycles at MOCK_CPU_MHZ, i.e. of the APB clock, into cycles of the CPU clock.
+ */
+static uint32_t apb_cycles(uint32_t cycles)
+{
+    return (uint32_t)((uint64_t)cycles * s_cpu_mhz / MOCK_CPU_MHZ);
+}
+
+/**
+ * @brief Rescales a point in time given in cycles after a change of the CPU clock.
+ */
+static uint32_t rescale(uint32_t at, uint32_t old_mhz)
+{
+    if ((int32_t)(at - s_cycles) <= 0) {
+        return at;
+    }
+    return s_cycles + (uint32_t)((uint64_t)(at - s_cycles) * s_cpu_mhz / old_mhz);
+}
+
+bool rtc_clk_cpu_freq_mhz_to_config(uint32_t freq_mhz, rtc_cpu_freq_config_t *out_config)
+{
+    if (freq_mhz != 40 && freq_mhz != 80 && freq_mhz != 160 && freq_mhz != 240) {
+        return false;
+    }
+    out_config->source = freq_mhz == 40 ? SOC_CPU_CLK_SRC_XTAL : SOC_CPU_CLK_SRC_PLL;
+    out_config->source_freq_mhz = freq_mhz == 40 ? 40 : freq_mhz == 240 ? 480 : 320;
+    out_config->div = out_config->source_freq_mhz / freq_mhz;
+    out_config->freq_mhz = freq_mhz;
+    return true;
+}
+
+void rtc_clk_cpu_freq_set_config(const rtc_cpu_freq_config_t *config)
+{
+    s_clock_base_us = mock_time_us();
+    s_clock_base_cycles = s_cycles;
+    const uint32_t old_mhz = s_cpu_mhz;
+    s_cpu_mhz = config->freq_mhz;
+    s_sha_busy_until = rescale(s_sha_busy_until, old_mhz);
+    s_uart_idle_at = rescale(s_uart_idle_at, old_mhz);
+}
+
+void rtc_clk_cpu_freq_get_config(rtc_cpu_freq_config_t *out_config)
+{
+    rtc_clk_cpu_freq_mhz_to_config(s_cpu_mhz, out_config);
+}
+
+uint32_t mock_time_cycles(void)
+{
+    return s_cycles;
+}
+
+void mock_time_set_cycles(uint32_t cycles)
+{
+    s_cycles = cycles;
+}
+
+void mock_app_cpu_set_present(bool present)
+{
+    s_app_cpu_present = present;
+}
+
+bool mock_app_cpu_present(void)
+{
+    return s_app_cpu_present;
+}
+
+void mock_sha_set_block_cycles(uint32_t cycles)
+{
+    s_sha_block_cycles = cycles;
+}
+
+void mock_sha_engine_wait(void)
+{
+    if ((int32_t)(s_sha_busy_until - s_cycles) > 0) {
+        s_cycles = s_sha_busy_until;
+    }
+}
+
+void mock_sha_engine_start_block(void)
+{
+    mock_sha_engine_wait();
+    s_sha_busy_until = s_cycles + apb_cycles(s_sha_block_cycles);
+}
+
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void)
+{
+    s_cycles += MOCK_CYCLES_PER_READ;
+    // The line only changes when time passes, i.e. between two reads of the cycle counter
+    if (s_button_script != NULL) {
+        mock_button_set(s_button_script(mock_time_us()));
+    }
+    return s_cycles;
+}
+
+uint32_t esp_rom_get_cpu_ticks_per_us(void)
+{
+    return s_cpu_mhz;
+}
+
+void mock_button_set(bool pressed)
+{
+    if (pressed) {
+        GPIO.in &= ~(1u << MOCK_BUTTON_GPIO);
+    } else {
+        GPIO.in |= (1u << MOCK_BUTTON_GPIO);
+    }
+}
+
+void mock_log_enable(bool enable)
+{
+    s_log_enabled = enable;
+}
+
+static void uart_putc(char c)
+{
+    const uint32_t char_cycles = apb_cycles(MOCK_UART_CHAR_CYCLES);
+    const uint32_t full = (MOCK_UART_FIFO_LEN - 1) * char_cycles;
+    if ((int32_t)(s_uart_idle_at - s_cycles) > (int32_t)full) {
+        s_cycles = s_uart_idle_at - full;
+    }
+    s_uart_idle_at = ((int32_t)(s_uart_idle_at - s_cycles) > 0 ? s_uart_idle_at : s_cycles) + char_cycles;
+    s_uart_bytes++;
+    if (s_log_enabled) {
+        fputc(c, s_uart_output != NULL ? s_uart_output : stdout);
+    }
+}
+
+void mock_uart_set_output(FILE *file)
+{
+    s_uart_output = file;
+}
+
+uint32_t mock_uart_bytes(void)
+{
+    return s_uart_bytes;
+}
+
+void esp_rom_install_channel_putc(int channel, void (*putc)(char c))
+{
+    if (channel == 1) {
+        s_putc = putc;
+    }
+}
+
+void esp_rom_install_uart_printf(void)
+{
+    s_putc = uart_putc;
+}
+
+static void vprint(const char *format, va_list args)
+{
+    char line[256];
+    const int len = vsnprintf(line, sizeof(line), format, args);
+    for (int i = 0; i < len && i < (int)sizeof(line) - 1; i++) {
+        s_putc(line[i]);
+    }
+}
+
+int esp_rom_printf(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vprint(format, args);
+    va_end(args);
+    return 0;
+}
+
+void mock_log(char level, const char *tag, const char *format, ...)
+{
+    // As the IDF's ESP_LOGx(), which leaves out the levels above CONFIG_BOOTLOADER_LOG_LEVEL
+    static const char LEVELS[] = "EWIDV";
+    if (strchr(LEVELS, level) - LEVELS >= CONFIG_BOOTLOADER_LOG_LEVEL) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    esp_rom_printf("%c (%s) ", level, tag);
+    vprint(format, args);
+    esp_rom_printf("\n");
+    va_end(args);
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1U)));
+        }
+    }
+    return ~crc;
+}
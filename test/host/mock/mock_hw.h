@@ -0,0 +1,161 @@
+/*
+ * Controls for the simulated hardware of the host build.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "esp_rom_sys.h"
+
+#define MOCK_BUTTON_GPIO 13
+
+/**
+ * @brief Restores all simulated registers to their reset values.
+ */
+void mock_hw_reset(void);
+
+/**
+ * @brief Sets the level the button line reads as: LOW while the button is held.
+ */
+void mock_button_set(bool pressed);
+
+/**
+ * @brief Drives the button line from a function of the simulated time instead of a fixed level.
+ *
+ * @param script Returns whether the button reads as pressed at the given time, NULL to stop
+ */
+void mock_button_set_script(bool (*script)(uint32_t us));
+
+/**
+ * @brief Simulated CPU clock: the cycle counter advances by MOCK_CYCLES_PER_READ on every read.
+ *
+ * The CPU runs at MOCK_CPU_MHZ after mock_hw_reset() and bootloader_init(), and can be switched
+ * to 40, 160 or 240 MHz with rtc_clk_cpu_freq_set_config(). The APB clock, and with it the
+ * UART and the SHA accelerator, stays at 80 MHz.
+ */
+#define MOCK_CPU_MHZ 80
+#define MOCK_CYCLES_PER_READ 8
+
+/**
+ * @brief Returns the simulated time in microseconds, without advancing it.
+ */
+uint32_t mock_time_us(void);
+
+/**
+ * @brief Advances the simulated time.
+ */
+void mock_time_advance_us(uint32_t us);
+
+/**
+ * @brief Returns the cycle counter without advancing it.
+ */
+uint32_t mock_time_cycles(void);
+
+/**
+ * @brief Sets the cycle counter, e.g. to run the simulated APP CPU on its own clock.
+ */
+void mock_time_set_cycles(uint32_t cycles);
+
+/**
+ * @brief Simulates a single-core chip, where boot_app_cpu_start() fails. Dual-core after mock_hw_reset().
+ */
+void mock_app_cpu_set_present(bool present);
+
+/**
+ * @brief Returns whether the simulated chip has an APP CPU.
+ */
+bool mock_app_cpu_present(void);
+
+/**
+ * @brief Puts the simulated APP CPU back in reset, as a chip reset does.
+ */
+void mock_app_cpu_reset(void);
+
+/**
+ * @brief Returns whether the simulated APP CPU is running a job, which must not use
+ * bootloader_sha256_*() (see boot_sha.h).
+ */
+bool mock_app_cpu_in_job(void);
+
+/**
+ * @brief Returns whether a job posted to the simulated APP CPU may still run, so that CPU0
+ * must not read flash other than through boot_app_cpu_flash_read().
+ */
+bool mock_app_cpu_busy(void);
+
+/**
+ * @brief Simulated SHA accelerator: each 64 byte block keeps it busy for this many CPU cycles
+ * at MOCK_CPU_MHZ. It runs on the APB clock, so a faster CPU clock doesn't speed it up.
+ *
+ * As on the ESP32, bootloader_sha256_data() and boot_sha_data() start a full block and returns without waiting
+ * for it; only the next block or the digest waits. The default of 0 after mock_hw_reset()
+ * makes hashing free.
+ */
+void mock_sha_set_block_cycles(uint32_t cycles);
+
+/**
+ * @brief Used by the SHA-256 stand-in: waits for the simulated accelerator, then starts a block.
+ */
+void mock_sha_engine_start_block(void);
+
+/**
+ * @brief Used by the SHA-256 stand-in: waits until the simulated accelerator is idle.
+ */
+void mock_sha_engine_wait(void);
+
+/**
+ * @brief Simulated console UART at 115200 baud, with the ESP32's 128 byte transmit FIFO.
+ *
+ * esp_rom_printf() waits as on the chip while the FIFO is full, so log output costs simulated
+ * time also when muted with mock_log_enable(). Characters take MOCK_UART_CHAR_CYCLES at
+ * MOCK_CPU_MHZ.
+ */
+#define MOCK_UART_CHAR_CYCLES (MOCK_CPU_MHZ * 1000000 / (115200 / 10))
+#define MOCK_UART_FIFO_LEN 128
+
+/**
+ * @brief Writes what the UART sends to a file instead of stdout (NULL: stdout again).
+ */
+void mock_uart_set_output(FILE *file);
+
+/**
+ * @brief Returns the number of characters sent to the UART since mock_hw_reset().
+ */
+uint32_t mock_uart_bytes(void);
+
+/**
+ * @brief Simulated stack pointer of the bootloader, as on the ESP32 right below the ROM stack.
+ */
+#define MOCK_STACK_POINTER 0x3FFE2000
+
+/**
+ * @brief Text of the loader segment (iram_loader_seg) and data of the bootloader, as placed by
+ * the linker script; the stand-ins for its symbols are mapped there by mock_linker_addr().
+ */
+#define MOCK_LOADER_TEXT_START  0x40078000
+#define MOCK_LOADER_TEXT_END    0x4007E000
+#define MOCK_DRAM_START         0x3FFF0000
+#define MOCK_DRAM_END           0x3FFF6000
+
+/**
+ * @brief Sets the reset reason reported by esp_rom_get_reset_reason(); power-on after mock_hw_reset().
+ */
+void mock_reset_reason_set(soc_reset_reason_t reason);
+
+/**
+ * @brief Returns how often the RTC watchdog was fed since mock_hw_reset().
+ */
+uint32_t mock_wdt_feeds(void);
+
+/**
+ * @brief Fills all simulated RAM (IRAM, DRAM, RTC fast and slow memory) with a byte value.
+ *
+ * Addresses are translated with mock_ram() from soc/soc.h.
+ */
+void mock_ram_fill(uint8_t value);
+
+/**
+ * @brief Simulates a power loss: the RTC retain memory comes back filled with garbage.
+ */
+void mock_rtc_power_loss(void);
@@ -0,0 +1,184 @@
+/*
+ * Software SHA-256 behind the host bootloader_sha.h and boot_sha.h, timed like the ESP32
+ * accelerator (see mock_hw.h).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bootloader_sha.h"
+#include "boot_sha.h"
+#include "mock_hw.h"
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t len;
+    uint8_t block[64];
+    size_t used;
+} sha256_ctx_t;
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void compress(sha256_ctx_t *ctx, const uint8_t *p)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        const uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        const uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3];
+    uint32_t e = ctx->state[4], f = ctx->state[5], g = ctx->state[6], h = ctx->state[7];
+    for (int i = 0; i < 64; i++) {
+        const uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+        const uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    ctx->state[0] += a;
+    ctx->state[1] += b;
+    ctx->state[2] += c;
+    ctx->state[3] += d;
+    ctx->state[4] += e;
+    ctx->state[5] += f;
+    ctx->state[6] += g;
+    ctx->state[7] += h;
+}
+
+/**
+ * @brief The ESP-IDF driver reads the accelerator without the DPORT workaround, so only CPU0
+ * may use it.
+ */
+static void check_cpu(const char *func)
+{
+    if (mock_app_cpu_in_job()) {
+        fprintf(stderr, "%s() called on the APP CPU, see boot_sha.h\n", func);
+        abort();
+    }
+}
+
+static bootloader_sha256_handle_t sha_start(void)
+{
+    static const uint32_t init[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    sha256_ctx_t *ctx = calloc(1, sizeof(*ctx));
+    memcpy(ctx->state, init, sizeof(init));
+    return ctx;
+}
+
+static void update(sha256_ctx_t *ctx, const void *data, size_t data_len)
+{
+    const uint8_t *p = data;
+    ctx->len += data_len;
+    while (data_len > 0) {
+        size_t n = sizeof(ctx->block) - ctx->used;
+        if (n > data_len) {
+            n = data_len;
+        }
+        memcpy(ctx->block + ctx->used, p, n);
+        ctx->used += n;
+        p += n;
+        data_len -= n;
+        if (ctx->used == sizeof(ctx->block)) {
+            mock_sha_engine_start_block();
+            compress(ctx, ctx->block);
+            ctx->used = 0;
+        }
+    }
+}
+
+static void sha_data(bootloader_sha256_handle_t handle, const void *data, size_t data_len)
+{
+    // The ESP32 driver feeds the accelerator whole words and asserts the same
+    if (data_len % 4 != 0 || (uintptr_t)data % 4 != 0) {
+        fprintf(stderr, "SHA-256 fed %zu bytes at %p, not whole words\n", data_len, data);
+        abort();
+    }
+    update(handle, data, data_len);
+}
+
+static void sha_finish(bootloader_sha256_handle_t handle, uint8_t *digest)
+{
+    sha256_ctx_t *ctx = handle;
+    // The driver writes the digest a word at a time
+    if ((uintptr_t)digest % 4 != 0) {
+        fprintf(stderr, "SHA-256 digest %p is not word aligned\n", (void *)digest);
+        abort();
+    }
+    if (digest != NULL) {
+        const uint64_t bits = ctx->len * 8;
+        const uint8_t pad = 0x80;
+        const uint8_t zero = 0;
+        update(ctx, &pad, 1);
+        while (ctx->used != 56) {
+            update(ctx, &zero, 1);
+        }
+        uint8_t len_be[8];
+        for (int i = 0; i < 8; i++) {
+            len_be[i] = (uint8_t)(bits >> (56 - 8 * i));
+        }
+        update(ctx, len_be, 8);
+        mock_sha_engine_wait();
+        for (int i = 0; i < 8; i++) {
+            digest[4 * i] = (uint8_t)(ctx->state[i] >> 24);
+            digest[4 * i + 1] = (uint8_t)(ctx->state[i] >> 16);
+            digest[4 * i + 2] = (uint8_t)(ctx->state[i] >> 8);
+            digest[4 * i + 3] = (uint8_t)ctx->state[i];
+        }
+    }
+    free(ctx);
+}
+
+bootloader_sha256_handle_t bootloader_sha256_start(void)
+{
+    check_cpu(__func__);
+    return sha_start();
+}
+
+void bootloader_sha256_data(bootloader_sha256_handle_t handle, const void *data, size_t data_len)
+{
+    check_cpu(__func__);
+    sha_data(handle, data, data_len);
+}
+
+void bootloader_sha256_finish(bootloader_sha256_handle_t handle, uint8_t *digest)
+{
+    check_cpu(__func__);
+    sha_finish(handle, digest);
+}
+
+bootloader_sha256_handle_t boot_sha_start(void)
+{
+    return sha_start();
+}
+
+void boot_sha_data(bootloader_sha256_handle_t sha, const void *data, size_t data_len)
+{
+    sha_data(sha, data, data_len);
+}
+
+void boot_sha_finish(bootloader_sha256_handle_t sha, uint8_t *digest)
+{
+    sha_finish(sha, digest);
+}
@@ -0,0 +1,49 @@
+/*
+ * Host stand-in for the generated sdkconfig.h, mirroring sdkconfig.esp32dev.
+ */
+#pragma once
+
+#define CONFIG_IDF_TARGET_ESP32 1
+#define CONFIG_PARTITION_TABLE_OFFSET 0x8000
+#define CONFIG_BOOTLOADER_OFFSET_IN_FLASH 0x1000
+#define CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC 1
+#define CONFIG_BOOTLOADER_CUSTOM_RESERVE_RTC_SIZE 0xC00
+#define CONFIG_BOOTLOADER_LOG_LEVEL 3
+#define CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE 1
+#define CONFIG_BETTEROTA_LOAD_ATTEMPTS 2
+#define CONFIG_BETTEROTA_FAST_WAKE 1
+#define CONFIG_BETTEROTA_PTABLE_CACHE 1
+#define CONFIG_BETTEROTA_COMPRESSED_IMAGES 1
+// The serial loader is built per target in CMakeLists.txt
+#ifndef CONFIG_BETTEROTA_PIPELINED_VERIFY
+#define CONFIG_BETTEROTA_PIPELINED_VERIFY 1
+#endif
+#ifndef CONFIG_BETTEROTA_APP_CPU
+#define CONFIG_BETTEROTA_APP_CPU 1
+#endif
+#define CONFIG_BETTEROTA_LAZY_VERIFY 1
+#define CONFIG_BETTEROTA_MERKLE 1
+#define CONFIG_BETTEROTA_SEGMENT_INDEX 1
+#define CONFIG_BETTEROTA_READ_AHEAD 1
+#define CONFIG_BETTEROTA_READ_AHEAD_SIZE 512
+#define CONFIG_BETTEROTA_FLASH_PROBE 1
+#define CONFIG_BETTEROTA_CLOCK_BOOST 1
+#define CONFIG_BETTEROTA_CLOCK_BOOST_MHZ 240
+#define CONFIG_BETTEROTA_BLANK_PROBE 1
+#define CONFIG_BETTEROTA_TRIAL_BOOT 1
+#define CONFIG_BETTEROTA_TRIAL_BOOT_ATTEMPTS 3
+#define CONFIG_BETTEROTA_VERIFIED_CACHE 1
+#define CONFIG_BETTEROTA_VERIFIED_CACHE_INTERVAL 16
+#define CONFIG_BETTEROTA_VERIFIED_CACHE_MERKLE_BLOCKS 4
+#define CONFIG_BETTEROTA_LOAD_CHUNK_SIZE 2048
+#define CONFIG_BETTEROTA_PATCH 1
+#define CONFIG_BETTEROTA_DEFERRED_LOG 1
+#define CONFIG_BETTEROTA_DEFERRED_LOG_SIZE 2048
+// Tokenized log lines are built per target in CMakeLists.txt
+// The majority vote is selected per target in CMakeLists.txt
+#ifndef CONFIG_BETTEROTA_BUTTON_DEBOUNCE_MAJORITY
+#define CONFIG_BETTEROTA_BUTTON_DEBOUNCE_STABLE 1
+#endif
+#define CONFIG_BETTEROTA_BUTTON_SAMPLES 5
+#define CONFIG_BETTEROTA_BUTTON_SAMPLE_INTERVAL_US 100
+#define CONFIG_BETTEROTA_BUTTON_BUDGET_US 800
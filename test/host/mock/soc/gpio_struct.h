@@ -0,0 +1,18 @@
+/*
+ * Host stand-in for soc/gpio_struct.h, covering the registers the bootloader touches.
+ */
+#pragma once
+
+#include <stdint.h>
+
+typedef volatile struct {
+    uint32_t out;
+    uint32_t out_w1ts;
+    uint32_t out_w1tc;
+    uint32_t enable;
+    uint32_t enable_w1ts;
+    uint32_t enable_w1tc;
+    uint32_t in;
+} gpio_dev_t;
+
+extern gpio_dev_t GPIO;
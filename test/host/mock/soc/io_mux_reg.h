@@ -0,0 +1,11 @@
+/*
+ * Host stand-in for soc/io_mux_reg.h. The IO_MUX register of the MTCK pad (GPIO 13)
+ * is backed by a plain variable.
+ */
+#pragma once
+
+#include <stdint.h>
+
+extern volatile uint32_t mock_io_mux_mtck;
+
+#define PERIPHS_IO_MUX_MTCK_U (&mock_io_mux_mtck)
@@ -0,0 +1,23 @@
+/*
+ * Host stand-in for soc/rtc.h. The CPU clock is simulated, see mock_hw.h.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    SOC_CPU_CLK_SRC_XTAL,
+    SOC_CPU_CLK_SRC_PLL,
+} soc_cpu_clk_src_t;
+
+typedef struct {
+    soc_cpu_clk_src_t source;
+    uint32_t source_freq_mhz;
+    uint32_t div;
+    uint32_t freq_mhz;
+} rtc_cpu_freq_config_t;
+
+bool rtc_clk_cpu_freq_mhz_to_config(uint32_t freq_mhz, rtc_cpu_freq_config_t *out_config);
+void rtc_clk_cpu_freq_set_config(const rtc_cpu_freq_config_t *config);
+void rtc_clk_cpu_freq_get_config(rtc_cpu_freq_config_t *out_config);
@@ -0,0 +1,38 @@
+/*
+ * Host stand-in for the ESP32 soc/soc.h memory map.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#define SOC_IROM_LOW        0x400D0000
+#define SOC_IROM_HIGH       0x40400000
+#define SOC_DROM_LOW        0x3F400000
+#define SOC_DROM_HIGH       0x3F800000
+#define SOC_IRAM_LOW        0x40070000
+#define SOC_IRAM_HIGH       0x400A0000
+#define SOC_DRAM_LOW        0x3FFAE000
+#define SOC_DRAM_HIGH       0x40000000
+#define SOC_RTC_IRAM_LOW    0x400C0000
+#define SOC_RTC_IRAM_HIGH   0x400C2000
+#define SOC_RTC_DRAM_LOW    0x3FF80000
+#define SOC_RTC_DRAM_HIGH   0x3FF82000
+#define SOC_RTC_DATA_LOW    0x50000000
+#define SOC_RTC_DATA_HIGH   0x50002000
+#define SOC_ROM_STACK_START 0x3FFE3F20
+
+/**
+ * @brief Host address of a word of simulated RAM, see mock_hw.h; NULL outside of RAM.
+ */
+uint32_t *mock_ram(uint32_t addr);
+
+// Makes the image loader write segments to the simulated RAM
+#define BOOT_IMAGE_RAM(addr) mock_ram(addr)
+
+/**
+ * @brief Address on the chip of one of the stand-ins for the linker script symbols, see mock_hw.c.
+ */
+uintptr_t mock_linker_addr(const int *sym);
+
+// Makes the image loader check segments against the bootloader's layout on the chip
+#define BOOT_IMAGE_LINKER_ADDR(sym) mock_linker_addr(&(sym))
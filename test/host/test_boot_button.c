@@ -0,0 +1,119 @@
+/*
+ * Tests of the debounced boot button read.
+ *
+ * Built twice: once with the stable window (the sdkconfig.esp32dev default) and once
+ * with CONFIG_BETTEROTA_BUTTON_DEBOUNCE_MAJORITY.
+ */
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "mock_hw.h"
+#include "boot_button.h"
+#include "test_harness.h"
+
+static const uint32_t SAMPLES = CONFIG_BETTEROTA_BUTTON_SAMPLES;
+static const uint32_t INTERVAL_US = CONFIG_BETTEROTA_BUTTON_SAMPLE_INTERVAL_US;
+static const uint32_t BUDGET_US = CONFIG_BETTEROTA_BUTTON_BUDGET_US;
+
+static void setup(void)
+{
+    mock_hw_reset();
+    mock_log_enable(false);
+}
+
+// Contact bounce for the first 250 us, then held
+static bool bounce_then_pressed(uint32_t us)
+{
+    return us >= 250 || (us / 30) % 2 == 0;
+}
+
+// Toggles every sample interval, never settling
+static bool chatter(uint32_t us)
+{
+    return (us / INTERVAL_US) % 2 == 0;
+}
+
+// Released, with a single glitch right at the first sample
+static bool glitch_then_released(uint32_t us)
+{
+    return us < INTERVAL_US / 2;
+}
+
+static void test_steady_released(void)
+{
+    setup();
+    button_result_t r;
+    TEST_ASSERT(!button_read(&r));
+    TEST_ASSERT(!r.timed_out);
+    TEST_ASSERT_EQUAL_INT(0, r.pressed_samples);
+#if CONFIG_BETTEROTA_BUTTON_DEBOUNCE_MAJORITY
+    TEST_ASSERT_EQUAL_INT(SAMPLES / 2 + 1, r.samples);
+#else
+    TEST_ASSERT_EQUAL_INT(SAMPLES, r.samples);
+#endif
+}
+
+static void test_steady_pressed(void)
+{
+    setup();
+    mock_button_set(true);
+    button_result_t r;
+    TEST_ASSERT(button_read(&r));
+    TEST_ASSERT(!r.timed_out);
+    TEST_ASSERT_EQUAL_INT(r.samples, r.pressed_samples);
+}
+
+static void test_bounce_settles_pressed(void)
+{
+    setup();
+    mock_button_set_script(bounce_then_pressed);
+    button_result_t r;
+    TEST_ASSERT(button_read(&r));
+    TEST_ASSERT(!r.timed_out);
+}
+
+static void test_glitch_is_rejected(void)
+{
+    setup();
+    mock_button_set_script(glitch_then_released);
+    button_result_t r;
+    TEST_ASSERT(!button_read(&r));
+    TEST_ASSERT_EQUAL_INT(1, r.pressed_samples);
+    TEST_ASSERT(!r.timed_out);
+}
+
+static void test_chatter_respects_budget(void)
+{
+    setup();
+    mock_button_set_script(chatter);
+    button_result_t r;
+    button_read(&r);
+#if !CONFIG_BETTEROTA_BUTTON_DEBOUNCE_MAJORITY
+    TEST_ASSERT(r.timed_out);
+#endif
+    TEST_ASSERT(r.elapsed_us <= BUDGET_US);
+    TEST_ASSERT(mock_time_us() <= BUDGET_US + 1);
+}
+
+static void test_elapsed_matches_simulated_time(void)
+{
+    setup();
+    mock_time_advance_us(1000);
+    button_result_t r;
+    button_read(&r);
+    const uint32_t taken = mock_time_us() - 1000;
+    TEST_ASSERT(r.elapsed_us <= taken);
+    TEST_ASSERT(r.elapsed_us + 1 >= taken);
+    TEST_ASSERT(r.elapsed_us >= (r.samples - 1) * INTERVAL_US);
+}
+
+int main(void)
+{
+    RUN_TEST(test_steady_released);
+    RUN_TEST(test_steady_pressed);
+    RUN_TEST(test_bounce_settles_pressed);
+    RUN_TEST(test_glitch_is_rejected);
+    RUN_TEST(test_chatter_respects_budget);
+    RUN_TEST(test_elapsed_matches_simulated_time);
+    return TEST_SUMMARY();
+}
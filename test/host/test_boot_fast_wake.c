@@ -0,0 +1,108 @@
+/*
+ * Tests of the deep-sleep wake record.
+ */
+#include <stdint.h>
+#include <string.h>
+#include "esp_log.h"
+#include "mock_hw.h"
+#include "mock_flash.h"
+#include "boot_rtc.h"
+#include "boot_fast_wake.h"
+#include "fixtures.h"
+#include "test_harness.h"
+
+// A verified image of 0x1230 bytes at the start of OTA_1, digest included
+#define IMAGE_LEN 0x1230
+#define DIGEST_OFFSET (FIXTURE_OTA_1_OFFSET + IMAGE_LEN - 32)
+
+static esp_image_metadata_t s_data;
+static esp_partition_pos_t s_part;
+
+static void setup(void)
+{
+    mock_hw_reset();
+    mock_flash_reset();
+    mock_log_enable(false);
+    mock_rtc_power_loss();
+
+    s_part = fixture_state().ota[1];
+    memset(&s_data, 0, sizeof(s_data));
+    s_data.start_addr = s_part.offset;
+    s_data.image.hash_appended = 1;
+    s_data.image_len = IMAGE_LEN;
+    for (int i = 0; i < 32; i++) {
+        s_data.image_digest[i] = (uint8_t)(0xA0 + i);
+    }
+    mock_flash_put(DIGEST_OFFSET, s_data.image_digest, sizeof(s_data.image_digest));
+}
+
+static void test_no_record_after_power_loss(void)
+{
+    setup();
+    TEST_ASSERT(!boot_fast_wake_check(&s_part));
+}
+
+static void test_unchanged_image_skips_verification(void)
+{
+    setup();
+    boot_fast_wake_record(&s_part, &s_data);
+    TEST_ASSERT_EQUAL_HEX32(DIGEST_OFFSET, boot_rtc()->wake.digest_offset);
+    TEST_ASSERT(boot_fast_wake_check(&s_part));
+    // A single read of the window around the digest is all it costs
+    TEST_ASSERT_EQUAL_INT(1, mock_flash_stats()->reads);
+    TEST_ASSERT_EQUAL_INT(CONFIG_BETTEROTA_READ_AHEAD_SIZE, mock_flash_stats()->bytes_read);
+}
+
+static void test_other_partition_is_verified(void)
+{
+    setup();
+    boot_fast_wake_record(&s_part, &s_data);
+    const esp_partition_pos_t other = fixture_state().ota[0];
+    TEST_ASSERT(!boot_fast_wake_check(&other));
+}
+
+static void test_flash_write_forces_verification(void)
+{
+    setup();
+    boot_fast_wake_record(&s_part, &s_data);
+    boot_rtc_note_flash_write();
+    TEST_ASSERT(!boot_fast_wake_check(&s_part));
+}
+
+static void test_rewritten_image_is_verified(void)
+{
+    setup();
+    boot_fast_wake_record(&s_part, &s_data);
+    const uint8_t changed = 0x00;
+    mock_flash_put(DIGEST_OFFSET + 31, &changed, 1);
+    TEST_ASSERT(!boot_fast_wake_check(&s_part));
+}
+
+static void test_corrupt_record_is_ignored(void)
+{
+    setup();
+    boot_fast_wake_record(&s_part, &s_data);
+    boot_rtc()->wake.part_size ^= 0x1000;
+    TEST_ASSERT(!boot_fast_wake_check(&s_part));
+}
+
+static void test_image_without_digest_is_not_recorded(void)
+{
+    setup();
+    boot_fast_wake_record(&s_part, &s_data);
+    s_data.image.hash_appended = 0;
+    boot_fast_wake_record(&s_part, &s_data);
+    TEST_ASSERT(!boot_fast_wake_check(&s_part));
+}
+
+int main(void)
+{
+    RUN_TEST(test_no_record_after_power_loss);
+    RUN_TEST(test_unchanged_image_skips_verification);
+    RUN_TEST(test_other_partition_is_verified);
+    RUN_TEST(test_flash_write_forces_verification);
+    RUN_TEST(test_rewritten_image_is_verified);
+    RUN_TEST(test_corrupt_record_is_ignored);
+    RUN_TEST(test_image_without_digest_is_not_recorded);
+    return TEST_SUMMARY();
+}
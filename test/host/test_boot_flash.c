@@ -0,0 +1,142 @@
+/*
+ * Tests of the buffered flash reads.
+ */
+#include <stdint.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "mock_hw.h"
+#include "bootloader_flash_priv.h"
+#include "mock_flash.h"
+#include "boot_flash.h"
+#include "test_harness.h"
+
+#define WINDOW CONFIG_BETTEROTA_READ_AHEAD_SIZE
+#define BASE 0x20000
+
+// Taken once, as mock_flash_data() drops the windows
+static const uint8_t *s_flash;
+
+static void setup(void)
+{
+    mock_hw_reset();
+    mock_flash_reset();
+    uint8_t *flash = mock_flash_data();
+    for (uint32_t i = 0; i < 4 * WINDOW; i++) {
+        flash[BASE + i] = (uint8_t)(i * 7 + (i >> 8));
+    }
+    s_flash = flash;
+}
+
+static void test_reads_within_a_window_hit(void)
+{
+    setup();
+    uint8_t buf[16];
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_flash_read(BASE + 4, buf, 8));
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_flash_read(BASE + 64, buf, 16));
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_flash_read(BASE + WINDOW - 16, buf, 16));
+    TEST_ASSERT_EQUAL_MEMORY(s_flash + BASE + WINDOW - 16, buf, 16);
+    TEST_ASSERT_EQUAL_INT(1, mock_flash_stats()->reads);
+    TEST_ASSERT_EQUAL_INT(WINDOW, mock_flash_stats()->bytes_read);
+    TEST_ASSERT_EQUAL_INT(2, boot_flash_stats()->hits);
+    TEST_ASSERT_EQUAL_INT(1, boot_flash_stats()->misses);
+}
+
+static void test_unaligned_read(void)
+{
+    setup();
+    uint8_t buf[7];
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_flash_read(BASE + 3, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY(s_flash + BASE + 3, buf, sizeof(buf));
+}
+
+static void test_read_across_windows(void)
+{
+    setup();
+    uint8_t buf[32];
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_flash_read(BASE + WINDOW - 10, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY(s_flash + BASE + WINDOW - 10, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_INT(2, mock_flash_stats()->reads);
+    // A single call, even if it took two flash reads
+    TEST_ASSERT_EQUAL_INT(1, boot_flash_stats()->misses);
+
+    // Both windows are now filled
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_flash_read(BASE, buf, 4));
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_flash_read(BASE + WINDOW, buf, 4));
+    TEST_ASSERT_EQUAL_INT(2, mock_flash_stats()->reads);
+    TEST_ASSERT_EQUAL_INT(2, boot_flash_stats()->hits);
+}
+
+static void test_least_recently_used_window_is_refilled(void)
+{
+    setup();
+    uint8_t buf[4];
+    boot_flash_read(BASE, buf, sizeof(buf));
+    boot_flash_read(BASE + WINDOW, buf, sizeof(buf));
+    boot_flash_read(BASE, buf, sizeof(buf));
+    // Replaces the second window, the first one was used last
+    boot_flash_read(BASE + 2 * WINDOW, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_INT(3, mock_flash_stats()->reads);
+    boot_flash_read(BASE, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_INT(3, mock_flash_stats()->reads);
+    boot_flash_read(BASE + WINDOW, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_INT(4, mock_flash_stats()->reads);
+}
+
+static void test_invalidate_drops_the_window(void)
+{
+    setup();
+    uint32_t word;
+    boot_flash_read(BASE + 8, &word, sizeof(word));
+    boot_flash_read(BASE + WINDOW, &word, sizeof(word));
+
+    // As boot_patch.c does after writing a word
+    const uint32_t zero = 0;
+    bootloader_flash_write(BASE + 8, (void *)&zero, sizeof(zero), false);
+    boot_flash_invalidate(BASE + 8, sizeof(zero));
+
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_flash_read(BASE + 8, &word, sizeof(word)));
+    TEST_ASSERT_EQUAL_HEX32(0, word);
+    TEST_ASSERT_EQUAL_INT(3, mock_flash_stats()->reads);
+    // The other window is untouched
+    boot_flash_read(BASE + WINDOW, &word, sizeof(word));
+    TEST_ASSERT_EQUAL_INT(3, mock_flash_stats()->reads);
+}
+
+static void test_long_read_goes_to_flash(void)
+{
+    setup();
+    static uint8_t buf[2 * WINDOW];
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_flash_read(BASE, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY(s_flash + BASE, buf, sizeof(buf));
+    TEST_ASSERT_EQUAL_INT(1, mock_flash_stats()->reads);
+    TEST_ASSERT_EQUAL_INT(sizeof(buf), mock_flash_stats()->bytes_read);
+    TEST_ASSERT_EQUAL_INT(1, boot_flash_stats()->misses);
+
+    // ... without filling a window
+    boot_flash_read(BASE, buf, 4);
+    TEST_ASSERT_EQUAL_INT(2, mock_flash_stats()->reads);
+}
+
+static void test_failed_read_fills_no_window(void)
+{
+    setup();
+    uint8_t buf[4];
+    const uint32_t last = MOCK_FLASH_SIZE - WINDOW;
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_flash_read(last, buf, sizeof(buf)));
+    TEST_ASSERT(boot_flash_read(MOCK_FLASH_SIZE, buf, sizeof(buf)) != ESP_OK);
+    TEST_ASSERT_EQUAL_INT(2, boot_flash_stats()->misses);
+    TEST_ASSERT(boot_flash_read(MOCK_FLASH_SIZE, buf, sizeof(buf)) != ESP_OK);
+    TEST_ASSERT_EQUAL_INT(3, boot_flash_stats()->misses);
+}
+
+int main(void)
+{
+    RUN_TEST(test_reads_within_a_window_hit);
+    RUN_TEST(test_unaligned_read);
+    RUN_TEST(test_read_across_windows);
+    RUN_TEST(test_least_recently_used_window_is_refilled);
+    RUN_TEST(test_invalidate_drops_the_window);
+    RUN_TEST(test_long_read_goes_to_flash);
+    RUN_TEST(test_failed_read_fills_no_window);
+    return TEST_SUMMARY();
+}
@@ -0,0 +1,105 @@
+/*
+ * Tests of the flash mode probe.
+ */
+#include <stdint.h>
+#include "esp_image_format.h"
+#include "esp_log.h"
+#include "bootloader_init.h"
+#include "mock_hw.h"
+#include "mock_flash.h"
+#include "boot_flash_mode.h"
+#include "test_harness.h"
+
+#define GD25Q32 0xC84016
+#define UNKNOWN_CHIP 0x5E4016
+
+static void setup(void)
+{
+    mock_hw_reset();
+    mock_flash_reset();
+    mock_log_enable(false);
+    bootloader_image_hdr.spi_mode = ESP_IMAGE_SPI_MODE_DIO;
+    bootloader_image_hdr.spi_speed = ESP_IMAGE_SPI_SPEED_DIV_2;
+    // The bootloader image the probe reads back
+    const uint8_t header[] = { ESP_IMAGE_HEADER_MAGIC, 3, ESP_IMAGE_SPI_MODE_DIO, 0x20 };
+    mock_flash_put(0x1000, header, sizeof(header));
+}
+
+static void test_known_chip_switches_to_qio_80m(void)
+{
+    setup();
+    mock_flash_set_jedec_id(GD25Q32);
+    const boot_flash_mode_t *mode = boot_flash_mode_probe();
+    TEST_ASSERT_EQUAL_HEX32(GD25Q32, mode->jedec_id);
+    TEST_ASSERT_EQUAL_INT(ESP_IMAGE_SPI_MODE_QIO, mode->spi_mode);
+    TEST_ASSERT_EQUAL_INT(80, mode->spi_mhz);
+    TEST_ASSERT(mock_flash_spi_quad());
+    TEST_ASSERT_EQUAL_INT(80, mock_flash_spi_mhz());
+    TEST_ASSERT(mock_flash_quad_enable());
+
+    boot_flash_mode_restore();
+    TEST_ASSERT(!mock_flash_spi_quad());
+    TEST_ASSERT_EQUAL_INT(40, mock_flash_spi_mhz());
+    // The record stays for the boot statistics
+    TEST_ASSERT_EQUAL_INT(ESP_IMAGE_SPI_MODE_QIO, boot_flash_mode_get()->spi_mode);
+}
+
+static void test_unknown_chip_keeps_the_header_mode(void)
+{
+    setup();
+    mock_flash_set_jedec_id(UNKNOWN_CHIP);
+    const boot_flash_mode_t *mode = boot_flash_mode_probe();
+    TEST_ASSERT_EQUAL_HEX32(UNKNOWN_CHIP, mode->jedec_id);
+    TEST_ASSERT_EQUAL_INT(ESP_IMAGE_SPI_MODE_DIO, mode->spi_mode);
+    TEST_ASSERT_EQUAL_INT(40, mode->spi_mhz);
+    TEST_ASSERT(!mock_flash_spi_quad());
+    TEST_ASSERT_EQUAL_INT(0, mock_flash_stats()->reads);
+}
+
+static void test_failed_read_back_restores_the_header_mode(void)
+{
+    setup();
+    mock_flash_set_jedec_id(GD25Q32);
+    mock_flash_set_quad_broken(true);
+    const boot_flash_mode_t *mode = boot_flash_mode_probe();
+    TEST_ASSERT_EQUAL_INT(ESP_IMAGE_SPI_MODE_DIO, mode->spi_mode);
+    TEST_ASSERT_EQUAL_INT(40, mode->spi_mhz);
+    TEST_ASSERT(!mock_flash_spi_quad());
+    TEST_ASSERT_EQUAL_INT(40, mock_flash_spi_mhz());
+    TEST_ASSERT_EQUAL_INT(2, mock_flash_stats()->reads);
+    // The QE bit the probe set is cleared again
+    TEST_ASSERT(!mock_flash_quad_enable());
+}
+
+static void test_failed_read_back_keeps_a_factory_qe_bit(void)
+{
+    setup();
+    mock_flash_set_jedec_id(GD25Q32);
+    mock_flash_set_quad_broken(true);
+    mock_flash_set_quad_enable(true);
+    TEST_ASSERT_EQUAL_INT(ESP_IMAGE_SPI_MODE_DIO, boot_flash_mode_probe()->spi_mode);
+    TEST_ASSERT(mock_flash_quad_enable());
+}
+
+static void test_header_already_asking_for_qio_80m(void)
+{
+    setup();
+    bootloader_image_hdr.spi_mode = ESP_IMAGE_SPI_MODE_QIO;
+    bootloader_image_hdr.spi_speed = ESP_IMAGE_SPI_SPEED_DIV_1;
+    mock_flash_set_jedec_id(GD25Q32);
+    const boot_flash_mode_t *mode = boot_flash_mode_probe();
+    TEST_ASSERT_EQUAL_INT(0, mode->jedec_id);
+    TEST_ASSERT_EQUAL_INT(ESP_IMAGE_SPI_MODE_QIO, mode->spi_mode);
+    TEST_ASSERT_EQUAL_INT(80, mode->spi_mhz);
+    TEST_ASSERT_EQUAL_INT(0, mock_flash_stats()->reads);
+}
+
+int main(void)
+{
+    RUN_TEST(test_known_chip_switches_to_qio_80m);
+    RUN_TEST(test_unknown_chip_keeps_the_header_mode);
+    RUN_TEST(test_failed_read_back_restores_the_header_mode);
+    RUN_TEST(test_failed_read_back_keeps_a_factory_qe_bit);
+    RUN_TEST(test_header_already_asking_for_qio_80m);
+    return TEST_SUMMARY();
+}
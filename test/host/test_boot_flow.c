@@ -0,0 +1,476 @@
+/*
+ * Tests of the whole boot flow, from call_start_cpu0() to the jump to the app (see mock_boot.h).
+ *
+ * Also writes the flash of a regular boot to FLASH_DUMP and boots from the mapped file, which
+ * the emulate_boot test then boots again.
+ *
+ * Usage: test_boot_flow [FLASH_DUMP]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "mock_boot.h"
+#include "mock_hw.h"
+#include "mock_flash.h"
+#include "boot_app_cpu.h"
+#include "boot_flash.h"
+#include "boot_rtc.h"
+#include "boot_trial.h"
+#include "fixtures.h"
+#include "fixture_image.h"
+#include "test_harness.h"
+
+#define IRAM_ADDR 0x40080000
+#define DROM_ADDR 0x3F400020
+#define IROM_ADDR 0x400D0020
+
+// DROM and IROM each start a new 64K MMU page
+static uint8_t s_image[2][3 * FIXTURE_MMU_PAGE_SIZE];
+static size_t s_image_len[2];
+static mock_boot_result_t s_result;
+static const char *s_dump_path;
+
+/**
+ * @brief Builds a small app image per OTA slot, with different code in each.
+ */
+static void build_images(void)
+{
+    static uint8_t iram[4096], drom[2048], irom[4096];
+    for (int slot = 0; slot < 2; slot++) {
+        fixture_code_like(iram, sizeof(iram), 0x10 + slot);
+        fixture_code_like(drom, sizeof(drom), 0x20 + slot);
+        fixture_code_like(irom, sizeof(irom), 0x30 + slot);
+        const fixture_segment_t segments[] = {
+            { DROM_ADDR, drom, sizeof(drom) },
+            { IRAM_ADDR, iram, sizeof(iram) },
+            { IROM_ADDR, irom, sizeof(irom) },
+        };
+        s_image_len[slot] = fixture_build_image(s_image[slot], segments, sizeof(segments) / sizeof(segments[0]));
+    }
+}
+
+static void setup(void)
+{
+    mock_hw_reset();
+    mock_flash_reset();
+    mock_log_enable(false);
+    mock_rtc_power_loss();
+
+    fixture_put_partition_table(0x40);
+    mock_flash_put(FIXTURE_OTA_0_OFFSET, s_image[0], s_image_len[0]);
+    mock_flash_put(FIXTURE_OTA_1_OFFSET, s_image[1], s_image_len[1]);
+}
+
+static void assert_booted(int slot)
+{
+    const bootloader_state_t bs = fixture_state();
+    TEST_ASSERT(s_result.started);
+    TEST_ASSERT_EQUAL_INT(slot, s_result.boot_index);
+    TEST_ASSERT_EQUAL_HEX32(bs.ota[slot].offset, s_result.image.start_addr);
+    TEST_ASSERT_EQUAL_HEX32(FIXTURE_IMAGE_ENTRY, s_result.image.image.entry_addr);
+}
+
+static void test_boots_default_slot_without_otadata(void)
+{
+    setup();
+    mock_boot_run(&s_result);
+    assert_booted(1);
+    TEST_ASSERT_EQUAL_MEMORY(s_image[1] + s_image_len[1] - 32, s_result.image.image_digest, 32);
+
+    // The app finds the statistics of this boot
+    const boot_stats_t *stats = boot_stats_get();
+    TEST_ASSERT(stats != NULL);
+    TEST_ASSERT_EQUAL_INT(1, stats->boot_index);
+    TEST_ASSERT_EQUAL_INT(1, stats->load_attempts);
+    TEST_ASSERT_EQUAL_INT(boot_flash_stats()->misses, stats->read_misses);
+    TEST_ASSERT(stats->read_misses > 0);
+    const boot_load_stats_t *load = boot_load_stats_get();
+    TEST_ASSERT(load != NULL);
+    TEST_ASSERT_EQUAL_HEX32(FIXTURE_OTA_1_OFFSET, load->part_offset);
+}
+
+static void test_app_cpu_hashes_and_is_stopped_before_the_jump(void)
+{
+    setup();
+    mock_sha_set_block_cycles(320);
+    mock_boot_run(&s_result);
+    assert_booted(1);
+    TEST_ASSERT(!boot_app_cpu_running());
+    TEST_ASSERT(boot_load_stats_get()->app_cpu_us > 0);
+}
+
+static void test_known_flash_chip_loads_in_qio(void)
+{
+    setup();
+    mock_flash_set_read_speed(5);
+    mock_boot_run(&s_result);
+    const uint32_t dio_us = s_result.elapsed_us;
+
+    setup();
+    mock_flash_set_read_speed(5);
+    mock_flash_set_jedec_id(0xEF4016);  // W25Q32
+    mock_boot_run(&s_result);
+    assert_booted(1);
+    TEST_ASSERT(s_result.elapsed_us < dio_us);
+    const boot_stats_t *stats = boot_stats_get();
+    TEST_ASSERT_EQUAL_HEX32(0xEF4016, stats->flash_id);
+    TEST_ASSERT_EQUAL_INT(ESP_IMAGE_SPI_MODE_QIO, stats->flash_mode);
+    TEST_ASSERT_EQUAL_INT(80, stats->flash_mhz);
+    // ... and hands over to the app in the header's DIO at 40 MHz
+    TEST_ASSERT(!mock_flash_spi_quad());
+    TEST_ASSERT_EQUAL_INT(40, mock_flash_spi_mhz());
+}
+
+static void test_clock_is_boosted_for_the_load_only(void)
+{
+    setup();
+    mock_flash_set_read_speed(5);
+    mock_sha_set_block_cycles(320);
+    mock_boot_run(&s_result);
+    assert_booted(1);
+    TEST_ASSERT(boot_stats_get()->flags & BOOT_STATS_FLAG_CLOCK_BOOST);
+    // The app starts at the bootloader's clock
+    TEST_ASSERT_EQUAL_INT(MOCK_CPU_MHZ, esp_rom_get_cpu_ticks_per_us());
+    // The boot timer follows the clock changes; the simulated time drops a fraction of a
+    // microsecond at each of them, the timer doesn't
+    const uint32_t total_us = boot_stats_get()->phase_end_us[BOOT_PHASE_LOAD];
+    TEST_ASSERT(total_us <= s_result.elapsed_us + 1 && total_us + 10 >= s_result.elapsed_us);
+}
+
+static void test_single_core_chip_boots(void)
+{
+    setup();
+    mock_app_cpu_set_present(false);
+    mock_boot_run(&s_result);
+    assert_booted(1);
+    TEST_ASSERT_EQUAL_MEMORY(s_image[1] + s_image_len[1] - 32, s_result.image.image_digest, 32);
+    TEST_ASSERT_EQUAL_INT(0, boot_load_stats_get()->app_cpu_us);
+}
+
+static char s_log[2 * CONFIG_BETTEROTA_DEFERRED_LOG_SIZE];
+static size_t s_log_len;
+
+static void collect_log(const char *text, size_t len)
+{
+    memcpy(s_log + s_log_len, text, len);
+    s_log_len += len;
+    s_log[s_log_len] = '\0';
+}
+
+static void test_log_is_left_to_the_app(void)
+{
+    setup();
+    mock_boot_run(&s_result);
+    assert_booted(1);
+    TEST_ASSERT_EQUAL_INT(0, mock_uart_bytes());
+
+    s_log_len = 0;
+    TEST_ASSERT_EQUAL_INT(0, boot_log_drain(collect_log));
+    TEST_ASSERT(strstr(s_log, "Loaded partition index 1") != NULL);
+}
+
+static void test_failing_load_logs_to_uart(void)
+{
+    setup();
+    mock_flash_data()[FIXTURE_OTA_1_OFFSET + s_image_len[1] / 2] ^= 0x01;
+    mock_boot_run(&s_result);
+    assert_booted(0);
+    // The lines before the failure are replayed, so the UART has all of them
+    s_log_len = 0;
+    boot_log_drain(collect_log);
+    TEST_ASSERT(mock_uart_bytes() > s_log_len);
+    TEST_ASSERT(strstr(s_log, "Failed to load") == NULL);
+}
+
+static void test_boots_slot_selected_by_otadata(void)
+{
+    setup();
+    fixture_put_otadata(0, 1, ESP_OTA_IMG_VALID);
+    mock_boot_run(&s_result);
+    assert_booted(0);
+}
+
+static void test_button_overrides_otadata(void)
+{
+    setup();
+    fixture_put_otadata(0, 2, ESP_OTA_IMG_VALID);
+    mock_button_set(true);
+    mock_boot_run(&s_result);
+    assert_booted(0);
+}
+
+static void test_falls_over_to_other_slot(void)
+{
+    setup();
+    mock_flash_data()[FIXTURE_OTA_1_OFFSET + s_image_len[1] / 2] ^= 0x01;
+    mock_boot_run(&s_result);
+    assert_booted(0);
+    TEST_ASSERT_EQUAL_INT(2, boot_stats_get()->load_attempts);
+}
+
+static void test_blank_slot_is_skipped_without_a_load(void)
+{
+    setup();
+    uint8_t erased[64];
+    memset(erased, 0xFF, sizeof(erased));
+    mock_flash_put(FIXTURE_OTA_1_OFFSET, erased, sizeof(erased));
+    mock_boot_run(&s_result);
+    assert_booted(0);
+    TEST_ASSERT_EQUAL_INT(1, boot_stats_get()->load_attempts);
+    TEST_ASSERT_EQUAL_INT(BOOT_SELECT_BLANK_SLOT, boot_stats_get()->select_reason);
+}
+
+static void test_resets_without_bootable_image(void)
+{
+    setup();
+    uint8_t erased[64];
+    memset(erased, 0xFF, sizeof(erased));
+    mock_flash_put(FIXTURE_OTA_0_OFFSET, erased, sizeof(erased));
+    mock_flash_put(FIXTURE_OTA_1_OFFSET, erased, sizeof(erased));
+    mock_boot_run(&s_result);
+    TEST_ASSERT(!s_result.started);
+    TEST_ASSERT_EQUAL_INT(-1, s_result.boot_index);
+}
+
+static void test_deep_sleep_wake_skips_verification(void)
+{
+    setup();
+    mock_boot_run(&s_result);
+    assert_booted(1);
+    const uint64_t cold_read = mock_flash_stats()->bytes_read;
+
+    mock_reset_reason_set(RESET_REASON_CORE_DEEP_SLEEP);
+    mock_boot_run(&s_result);
+    assert_booted(1);
+    TEST_ASSERT(boot_stats_get()->flags & BOOT_STATS_FLAG_FAST_WAKE);
+    TEST_ASSERT(mock_flash_stats()->bytes_read - cold_read < cold_read);
+}
+
+#if CONFIG_BETTEROTA_TRIAL_BOOT
+static uint32_t s_button_samples;
+
+static bool released_counted(uint32_t us)
+{
+    s_button_samples++;
+    return false;
+}
+
+static void test_unconfirmed_image_is_rolled_back(void)
+{
+    setup();
+    fixture_put_otadata(0, 1, ESP_OTA_IMG_VALID);
+    fixture_put_otadata(1, 2, ESP_OTA_IMG_NEW);
+    mock_button_set_script(released_counted);
+
+    // An app that keeps crashing before it confirms
+    uint32_t samples = 0;
+    for (int boot = 1; boot <= CONFIG_BETTEROTA_TRIAL_BOOT_ATTEMPTS; boot++) {
+        s_button_samples = 0;
+        mock_boot_run(&s_result);
+        samples = s_button_samples;
+        assert_booted(1);
+        TEST_ASSERT(boot_stats_get()->flags & BOOT_STATS_FLAG_TRIAL);
+        TEST_ASSERT(boot_trial_pending());
+        TEST_ASSERT_EQUAL_INT(boot, boot_trial_get()->boots);
+    }
+
+    s_button_samples = 0;
+    mock_boot_run(&s_result);
+    assert_booted(0);
+    TEST_ASSERT(boot_stats_get()->flags & BOOT_STATS_FLAG_ROLLED_BACK);
+    TEST_ASSERT_EQUAL_INT(BOOT_SELECT_ROLLBACK, boot_stats_get()->select_reason);
+    // The slot is chosen again without a second debounce, which would about double the samples
+    TEST_ASSERT(s_button_samples < samples + samples / 2);
+    TEST_ASSERT(!(boot_stats_get()->flags & BOOT_STATS_FLAG_TRIAL));
+    TEST_ASSERT(!boot_trial_pending());
+    TEST_ASSERT_EQUAL_INT(1, boot_stats_get()->load_attempts);
+
+    // And stays there
+    mock_boot_run(&s_result);
+    assert_booted(0);
+    TEST_ASSERT_EQUAL_INT(BOOT_SELECT_OTADATA, boot_stats_get()->select_reason);
+    TEST_ASSERT_EQUAL_HEX32(0, boot_stats_get()->flags & (BOOT_STATS_FLAG_TRIAL | BOOT_STATS_FLAG_ROLLED_BACK));
+}
+
+static void test_confirmed_image_stays(void)
+{
+    setup();
+    fixture_put_otadata(0, 1, ESP_OTA_IMG_VALID);
+    fixture_put_otadata(1, 2, ESP_OTA_IMG_NEW);
+    mock_boot_run(&s_result);
+    assert_booted(1);
+    TEST_ASSERT(boot_trial_pending());
+
+    // What esp_ota_mark_app_valid_cancel_rollback() leaves behind
+    fixture_put_otadata(1, 2, ESP_OTA_IMG_VALID);
+    for (int boot = 0; boot <= CONFIG_BETTEROTA_TRIAL_BOOT_ATTEMPTS; boot++) {
+        mock_boot_run(&s_result);
+        assert_booted(1);
+        TEST_ASSERT(!boot_trial_pending());
+    }
+}
+#endif
+
+#if CONFIG_BETTEROTA_VERIFIED_CACHE
+static void test_verified_image_skips_verification(void)
+{
+    setup();
+    fixture_put_otadata(0, 1, ESP_OTA_IMG_VALID);
+    mock_boot_run(&s_result);
+    assert_booted(0);
+    TEST_ASSERT(!(boot_stats_get()->flags & BOOT_STATS_FLAG_VERIFIED));
+    const uint64_t cold_read = mock_flash_stats()->bytes_read;
+
+    mock_boot_run(&s_result);
+    assert_booted(0);
+    TEST_ASSERT(boot_stats_get()->flags & BOOT_STATS_FLAG_VERIFIED);
+    TEST_ASSERT(mock_flash_stats()->bytes_read - cold_read < cold_read);
+
+    // An update writes otadata, which takes the record with it
+    fixture_put_otadata(0, 1, ESP_OTA_IMG_VALID);
+    mock_boot_run(&s_result);
+    assert_booted(0);
+    TEST_ASSERT(!(boot_stats_get()->flags & BOOT_STATS_FLAG_VERIFIED));
+}
+
+static void test_changed_verified_image_is_verified_again(void)
+{
+    setup();
+    fixture_put_otadata(0, 1, ESP_OTA_IMG_VALID);
+    mock_boot_run(&s_result);
+    assert_booted(0);
+
+    // In the first sector, with the segment headers
+    mock_flash_data()[FIXTURE_OTA_0_OFFSET + 0x100] ^= 0x01;
+    mock_boot_run(&s_result);
+    assert_booted(1);
+    TEST_ASSERT(!(boot_stats_get()->flags & BOOT_STATS_FLAG_VERIFIED));
+}
+
+static void test_verified_image_is_verified_fully_every_nth_boot(void)
+{
+    setup();
+    fixture_put_otadata(1, 2, ESP_OTA_IMG_VALID);
+    mock_boot_run(&s_result);
+    assert_booted(1);
+
+    // The boots are counted from the first one with a record
+    for (int boot = 1; boot <= CONFIG_BETTEROTA_VERIFIED_CACHE_INTERVAL + 1; boot++) {
+        mock_boot_run(&s_result);
+        assert_booted(1);
+        const bool verified = (boot_stats_get()->flags & BOOT_STATS_FLAG_VERIFIED) != 0;
+        TEST_ASSERT_EQUAL_INT(boot % CONFIG_BETTEROTA_VERIFIED_CACHE_INTERVAL != 0, verified);
+    }
+}
+#endif
+
+#if CONFIG_BETTEROTA_LAZY_VERIFY
+#if CONFIG_BETTEROTA_MERKLE
+static void test_verified_image_blocks_are_checked_between_full_verifications(void)
+{
+    static uint8_t image[sizeof(s_image[0])];
+    setup();
+    memcpy(image, s_image[0], s_image_len[0]);
+    const size_t len = fixture_add_merkle(image, s_image_len[0]);
+    mock_flash_put(FIXTURE_OTA_0_OFFSET, image, len);
+    fixture_put_otadata(0, 1, ESP_OTA_IMG_VALID);
+    mock_boot_run(&s_result);
+    assert_booted(0);
+    mock_boot_run(&s_result);
+    assert_booted(0);
+    TEST_ASSERT(boot_stats_get()->flags & BOOT_STATS_FLAG_VERIFIED);
+
+    // In the padding in front of IROM, which the quick digest doesn't cover
+    mock_flash_data()[FIXTURE_OTA_0_OFFSET + FIXTURE_MMU_PAGE_SIZE / 2] ^= 0x01;
+    int boot = 2;
+    while (boot < CONFIG_BETTEROTA_VERIFIED_CACHE_INTERVAL - 1) {
+        mock_boot_run(&s_result);
+        boot++;
+        if (s_result.boot_index != 0) {
+            break;
+        }
+        TEST_ASSERT(boot_stats_get()->flags & BOOT_STATS_FLAG_VERIFIED);
+    }
+    // Caught before the next full verification, which then fails
+    assert_booted(1);
+    TEST_ASSERT(boot < CONFIG_BETTEROTA_VERIFIED_CACHE_INTERVAL - 1);
+}
+#endif
+
+static void test_lazily_verified_image_is_left_to_the_app(void)
+{
+    static uint8_t image[sizeof(s_image[1]) + sizeof(boot_image_ram_digest_t)];
+    setup();
+    memcpy(image, s_image[1], s_image_len[1]);
+    const size_t len = fixture_add_ram_digest(image, s_image_len[1]);
+    mock_flash_put(FIXTURE_OTA_1_OFFSET, image, len);
+    mock_boot_run(&s_result);
+    assert_booted(1);
+    TEST_ASSERT(boot_stats_get()->flags & BOOT_STATS_FLAG_LAZY_VERIFY);
+
+    // Never fully verified, so a wake from deep sleep doesn't skip the verification
+    mock_reset_reason_set(RESET_REASON_CORE_DEEP_SLEEP);
+    mock_boot_run(&s_result);
+    assert_booted(1);
+    TEST_ASSERT(boot_stats_get()->flags & BOOT_STATS_FLAG_LAZY_VERIFY);
+    TEST_ASSERT(!(boot_stats_get()->flags & BOOT_STATS_FLAG_FAST_WAKE));
+}
+#endif
+
+static void test_boots_from_flash_dump(void)
+{
+    setup();
+    fixture_put_otadata(1, 3, ESP_OTA_IMG_VALID);
+    FILE *f = fopen(s_dump_path, "wb");
+    TEST_ASSERT(f != NULL);
+    TEST_ASSERT_EQUAL_INT(MOCK_FLASH_SIZE, fwrite(mock_flash_data(), 1, MOCK_FLASH_SIZE, f));
+    TEST_ASSERT_EQUAL_INT(0, fclose(f));
+
+    mock_flash_reset();
+    TEST_ASSERT(mock_flash_map_file(s_dump_path, false));
+    mock_boot_run(&s_result);
+    assert_booted(0);   // (3 - 1) % 2
+    mock_flash_reset();
+}
+
+int main(int argc, char **argv)
+{
+    build_images();
+    RUN_TEST(test_boots_default_slot_without_otadata);
+    RUN_TEST(test_app_cpu_hashes_and_is_stopped_before_the_jump);
+    RUN_TEST(test_known_flash_chip_loads_in_qio);
+    RUN_TEST(test_clock_is_boosted_for_the_load_only);
+    RUN_TEST(test_single_core_chip_boots);
+    RUN_TEST(test_log_is_left_to_the_app);
+    RUN_TEST(test_failing_load_logs_to_uart);
+    RUN_TEST(test_boots_slot_selected_by_otadata);
+    RUN_TEST(test_button_overrides_otadata);
+    RUN_TEST(test_falls_over_to_other_slot);
+    RUN_TEST(test_blank_slot_is_skipped_without_a_load);
+    RUN_TEST(test_resets_without_bootable_image);
+    RUN_TEST(test_deep_sleep_wake_skips_verification);
+#if CONFIG_BETTEROTA_TRIAL_BOOT
+    RUN_TEST(test_unconfirmed_image_is_rolled_back);
+    RUN_TEST(test_confirmed_image_stays);
+#endif
+#if CONFIG_BETTEROTA_VERIFIED_CACHE
+    RUN_TEST(test_verified_image_skips_verification);
+    RUN_TEST(test_changed_verified_image_is_verified_again);
+    RUN_TEST(test_verified_image_is_verified_fully_every_nth_boot);
+#if CONFIG_BETTEROTA_MERKLE
+    RUN_TEST(test_verified_image_blocks_are_checked_between_full_verifications);
+#endif
+#endif
+#if CONFIG_BETTEROTA_LAZY_VERIFY
+    RUN_TEST(test_lazily_verified_image_is_left_to_the_app);
+#endif
+
+    if (argc == 2) {
+        s_dump_path = argv[1];
+        RUN_TEST(test_boots_from_flash_dump);
+    } else {
+        printf("Skipping the flash dump test, no path given\n");
+    }
+    return TEST_SUMMARY();
+}
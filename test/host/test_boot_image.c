@@ -0,0 +1,614 @@
+/*
+ * Tests of the app image loader, on images built in memory and on the synthetic image
+ * before and after packing (see gen_test_image.c).
+ *
+ * Built with pipelined verification and the APP CPU as test_boot_image, and without either
+ * as test_boot_image_serial.
+ *
+ * Usage: test_boot_image [PLAIN_IMAGE PACKED_IMAGE [LAZY_IMAGE]]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "mock_hw.h"
+#include "mock_flash.h"
+#include "soc/soc.h"
+#include "boot_app_cpu.h"
+#include "boot_image.h"
+#include "boot_rtc.h"
+#include "fixtures.h"
+#include "fixture_image.h"
+#include "gen_test_image.h"
+#include "test_harness.h"
+
+#define IRAM_ADDR 0x40080000
+#define DRAM_ADDR 0x3FFB0000
+#define RTC_ADDR  0x400C0000
+#define DROM_ADDR 0x3F400020
+#define IROM_ADDR 0x400D0020
+
+static uint8_t s_iram[8192];
+static uint8_t s_dram[1024];
+static uint8_t s_rtc[256];
+static uint8_t s_flash_data[4096];
+static uint8_t s_image[GEN_TEST_IMAGE_MAX_LEN];
+static size_t s_image_len;
+static esp_partition_pos_t s_part;
+static esp_image_metadata_t s_data;
+
+static uint8_t s_plain_file[GEN_TEST_IMAGE_MAX_LEN];
+static size_t s_plain_file_len;
+static uint8_t s_packed_file[GEN_TEST_IMAGE_MAX_LEN];
+static size_t s_packed_file_len;
+static uint8_t s_lazy_file[GEN_TEST_IMAGE_MAX_LEN];
+static size_t s_lazy_file_len;
+
+static void setup(void)
+{
+    mock_hw_reset();
+    mock_flash_reset();
+    mock_ram_fill(0xA5);
+    mock_log_enable(false);
+    s_part = fixture_state().ota[0];
+    memset(&s_data, 0, sizeof(s_data));
+
+    fixture_code_like(s_iram, sizeof(s_iram), 1);
+    fixture_code_like(s_dram, sizeof(s_dram), 2);
+    fixture_code_like(s_rtc, sizeof(s_rtc), 3);
+    fixture_code_like(s_flash_data, sizeof(s_flash_data), 4);
+}
+
+static void put_image(const fixture_segment_t *segments, int count)
+{
+    s_image_len = fixture_build_image(s_image, segments, count);
+    mock_flash_put(s_part.offset, s_image, s_image_len);
+}
+
+static void put_default_image(void)
+{
+    const fixture_segment_t segments[] = {
+        { DROM_ADDR, s_flash_data, sizeof(s_flash_data) },
+        { IRAM_ADDR, s_iram, sizeof(s_iram) },
+        { DRAM_ADDR, s_dram, sizeof(s_dram) },
+        { RTC_ADDR, s_rtc, sizeof(s_rtc) },
+        { IROM_ADDR, s_flash_data, sizeof(s_flash_data) },
+    };
+    put_image(segments, sizeof(segments) / sizeof(segments[0]));
+}
+
+static int ram_equals(uint32_t addr, const uint8_t *expected, size_t len)
+{
+    return memcmp(mock_ram(addr), expected, len) == 0;
+}
+
+static void test_loads_ram_segments(void)
+{
+    setup();
+    put_default_image();
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load(&s_part, &s_data));
+    TEST_ASSERT(ram_equals(IRAM_ADDR, s_iram, sizeof(s_iram)));
+    TEST_ASSERT(ram_equals(DRAM_ADDR, s_dram, sizeof(s_dram)));
+    TEST_ASSERT(ram_equals(RTC_ADDR, s_rtc, sizeof(s_rtc)));
+    TEST_ASSERT_EQUAL_HEX32(FIXTURE_IMAGE_ENTRY, s_data.image.entry_addr);
+    TEST_ASSERT_EQUAL_INT(s_image_len, s_data.image_len);
+    TEST_ASSERT_EQUAL_MEMORY(s_image + s_image_len - 32, s_data.image_digest, 32);
+}
+
+static void test_records_flash_segments_for_mapping(void)
+{
+    setup();
+    put_default_image();
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load(&s_part, &s_data));
+    // DROM, IRAM, DRAM, RTC, padding, IROM
+    TEST_ASSERT_EQUAL_INT(6, s_data.image.segment_count);
+    TEST_ASSERT_EQUAL_HEX32(IROM_ADDR, s_data.segments[5].load_addr);
+    TEST_ASSERT_EQUAL_HEX32(IROM_ADDR % FIXTURE_MMU_PAGE_SIZE, s_data.segment_data[5] % FIXTURE_MMU_PAGE_SIZE);
+    TEST_ASSERT_EQUAL_MEMORY(s_flash_data, mock_flash_data() + s_data.segment_data[5], sizeof(s_flash_data));
+}
+
+static void test_reads_image_once(void)
+{
+    setup();
+    put_default_image();
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load(&s_part, &s_data));
+    TEST_ASSERT_EQUAL_INT(s_image_len, mock_flash_stats()->bytes_read);
+}
+
+static void test_corrupt_segment_fails(void)
+{
+    setup();
+    put_default_image();
+    mock_flash_data()[s_part.offset + s_image_len / 2] ^= 0x01;
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_IMAGE_INVALID, boot_image_load(&s_part, &s_data));
+}
+
+static void test_corrupt_digest_fails(void)
+{
+    setup();
+    put_default_image();
+    mock_flash_data()[s_part.offset + s_image_len - 1] ^= 0x01;
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_IMAGE_INVALID, boot_image_load(&s_part, &s_data));
+}
+
+static void test_erased_partition_fails(void)
+{
+    setup();
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_IMAGE_INVALID, boot_image_load(&s_part, &s_data));
+    TEST_ASSERT_EQUAL_INT(sizeof(esp_image_header_t), mock_flash_stats()->bytes_read);
+}
+
+static void test_missing_partition_fails(void)
+{
+    setup();
+    const esp_partition_pos_t none = {0};
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_NOT_FOUND, boot_image_load(&none, &s_data));
+}
+
+static void test_image_past_partition_end_fails(void)
+{
+    setup();
+    put_default_image();
+    s_part.size = s_image_len - 4;
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_IMAGE_INVALID, boot_image_load(&s_part, &s_data));
+}
+
+static void test_segment_over_bootloader_stack_fails(void)
+{
+    setup();
+    const fixture_segment_t segments[] = {
+        { MOCK_STACK_POINTER - 0x100, s_dram, sizeof(s_dram) },
+    };
+    put_image(segments, 1);
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_IMAGE_INVALID, boot_image_load(&s_part, &s_data));
+}
+
+static void test_segment_over_loader_iram_fails(void)
+{
+    setup();
+    // IRAM below the loader segment is free, the loader itself is not
+    const fixture_segment_t segments[] = {
+        { MOCK_LOADER_TEXT_START - sizeof(s_iram), s_iram, sizeof(s_iram) },
+        { MOCK_LOADER_TEXT_END - 0x100, s_iram, sizeof(s_iram) },
+    };
+    put_image(segments, 2);
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_IMAGE_INVALID, boot_image_load(&s_part, &s_data));
+    TEST_ASSERT(ram_equals(MOCK_LOADER_TEXT_START - sizeof(s_iram), s_iram, sizeof(s_iram)));
+}
+
+static void test_segment_over_bootloader_data_fails(void)
+{
+    setup();
+    const fixture_segment_t segments[] = {
+        { MOCK_DRAM_START, s_dram, sizeof(s_dram) },
+    };
+    put_image(segments, 1);
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_IMAGE_INVALID, boot_image_load(&s_part, &s_data));
+}
+
+static void test_segment_across_regions_fails(void)
+{
+    setup();
+    const fixture_segment_t segments[] = {
+        { SOC_IRAM_HIGH - 0x100, s_iram, sizeof(s_iram) },
+    };
+    put_image(segments, 1);
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_IMAGE_INVALID, boot_image_load(&s_part, &s_data));
+}
+
+static void test_rtc_kept_on_deep_sleep_wake(void)
+{
+    setup();
+    put_default_image();
+    mock_reset_reason_set(RESET_REASON_CORE_DEEP_SLEEP);
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load(&s_part, &s_data));
+    TEST_ASSERT(ram_equals(IRAM_ADDR, s_iram, sizeof(s_iram)));
+    TEST_ASSERT_EQUAL_HEX32(0xA5A5A5A5, *mock_ram(RTC_ADDR));
+}
+
+static void test_unverified_load_skips_flash_segments(void)
+{
+    setup();
+    put_default_image();
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load_unverified(&s_part, &s_data));
+    TEST_ASSERT(ram_equals(IRAM_ADDR, s_iram, sizeof(s_iram)));
+    TEST_ASSERT(mock_flash_stats()->bytes_read < s_image_len - 2 * sizeof(s_flash_data));
+}
+
+static void test_records_segment_stats(void)
+{
+    setup();
+    put_default_image();
+    mock_flash_set_read_speed(10);
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load(&s_part, &s_data));
+
+    const boot_load_stats_t *stats = boot_image_stats();
+    TEST_ASSERT_EQUAL_INT(6, stats->segment_count);
+    TEST_ASSERT_EQUAL_HEX32(s_part.offset, stats->part_offset);
+
+    const boot_segment_stats_t *drom = &stats->segments[0];
+    TEST_ASSERT_EQUAL_INT(BOOT_REGION_FLASH, drom->region);
+    TEST_ASSERT_EQUAL_INT(sizeof(s_flash_data), drom->flash_len);
+    TEST_ASSERT_EQUAL_INT(0, drom->load_len);
+    TEST_ASSERT_EQUAL_INT(0, drom->copy_us);
+
+    const boot_segment_stats_t *iram = &stats->segments[1];
+    TEST_ASSERT_EQUAL_HEX32(IRAM_ADDR, iram->load_addr);
+    TEST_ASSERT_EQUAL_INT(BOOT_REGION_IRAM, iram->region);
+    TEST_ASSERT_EQUAL_INT(sizeof(s_iram), iram->flash_len);
+    TEST_ASSERT_EQUAL_INT(sizeof(s_iram), iram->load_len);
+    TEST_ASSERT_EQUAL_INT(0, iram->flags);
+    // 10 bytes/us, within a few microseconds of cycle counter reads
+    // Hashing and copying take no simulated time on the host
+    TEST_ASSERT(iram->read_us >= sizeof(s_iram) / 10 && iram->read_us <= sizeof(s_iram) / 10 + 5);
+
+    TEST_ASSERT_EQUAL_INT(BOOT_REGION_DRAM, stats->segments[2].region);
+    TEST_ASSERT_EQUAL_INT(BOOT_REGION_RTC, stats->segments[3].region);
+    TEST_ASSERT_EQUAL_INT(BOOT_REGION_PADDING, stats->segments[4].region);
+    TEST_ASSERT_EQUAL_INT(BOOT_REGION_FLASH, stats->segments[5].region);
+    TEST_ASSERT(stats->total_us >= s_image_len / 10);
+}
+
+static void test_hashing_overlaps_flash_reads(void)
+{
+    setup();
+    put_default_image();
+    mock_flash_set_read_speed(10);
+    // 6.4 us per block, as long as reading it
+    mock_sha_set_block_cycles(512);
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load(&s_part, &s_data));
+    TEST_ASSERT_EQUAL_MEMORY(s_iram, mock_ram(IRAM_ADDR), sizeof(s_iram));
+
+    const uint32_t read_us = mock_flash_stats()->bytes_read / 10;
+    const uint32_t sha_us = (s_data.image_len - ESP_IMAGE_HASH_LEN) / 64 * 512 / MOCK_CPU_MHZ;
+    const uint32_t total_us = boot_image_stats()->total_us;
+#if CONFIG_BETTEROTA_PIPELINED_VERIFY
+    TEST_ASSERT(total_us < read_us + sha_us / 4);
+#else
+    // Only the last block of each chunk overlaps the next read
+    TEST_ASSERT(total_us >= read_us + sha_us * 9 / 10);
+#endif
+}
+
+#if CONFIG_BETTEROTA_APP_CPU
+static void test_app_cpu_hashes_while_reading(void)
+{
+    setup();
+    put_default_image();
+    mock_flash_set_read_speed(10);
+    mock_sha_set_block_cycles(512);
+    TEST_ASSERT(boot_app_cpu_start());
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load(&s_part, &s_data));
+    boot_app_cpu_stop();
+    TEST_ASSERT_EQUAL_MEMORY(s_image + s_image_len - ESP_IMAGE_HASH_LEN, s_data.image_digest, ESP_IMAGE_HASH_LEN);
+    TEST_ASSERT_EQUAL_MEMORY(s_iram, mock_ram(IRAM_ADDR), sizeof(s_iram));
+
+    const uint32_t read_us = mock_flash_stats()->bytes_read / 10;
+    const uint32_t sha_us = (s_data.image_len - ESP_IMAGE_HASH_LEN) / 64 * 512 / MOCK_CPU_MHZ;
+    const boot_load_stats_t *stats = boot_image_stats();
+    TEST_ASSERT(stats->app_cpu_us >= sha_us / 2);
+    TEST_ASSERT(stats->total_us < read_us + sha_us / 4);
+}
+
+static void test_app_cpu_corrupt_image_fails(void)
+{
+    setup();
+    put_default_image();
+    mock_flash_data()[s_part.offset + s_image_len / 2] ^= 0x01;
+    TEST_ASSERT(boot_app_cpu_start());
+    TEST_ASSERT(boot_image_load(&s_part, &s_data) != ESP_OK);
+    boot_app_cpu_stop();
+}
+#endif
+
+static void test_unverified_load_stats_skip_flash_segments(void)
+{
+    setup();
+    put_default_image();
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load_unverified(&s_part, &s_data));
+    const boot_load_stats_t *stats = boot_image_stats();
+    TEST_ASSERT_EQUAL_INT(0, stats->segments[0].flash_len);
+    TEST_ASSERT_EQUAL_INT(0, stats->segments[1].verify_us);
+    TEST_ASSERT_EQUAL_INT(sizeof(s_iram), stats->segments[1].load_len);
+}
+
+#if CONFIG_BETTEROTA_LAZY_VERIFY
+// Offsets in the default image: the data of the DROM segment, then of the IRAM segment
+#define DROM_DATA_OFFSET (sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t))
+#define IRAM_DATA_OFFSET (DROM_DATA_OFFSET + sizeof(s_flash_data) + sizeof(esp_image_segment_header_t))
+
+static void put_default_lazy_image(void)
+{
+    put_default_image();
+    s_image_len = fixture_add_ram_digest(s_image, s_image_len);
+    mock_flash_put(s_part.offset, s_image, s_image_len);
+}
+
+static void test_lazy_verify_skips_flash_segments(void)
+{
+    setup();
+    put_default_lazy_image();
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load(&s_part, &s_data));
+    TEST_ASSERT(ram_equals(IRAM_ADDR, s_iram, sizeof(s_iram)));
+    TEST_ASSERT(ram_equals(DRAM_ADDR, s_dram, sizeof(s_dram)));
+    TEST_ASSERT_EQUAL_INT(s_image_len - sizeof(boot_image_ram_digest_t), s_data.image_len);
+    TEST_ASSERT_EQUAL_MEMORY(s_image + s_data.image_len - ESP_IMAGE_HASH_LEN, s_data.image_digest, ESP_IMAGE_HASH_LEN);
+    TEST_ASSERT(mock_flash_stats()->bytes_read < s_image_len - 2 * sizeof(s_flash_data));
+
+    const boot_load_stats_t *stats = boot_image_stats();
+    TEST_ASSERT_EQUAL_INT(0, stats->segments[0].flash_len);
+    TEST_ASSERT_EQUAL_INT(sizeof(s_iram), stats->segments[1].flash_len);
+    TEST_ASSERT_EQUAL_INT(0, stats->segments[5].flash_len);
+}
+
+static void test_lazy_verify_leaves_flash_segments_to_app(void)
+{
+    setup();
+    put_default_lazy_image();
+    mock_flash_data()[s_part.offset + DROM_DATA_OFFSET + 100] ^= 0x01;
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load(&s_part, &s_data));
+}
+
+static void test_lazy_verify_corrupt_ram_segment_fails(void)
+{
+    setup();
+    put_default_lazy_image();
+    mock_flash_data()[s_part.offset + IRAM_DATA_OFFSET + 100] ^= 0x01;
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_IMAGE_INVALID, boot_image_load(&s_part, &s_data));
+}
+
+static void test_lazy_verify_corrupt_footer_fails(void)
+{
+    setup();
+    put_default_lazy_image();
+    mock_flash_data()[s_part.offset + s_image_len - 1] ^= 0x01;
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_IMAGE_INVALID, boot_image_load(&s_part, &s_data));
+}
+#endif
+
+#if CONFIG_BETTEROTA_SEGMENT_INDEX
+static void put_default_indexed_image(void)
+{
+    put_default_image();
+    s_image_len = fixture_add_segment_index(s_image, s_image_len);
+    mock_flash_put(s_part.offset, s_image, s_image_len);
+}
+
+static uint32_t index_len(void)
+{
+    esp_image_header_t header;
+    memcpy(&header, s_image, sizeof(header));
+    return sizeof(boot_image_index_t) + header.segment_count * sizeof(boot_image_index_entry_t);
+}
+
+static void test_index_replaces_segment_header_reads(void)
+{
+    setup();
+    put_default_image();
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load(&s_part, &s_data));
+    const uint32_t plain_reads = mock_flash_stats()->reads;
+
+    setup();
+    put_default_indexed_image();
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load(&s_part, &s_data));
+    TEST_ASSERT(ram_equals(IRAM_ADDR, s_iram, sizeof(s_iram)));
+    TEST_ASSERT(ram_equals(DRAM_ADDR, s_dram, sizeof(s_dram)));
+    TEST_ASSERT_EQUAL_INT(s_image_len - index_len(), s_data.image_len);
+    TEST_ASSERT_EQUAL_INT(plain_reads - s_data.image.segment_count + 1, mock_flash_stats()->reads);
+    TEST_ASSERT_EQUAL_HEX32(IROM_ADDR, s_data.segments[5].load_addr);
+    TEST_ASSERT_EQUAL_HEX32(IROM_ADDR % FIXTURE_MMU_PAGE_SIZE, s_data.segment_data[5] % FIXTURE_MMU_PAGE_SIZE);
+    const boot_load_stats_t *stats = boot_image_stats();
+    for (uint32_t i = 0; i < stats->segment_count; i++) {
+        TEST_ASSERT(stats->segments[i].flags & BOOT_SEGMENT_FLAG_INDEXED);
+    }
+
+    // Unverified loads take the headers from the index as well
+    setup();
+    put_default_indexed_image();
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load_unverified(&s_part, &s_data));
+    TEST_ASSERT(ram_equals(IRAM_ADDR, s_iram, sizeof(s_iram)));
+    TEST_ASSERT(boot_image_stats()->segments[0].flags & BOOT_SEGMENT_FLAG_INDEXED);
+}
+
+static void test_corrupt_index_is_ignored(void)
+{
+    setup();
+    put_default_indexed_image();
+    mock_flash_data()[s_part.offset + s_image_len - 1] ^= 0x01;
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load(&s_part, &s_data));
+    TEST_ASSERT(ram_equals(IRAM_ADDR, s_iram, sizeof(s_iram)));
+    TEST_ASSERT(!(boot_image_stats()->segments[0].flags & BOOT_SEGMENT_FLAG_INDEXED));
+}
+
+static void test_index_unlike_image_fails_verified_load(void)
+{
+    // An index with a valid CRC that moves the DRAM segment
+    setup();
+    put_default_indexed_image();
+    boot_image_index_t index;
+    boot_image_index_entry_t entries[ESP_IMAGE_MAX_SEGMENTS];
+    const uint32_t offset = s_image_len - index_len();
+    memcpy(&index, s_image + offset, sizeof(index));
+    memcpy(entries, s_image + offset + sizeof(index), index.segment_count * sizeof(entries[0]));
+    entries[2].load_addr += 0x1000;
+    index.crc = esp_rom_crc32_le(UINT32_MAX, (const uint8_t *)entries, index.segment_count * sizeof(entries[0]));
+    mock_flash_put(s_part.offset + offset, &index, sizeof(index));
+    mock_flash_put(s_part.offset + offset + sizeof(index), entries, index.segment_count * sizeof(entries[0]));
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_IMAGE_INVALID, boot_image_load(&s_part, &s_data));
+}
+#endif
+
+static void test_publishes_stats_to_rtc(void)
+{
+    setup();
+    put_default_image();
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load(&s_part, &s_data));
+    boot_image_stats_publish();
+    const boot_load_stats_t *stats = boot_load_stats_get();
+    TEST_ASSERT(stats != NULL);
+    TEST_ASSERT_EQUAL_MEMORY(boot_image_stats()->segments, stats->segments, sizeof(stats->segments));
+
+    boot_rtc()->load.segments[0].read_us++;
+    TEST_ASSERT(boot_load_stats_get() == NULL);
+}
+
+static void put_file(const uint8_t *file, size_t len)
+{
+    mock_flash_put(s_part.offset, file, len);
+}
+
+static void test_packed_image_matches_plain(void)
+{
+    setup();
+    put_file(s_plain_file, s_plain_file_len);
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load(&s_part, &s_data));
+    static uint8_t iram[90 * 1024];
+    memcpy(iram, mock_ram(0x40080000), sizeof(iram));
+    const uint32_t plain_read = mock_flash_stats()->bytes_read;
+
+    setup();
+    put_file(s_packed_file, s_packed_file_len);
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load(&s_part, &s_data));
+    TEST_ASSERT(s_data.image.reserved[0] & BOOT_IMAGE_FLAG_LZ4);
+    TEST_ASSERT(ram_equals(0x40080000, iram, sizeof(iram)));
+    TEST_ASSERT(mock_flash_stats()->bytes_read < plain_read);
+
+    // The packing tool may move RAM segments into the gaps between flash segments
+    const boot_load_stats_t *stats = boot_image_stats();
+    const boot_segment_stats_t *seg = NULL;
+    for (uint32_t i = 0; i < stats->segment_count; i++) {
+        if (stats->segments[i].load_addr == 0x40080000) {
+            seg = &stats->segments[i];
+        }
+    }
+    TEST_ASSERT(seg != NULL);
+    TEST_ASSERT_EQUAL_INT(BOOT_REGION_IRAM, seg->region);
+    TEST_ASSERT(seg->flags & BOOT_SEGMENT_FLAG_LZ4);
+    TEST_ASSERT_EQUAL_INT(sizeof(iram), seg->load_len);
+    TEST_ASSERT(seg->flash_len < seg->load_len);
+}
+
+static void test_packed_image_keeps_flash_alignment(void)
+{
+    setup();
+    put_file(s_packed_file, s_packed_file_len);
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load(&s_part, &s_data));
+    TEST_ASSERT_EQUAL_HEX32(0x3F400020, s_data.segments[0].load_addr);
+    for (int i = 0; i < s_data.image.segment_count; i++) {
+        const uint32_t addr = s_data.segments[i].load_addr;
+        if (addr >= SOC_IROM_LOW && addr < SOC_IROM_HIGH) {
+            TEST_ASSERT_EQUAL_HEX32(addr % FIXTURE_MMU_PAGE_SIZE, s_data.segment_data[i] % FIXTURE_MMU_PAGE_SIZE);
+        }
+    }
+}
+
+static void test_corrupt_packed_block_fails(void)
+{
+    setup();
+    put_file(s_packed_file, s_packed_file_len);
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load(&s_part, &s_data));
+    // The first block header of the first RAM segment, made to claim more than it holds
+    for (int i = 0; i < s_data.image.segment_count; i++) {
+        if (s_data.segments[i].load_addr == 0x3FFB0000) {
+            uint32_t *block_header = (uint32_t *)(mock_flash_data() + s_data.segment_data[i] + 4);
+            *block_header = (*block_header & ~0xFFFFU) | 0xFFF0;
+        }
+    }
+    // The digest check would catch it too, so check the decompression on its own
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_IMAGE_INVALID, boot_image_load_unverified(&s_part, &s_data));
+}
+
+#if CONFIG_BETTEROTA_LAZY_VERIFY
+static void test_lazy_packed_image_matches_plain(void)
+{
+    setup();
+    put_file(s_plain_file, s_plain_file_len);
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load(&s_part, &s_data));
+    static uint8_t iram[90 * 1024];
+    memcpy(iram, mock_ram(0x40080000), sizeof(iram));
+
+    // Packed by betterota_pack.py --ram-digest --segment-index, whose digest and index must
+    // match the bootloader's
+    setup();
+    put_file(s_lazy_file, s_lazy_file_len);
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load(&s_part, &s_data));
+    TEST_ASSERT(boot_image_has_ram_digest(&s_data.image));
+    TEST_ASSERT(ram_equals(0x40080000, iram, sizeof(iram)));
+    const boot_load_stats_t *stats = boot_image_stats();
+    for (uint32_t i = 0; i < stats->segment_count; i++) {
+        if (stats->segments[i].region == BOOT_REGION_FLASH) {
+            TEST_ASSERT_EQUAL_INT(0, stats->segments[i].flash_len);
+        }
+#if CONFIG_BETTEROTA_SEGMENT_INDEX
+        TEST_ASSERT(stats->segments[i].flags & BOOT_SEGMENT_FLAG_INDEXED);
+#endif
+    }
+}
+#endif
+
+static size_t read_file(const char *path, uint8_t *buf, size_t size)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return 0;
+    }
+    const size_t len = fread(buf, 1, size, f);
+    fclose(f);
+    return len;
+}
+
+int main(int argc, char **argv)
+{
+    RUN_TEST(test_loads_ram_segments);
+    RUN_TEST(test_records_flash_segments_for_mapping);
+    RUN_TEST(test_reads_image_once);
+    RUN_TEST(test_corrupt_segment_fails);
+    RUN_TEST(test_corrupt_digest_fails);
+    RUN_TEST(test_erased_partition_fails);
+    RUN_TEST(test_missing_partition_fails);
+    RUN_TEST(test_image_past_partition_end_fails);
+    RUN_TEST(test_segment_over_bootloader_stack_fails);
+    RUN_TEST(test_segment_over_loader_iram_fails);
+    RUN_TEST(test_segment_over_bootloader_data_fails);
+    RUN_TEST(test_segment_across_regions_fails);
+    RUN_TEST(test_rtc_kept_on_deep_sleep_wake);
+    RUN_TEST(test_unverified_load_skips_flash_segments);
+    RUN_TEST(test_records_segment_stats);
+    RUN_TEST(test_hashing_overlaps_flash_reads);
+#if CONFIG_BETTEROTA_APP_CPU
+    RUN_TEST(test_app_cpu_hashes_while_reading);
+    RUN_TEST(test_app_cpu_corrupt_image_fails);
+#endif
+    RUN_TEST(test_unverified_load_stats_skip_flash_segments);
+#if CONFIG_BETTEROTA_LAZY_VERIFY
+    RUN_TEST(test_lazy_verify_skips_flash_segments);
+    RUN_TEST(test_lazy_verify_leaves_flash_segments_to_app);
+    RUN_TEST(test_lazy_verify_corrupt_ram_segment_fails);
+    RUN_TEST(test_lazy_verify_corrupt_footer_fails);
+#endif
+#if CONFIG_BETTEROTA_SEGMENT_INDEX
+    RUN_TEST(test_index_replaces_segment_header_reads);
+    RUN_TEST(test_corrupt_index_is_ignored);
+    RUN_TEST(test_index_unlike_image_fails_verified_load);
+#endif
+    RUN_TEST(test_publishes_stats_to_rtc);
+
+    if (argc >= 3) {
+        s_plain_file_len = read_file(argv[1], s_plain_file, sizeof(s_plain_file));
+        s_packed_file_len = read_file(argv[2], s_packed_file, sizeof(s_packed_file));
+        RUN_TEST(test_packed_image_matches_plain);
+        RUN_TEST(test_packed_image_keeps_flash_alignment);
+        RUN_TEST(test_corrupt_packed_block_fails);
+    } else {
+        printf("Skipping the packed image tests, no images given\n");
+    }
+#if CONFIG_BETTEROTA_LAZY_VERIFY
+    if (argc == 4) {
+        s_lazy_file_len = read_file(argv[3], s_lazy_file, sizeof(s_lazy_file));
+        RUN_TEST(test_lazy_packed_image_matches_plain);
+    }
+#endif
+    return TEST_SUMMARY();
+}
@@ -0,0 +1,222 @@
+/*
+ * Tests of the deferred log output into the RTC ring buffer, and of draining it in the app.
+ *
+ * Built a second time with tokenized log lines (test_boot_log_tokenized).
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "mock_hw.h"
+#include "boot_log.h"
+#include "boot_rtc.h"
+#include "test_harness.h"
+
+#define LOG_SIZE CONFIG_BETTEROTA_DEFERRED_LOG_SIZE
+
+static char s_drained[2 * LOG_SIZE];
+static size_t s_drained_len;
+
+static void collect(const char *text, size_t len)
+{
+    memcpy(s_drained + s_drained_len, text, len);
+    s_drained_len += len;
+}
+
+static uint32_t drain(void)
+{
+    s_drained_len = 0;
+    const uint32_t lost = boot_log_drain(collect);
+    s_drained[s_drained_len] = '\0';
+    return lost;
+}
+
+static void setup(void)
+{
+    mock_hw_reset();
+    mock_log_enable(false);
+    mock_rtc_power_loss();
+    boot_log_defer();
+}
+
+static void test_nothing_to_drain_after_power_loss(void)
+{
+    mock_hw_reset();
+    mock_rtc_power_loss();
+    TEST_ASSERT(!boot_log_valid(&boot_rtc()->log));
+    TEST_ASSERT_EQUAL_INT(0, drain());
+    TEST_ASSERT_EQUAL_INT(0, s_drained_len);
+}
+
+static void test_lines_go_to_rtc_instead_of_uart(void)
+{
+    setup();
+    esp_rom_printf("first %d\n", 1);
+    esp_rom_printf("second\n");
+    boot_log_finish();
+    TEST_ASSERT_EQUAL_INT(0, mock_uart_bytes());
+
+    TEST_ASSERT_EQUAL_INT(0, drain());
+    TEST_ASSERT(strcmp(s_drained, "first 1\nsecond\n") == 0);
+    // Drained lines are not handed out again
+    TEST_ASSERT_EQUAL_INT(0, drain());
+    TEST_ASSERT_EQUAL_INT(0, s_drained_len);
+}
+
+static void test_finish_restores_uart(void)
+{
+    setup();
+    boot_log_finish();
+    esp_rom_printf("to the uart\n");
+    TEST_ASSERT_EQUAL_INT(strlen("to the uart\n"), mock_uart_bytes());
+    drain();
+    TEST_ASSERT_EQUAL_INT(0, s_drained_len);
+}
+
+static void test_lines_of_earlier_boots_are_kept(void)
+{
+    setup();
+    esp_rom_printf("boot 1\n");
+    boot_log_finish();
+
+    mock_hw_reset();
+    boot_log_defer();
+    esp_rom_printf("boot 2\n");
+    boot_log_finish();
+
+    TEST_ASSERT_EQUAL_INT(0, drain());
+    TEST_ASSERT(strcmp(s_drained, "boot 1\nboot 2\n") == 0);
+}
+
+static void test_overwritten_lines_are_counted(void)
+{
+    setup();
+    for (int i = 0; i < LOG_SIZE / 10 + 5; i++) {
+        esp_rom_printf("line %04d\n", i);
+    }
+    boot_log_finish();
+
+    const uint32_t written = (LOG_SIZE / 10 + 5) * 10;
+    TEST_ASSERT_EQUAL_INT(written - LOG_SIZE, drain());
+    TEST_ASSERT_EQUAL_INT(LOG_SIZE, s_drained_len);
+    // The newest lines survive, in order
+    char last[16];
+    snprintf(last, sizeof(last), "line %04d\n", LOG_SIZE / 10 + 4);
+    TEST_ASSERT(memcmp(s_drained + LOG_SIZE - strlen(last), last, strlen(last)) == 0);
+}
+
+static void test_failing_boot_replays_its_lines_to_uart(void)
+{
+    setup();
+    esp_rom_printf("earlier boot\n");
+    boot_log_finish();
+
+    mock_hw_reset();
+    boot_log_defer();
+    esp_rom_printf("this boot\n");
+    TEST_ASSERT_EQUAL_INT(0, mock_uart_bytes());
+    boot_log_immediate();
+    TEST_ASSERT_EQUAL_INT(strlen("this boot\n"), mock_uart_bytes());
+    esp_rom_printf("failing\n");
+    TEST_ASSERT_EQUAL_INT(strlen("this boot\nfailing\n"), mock_uart_bytes());
+
+    // The app still finds everything that went to the ring
+    drain();
+    TEST_ASSERT(strcmp(s_drained, "earlier boot\nthis boot\n") == 0);
+}
+
+static void test_deferred_lines_cost_no_uart_time(void)
+{
+    setup();
+    uint32_t start = mock_time_us();
+    for (int i = 0; i < 10; i++) {
+        esp_rom_printf("I (test) A log line of the length the bootloader writes, number %d\n", i);
+    }
+    const uint32_t deferred_us = mock_time_us() - start;
+    boot_log_finish();
+
+    start = mock_time_us();
+    for (int i = 0; i < 10; i++) {
+        esp_rom_printf("I (test) A log line of the length the bootloader writes, number %d\n", i);
+    }
+    const uint32_t uart_us = mock_time_us() - start;
+    TEST_ASSERT_EQUAL_INT(0, deferred_us);
+    // All but the FIFO's worth waits for the UART
+    TEST_ASSERT(uart_us >= (mock_uart_bytes() - MOCK_UART_FIFO_LEN) * MOCK_UART_CHAR_CYCLES / MOCK_CPU_MHZ);
+}
+
+#if CONFIG_BETTEROTA_TOKENIZED_LOG
+static void base64(const uint8_t *data, size_t len, char *out)
+{
+    static const char DIGITS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (size_t i = 0; i < len; i += 3) {
+        const uint32_t bits = data[i] << 16 | (i + 1 < len ? data[i + 1] << 8 : 0) | (i + 2 < len ? data[i + 2] : 0);
+        *out++ = DIGITS[bits >> 18];
+        *out++ = DIGITS[(bits >> 12) & 0x3F];
+        *out++ = i + 1 < len ? DIGITS[(bits >> 6) & 0x3F] : '=';
+        *out++ = i + 2 < len ? DIGITS[bits & 0x3F] : '=';
+    }
+    *out = '\0';
+}
+
+static void test_lines_are_sent_as_frames(void)
+{
+    setup();
+    ESP_LOGI("test", "Slot %d of %s at 0x%lx", -1, "ota", (unsigned long)0x10000);
+    boot_log_finish();
+    drain();
+
+    const uint32_t token = BOOT_LOG_TOKEN("I" "Slot %d of %s at 0x%lx");
+    const uint8_t payload[] = {
+        token, token >> 8, token >> 16, token >> 24,
+        0xFF, 0xFF, 0xFF, 0xFF, 0x0F,       // -1 as 32 bits
+        3, 'o', 't', 'a',
+        0x80, 0x80, 0x04,                   // 0x10000
+    };
+    char expected[64] = "$";
+    base64(payload, sizeof(payload), expected + 1);
+    strcat(expected, "\n");
+    TEST_ASSERT(strcmp(s_drained, expected) == 0);
+}
+
+static void test_long_strings_are_cut(void)
+{
+    char name[2 * BOOT_LOG_FRAME_MAX];
+    memset(name, 'x', sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+
+    setup();
+    ESP_LOGI("test", "%s and %d", name, 1);
+    boot_log_finish();
+    drain();
+    TEST_ASSERT_EQUAL_INT(1 + BOOT_LOG_FRAME_MAX / 3 * 4 + 1, s_drained_len);
+}
+
+static void test_levels_above_the_log_level_are_left_out(void)
+{
+    setup();
+    ESP_LOGD("test", "Not sent %d", 1);
+    ESP_LOGV("test", "Not sent either");
+    boot_log_finish();
+    drain();
+    TEST_ASSERT_EQUAL_INT(0, s_drained_len);
+}
+#endif
+
+int main(void)
+{
+    RUN_TEST(test_nothing_to_drain_after_power_loss);
+    RUN_TEST(test_lines_go_to_rtc_instead_of_uart);
+    RUN_TEST(test_finish_restores_uart);
+    RUN_TEST(test_lines_of_earlier_boots_are_kept);
+    RUN_TEST(test_overwritten_lines_are_counted);
+    RUN_TEST(test_failing_boot_replays_its_lines_to_uart);
+    RUN_TEST(test_deferred_lines_cost_no_uart_time);
+#if CONFIG_BETTEROTA_TOKENIZED_LOG
+    RUN_TEST(test_lines_are_sent_as_frames);
+    RUN_TEST(test_long_strings_are_cut);
+    RUN_TEST(test_levels_above_the_log_level_are_left_out);
+#endif
+    return TEST_SUMMARY();
+}
@@ -0,0 +1,85 @@
+/*
+ * Tests of the LZ4 block decompressor.
+ */
+#include <stdint.h>
+#include <string.h>
+#include "boot_lz4.h"
+#include "test_harness.h"
+
+static uint8_t s_out[64];
+
+static void test_literals_only(void)
+{
+    const uint8_t block[] = { 0x50, 'h', 'e', 'l', 'l', 'o' };
+    TEST_ASSERT_EQUAL_INT(5, boot_lz4_decompress(block, sizeof(block), s_out, sizeof(s_out)));
+    TEST_ASSERT_EQUAL_MEMORY("hello", s_out, 5);
+}
+
+static void test_match(void)
+{
+    // "abcd", then copy 4 bytes from 4 back, then the last literal "!"
+    const uint8_t block[] = { 0x40, 'a', 'b', 'c', 'd', 0x04, 0x00, 0x10, '!' };
+    TEST_ASSERT_EQUAL_INT(9, boot_lz4_decompress(block, sizeof(block), s_out, sizeof(s_out)));
+    TEST_ASSERT_EQUAL_MEMORY("abcdabcd!", s_out, 9);
+}
+
+static void test_overlapping_match_repeats(void)
+{
+    // "x", then 19 more bytes from 1 back: the match extends past its own start
+    const uint8_t block[] = { 0x1F, 'x', 0x01, 0x00, 0x00, 0x00 };
+    TEST_ASSERT_EQUAL_INT(20, boot_lz4_decompress(block, sizeof(block), s_out, sizeof(s_out)));
+    for (int i = 0; i < 20; i++) {
+        TEST_ASSERT_EQUAL_INT('x', s_out[i]);
+    }
+}
+
+static void test_long_literal_length(void)
+{
+    uint8_t block[2 + 30];
+    block[0] = 0xF0;
+    block[1] = 15;      // 15 + 15 = 30 literals
+    memset(block + 2, 'z', 30);
+    TEST_ASSERT_EQUAL_INT(30, boot_lz4_decompress(block, sizeof(block), s_out, sizeof(s_out)));
+    TEST_ASSERT_EQUAL_INT('z', s_out[29]);
+}
+
+static void test_offset_before_start_fails(void)
+{
+    const uint8_t block[] = { 0x10, 'a', 0x02, 0x00, 0x00 };
+    TEST_ASSERT_EQUAL_INT(-1, boot_lz4_decompress(block, sizeof(block), s_out, sizeof(s_out)));
+}
+
+static void test_zero_offset_fails(void)
+{
+    const uint8_t block[] = { 0x10, 'a', 0x00, 0x00, 0x00 };
+    TEST_ASSERT_EQUAL_INT(-1, boot_lz4_decompress(block, sizeof(block), s_out, sizeof(s_out)));
+}
+
+static void test_output_overrun_fails(void)
+{
+    const uint8_t block[] = { 0x1F, 'x', 0x01, 0x00, 0xFF, 0x00 };
+    TEST_ASSERT_EQUAL_INT(-1, boot_lz4_decompress(block, sizeof(block), s_out, sizeof(s_out)));
+}
+
+static void test_truncated_input_fails(void)
+{
+    const uint8_t literals[] = { 0x50, 'h', 'e' };
+    TEST_ASSERT_EQUAL_INT(-1, boot_lz4_decompress(literals, sizeof(literals), s_out, sizeof(s_out)));
+    const uint8_t offset[] = { 0x10, 'a', 0x01 };
+    TEST_ASSERT_EQUAL_INT(-1, boot_lz4_decompress(offset, sizeof(offset), s_out, sizeof(s_out)));
+    const uint8_t length[] = { 0xF0, 0xFF };
+    TEST_ASSERT_EQUAL_INT(-1, boot_lz4_decompress(length, sizeof(length), s_out, sizeof(s_out)));
+}
+
+int main(void)
+{
+    RUN_TEST(test_literals_only);
+    RUN_TEST(test_match);
+    RUN_TEST(test_overlapping_match_repeats);
+    RUN_TEST(test_long_literal_length);
+    RUN_TEST(test_offset_before_start_fails);
+    RUN_TEST(test_zero_offset_fails);
+    RUN_TEST(test_output_overrun_fails);
+    RUN_TEST(test_truncated_input_fails);
+    return TEST_SUMMARY();
+}
@@ -0,0 +1,213 @@
+/*
+ * Tests of the Merkle tree verifier, on trees of every shape built in memory and on the
+ * synthetic image packed with a tree by tools/betterota_pack.py (see CMakeLists.txt).
+ *
+ * Usage: test_boot_merkle [PLAIN_IMAGE MERKLE_IMAGE]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "bootloader_sha.h"
+#include "esp_log.h"
+#include "mock_hw.h"
+#include "mock_flash.h"
+#include "boot_image.h"
+#include "boot_merkle.h"
+#include "fixtures.h"
+#include "fixture_image.h"
+#include "gen_test_image.h"
+#include "test_harness.h"
+
+#define BLOCK BOOT_IMAGE_MERKLE_BLOCK_SIZE
+#define MAX_BLOCKS 20
+
+static esp_partition_pos_t s_part;
+static esp_image_metadata_t s_data;
+static boot_merkle_t s_tree;
+
+static uint8_t s_plain_file[GEN_TEST_IMAGE_MAX_LEN];
+static size_t s_plain_file_len;
+static uint8_t s_merkle_file[GEN_TEST_IMAGE_MAX_LEN];
+static size_t s_merkle_file_len;
+
+static void setup(void)
+{
+    mock_hw_reset();
+    mock_flash_reset();
+    mock_log_enable(false);
+    s_part = fixture_state().ota[0];
+    memset(&s_data, 0, sizeof(s_data));
+    memset(&s_tree, 0, sizeof(s_tree));
+}
+
+static void sha256(uint32_t prefix, const uint8_t *a, size_t a_len, const uint8_t *b, size_t b_len, uint8_t *out)
+{
+    bootloader_sha256_handle_t sha = bootloader_sha256_start();
+    bootloader_sha256_data(sha, &prefix, sizeof(prefix));
+    bootloader_sha256_data(sha, a, a_len);
+    if (b != NULL) {
+        bootloader_sha256_data(sha, b, b_len);
+    }
+    bootloader_sha256_finish(sha, out);
+}
+
+/**
+ * @brief Writes an image of @p len bytes of filler with its tree footer, built level by level
+ * as betterota_pack.py does, and fills in the metadata a load would.
+ */
+static void put_tree_image(uint32_t len)
+{
+    static uint8_t image[MAX_BLOCKS * BLOCK];
+    static uint8_t nodes[MAX_BLOCKS][32];
+    fixture_code_like(image, len, len);
+    mock_flash_put(s_part.offset, image, len);
+
+    const uint32_t count = (len + BLOCK - 1) / BLOCK;
+    for (uint32_t i = 0; i < count; i++) {
+        const uint32_t n = len - i * BLOCK < BLOCK ? len - i * BLOCK : BLOCK;
+        sha256(0x00, image + i * BLOCK, n, NULL, 0, nodes[i]);
+    }
+    boot_image_merkle_t footer = { .magic = BOOT_IMAGE_MERKLE_MAGIC, .block_size = BLOCK, .block_count = count };
+    mock_flash_put(s_part.offset + len + sizeof(footer), nodes, count * 32);
+    for (uint32_t level = count; level > 1; level = (level + 1) / 2) {
+        for (uint32_t i = 0; i < level; i += 2) {
+            if (i + 1 < level) {
+                sha256(0x01, nodes[i], 32, nodes[i + 1], 32, nodes[i / 2]);
+            } else {
+                memcpy(nodes[i / 2], nodes[i], 32);
+            }
+        }
+    }
+    memcpy(footer.root, nodes[0], sizeof(footer.root));
+    mock_flash_put(s_part.offset + len, &footer, sizeof(footer));
+
+    s_data.start_addr = s_part.offset;
+    s_data.image_len = len;
+    s_data.image.reserved[0] = BOOT_IMAGE_FLAG_MERKLE;
+}
+
+static void test_root_of_every_shape(void)
+{
+    for (uint32_t count = 1; count <= MAX_BLOCKS; count++) {
+        setup();
+        put_tree_image(count * BLOCK - 48);
+        TEST_ASSERT_EQUAL_INT(ESP_OK, boot_merkle_open(&s_part, &s_data, &s_tree));
+        TEST_ASSERT_EQUAL_INT(count, s_tree.block_count);
+        TEST_ASSERT_EQUAL_INT(ESP_OK, boot_merkle_verify_blocks(&s_tree, 0, count));
+    }
+}
+
+static void test_open_reads_only_the_tree(void)
+{
+    setup();
+    put_tree_image(10 * BLOCK);
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_merkle_open(&s_part, &s_data, &s_tree));
+    TEST_ASSERT_EQUAL_INT(sizeof(boot_image_merkle_t) + 10 * 32, mock_flash_stats()->bytes_read);
+}
+
+static void test_corrupt_block_fails_only_its_block(void)
+{
+    setup();
+    put_tree_image(10 * BLOCK);
+    mock_flash_data()[s_part.offset + 3 * BLOCK + 100] ^= 0x01;
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_merkle_open(&s_part, &s_data, &s_tree));
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_merkle_verify_blocks(&s_tree, 0, 3));
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_merkle_verify_blocks(&s_tree, 4, 6));
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_IMAGE_INVALID, boot_merkle_verify_blocks(&s_tree, 3, 1));
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_merkle_verify_range(&s_tree, 0, 3 * BLOCK));
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_IMAGE_INVALID, boot_merkle_verify_range(&s_tree, 3 * BLOCK - 1, 2));
+}
+
+static void test_corrupt_leaf_fails_open(void)
+{
+    setup();
+    put_tree_image(5 * BLOCK);
+    mock_flash_data()[s_part.offset + 5 * BLOCK + sizeof(boot_image_merkle_t) + 2 * 32] ^= 0x01;
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_IMAGE_INVALID, boot_merkle_open(&s_part, &s_data, &s_tree));
+}
+
+static void test_corrupt_root_fails_open(void)
+{
+    setup();
+    put_tree_image(5 * BLOCK);
+    mock_flash_data()[s_part.offset + 5 * BLOCK + offsetof(boot_image_merkle_t, root)] ^= 0x01;
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_IMAGE_INVALID, boot_merkle_open(&s_part, &s_data, &s_tree));
+}
+
+static void test_wrong_block_count_fails_open(void)
+{
+    setup();
+    put_tree_image(5 * BLOCK);
+    s_data.image_len += BLOCK;
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_IMAGE_INVALID, boot_merkle_open(&s_part, &s_data, &s_tree));
+}
+
+static void test_blocks_outside_image_rejected(void)
+{
+    setup();
+    put_tree_image(5 * BLOCK - 4);
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_merkle_open(&s_part, &s_data, &s_tree));
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_ARG, boot_merkle_verify_blocks(&s_tree, 4, 2));
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_ARG, boot_merkle_verify_range(&s_tree, 5 * BLOCK - 8, 8));
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_ARG, boot_merkle_verify_range(&s_tree, 0, 0));
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_merkle_verify_range(&s_tree, 5 * BLOCK - 8, 4));
+}
+
+static void test_image_without_tree_not_found(void)
+{
+    setup();
+    mock_flash_put(s_part.offset, s_plain_file, s_plain_file_len);
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load(&s_part, &s_data));
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_NOT_FOUND, boot_merkle_open(&s_part, &s_data, &s_tree));
+}
+
+static void test_packed_image_tree(void)
+{
+    // Packed with --ram-digest --merkle --segment-index: the tree lies between the RAM digest
+    // footer and the index
+    setup();
+    mock_flash_put(s_part.offset, s_merkle_file, s_merkle_file_len);
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load(&s_part, &s_data));
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_merkle_open(&s_part, &s_data, &s_tree));
+    TEST_ASSERT_EQUAL_INT((s_data.image_len + BLOCK - 1) / BLOCK, s_tree.block_count);
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_merkle_verify_blocks(&s_tree, 0, s_tree.block_count));
+
+    // Unverified loads find the same tree
+    setup();
+    mock_flash_put(s_part.offset, s_merkle_file, s_merkle_file_len);
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load_unverified(&s_part, &s_data));
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_merkle_open(&s_part, &s_data, &s_tree));
+}
+
+static size_t read_file(const char *path, uint8_t *buf, size_t size)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return 0;
+    }
+    const size_t len = fread(buf, 1, size, f);
+    fclose(f);
+    return len;
+}
+
+int main(int argc, char **argv)
+{
+    RUN_TEST(test_root_of_every_shape);
+    RUN_TEST(test_open_reads_only_the_tree);
+    RUN_TEST(test_corrupt_block_fails_only_its_block);
+    RUN_TEST(test_corrupt_leaf_fails_open);
+    RUN_TEST(test_corrupt_root_fails_open);
+    RUN_TEST(test_wrong_block_count_fails_open);
+    RUN_TEST(test_blocks_outside_image_rejected);
+
+    if (argc == 3) {
+        s_plain_file_len = read_file(argv[1], s_plain_file, sizeof(s_plain_file));
+        s_merkle_file_len = read_file(argv[2], s_merkle_file, sizeof(s_merkle_file));
+        RUN_TEST(test_image_without_tree_not_found);
+        RUN_TEST(test_packed_image_tree);
+    } else {
+        printf("Skipping the packed image tests, no images given\n");
+    }
+    return TEST_SUMMARY();
+}
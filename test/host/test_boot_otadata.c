@@ -0,0 +1,249 @@
+/*
+ * Tests of the otadata parsing.
+ */
+#include <stdint.h>
+#include <string.h>
+#include "esp_log.h"
+#include "mock_hw.h"
+#include "mock_flash.h"
+#include "boot_otadata.h"
+#include "fixtures.h"
+#include "test_harness.h"
+
+static void setup(void)
+{
+    mock_hw_reset();
+    mock_flash_reset();
+    mock_log_enable(false);
+    boot_otadata_invalidate();
+}
+
+static void test_crc_matches_rom(void)
+{
+    // Known otadata entry for sequence number 1, as written by esp_ota_set_boot_partition()
+    const esp_ota_select_entry_t entry = fixture_otadata_entry(1, ESP_OTA_IMG_UNDEFINED);
+    TEST_ASSERT_EQUAL_HEX32(0x4743989A, entry.crc);
+    TEST_ASSERT(boot_otadata_entry_valid(&entry));
+}
+
+static void test_erased_selects_nothing(void)
+{
+    setup();
+    const bootloader_state_t bs = fixture_state();
+    const boot_otadata_t *otadata = boot_otadata_get(&bs);
+    TEST_ASSERT_EQUAL_INT(-1, otadata->slot);
+    TEST_ASSERT_EQUAL_INT(-1, otadata->active_entry);
+}
+
+static void test_single_entry(void)
+{
+    setup();
+    fixture_put_otadata(1, 2, ESP_OTA_IMG_UNDEFINED);
+    const bootloader_state_t bs = fixture_state();
+    const boot_otadata_t *otadata = boot_otadata_get(&bs);
+    TEST_ASSERT_EQUAL_INT(1, otadata->active_entry);
+    TEST_ASSERT_EQUAL_INT(1, otadata->slot);
+    TEST_ASSERT_EQUAL_INT(2, otadata->seq);
+}
+
+static void test_highest_sequence_wins(void)
+{
+    setup();
+    fixture_put_otadata(0, 5, ESP_OTA_IMG_VALID);
+    fixture_put_otadata(1, 4, ESP_OTA_IMG_VALID);
+    const bootloader_state_t bs = fixture_state();
+    const boot_otadata_t *otadata = boot_otadata_get(&bs);
+    TEST_ASSERT_EQUAL_INT(0, otadata->active_entry);
+    TEST_ASSERT_EQUAL_INT(0, otadata->slot);   // (5 - 1) % 2
+    TEST_ASSERT_EQUAL_HEX32(ESP_OTA_IMG_VALID, otadata->state);
+}
+
+static void test_corrupt_entry_is_ignored(void)
+{
+    setup();
+    esp_ota_select_entry_t entry = fixture_otadata_entry(7, ESP_OTA_IMG_VALID);
+    entry.crc ^= 1;
+    mock_flash_put(FIXTURE_OTADATA_OFFSET, &entry, sizeof(entry));
+    fixture_put_otadata(1, 2, ESP_OTA_IMG_VALID);
+
+    const bootloader_state_t bs = fixture_state();
+    const boot_otadata_t *otadata = boot_otadata_get(&bs);
+    TEST_ASSERT_EQUAL_INT(1, otadata->active_entry);
+    TEST_ASSERT_EQUAL_INT(1, otadata->slot);
+}
+
+static void test_invalid_image_falls_back_to_older_entry(void)
+{
+    setup();
+    fixture_put_otadata(0, 3, ESP_OTA_IMG_INVALID);
+    fixture_put_otadata(1, 2, ESP_OTA_IMG_VALID);
+    const bootloader_state_t bs = fixture_state();
+    const boot_otadata_t *otadata = boot_otadata_get(&bs);
+    TEST_ASSERT_EQUAL_INT(1, otadata->active_entry);
+    TEST_ASSERT_EQUAL_INT(1, otadata->slot);
+
+    setup();
+    fixture_put_otadata(0, 3, ESP_OTA_IMG_ABORTED);
+    TEST_ASSERT_EQUAL_INT(-1, boot_otadata_get(&bs)->slot);
+}
+
+static void test_missing_partition_selects_nothing(void)
+{
+    setup();
+    fixture_put_otadata(0, 1, ESP_OTA_IMG_VALID);
+    bootloader_state_t bs = fixture_state();
+    bs.ota_info.size = 0;
+    TEST_ASSERT_EQUAL_INT(-1, boot_otadata_get(&bs)->slot);
+    TEST_ASSERT_EQUAL_INT(0, mock_flash_stats()->reads);
+}
+
+static void test_result_is_cached(void)
+{
+    setup();
+    fixture_put_otadata(0, 1, ESP_OTA_IMG_VALID);
+    const bootloader_state_t bs = fixture_state();
+    boot_otadata_get(&bs);
+    fixture_put_otadata(1, 2, ESP_OTA_IMG_VALID);
+    TEST_ASSERT_EQUAL_INT(0, boot_otadata_get(&bs)->slot);
+    // One read per entry, both on the first call
+    TEST_ASSERT_EQUAL_INT(2, mock_flash_stats()->reads);
+
+    boot_otadata_invalidate();
+    TEST_ASSERT_EQUAL_INT(1, boot_otadata_get(&bs)->slot);
+    // The first entry is still in its read-ahead window, only the rewritten one is read again
+    TEST_ASSERT_EQUAL_INT(3, mock_flash_stats()->reads);
+}
+
+static boot_otadata_verified_t verified_record(uint32_t part_offset, uint8_t fill)
+{
+    boot_otadata_verified_t record;
+    memset(&record, 0, sizeof(record));
+    record.part_offset = part_offset;
+    record.image_len = 0x1230;
+    memset(record.digest, fill, sizeof(record.digest));
+    memset(record.quick_digest, fill, sizeof(record.quick_digest));
+    return record;
+}
+
+static void test_verified_record_round_trip(void)
+{
+    setup();
+    fixture_put_otadata(1, 2, ESP_OTA_IMG_VALID);
+    const bootloader_state_t bs = fixture_state();
+    boot_otadata_verified_t record = verified_record(FIXTURE_OTA_1_OFFSET, 0xA5);
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_otadata_write_verified(&bs, &record));
+
+    boot_otadata_verified_t read;
+    TEST_ASSERT(boot_otadata_read_verified(&bs, &read));
+    TEST_ASSERT_EQUAL_HEX32(BOOT_OTADATA_VERIFIED_MAGIC, read.magic);
+    TEST_ASSERT_EQUAL_INT(2, read.ota_seq);
+    TEST_ASSERT_EQUAL_MEMORY(&record, &read, sizeof(read));
+    // Next to the active entry, the other sector is left alone
+    TEST_ASSERT_EQUAL_HEX32(BOOT_OTADATA_VERIFIED_MAGIC,
+                            *(uint32_t *)(mock_flash_data() + FIXTURE_OTADATA_OFFSET + 0x1000 + BOOT_OTADATA_VERIFIED_OFFSET));
+}
+
+static void test_verified_record_goes_with_the_entry(void)
+{
+    setup();
+    fixture_put_otadata(0, 1, ESP_OTA_IMG_VALID);
+    const bootloader_state_t bs = fixture_state();
+    boot_otadata_verified_t record = verified_record(FIXTURE_OTA_0_OFFSET, 0xA5);
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_otadata_write_verified(&bs, &record));
+
+    // An entry written over the sector without erasing it doesn't take the record of another
+    const esp_ota_select_entry_t entry = fixture_otadata_entry(3, ESP_OTA_IMG_VALID);
+    mock_flash_put(FIXTURE_OTADATA_OFFSET, &entry, sizeof(entry));
+    boot_otadata_invalidate();
+    boot_otadata_verified_t read;
+    TEST_ASSERT(!boot_otadata_read_verified(&bs, &read));
+
+    // Writing otadata erases the record
+    fixture_put_otadata(0, 1, ESP_OTA_IMG_VALID);
+    boot_otadata_invalidate();
+    TEST_ASSERT(!boot_otadata_read_verified(&bs, &read));
+}
+
+static void test_verified_records_are_appended(void)
+{
+    setup();
+    fixture_put_otadata(0, 3, ESP_OTA_IMG_VALID);
+    const bootloader_state_t bs = fixture_state();
+    for (int i = 0; i < BOOT_OTADATA_VERIFIED_SLOTS; i++) {
+        boot_otadata_verified_t record = verified_record(FIXTURE_OTA_0_OFFSET, (uint8_t)i);
+        TEST_ASSERT_EQUAL_INT(ESP_OK, boot_otadata_write_verified(&bs, &record));
+    }
+    boot_otadata_verified_t record = verified_record(FIXTURE_OTA_0_OFFSET, 0xEE);
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_NO_MEM, boot_otadata_write_verified(&bs, &record));
+
+    boot_otadata_verified_t read;
+    TEST_ASSERT(boot_otadata_read_verified(&bs, &read));
+    TEST_ASSERT_EQUAL_INT(BOOT_OTADATA_VERIFIED_SLOTS - 1, read.digest[0]);
+
+    // A torn write of the last record leaves the one before
+    mock_flash_data()[FIXTURE_OTADATA_OFFSET + BOOT_OTADATA_VERIFIED_OFFSET +
+                      (BOOT_OTADATA_VERIFIED_SLOTS - 1) * BOOT_OTADATA_VERIFIED_STRIDE + 20] ^= 0x01;
+    TEST_ASSERT(boot_otadata_read_verified(&bs, &read));
+    TEST_ASSERT_EQUAL_INT(BOOT_OTADATA_VERIFIED_SLOTS - 2, read.digest[0]);
+}
+
+static void test_counts_boots(void)
+{
+    setup();
+    fixture_put_otadata(0, 1, ESP_OTA_IMG_VALID);
+    const bootloader_state_t bs = fixture_state();
+    for (uint32_t i = 1; i <= 70; i++) {
+        TEST_ASSERT_EQUAL_INT(i, boot_otadata_count_boot(&bs));
+    }
+    // One bit per boot, from the first word on
+    const uint32_t *counter = (const uint32_t *)(mock_flash_data() + FIXTURE_OTADATA_OFFSET + BOOT_OTADATA_COUNTER_OFFSET);
+    TEST_ASSERT_EQUAL_HEX32(0, counter[0]);
+    TEST_ASSERT_EQUAL_HEX32(0, counter[1]);
+    TEST_ASSERT_EQUAL_HEX32(0xFFFFFFC0, counter[2]);
+
+    fixture_put_otadata(0, 1, ESP_OTA_IMG_VALID);
+    TEST_ASSERT_EQUAL_INT(1, boot_otadata_count_boot(&bs));
+}
+
+static void test_full_counter_reads_zero(void)
+{
+    setup();
+    fixture_put_otadata(0, 1, ESP_OTA_IMG_VALID);
+    const bootloader_state_t bs = fixture_state();
+    memset(mock_flash_data() + FIXTURE_OTADATA_OFFSET + BOOT_OTADATA_COUNTER_OFFSET, 0,
+           BOOT_OTADATA_SECTOR_SIZE - BOOT_OTADATA_COUNTER_OFFSET - 4);
+    TEST_ASSERT_EQUAL_INT(((BOOT_OTADATA_SECTOR_SIZE - BOOT_OTADATA_COUNTER_OFFSET) / 4 - 1) * 32 + 1,
+                          boot_otadata_count_boot(&bs));
+    memset(mock_flash_data() + FIXTURE_OTADATA_OFFSET + BOOT_OTADATA_SECTOR_SIZE - 4, 0, 4);
+    TEST_ASSERT_EQUAL_INT(0, boot_otadata_count_boot(&bs));
+}
+
+static void test_no_record_without_entry(void)
+{
+    setup();
+    const bootloader_state_t bs = fixture_state();
+    boot_otadata_verified_t record = verified_record(FIXTURE_OTA_1_OFFSET, 0xA5);
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_NOT_FOUND, boot_otadata_write_verified(&bs, &record));
+    TEST_ASSERT(!boot_otadata_read_verified(&bs, &record));
+    TEST_ASSERT_EQUAL_INT(0, boot_otadata_count_boot(&bs));
+    TEST_ASSERT_EQUAL_INT(0, mock_flash_stats()->writes);
+}
+
+int main(void)
+{
+    RUN_TEST(test_crc_matches_rom);
+    RUN_TEST(test_erased_selects_nothing);
+    RUN_TEST(test_single_entry);
+    RUN_TEST(test_highest_sequence_wins);
+    RUN_TEST(test_corrupt_entry_is_ignored);
+    RUN_TEST(test_invalid_image_falls_back_to_older_entry);
+    RUN_TEST(test_missing_partition_selects_nothing);
+    RUN_TEST(test_result_is_cached);
+    RUN_TEST(test_verified_record_round_trip);
+    RUN_TEST(test_verified_record_goes_with_the_entry);
+    RUN_TEST(test_verified_records_are_appended);
+    RUN_TEST(test_counts_boots);
+    RUN_TEST(test_full_counter_reads_zero);
+    RUN_TEST(test_no_record_without_entry);
+    return TEST_SUMMARY();
+}
@@ -0,0 +1,255 @@
+/*
+ * Tests of applying delta patches, with the synthetic image, its v2 and the patch between
+ * them made by tools/betterota_diff.py (see CMakeLists.txt).
+ *
+ * Usage: test_boot_patch [SOURCE_IMAGE TARGET_IMAGE PATCH]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "mock_hw.h"
+#include "mock_flash.h"
+#include "boot_image.h"
+#include "boot_otadata.h"
+#include "boot_patch.h"
+#include "boot_patch_format.h"
+#include "boot_select.h"
+#include "fixtures.h"
+#include "gen_test_image.h"
+#include "test_harness.h"
+
+static uint8_t s_source[GEN_TEST_IMAGE_MAX_LEN];
+static size_t s_source_len;
+static uint8_t s_target[GEN_TEST_IMAGE_MAX_LEN];
+static size_t s_target_len;
+static uint8_t s_patch[FIXTURE_PATCH_SIZE];
+static size_t s_patch_len;
+static bootloader_state_t s_bs;
+
+/**
+ * @brief Selects an OTA slot in otadata, marked as waiting for a patch if @p patched.
+ */
+static void put_otadata(int slot, bool patched)
+{
+    esp_ota_select_entry_t entry = fixture_otadata_entry(slot + 1, ESP_OTA_IMG_UNDEFINED);
+    if (patched) {
+        memcpy(entry.seq_label, BOOT_PATCH_LABEL, sizeof(BOOT_PATCH_LABEL));
+    }
+    mock_flash_put(FIXTURE_OTADATA_OFFSET, &entry, sizeof(entry));
+}
+
+static void setup(void)
+{
+    mock_hw_reset();
+    mock_flash_reset();
+    mock_ram_fill(0xA5);
+    mock_log_enable(false);
+    boot_otadata_invalidate();
+    s_bs = fixture_state();
+
+    fixture_put_partition_table(0x10);
+    mock_flash_put(FIXTURE_OTA_0_OFFSET, s_source, s_source_len);
+    // An older image in the target slot, which must not boot in place of the new one
+    mock_flash_put(FIXTURE_OTA_1_OFFSET, s_source, s_source_len);
+    mock_flash_put(FIXTURE_PATCH_OFFSET, s_patch, s_patch_len);
+    put_otadata(1, true);
+}
+
+static boot_patch_header_t *flash_header(void)
+{
+    return (boot_patch_header_t *)(mock_flash_data() + FIXTURE_PATCH_OFFSET);
+}
+
+/**
+ * @brief Checks that an OTA slot still holds the image setup() put there.
+ */
+static void assert_slot_untouched(int slot)
+{
+    const uint32_t offset = slot == 0 ? FIXTURE_OTA_0_OFFSET : FIXTURE_OTA_1_OFFSET;
+    TEST_ASSERT_EQUAL_MEMORY(s_source, mock_flash_data() + offset, s_source_len);
+}
+
+static void test_nothing_pending(void)
+{
+    setup();
+    put_otadata(1, false);
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_NOT_FOUND, boot_patch_apply_pending(&s_bs));
+    TEST_ASSERT_EQUAL_INT(0, mock_flash_stats()->writes);
+    // Only the otadata entries are read, not the patch partition
+    TEST_ASSERT_EQUAL_INT(2, mock_flash_stats()->reads);
+}
+
+static void test_marker_without_patch_fails(void)
+{
+    setup();
+    uint8_t erased[sizeof(boot_patch_header_t)];
+    memset(erased, 0xFF, sizeof(erased));
+    mock_flash_put(FIXTURE_PATCH_OFFSET, erased, sizeof(erased));
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_STATE, boot_patch_apply_pending(&s_bs));
+    TEST_ASSERT_EQUAL_HEX32(BOOT_PATCH_STATE_FAILED, flash_header()->state);
+    assert_slot_untouched(1);
+    TEST_ASSERT_EQUAL_INT(0, choose_ota_partition(&s_bs));
+}
+
+static void test_patch_partition_comes_from_the_table(void)
+{
+    setup();
+    // The table ends before the patch partition, the last entry
+    const uint16_t end = 0xFFFF;
+    mock_flash_put(ESP_PARTITION_TABLE_OFFSET + 5 * sizeof(esp_partition_info_t), &end, sizeof(end));
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_STATE, boot_patch_apply_pending(&s_bs));
+    assert_slot_untouched(1);
+    TEST_ASSERT_EQUAL_INT(0, choose_ota_partition(&s_bs));
+}
+
+static void test_applies_patch(void)
+{
+    setup();
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_patch_apply_pending(&s_bs));
+    TEST_ASSERT_EQUAL_MEMORY(s_target, mock_flash_data() + FIXTURE_OTA_1_OFFSET, s_target_len);
+    TEST_ASSERT_EQUAL_HEX32(BOOT_PATCH_STATE_APPLIED, flash_header()->state);
+    // Every sector erase feeds the watchdog
+    TEST_ASSERT(mock_wdt_feeds() >= mock_flash_stats()->erases);
+
+    esp_image_metadata_t data = {0};
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_image_load(&s_bs.ota[1], &data));
+    TEST_ASSERT_EQUAL_INT(s_target_len, data.image_len);
+}
+
+static void test_applied_patch_is_not_applied_again(void)
+{
+    setup();
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_patch_apply_pending(&s_bs));
+    const uint32_t writes = mock_flash_stats()->writes;
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_NOT_FOUND, boot_patch_apply_pending(&s_bs));
+    TEST_ASSERT_EQUAL_INT(writes, mock_flash_stats()->writes);
+}
+
+static void test_changed_source_fails_before_writing(void)
+{
+    setup();
+    mock_flash_data()[FIXTURE_OTA_0_OFFSET + s_source_len / 2] ^= 0x01;
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_IMAGE_INVALID, boot_patch_apply_pending(&s_bs));
+    TEST_ASSERT_EQUAL_HEX32(BOOT_PATCH_STATE_FAILED, flash_header()->state);
+    assert_slot_untouched(1);
+}
+
+static void test_source_mismatch_boots_the_source_slot(void)
+{
+    setup();
+    boot_patch_header_t *header = flash_header();
+    header->source_digest[0] ^= 0x01;
+    header->crc = boot_patch_header_crc(header);
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_IMAGE_INVALID, boot_patch_apply_pending(&s_bs));
+
+    // The older image left in the target slot is not booted as if it were the new one
+    assert_slot_untouched(1);
+    TEST_ASSERT_EQUAL_INT(ESP_OTA_IMG_INVALID, boot_otadata_get(&s_bs)->entries[0].ota_state);
+    TEST_ASSERT_EQUAL_INT(0, choose_ota_partition(&s_bs));
+    // ... also on the next boot
+    boot_otadata_invalidate();
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_NOT_FOUND, boot_patch_apply_pending(&s_bs));
+    TEST_ASSERT_EQUAL_INT(0, choose_ota_partition(&s_bs));
+}
+
+static void test_corrupt_patch_fails(void)
+{
+    setup();
+    mock_flash_data()[FIXTURE_PATCH_OFFSET + sizeof(boot_patch_header_t) + s_patch_len / 2] ^= 0x5A;
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_IMAGE_INVALID, boot_patch_apply_pending(&s_bs));
+    TEST_ASSERT_EQUAL_HEX32(BOOT_PATCH_STATE_FAILED, flash_header()->state);
+
+    // The broken target image doesn't boot, nor is it selected
+    esp_image_metadata_t data = {0};
+    TEST_ASSERT(boot_image_load(&s_bs.ota[1], &data) != ESP_OK);
+    TEST_ASSERT_EQUAL_INT(0, choose_ota_partition(&s_bs));
+}
+
+static void test_flash_error_leaves_patch_pending(void)
+{
+    setup();
+    mock_flash_fail_writes_after(20);
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_IMAGE_FLASH_FAIL, boot_patch_apply_pending(&s_bs));
+    TEST_ASSERT_EQUAL_HEX32(BOOT_PATCH_STATE_PENDING, flash_header()->state);
+
+    // The next boot starts over
+    mock_flash_fail_writes_after(UINT32_MAX);
+    TEST_ASSERT_EQUAL_INT(ESP_OK, boot_patch_apply_pending(&s_bs));
+    TEST_ASSERT_EQUAL_MEMORY(s_target, mock_flash_data() + FIXTURE_OTA_1_OFFSET, s_target_len);
+}
+
+static void test_bad_header_crc_fails(void)
+{
+    setup();
+    flash_header()->target_size += 4;
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_STATE, boot_patch_apply_pending(&s_bs));
+    TEST_ASSERT_EQUAL_HEX32(BOOT_PATCH_STATE_FAILED, flash_header()->state);
+    assert_slot_untouched(1);
+    TEST_ASSERT_EQUAL_INT(0, choose_ota_partition(&s_bs));
+}
+
+static void test_target_must_be_selected_slot(void)
+{
+    setup();
+    put_otadata(0, true);
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_STATE, boot_patch_apply_pending(&s_bs));
+    assert_slot_untouched(0);
+    assert_slot_untouched(1);
+}
+
+static void test_source_slot_is_never_the_target(void)
+{
+    setup();
+    put_otadata(0, true);
+    boot_patch_header_t *header = flash_header();
+    header->target_slot = 0;
+    header->crc = boot_patch_header_crc(header);
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_INVALID_STATE, boot_patch_apply_pending(&s_bs));
+    assert_slot_untouched(0);
+    assert_slot_untouched(1);
+}
+
+static void test_patch_is_small(void)
+{
+    printf("Patch: %zu bytes for a %zu byte image\n", s_patch_len, s_target_len);
+    TEST_ASSERT(s_patch_len * 5 <= s_target_len);
+}
+
+static size_t read_file(const char *path, uint8_t *buf, size_t size)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        perror(path);
+        return 0;
+    }
+    const size_t len = fread(buf, 1, size, f);
+    fclose(f);
+    return len;
+}
+
+int main(int argc, char **argv)
+{
+    RUN_TEST(test_nothing_pending);
+    RUN_TEST(test_marker_without_patch_fails);
+    RUN_TEST(test_patch_partition_comes_from_the_table);
+
+    if (argc == 4) {
+        s_source_len = read_file(argv[1], s_source, sizeof(s_source));
+        s_target_len = read_file(argv[2], s_target, sizeof(s_target));
+        s_patch_len = read_file(argv[3], s_patch, sizeof(s_patch));
+        RUN_TEST(test_applies_patch);
+        RUN_TEST(test_applied_patch_is_not_applied_again);
+        RUN_TEST(test_changed_source_fails_before_writing);
+        RUN_TEST(test_source_mismatch_boots_the_source_slot);
+        RUN_TEST(test_corrupt_patch_fails);
+        RUN_TEST(test_flash_error_leaves_patch_pending);
+        RUN_TEST(test_bad_header_crc_fails);
+        RUN_TEST(test_target_must_be_selected_slot);
+        RUN_TEST(test_source_slot_is_never_the_target);
+        RUN_TEST(test_patch_is_small);
+    } else {
+        printf("Skipping the patch tests, no images given\n");
+    }
+    return TEST_SUMMARY();
+}
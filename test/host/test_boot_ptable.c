@@ -0,0 +1,116 @@
+/*
+ * Tests of the RTC partition table cache.
+ */
+#include <stdint.h>
+#include <string.h>
+#include "esp_log.h"
+#include "mock_hw.h"
+#include "mock_flash.h"
+#include "mock_bootloader.h"
+#include "boot_rtc.h"
+#include "boot_ptable.h"
+#include "boot_patch_format.h"
+#include "fixtures.h"
+#include "test_harness.h"
+
+static void setup(void)
+{
+    mock_hw_reset();
+    mock_flash_reset();
+    mock_bootloader_reset();
+    mock_log_enable(false);
+    mock_rtc_power_loss();
+    fixture_put_partition_table(0x10);
+}
+
+static void assert_partitions_csv(const bootloader_state_t *bs)
+{
+    const bootloader_state_t expected = fixture_state();
+    TEST_ASSERT_EQUAL_INT(2, bs->app_count);
+    TEST_ASSERT_EQUAL_MEMORY(&expected.ota_info, &bs->ota_info, sizeof(bs->ota_info));
+    TEST_ASSERT_EQUAL_MEMORY(&expected.ota, &bs->ota, sizeof(bs->ota));
+}
+
+static void test_cold_boot_parses_the_table(void)
+{
+    setup();
+    bootloader_state_t bs;
+    TEST_ASSERT(boot_ptable_load(&bs));
+    assert_partitions_csv(&bs);
+    TEST_ASSERT_EQUAL_INT(1, mock_bootloader_stats()->partition_table_loads);
+    TEST_ASSERT_EQUAL_HEX32(FIXTURE_PTABLE_MD5_OFFSET, boot_rtc()->ptable.md5_offset);
+}
+
+static void test_warm_boot_uses_the_cache(void)
+{
+    setup();
+    bootloader_state_t bs;
+    boot_ptable_load(&bs);
+    memset(&bs, 0, sizeof(bs));
+
+    mock_flash_reset();
+    fixture_put_partition_table(0x10);
+    TEST_ASSERT(boot_ptable_load(&bs));
+    assert_partitions_csv(&bs);
+    TEST_ASSERT_EQUAL_INT(1, mock_bootloader_stats()->partition_table_loads);
+    // Only the window around the MD5 entry is read
+    TEST_ASSERT_EQUAL_INT(0, mock_flash_stats()->mmaps);
+    TEST_ASSERT_EQUAL_INT(1, mock_flash_stats()->reads);
+    TEST_ASSERT_EQUAL_INT(CONFIG_BETTEROTA_READ_AHEAD_SIZE, mock_flash_stats()->bytes_read);
+}
+
+static void test_changed_table_is_parsed_again(void)
+{
+    setup();
+    bootloader_state_t bs;
+    boot_ptable_load(&bs);
+    fixture_put_partition_table(0x20);
+    TEST_ASSERT(boot_ptable_load(&bs));
+    TEST_ASSERT_EQUAL_INT(2, mock_bootloader_stats()->partition_table_loads);
+}
+
+static void test_table_write_invalidates_the_cache(void)
+{
+    setup();
+    bootloader_state_t bs;
+    boot_ptable_load(&bs);
+    boot_rtc_note_partition_table_write();
+    TEST_ASSERT(boot_ptable_load(&bs));
+    TEST_ASSERT_EQUAL_INT(2, mock_bootloader_stats()->partition_table_loads);
+    // ... and the table is cached again for the next boot
+    TEST_ASSERT(boot_ptable_load(&bs));
+    TEST_ASSERT_EQUAL_INT(2, mock_bootloader_stats()->partition_table_loads);
+}
+
+static void test_invalid_table_clears_the_cache(void)
+{
+    setup();
+    bootloader_state_t bs;
+    boot_ptable_load(&bs);
+    boot_rtc_note_partition_table_write();
+    const uint16_t garbage = 0x1234;
+    mock_flash_put(ESP_PARTITION_TABLE_OFFSET, &garbage, sizeof(garbage));
+    TEST_ASSERT(!boot_ptable_load(&bs));
+    TEST_ASSERT_EQUAL_INT(0, boot_rtc()->ptable.magic);
+}
+
+static void test_finds_data_partitions(void)
+{
+    setup();
+    esp_partition_pos_t pos;
+    TEST_ASSERT(boot_ptable_find(PART_TYPE_DATA, BOOT_PATCH_PARTITION_SUBTYPE, &pos));
+    TEST_ASSERT_EQUAL_HEX32(FIXTURE_PATCH_OFFSET, pos.offset);
+    TEST_ASSERT_EQUAL_HEX32(FIXTURE_PATCH_SIZE, pos.size);
+    TEST_ASSERT(!boot_ptable_find(PART_TYPE_DATA, 0x41, &pos));
+}
+
+int main(void)
+{
+    RUN_TEST(test_cold_boot_parses_the_table);
+    RUN_TEST(test_warm_boot_uses_the_cache);
+    RUN_TEST(test_changed_table_is_parsed_again);
+    RUN_TEST(test_table_write_invalidates_the_cache);
+    RUN_TEST(test_invalid_table_clears_the_cache);
+    RUN_TEST(test_finds_data_partitions);
+    return TEST_SUMMARY();
+}
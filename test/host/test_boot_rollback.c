@@ -0,0 +1,166 @@
+/*
+ * Tests of the trial boots of new images and their rollback.
+ */
+#include <stdint.h>
+#include <string.h>
+#include "esp_log.h"
+#include "mock_hw.h"
+#include "mock_flash.h"
+#include "boot_rtc.h"
+#include "boot_otadata.h"
+#include "boot_rollback.h"
+#include "boot_timer.h"
+#include "fixtures.h"
+#include "test_harness.h"
+
+static void setup(void)
+{
+    mock_hw_reset();
+    mock_flash_reset();
+    mock_log_enable(false);
+    mock_rtc_power_loss();
+    boot_otadata_invalidate();
+    boot_timer_start();
+}
+
+/**
+ * @brief Reads an otadata entry back from flash.
+ */
+static esp_ota_select_entry_t read_entry(int sector)
+{
+    esp_ota_select_entry_t entry;
+    memcpy(&entry, mock_flash_data() + FIXTURE_OTADATA_OFFSET + sector * 0x1000, sizeof(entry));
+    return entry;
+}
+
+static void test_confirmed_image_is_not_on_trial(void)
+{
+    setup();
+    fixture_put_otadata(1, 2, ESP_OTA_IMG_VALID);
+    const bootloader_state_t bs = fixture_state();
+    TEST_ASSERT_EQUAL_INT(BOOT_TRIAL_NONE, boot_rollback_check(&bs, 1));
+    TEST_ASSERT_EQUAL_INT(0, mock_flash_stats()->writes);
+    TEST_ASSERT_EQUAL_INT(0, boot_timer_stats()->flags);
+}
+
+static void test_image_selected_without_rollback_is_not_on_trial(void)
+{
+    setup();
+    // esp_ota_set_boot_partition() without CONFIG_BOOTLOADER_APP_ROLLBACK_ENABLE
+    fixture_put_otadata(1, 2, ESP_OTA_IMG_UNDEFINED);
+    const bootloader_state_t bs = fixture_state();
+    TEST_ASSERT_EQUAL_INT(BOOT_TRIAL_NONE, boot_rollback_check(&bs, 1));
+    TEST_ASSERT_EQUAL_INT(0, mock_flash_stats()->writes);
+}
+
+static void test_other_slot_is_not_counted(void)
+{
+    setup();
+    fixture_put_otadata(1, 2, ESP_OTA_IMG_NEW);
+    const bootloader_state_t bs = fixture_state();
+    // E.g. the button forced OTA_0
+    TEST_ASSERT_EQUAL_INT(BOOT_TRIAL_NONE, boot_rollback_check(&bs, 0));
+    TEST_ASSERT_EQUAL_INT(0, boot_otadata_trial_boots(&bs));
+}
+
+static void test_new_image_counts_trial_boots(void)
+{
+    setup();
+    fixture_put_otadata(1, 2, ESP_OTA_IMG_NEW);
+    const bootloader_state_t bs = fixture_state();
+    const boot_trial_record_t *record = &boot_rtc()->trial;
+    for (uint32_t boot = 1; boot <= CONFIG_BETTEROTA_TRIAL_BOOT_ATTEMPTS; boot++) {
+        boot_timer_start();
+        TEST_ASSERT_EQUAL_INT(BOOT_TRIAL_COUNTED, boot_rollback_check(&bs, 1));
+        TEST_ASSERT_EQUAL_HEX32(BOOT_STATS_FLAG_TRIAL, boot_timer_stats()->flags);
+        TEST_ASSERT_EQUAL_INT(boot, boot_otadata_trial_boots(&bs));
+        TEST_ASSERT_EQUAL_HEX32(BOOT_TRIAL_MAGIC, record->magic);
+        TEST_ASSERT_EQUAL_HEX32(boot_trial_record_crc(record), record->crc);
+        TEST_ASSERT_EQUAL_INT(2, record->ota_seq);
+        TEST_ASSERT_EQUAL_INT(1, record->slot);
+        TEST_ASSERT_EQUAL_INT(boot, record->boots);
+        TEST_ASSERT_EQUAL_INT(CONFIG_BETTEROTA_TRIAL_BOOT_ATTEMPTS, record->max_boots);
+    }
+}
+
+static void test_unconfirmed_image_is_rolled_back(void)
+{
+    setup();
+    fixture_put_otadata(0, 1, ESP_OTA_IMG_VALID);
+    fixture_put_otadata(1, 2, ESP_OTA_IMG_NEW);
+    const bootloader_state_t bs = fixture_state();
+    for (int boot = 1; boot <= CONFIG_BETTEROTA_TRIAL_BOOT_ATTEMPTS; boot++) {
+        TEST_ASSERT_EQUAL_INT(BOOT_TRIAL_COUNTED, boot_rollback_check(&bs, 1));
+    }
+
+    boot_timer_start();
+    TEST_ASSERT_EQUAL_INT(BOOT_TRIAL_ROLLED_BACK, boot_rollback_check(&bs, 1));
+    TEST_ASSERT_EQUAL_HEX32(BOOT_STATS_FLAG_ROLLED_BACK, boot_timer_stats()->flags);
+    TEST_ASSERT_EQUAL_HEX32(0, boot_rtc()->trial.magic);
+    // Marked aborted as the IDF bootloader does, the previous entry is left as it is
+    const esp_ota_select_entry_t aborted = read_entry(1);
+    TEST_ASSERT_EQUAL_INT(2, aborted.ota_seq);
+    TEST_ASSERT_EQUAL_HEX32(ESP_OTA_IMG_ABORTED, aborted.ota_state);
+    TEST_ASSERT(boot_otadata_entry_valid(&aborted));
+    TEST_ASSERT_EQUAL_INT(1, mock_flash_stats()->erases);
+    TEST_ASSERT_EQUAL_INT(0, boot_otadata_get(&bs)->slot);
+    TEST_ASSERT_EQUAL_HEX32(ESP_OTA_IMG_VALID, boot_otadata_get(&bs)->state);
+    TEST_ASSERT_EQUAL_INT(BOOT_TRIAL_NONE, boot_rollback_check(&bs, 0));
+}
+
+static void test_first_update_is_rolled_back_to_the_other_slot(void)
+{
+    setup();
+    // The first esp_ota_set_boot_partition() of a device, to OTA_0; the other entry is blank
+    fixture_put_otadata(0, 1, ESP_OTA_IMG_NEW);
+    const bootloader_state_t bs = fixture_state();
+    for (int boot = 1; boot <= CONFIG_BETTEROTA_TRIAL_BOOT_ATTEMPTS; boot++) {
+        TEST_ASSERT_EQUAL_INT(BOOT_TRIAL_COUNTED, boot_rollback_check(&bs, 0));
+    }
+    TEST_ASSERT_EQUAL_INT(BOOT_TRIAL_ROLLED_BACK, boot_rollback_check(&bs, 0));
+    TEST_ASSERT_EQUAL_HEX32(ESP_OTA_IMG_ABORTED, read_entry(0).ota_state);
+    TEST_ASSERT_EQUAL_INT(1, boot_otadata_get(&bs)->active_entry);
+    TEST_ASSERT_EQUAL_INT(1, boot_otadata_get(&bs)->slot);
+    TEST_ASSERT_EQUAL_HEX32(ESP_OTA_IMG_UNDEFINED, boot_otadata_get(&bs)->state);
+}
+
+static void test_count_survives_power_loss(void)
+{
+    setup();
+    fixture_put_otadata(1, 2, ESP_OTA_IMG_NEW);
+    const bootloader_state_t bs = fixture_state();
+    boot_rollback_check(&bs, 1);
+    boot_rollback_check(&bs, 1);
+    mock_rtc_power_loss();
+    TEST_ASSERT_EQUAL_INT(BOOT_TRIAL_COUNTED, boot_rollback_check(&bs, 1));
+    TEST_ASSERT_EQUAL_INT(3, boot_rtc()->trial.boots);
+}
+
+static void test_rtc_counts_when_otadata_cant_be_written(void)
+{
+    setup();
+    fixture_put_otadata(0, 1, ESP_OTA_IMG_VALID);
+    fixture_put_otadata(1, 2, ESP_OTA_IMG_NEW);
+    const bootloader_state_t bs = fixture_state();
+    mock_flash_fail_writes_after(0);
+    for (int boot = 1; boot <= CONFIG_BETTEROTA_TRIAL_BOOT_ATTEMPTS; boot++) {
+        TEST_ASSERT_EQUAL_INT(BOOT_TRIAL_COUNTED, boot_rollback_check(&bs, 1));
+    }
+    TEST_ASSERT_EQUAL_INT(0, boot_otadata_trial_boots(&bs));
+    // Still rolled back, though otadata keeps selecting the image it can't mark
+    TEST_ASSERT_EQUAL_INT(BOOT_TRIAL_ROLLED_BACK, boot_rollback_check(&bs, 1));
+    TEST_ASSERT_EQUAL_INT(1, boot_otadata_get(&bs)->slot);
+}
+
+int main(void)
+{
+    RUN_TEST(test_confirmed_image_is_not_on_trial);
+    RUN_TEST(test_image_selected_without_rollback_is_not_on_trial);
+    RUN_TEST(test_other_slot_is_not_counted);
+    RUN_TEST(test_new_image_counts_trial_boots);
+    RUN_TEST(test_unconfirmed_image_is_rolled_back);
+    RUN_TEST(test_first_update_is_rolled_back_to_the_other_slot);
+    RUN_TEST(test_count_survives_power_loss);
+    RUN_TEST(test_rtc_counts_when_otadata_cant_be_written);
+    return TEST_SUMMARY();
+}
@@ -0,0 +1,190 @@
+/*
+ * Tests of the button read and OTA partition selection.
+ */
+#include <stdint.h>
+#include <string.h>
+#include "esp_log.h"
+#include "mock_hw.h"
+#include "mock_flash.h"
+#include "soc/gpio_struct.h"
+#include "soc/io_mux_reg.h"
+#include "boot_button.h"
+#include "boot_otadata.h"
+#include "boot_select.h"
+#include "boot_timer.h"
+#include "fixtures.h"
+#include "fixture_image.h"
+#include "test_harness.h"
+
+static const uint32_t BUTTON_MASK = 1u << MOCK_BUTTON_GPIO;
+
+#define IRAM_ADDR 0x40080000
+#define DRAM_ADDR 0x3FFB0000
+
+static uint8_t s_image[8192];
+static size_t s_image_len;
+
+/**
+ * @brief Builds a two segment app image, to place in the OTA slots.
+ */
+static void build_image(void)
+{
+    static uint8_t iram[2048], dram[1024];
+    fixture_code_like(iram, sizeof(iram), 1);
+    fixture_code_like(dram, sizeof(dram), 2);
+    const fixture_segment_t segments[] = {
+        { IRAM_ADDR, iram, sizeof(iram) },
+        { DRAM_ADDR, dram, sizeof(dram) },
+    };
+    s_image_len = fixture_build_image(s_image, segments, 2);
+}
+
+static void setup(void)
+{
+    mock_hw_reset();
+    mock_flash_reset();
+    mock_log_enable(false);
+    boot_otadata_invalidate();
+}
+
+static void test_button_released_reads_not_pressed(void)
+{
+    setup();
+    mock_button_set(false);
+    TEST_ASSERT(!button_pressed());
+}
+
+static void test_button_held_reads_pressed(void)
+{
+    setup();
+    mock_button_set(true);
+    TEST_ASSERT(button_pressed());
+}
+
+static void test_button_configures_pad_as_gpio_input_with_pullup(void)
+{
+    setup();
+    button_pressed();
+
+    const uint32_t r = mock_io_mux_mtck;
+    TEST_ASSERT_EQUAL_INT(2, (r >> 12) & 0x7);   // MCU_SEL = GPIO
+    TEST_ASSERT_EQUAL_INT(0, (r >> 7) & 1);      // pull-down off
+    TEST_ASSERT_EQUAL_INT(1, (r >> 8) & 1);      // pull-up on
+    TEST_ASSERT_EQUAL_INT(1, (r >> 9) & 1);      // input enabled
+}
+
+static void test_button_leaves_pin_undriven(void)
+{
+    setup();
+    button_pressed();
+
+    TEST_ASSERT_EQUAL_HEX32(BUTTON_MASK, GPIO.enable_w1ts);
+    TEST_ASSERT_EQUAL_HEX32(BUTTON_MASK, GPIO.enable_w1tc);
+    TEST_ASSERT_EQUAL_HEX32(BUTTON_MASK, GPIO.out_w1tc);
+}
+
+static void test_select_without_otadata_boots_ota_1(void)
+{
+    setup();
+    const bootloader_state_t bs = fixture_state();
+    mock_button_set(false);
+    TEST_ASSERT_EQUAL_INT(1, choose_ota_partition(&bs));
+}
+
+static void test_select_pressed_boots_ota_0(void)
+{
+    setup();
+    const bootloader_state_t bs = fixture_state();
+    mock_button_set(true);
+    TEST_ASSERT_EQUAL_INT(0, choose_ota_partition(&bs));
+}
+
+static void test_select_follows_otadata(void)
+{
+    setup();
+    const bootloader_state_t bs = fixture_state();
+    fixture_put_otadata(0, 1, ESP_OTA_IMG_VALID);
+    TEST_ASSERT_EQUAL_INT(0, choose_ota_partition(&bs));
+    TEST_ASSERT_EQUAL_INT(BOOT_SELECT_OTADATA, boot_timer_stats()->select_reason);
+    // One read per otadata entry, and one per blank slot probed
+    TEST_ASSERT_EQUAL_INT(4, mock_flash_stats()->reads);
+}
+
+static void test_button_overrides_otadata(void)
+{
+    setup();
+    const bootloader_state_t bs = fixture_state();
+    fixture_put_otadata(0, 2, ESP_OTA_IMG_VALID);
+    mock_button_set(true);
+    TEST_ASSERT_EQUAL_INT(0, choose_ota_partition(&bs));
+    TEST_ASSERT_EQUAL_INT(BOOT_SELECT_BUTTON, boot_timer_stats()->select_reason);
+    // The button alone decides, otadata is not even read; only the blank slots are probed
+    TEST_ASSERT_EQUAL_INT(2, mock_flash_stats()->reads);
+}
+
+static void test_probe_finds_image(void)
+{
+    setup();
+    const bootloader_state_t bs = fixture_state();
+    mock_flash_put(FIXTURE_OTA_0_OFFSET, s_image, s_image_len);
+    TEST_ASSERT_EQUAL_INT(BOOT_SLOT_IMAGE, boot_select_probe_slot(&bs.ota[0]));
+    // The image header with the first segment header, then the second segment header
+    TEST_ASSERT_EQUAL_INT(2, mock_flash_stats()->reads);
+    TEST_ASSERT_EQUAL_INT(BOOT_SLOT_BLANK, boot_select_probe_slot(&bs.ota[1]));
+}
+
+static void test_probe_finds_half_written_image(void)
+{
+    setup();
+    const bootloader_state_t bs = fixture_state();
+    // An update that stopped within the first segment
+    mock_flash_put(FIXTURE_OTA_0_OFFSET, s_image, 1024);
+    TEST_ASSERT_EQUAL_INT(BOOT_SLOT_PARTIAL, boot_select_probe_slot(&bs.ota[0]));
+
+    // A first segment running past the end of the slot
+    esp_image_segment_header_t segment = { IRAM_ADDR, FIXTURE_OTA_0_SIZE };
+    mock_flash_put(FIXTURE_OTA_0_OFFSET + sizeof(esp_image_header_t), &segment, sizeof(segment));
+    TEST_ASSERT_EQUAL_INT(BOOT_SLOT_PARTIAL, boot_select_probe_slot(&bs.ota[0]));
+}
+
+static void test_select_skips_blank_slot(void)
+{
+    setup();
+    const bootloader_state_t bs = fixture_state();
+    fixture_put_otadata(0, 1, ESP_OTA_IMG_VALID);
+    mock_flash_put(FIXTURE_OTA_1_OFFSET, s_image, s_image_len);
+    TEST_ASSERT_EQUAL_INT(1, choose_ota_partition(&bs));
+    TEST_ASSERT_EQUAL_INT(BOOT_SELECT_BLANK_SLOT, boot_timer_stats()->select_reason);
+
+    // Not even the button makes an erased OTA_0 worth trying
+    mock_button_set(true);
+    TEST_ASSERT_EQUAL_INT(1, choose_ota_partition(&bs));
+    TEST_ASSERT_EQUAL_INT(BOOT_SELECT_BLANK_SLOT, boot_timer_stats()->select_reason);
+}
+
+static void test_select_keeps_slot_when_neither_holds_an_image(void)
+{
+    setup();
+    const bootloader_state_t bs = fixture_state();
+    mock_flash_put(FIXTURE_OTA_0_OFFSET, s_image, 1024);
+    TEST_ASSERT_EQUAL_INT(1, choose_ota_partition(&bs));
+    TEST_ASSERT_EQUAL_INT(BOOT_SELECT_DEFAULT, boot_timer_stats()->select_reason);
+}
+
+int main(void)
+{
+    build_image();
+    RUN_TEST(test_button_released_reads_not_pressed);
+    RUN_TEST(test_button_held_reads_pressed);
+    RUN_TEST(test_button_configures_pad_as_gpio_input_with_pullup);
+    RUN_TEST(test_button_leaves_pin_undriven);
+    RUN_TEST(test_select_without_otadata_boots_ota_1);
+    RUN_TEST(test_select_pressed_boots_ota_0);
+    RUN_TEST(test_select_follows_otadata);
+    RUN_TEST(test_button_overrides_otadata);
+    RUN_TEST(test_probe_finds_image);
+    RUN_TEST(test_probe_finds_half_written_image);
+    RUN_TEST(test_select_skips_blank_slot);
+    RUN_TEST(test_select_keeps_slot_when_neither_holds_an_image);
+    return TEST_SUMMARY();
+}
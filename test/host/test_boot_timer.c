@@ -0,0 +1,43 @@
+/*
+ * Tests of the boot phase timer.
+ */
+#include <stdint.h>
+#include "mock_hw.h"
+#include "boot_timer.h"
+#include "test_harness.h"
+
+static void test_frequent_reads_keep_the_time(void)
+{
+    mock_hw_reset();
+    boot_timer_start();
+    const uint32_t start_us = mock_time_us();
+    // Each read of the cycle counter is a fraction of a microsecond apart
+    for (int i = 0; i < 10000; i++) {
+        boot_timer_now_us();
+    }
+    const uint32_t elapsed_us = mock_time_us() - start_us;
+    const uint32_t measured_us = boot_timer_now_us();
+    TEST_ASSERT(elapsed_us >= 1000);
+    TEST_ASSERT(measured_us + 1 >= elapsed_us && measured_us <= elapsed_us + 1);
+}
+
+static void test_sampled_timer_outlasts_the_cycle_counter(void)
+{
+    mock_hw_reset();
+    boot_timer_start();
+    // 60 s at 80 MHz is more than 2^32 cycles
+    for (int i = 0; i < 60; i++) {
+        mock_time_advance_us(1000000);
+        boot_timer_now_us();
+    }
+    const uint32_t measured_us = boot_timer_now_us();
+    // ... plus the few cycles the reads themselves take
+    TEST_ASSERT(measured_us >= 60000000 && measured_us < 60000000 + 100);
+}
+
+int main(void)
+{
+    RUN_TEST(test_frequent_reads_keep_the_time);
+    RUN_TEST(test_sampled_timer_outlasts_the_cycle_counter);
+    return TEST_SUMMARY();
+}
@@ -0,0 +1,59 @@
+/*
+ * Minimal assertion and runner macros for the host test suites.
+ */
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+
+static int s_test_failures;
+static int s_test_count;
+static const char *s_test_name;
+
+#define TEST_FAIL_AT(file, line, ...) do {                          \
+        printf("FAIL %s (%s:%d): ", s_test_name, file, line);      \
+        printf(__VA_ARGS__);                                        \
+        printf("\n");                                               \
+        s_test_failures++;                                          \
+        return;                                                     \
+    } while (0)
+
+#define TEST_ASSERT(cond) do {                                      \
+        if (!(cond)) {                                              \
+            TEST_FAIL_AT(__FILE__, __LINE__, "%s", #cond);          \
+        }                                                           \
+    } while (0)
+
+#define TEST_ASSERT_EQUAL_INT(expected, actual) do {                \
+        const long long e_ = (long long)(expected);                 \
+        const long long a_ = (long long)(actual);                   \
+        if (e_ != a_) {                                             \
+            TEST_FAIL_AT(__FILE__, __LINE__, "%s: expected %lld, got %lld", #actual, e_, a_); \
+        }                                                           \
+    } while (0)
+
+#define TEST_ASSERT_EQUAL_HEX32(expected, actual) do {              \
+        const unsigned long e_ = (unsigned long)(uint32_t)(expected); \
+        const unsigned long a_ = (unsigned long)(uint32_t)(actual); \
+        if (e_ != a_) {                                             \
+            TEST_FAIL_AT(__FILE__, __LINE__, "%s: expected 0x%08lx, got 0x%08lx", #actual, e_, a_); \
+        }                                                           \
+    } while (0)
+
+#define TEST_ASSERT_EQUAL_MEMORY(expected, actual, len) do {        \
+        if (memcmp((expected), (actual), (len)) != 0) {             \
+            TEST_FAIL_AT(__FILE__, __LINE__, "%s differs from %s", #actual, #expected); \
+        }                                                           \
+    } while (0)
+
+#define RUN_TEST(fn) do {                                           \
+        const int failures_ = s_test_failures;                      \
+        s_test_name = #fn;                                          \
+        s_test_count++;                                             \
+        fn();                                                       \
+        if (failures_ == s_test_failures) {                         \
+            printf("PASS %s\n", #fn);                               \
+        }                                                           \
+    } while (0)
+
+#define TEST_SUMMARY() (printf("%d tests, %d failures\n", s_test_count, s_test_failures), s_test_failures != 0)
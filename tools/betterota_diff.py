@@ -0,0 +1,195 @@
+#!/usr/bin/env python3
+"""
+Makes a delta patch between two app images for the BetterOTA bootloader.
+
+The app downloads the patch into the "patch" partition instead of the full new image, and
+the bootloader rebuilds the new image in the target OTA slot from the image in the source
+slot. The patch follows bsdiff: target bytes are described as source bytes plus a
+difference, which is mostly zero when code merely moved, and as extra bytes where there is
+nothing to match. The patch data is LZ4 compressed in the block framing of
+betterota_pack.py. See include/boot_patch_format.h for the format.
+
+Usage: betterota_diff.py [--source-slot N] [--target-slot N] SOURCE TARGET OUTPUT
+"""
+import argparse
+import hashlib
+import struct
+import sys
+import zlib
+
+import betterota_pack
+
+# Must match include/boot_patch_format.h
+PATCH_MAGIC = 0x48435042
+STATE_PENDING = 0xFFFFFFFF
+HEADER_FORMAT = "<IIII32sI32sII"
+
+# Length of the source strings indexed for finding matches
+KEY_LEN = 16
+# Source positions are indexed at this step, target positions are all looked up
+INDEX_STEP = 4
+# Candidates kept per key, the earliest ones
+MAX_CANDIDATES = 4
+# A match is extended past mismatches until its score hasn't improved for this many bytes
+APPROX_WINDOW = 32
+
+
+class DiffError(Exception):
+    pass
+
+
+def _index(source):
+    index = {}
+    for pos in range(0, len(source) - KEY_LEN + 1, INDEX_STEP):
+        candidates = index.setdefault(source[pos:pos + KEY_LEN], [])
+        if len(candidates) < MAX_CANDIDATES:
+            candidates.append(pos)
+    return index
+
+
+def _exact_len(source, s, target, t):
+    """Returns the number of equal bytes at source[s:] and target[t:]."""
+    n = 0
+    limit = min(len(source) - s, len(target) - t)
+    step = 64
+    while n < limit:
+        step = min(step, limit - n)
+        if source[s + n:s + n + step] == target[t + n:t + n + step]:
+            n += step
+            step *= 2
+        elif step > 1:
+            step //= 2
+        else:
+            break
+    return n
+
+
+def _approx_len(source, s, target, t):
+    """
+    Returns how far the match at source[s:] and target[t:] is worth extending, mismatches
+    included: as in bsdiff, as long as at least half of the bytes are equal.
+    """
+    limit = min(len(source) - s, len(target) - t)
+    n = score = best_score = best_n = 0
+    while n < limit and n - best_n < APPROX_WINDOW:
+        equal = _exact_len(source, s + n, target, t + n)
+        if equal:
+            n += equal
+            score += equal
+        else:
+            n += 1
+            score -= 1
+        if score > best_score:
+            best_score, best_n = score, n
+    return best_n
+
+
+def find_matches(source, target):
+    """Returns (target offset, source offset, length) of the matched regions, in target order."""
+    index = _index(source)
+    matches = []
+    offset = 0      # Source minus target offset of the last match
+    t = 0
+    while t <= len(target) - KEY_LEN:
+        key = target[t:t + KEY_LEN]
+        candidates = list(index.get(key, ()))
+        # Code that only moved keeps the offset of the last match, whether or not it is indexed
+        if 0 <= t + offset <= len(source) - KEY_LEN and source[t + offset:t + offset + KEY_LEN] == key:
+            candidates.insert(0, t + offset)
+        if not candidates:
+            t += 1
+            continue
+
+        s = max(candidates, key=lambda c: _exact_len(source, c, target, t))
+        # Take back the bytes before the hit that match too, but not past the last match
+        start = matches[-1][0] + matches[-1][2] if matches else 0
+        while t > start and s > 0 and source[s - 1] == target[t - 1]:
+            t -= 1
+            s -= 1
+        length = _approx_len(source, s, target, t)
+        matches.append((t, s, length))
+        offset = s - t
+        t += length
+    return matches
+
+
+def make_stream(source, target):
+    """Returns the uncompressed patch data turning source into target."""
+    matches = find_matches(source, target)
+    stream = bytearray()
+    # A first control with no diff bytes covers the target up to the first match
+    controls = [(0, 0, 0)] + matches
+    for i, (t, s, length) in enumerate(controls):
+        if i + 1 < len(controls):
+            next_t, next_s, _ = controls[i + 1]
+        else:
+            next_t, next_s = len(target), s + length
+        diff = bytes((target[t + k] - source[s + k]) & 0xFF for k in range(length))
+        extra = target[t + length:next_t]
+        stream += struct.pack("<IIi", length, len(extra), next_s - (s + length))
+        stream += diff + extra
+    return bytes(stream)
+
+
+def apply_stream(source, stream, target_size):
+    """Rebuilds the target as the bootloader does, for checking a patch."""
+    out = bytearray()
+    pos = src_pos = 0
+    while len(out) < target_size:
+        diff_len, extra_len, seek = struct.unpack_from("<IIi", stream, pos)
+        pos += 12
+        out += bytes((stream[pos + k] + source[src_pos + k]) & 0xFF for k in range(diff_len))
+        pos += diff_len
+        out += stream[pos:pos + extra_len]
+        pos += extra_len
+        src_pos += diff_len + seek
+    return bytes(out)
+
+
+def diff(source, target, source_slot, target_slot):
+    """Returns the contents of the patch partition turning source into target."""
+    if len(source) % 4 or len(target) % 4:
+        raise DiffError("image lengths must be multiples of 4")
+    if source_slot == target_slot:
+        raise DiffError("source and target slot must differ")
+
+    stream = make_stream(source, target)
+    if apply_stream(source, stream, len(target)) != target:
+        raise DiffError("patch does not reproduce the target image")
+
+    data = betterota_pack.pack_blocks(stream)
+    header = struct.pack(HEADER_FORMAT, PATCH_MAGIC, source_slot, target_slot,
+                         len(source), hashlib.sha256(source).digest(),
+                         len(target), hashlib.sha256(target).digest(),
+                         len(stream), len(data))
+    # esp_rom_crc32_le(UINT32_MAX, ...)
+    crc = zlib.crc32(header, 0xFFFFFFFF)
+    return header + struct.pack("<II", crc, STATE_PENDING) + data
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--source-slot", type=int, default=0, help="OTA slot holding SOURCE (default 0)")
+    parser.add_argument("--target-slot", type=int, default=1, help="OTA slot to write the new image to (default 1)")
+    parser.add_argument("source")
+    parser.add_argument("target")
+    parser.add_argument("output")
+    args = parser.parse_args(argv[1:])
+
+    with open(args.source, "rb") as f:
+        source = f.read()
+    with open(args.target, "rb") as f:
+        target = f.read()
+    try:
+        patch = diff(source, target, args.source_slot, args.target_slot)
+    except DiffError as e:
+        print(f"{args.target}: {e}", file=sys.stderr)
+        return 1
+    with open(args.output, "wb") as f:
+        f.write(patch)
+    print(f"{args.output}: {len(patch)} bytes, {100 * len(patch) / len(target):.1f}% of the target image")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,328 @@
+#!/usr/bin/env python3
+"""
+Builds the dictionary of the BetterOTA bootloader's tokenized log lines and decodes them.
+
+With CONFIG_BETTEROTA_TOKENIZED_LOG the bootloader sends each ESP_LOGx() line as a frame
+holding the token of its level and format string and the raw arguments, instead of the text
+(see bootloader/boot_log.h). The "dict" command finds the log calls in the bootloader's
+sources and writes their formats by token; "decode" turns the frames in a captured log back
+into text and passes all other lines through.
+
+Usage: betterota_log.py dict [--int32 long|int] OUTPUT SOURCE...
+       betterota_log.py decode [-o OUTPUT] DICT [LOG]
+"""
+import argparse
+import base64
+import binascii
+import json
+import os
+import re
+import struct
+import sys
+
+# Must match bootloader/boot_log_token.h
+HASH_LEN = 128
+HASH_MULTIPLIER = 65599
+
+LOG_CALL = re.compile(r"\bESP_(?:EARLY_)?LOG([EWIDV])\s*\(")
+STRING_CONSTANT = re.compile(r'\bconst\s+char\s*\*\s*(?:const\s+)?(\w+)\s*=\s*"((?:[^"\\]|\\.)*)"\s*;')
+FRAME = re.compile(r"\$([A-Za-z0-9+/]+={0,2})\s*$")
+CONVERSION = re.compile(r"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d+))?(hh|h|ll|l|j|z|t)?([diouxXcsp%])")
+
+ESCAPES = {"n": "\n", "t": "\t", "r": "\r", "0": "\0", "\\": "\\", '"': '"', "'": "'", "a": "\a",
+           "b": "\b", "f": "\f", "v": "\v", "?": "?"}
+
+
+class LogDictError(Exception):
+    pass
+
+
+def token(text):
+    """Returns the token of a level letter followed by a format string, as BOOT_LOG_TOKEN()."""
+    data = text.encode("utf-8")
+    result = len(data)
+    coefficient = 1
+    for c in data[:HASH_LEN]:
+        coefficient = coefficient * HASH_MULTIPLIER % 2**32
+        result = (result + c * coefficient) % 2**32
+    return result
+
+
+def pri_macros(int32_is_long):
+    """The <inttypes.h> macros the bootloader uses; 32-bit types are long on the ESP32's toolchain."""
+    size = "l" if int32_is_long else ""
+    macros = {}
+    for bits, prefix in ((8, "hh"), (16, "h"), (32, size), (64, "ll")):
+        for conversion in "diouxX":
+            macros[f"PRI{conversion}{bits}"] = prefix + conversion
+    return macros
+
+
+def strip_comments(source):
+    """Replaces the comments of C source with spaces, keeping line numbers and literals."""
+    out = []
+    i = 0
+    while i < len(source):
+        c = source[i]
+        if c in "\"'":
+            end = i + 1
+            while end < len(source) and source[end] != c:
+                end += 2 if source[end] == "\\" else 1
+            out.append(source[i:end + 1])
+            i = end + 1
+        elif source.startswith("//", i):
+            end = source.find("\n", i)
+            end = len(source) if end < 0 else end
+            i = end
+        elif source.startswith("/*", i):
+            end = source.find("*/", i + 2)
+            end = len(source) if end < 0 else end + 2
+            out.append("\n" * source.count("\n", i, end))
+            i = end
+        else:
+            out.append(c)
+            i += 1
+    return "".join(out)
+
+
+def call_arguments(source, start):
+    """Splits the arguments of the call whose opening parenthesis is right before start."""
+    args = []
+    depth = 0
+    arg_start = start
+    i = start
+    while i < len(source):
+        c = source[i]
+        if c in "\"'":
+            i += 1
+            while source[i] != c:
+                i += 2 if source[i] == "\\" else 1
+        elif c in "([{":
+            depth += 1
+        elif c in ")]}":
+            if depth == 0:
+                args.append(source[arg_start:i].strip())
+                return args
+            depth -= 1
+        elif c == "," and depth == 0:
+            args.append(source[arg_start:i].strip())
+            arg_start = i + 1
+        i += 1
+    raise LogDictError("unterminated log call")
+
+
+def unescape(literal):
+    out = []
+    i = 0
+    while i < len(literal):
+        c = literal[i]
+        if c != "\\":
+            out.append(c)
+            i += 1
+            continue
+        nxt = literal[i + 1]
+        if nxt == "x":
+            m = re.match(r"[0-9a-fA-F]+", literal[i + 2:])
+            out.append(chr(int(m.group(0), 16)))
+            i += 2 + len(m.group(0))
+        elif nxt in "01234567":
+            m = re.match(r"[0-7]{1,3}", literal[i + 1:])
+            out.append(chr(int(m.group(0), 8)))
+            i += 1 + len(m.group(0))
+        else:
+            out.append(ESCAPES.get(nxt, nxt))
+            i += 2
+    return "".join(out)
+
+
+def string_expression(expr, macros, constants):
+    """Evaluates adjacent string literals and string macros, e.g. "at 0x%08" PRIx32 "\\n"."""
+    parts = []
+    for literal, name in re.findall(r'"((?:[^"\\]|\\.)*)"|(\w+)', expr):
+        if name:
+            if name in macros:
+                parts.append(macros[name])
+            elif name in constants:
+                parts.append(constants[name])
+            else:
+                raise LogDictError(f"can't resolve {name} in {expr}")
+        else:
+            parts.append(unescape(literal))
+    return "".join(parts)
+
+
+def scan_source(path, int32_is_long=True):
+    """Yields (level, tag, format, line) for every log call in a C source file."""
+    with open(path, encoding="utf-8") as f:
+        source = strip_comments(f.read())
+    macros = pri_macros(int32_is_long)
+    constants = {name: unescape(value) for name, value in STRING_CONSTANT.findall(source)}
+    for m in LOG_CALL.finditer(source):
+        line = source.count("\n", 0, m.start()) + 1
+        try:
+            args = call_arguments(source, m.end())
+            if len(args) < 2:
+                raise LogDictError("expected a tag and a format")
+            tag = string_expression(args[0], macros, constants)
+            fmt = string_expression(args[1], macros, constants)
+        except LogDictError as e:
+            raise LogDictError(f"{path}:{line}: {e}")
+        yield m.group(1), tag, fmt, line
+
+
+def build_dictionary(paths, int32_is_long=True):
+    """Returns the dictionary of the log calls in the given sources, keyed by token."""
+    tokens = {}
+    for path in paths:
+        for level, tag, fmt, line in scan_source(path, int32_is_long):
+            key = f"0x{token(level + fmt):08x}"
+            entry = {"level": level, "tag": tag, "format": fmt, "source": f"{os.path.basename(path)}:{line}"}
+            known = tokens.get(key)
+            if known is None:
+                tokens[key] = entry
+            elif (known["level"], known["tag"], known["format"]) != (level, tag, fmt):
+                raise LogDictError(f"{entry['source']}: token {key} collides with {known['source']}; "
+                                   "change one of the formats")
+    return {"hash_len": HASH_LEN, "tokens": tokens}
+
+
+def write_dictionary(path, sources, int32_is_long=True):
+    """Writes the dictionary of the log calls in the given sources as JSON; returns the number of formats."""
+    dictionary = build_dictionary(sources, int32_is_long)
+    with open(path, "w", encoding="utf-8") as f:
+        json.dump(dictionary, f, indent=1, sort_keys=True)
+    return len(dictionary["tokens"])
+
+
+def load_dictionary(path):
+    with open(path, encoding="utf-8") as f:
+        dictionary = json.load(f)
+    if dictionary.get("hash_len") != HASH_LEN:
+        raise LogDictError(f"{path}: made for another token hash")
+    return {int(key, 16): entry for key, entry in dictionary["tokens"].items()}
+
+
+class Payload:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 4
+
+    def integer(self):
+        value = 0
+        shift = 0
+        while True:
+            if self.pos >= len(self.data):
+                raise EOFError
+            byte = self.data[self.pos]
+            self.pos += 1
+            value |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                return value & 0xFFFFFFFF
+
+    def string(self):
+        if self.pos >= len(self.data):
+            raise EOFError
+        length = self.data[self.pos]
+        text = self.data[self.pos + 1:self.pos + 1 + length].decode("utf-8", "replace")
+        self.pos += 1 + length
+        return text
+
+
+def render(fmt, payload):
+    """Formats the arguments in the payload as printf would with the format."""
+    out = []
+    last = 0
+    truncated = False
+    for m in CONVERSION.finditer(fmt):
+        out.append(fmt[last:m.start()])
+        last = m.end()
+        flags, width, precision, _, conversion = m.groups()
+        if conversion == "%":
+            out.append("%")
+            continue
+        if truncated:
+            out.append("?")
+            continue
+        try:
+            if width == "*":
+                width = str(struct.unpack("<i", struct.pack("<I", payload.integer()))[0])
+            if precision == "*":
+                precision = str(payload.integer())
+            if conversion == "s":
+                value = payload.string()
+            else:
+                value = payload.integer()
+                if conversion in "di":
+                    value = struct.unpack("<i", struct.pack("<I", value))[0]
+                elif conversion == "c":
+                    value = chr(value & 0xFF)
+                elif conversion == "p":
+                    flags += "#"
+                    conversion = "x"
+        except EOFError:
+            truncated = True
+            out.append("?")
+            continue
+        spec = "%" + flags + (width or "") + (f".{precision}" if precision is not None else "")
+        out.append((spec + ("d" if conversion == "u" else conversion)) % value)
+    out.append(fmt[last:])
+    text = "".join(out)
+    if text.endswith("\n"):
+        text = text[:-1]
+    return text + (" [truncated]" if truncated else "")
+
+
+def decode_line(tokens, line):
+    """Returns the line with a tokenized frame at its end turned into text, other lines as they are."""
+    m = FRAME.search(line)
+    if m is None:
+        return line
+    try:
+        data = base64.b64decode(m.group(1), validate=True)
+    except (binascii.Error, ValueError):
+        return line
+    if len(data) < 4:
+        return line
+    prefix = line[:m.start()]
+    value = struct.unpack_from("<I", data)[0]
+    entry = tokens.get(value)
+    if entry is None:
+        return f"{prefix}<unknown log token 0x{value:08x}: {m.group(1)}>\n"
+    return f"{prefix}{entry['level']} ({entry['tag']}) {render(entry['format'], Payload(data))}\n"
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    commands = parser.add_subparsers(dest="command", required=True)
+    make = commands.add_parser("dict", help="write the dictionary of the log calls in SOURCE files")
+    make.add_argument("--int32", choices=("long", "int"), default="long",
+                      help="type of int32_t for the PRI*32 macros (default long, as on the ESP32)")
+    make.add_argument("output")
+    make.add_argument("sources", nargs="+")
+    decode = commands.add_parser("decode", help="decode the tokenized lines of LOG (default stdin)")
+    decode.add_argument("-o", "--output", help="write the decoded log here instead of stdout")
+    decode.add_argument("dict")
+    decode.add_argument("log", nargs="?")
+    args = parser.parse_args(argv[1:])
+
+    try:
+        if args.command == "dict":
+            count = write_dictionary(args.output, args.sources, args.int32 == "long")
+            print(f"{args.output}: {count} log formats")
+            return 0
+
+        tokens = load_dictionary(args.dict)
+        src = open(args.log, encoding="utf-8", errors="replace") if args.log else sys.stdin
+        dst = open(args.output, "w", encoding="utf-8") if args.output else sys.stdout
+        with src, dst:
+            for line in src:
+                dst.write(decode_line(tokens, line))
+        return 0
+    except (LogDictError, OSError) as e:
+        print(e, file=sys.stderr)
+        return 1
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,366 @@
+#!/usr/bin/env python3
+"""
+Packs an ESP32 app image for the BetterOTA bootloader.
+
+The RAM segments (IRAM, DRAM, RTC) are split into 2 KiB blocks and LZ4 compressed; the
+bootloader decompresses them while loading. Flash-mapped segments run in place and are
+stored as they are. With --ram-digest the image is followed by the SHA-256 of its header
+and RAM segments, which lets the bootloader leave the flash-mapped segments for the app to
+verify; with --merkle by a Merkle tree of its 4 KiB blocks, against which the bootloader can
+verify any of them; with --segment-index by an index of its segments, from which the
+bootloader takes all segment headers in one read. See bootloader/boot_image.h for the format.
+
+Usage: betterota_pack.py [--no-compress] [--ram-digest] [--merkle] [--segment-index] INPUT OUTPUT
+"""
+import argparse
+import hashlib
+import struct
+import sys
+import zlib
+
+HEADER_LEN = 24
+SEGMENT_HEADER_LEN = 8
+HASH_LEN = 32
+IMAGE_MAGIC = 0xE9
+MAX_SEGMENTS = 16
+CHECKSUM_INITIAL = 0xEF
+MMU_PAGE_SIZE = 0x10000
+
+# esp_image_header_t offsets
+SEGMENT_COUNT_OFFSET = 1
+FLAGS_OFFSET = 19           # reserved[0]
+INDEX_OFFSET_OFFSET = 20    # reserved[1..3]
+HASH_APPENDED_OFFSET = 23
+
+# Must match bootloader/boot_image.h
+FLAG_LZ4 = 1 << 0
+FLAG_RAM_DIGEST = 1 << 1
+RAM_DIGEST_MAGIC = 0x4D415242
+FLAG_MERKLE = 1 << 2
+MERKLE_MAGIC = 0x4B524D42
+MERKLE_BLOCK_SIZE = 4096
+# Whole words, as the ESP32 SHA accelerator only takes those
+MERKLE_LEAF_PREFIX = struct.pack("<I", 0)
+MERKLE_NODE_PREFIX = struct.pack("<I", 1)
+FLAG_SEGMENT_INDEX = 1 << 3
+INDEX_MAGIC = 0x58444942
+BLOCK_SIZE = 2048
+BLOCK_RAW = 1 << 31
+
+FLASH_RANGES = ((0x400D0000, 0x40400000), (0x3F400000, 0x3F800000))
+RAM_RANGES = (
+    (0x40070000, 0x400A0000),   # IRAM
+    (0x3FFAE000, 0x40000000),   # DRAM
+    (0x400C0000, 0x400C2000),   # RTC fast, instruction bus
+    (0x3FF80000, 0x3FF82000),   # RTC fast, data bus
+    (0x50000000, 0x50002000),   # RTC slow
+)
+
+# LZ4 block format
+MIN_MATCH = 4
+MAX_OFFSET = 0xFFFF
+# A block ends with at least 5 literals and its last match starts 12 bytes before the end
+LAST_LITERALS = 5
+MATCH_LIMIT = 12
+
+
+class PackError(Exception):
+    pass
+
+
+def in_ranges(addr, ranges):
+    return any(low <= addr < high for low, high in ranges)
+
+
+def _put_length(out, n):
+    while n >= 255:
+        out.append(255)
+        n -= 255
+    out.append(n)
+
+
+def _put_sequence(out, literals, match_len=None, offset=None):
+    lit = len(literals)
+    ml = match_len - MIN_MATCH if match_len is not None else 0
+    out.append((min(lit, 15) << 4) | min(ml, 15))
+    if lit >= 15:
+        _put_length(out, lit - 15)
+    out += literals
+    if match_len is not None:
+        out += struct.pack("<H", offset)
+        if ml >= 15:
+            _put_length(out, ml - 15)
+
+
+def lz4_compress_block(src):
+    """Greedy LZ4 block compression, with a single hash slot per 4 byte sequence."""
+    out = bytearray()
+    table = {}
+    anchor = 0
+    i = 0
+    limit = len(src) - MATCH_LIMIT
+    while i < limit:
+        key = src[i:i + MIN_MATCH]
+        candidate = table.get(key)
+        table[key] = i
+        if candidate is None or i - candidate > MAX_OFFSET:
+            i += 1
+            continue
+
+        length = MIN_MATCH
+        max_len = len(src) - LAST_LITERALS - i
+        while length < max_len and src[candidate + length] == src[i + length]:
+            length += 1
+
+        _put_sequence(out, src[anchor:i], length, i - candidate)
+        i += length
+        anchor = i
+    _put_sequence(out, src[anchor:])
+    return bytes(out)
+
+
+def lz4_decompress_block(src, size):
+    """Reference decoder, used to check every block before it is written."""
+    out = bytearray()
+    i = 0
+    while i < len(src):
+        token = src[i]
+        i += 1
+        lit = token >> 4
+        if lit == 15:
+            while True:
+                b = src[i]
+                i += 1
+                lit += b
+                if b != 255:
+                    break
+        out += src[i:i + lit]
+        i += lit
+        if i >= len(src):
+            break
+        offset = struct.unpack_from("<H", src, i)[0]
+        i += 2
+        ml = token & 0x0F
+        if ml == 15:
+            while True:
+                b = src[i]
+                i += 1
+                ml += b
+                if b != 255:
+                    break
+        for _ in range(ml + MIN_MATCH):
+            out.append(out[-offset])
+    if len(out) != size:
+        raise PackError("LZ4 round trip failed")
+    return bytes(out)
+
+
+def pack_blocks(data):
+    """Returns data as a sequence of LZ4 blocks, each with its header and padded to 4 bytes."""
+    out = bytearray()
+    for start in range(0, len(data), BLOCK_SIZE):
+        raw = data[start:start + BLOCK_SIZE]
+        compressed = lz4_compress_block(raw)
+        if len(compressed) < len(raw):
+            lz4_decompress_block(compressed, len(raw))
+            out += struct.pack("<I", len(compressed)) + compressed
+        else:
+            out += struct.pack("<I", len(raw) | BLOCK_RAW) + raw
+        out += b"\0" * (-len(out) % 4)
+    return bytes(out)
+
+
+def pack_segment_data(data):
+    """Returns the stored form of a RAM segment: its raw length followed by LZ4 blocks."""
+    return struct.pack("<I", len(data)) + pack_blocks(data)
+
+
+def parse_image(image):
+    """Returns the header and (load address, data) of every segment, after checking the image."""
+    if len(image) < HEADER_LEN or image[0] != IMAGE_MAGIC:
+        raise PackError("not an app image")
+    header = bytearray(image[:HEADER_LEN])
+    if header[FLAGS_OFFSET] & (FLAG_LZ4 | FLAG_RAM_DIGEST | FLAG_MERKLE | FLAG_SEGMENT_INDEX):
+        raise PackError("image is already packed")
+
+    segments = []
+    pos = HEADER_LEN
+    checksum = CHECKSUM_INITIAL
+    for _ in range(header[SEGMENT_COUNT_OFFSET]):
+        addr, length = struct.unpack_from("<II", image, pos)
+        pos += SEGMENT_HEADER_LEN
+        data = image[pos:pos + length]
+        if len(data) != length:
+            raise PackError("truncated segment")
+        for b in data:
+            checksum ^= b
+        segments.append((addr, data))
+        pos += length
+
+    pos += 15 - pos % 16
+    if pos >= len(image) or image[pos] != checksum:
+        raise PackError("invalid checksum")
+    pos += 1
+    if header[HASH_APPENDED_OFFSET] == 1 and hashlib.sha256(image[:pos]).digest() != image[pos:pos + HASH_LEN]:
+        raise PackError("invalid SHA-256 digest")
+    return header, segments
+
+
+def layout(segments):
+    """
+    Orders the segments for the packed image.
+
+    The flash offset of a mapped segment has to match its address within a 64 KiB MMU page,
+    so the gap in front of it is filled with RAM segments where they fit and a padding
+    segment otherwise. RAM segments that fit nowhere go to the end. The first segment
+    keeps its place, as the app description is expected at its start.
+    """
+    ram = []
+    order = []
+    for index, (addr, data) in enumerate(segments):
+        if addr < 0x10000:
+            continue  # Padding, regenerated below
+        if in_ranges(addr, RAM_RANGES) and index > 0:
+            ram.append((addr, data))
+        else:
+            order.append((addr, data))
+
+    placed = []
+    pos = HEADER_LEN
+    for addr, data in order:
+        if in_ranges(addr, FLASH_RANGES) and placed:
+            gap = (addr - pos - SEGMENT_HEADER_LEN) % MMU_PAGE_SIZE
+            if 0 < gap < SEGMENT_HEADER_LEN:
+                gap += MMU_PAGE_SIZE
+            for segment in list(ram):
+                size = SEGMENT_HEADER_LEN + len(segment[1])
+                left = gap - size
+                if left == 0 or left >= SEGMENT_HEADER_LEN:
+                    placed.append(segment)
+                    ram.remove(segment)
+                    pos += size
+                    gap = left
+            if gap:
+                placed.append((0, b"\0" * (gap - SEGMENT_HEADER_LEN)))
+                pos += gap
+        placed.append((addr, data))
+        pos += SEGMENT_HEADER_LEN + len(data)
+    placed += ram
+
+    if len(placed) > MAX_SEGMENTS:
+        raise PackError(f"packed image needs {len(placed)} segments")
+    return placed
+
+
+def merkle_footer(image):
+    """Returns the Merkle tree footer of an image: header, root and leaf hashes."""
+    leaves = [hashlib.sha256(MERKLE_LEAF_PREFIX + image[i:i + MERKLE_BLOCK_SIZE]).digest()
+              for i in range(0, len(image), MERKLE_BLOCK_SIZE)]
+    level = leaves
+    while len(level) > 1:
+        # A node without a sibling moves up unchanged
+        level = [hashlib.sha256(MERKLE_NODE_PREFIX + level[i] + level[i + 1]).digest() if i + 1 < len(level)
+                 else level[i] for i in range(0, len(level), 2)]
+    return struct.pack("<III", MERKLE_MAGIC, MERKLE_BLOCK_SIZE, len(leaves)) + level[0] + b"".join(leaves)
+
+
+def merkle_footer_len(image_len):
+    """Returns the length of the Merkle tree footer of an image of image_len bytes."""
+    return 12 + HASH_LEN + HASH_LEN * -(-image_len // MERKLE_BLOCK_SIZE)
+
+
+def index_footer(placed):
+    """Returns the segment index of the placed segments: header and one entry per segment."""
+    entries = bytearray()
+    pos = HEADER_LEN
+    for addr, data in placed:
+        pos += SEGMENT_HEADER_LEN
+        entries += struct.pack("<III", addr, len(data), pos) + hashlib.sha256(data).digest()
+        pos += len(data)
+    return struct.pack("<III", INDEX_MAGIC, len(placed), zlib.crc32(entries, 0xFFFFFFFF)) + entries
+
+
+def pack(image, compress=True, ram_digest=False, merkle=False, segment_index=False):
+    """Returns the packed form of an app image."""
+    header, segments = parse_image(image)
+    if compress:
+        stored = [(addr, pack_segment_data(data) if in_ranges(addr, RAM_RANGES) else data) for addr, data in segments]
+        placed = layout(stored)
+        header[FLAGS_OFFSET] |= FLAG_LZ4
+    else:
+        placed = segments
+    if ram_digest:
+        if header[HASH_APPENDED_OFFSET] != 1:
+            raise PackError("a RAM segment digest needs an appended SHA-256 digest")
+        header[FLAGS_OFFSET] |= FLAG_RAM_DIGEST
+    if merkle:
+        header[FLAGS_OFFSET] |= FLAG_MERKLE
+
+    header[SEGMENT_COUNT_OFFSET] = len(placed)
+    if segment_index:
+        # The index follows the other footers, whose lengths only depend on the image length
+        unpadded = HEADER_LEN + sum(SEGMENT_HEADER_LEN + len(data) for _, data in placed)
+        image_len = (unpadded + 16) & ~15
+        image_len += HASH_LEN if header[HASH_APPENDED_OFFSET] == 1 else 0
+        offset = image_len + (4 + HASH_LEN if ram_digest else 0) + (merkle_footer_len(image_len) if merkle else 0)
+        if offset // 4 >= 1 << 24:
+            raise PackError("image too large for a segment index")
+        header[FLAGS_OFFSET] |= FLAG_SEGMENT_INDEX
+        header[INDEX_OFFSET_OFFSET:INDEX_OFFSET_OFFSET + 3] = (offset // 4).to_bytes(3, "little")
+    out = bytearray(header)
+    ram_sha = hashlib.sha256(header)
+    checksum = CHECKSUM_INITIAL
+    for addr, data in placed:
+        segment_header = struct.pack("<II", addr, len(data))
+        out += segment_header + data
+        ram_sha.update(segment_header)
+        if in_ranges(addr, RAM_RANGES):
+            ram_sha.update(data)
+        for b in data:
+            checksum ^= b
+
+    out += b"\0" * (15 - len(out) % 16)
+    out.append(checksum)
+    if header[HASH_APPENDED_OFFSET] == 1:
+        out += hashlib.sha256(out).digest()
+    image_len = len(out)
+    if ram_digest:
+        out += struct.pack("<I", RAM_DIGEST_MAGIC) + ram_sha.digest()
+    if merkle:
+        out += merkle_footer(out[:image_len])
+    if segment_index:
+        assert len(out) == offset
+        out += index_footer(placed)
+    return bytes(out)
+
+
+def pack_file(input_path, output_path, compress=True, ram_digest=False, merkle=False, segment_index=False):
+    with open(input_path, "rb") as f:
+        image = f.read()
+    packed = pack(image, compress, ram_digest, merkle, segment_index)
+    with open(output_path, "wb") as f:
+        f.write(packed)
+    print(f"BetterOTA: packed {input_path}: {len(image)} -> {len(packed)} bytes")
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--no-compress", action="store_true", help="keep the RAM segments as they are")
+    parser.add_argument("--ram-digest", action="store_true",
+                        help="append the digest of the RAM segments, for lazy verification")
+    parser.add_argument("--merkle", action="store_true", help="append a Merkle tree of the image blocks")
+    parser.add_argument("--segment-index", action="store_true",
+                        help="append an index of the segments, read by the bootloader in one go")
+    parser.add_argument("input")
+    parser.add_argument("output")
+    args = parser.parse_args(argv[1:])
+    try:
+        pack_file(args.input, args.output, not args.no_compress, args.ram_digest, args.merkle, args.segment_index)
+    except PackError as e:
+        print(f"{args.input}: {e}", file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,351 @@
+#!/usr/bin/env python3
+"""
+Boot-time benchmark of the BetterOTA bootloader in the Espressif QEMU model of the ESP32.
+
+Builds a 4 MB flash image with the bootloader, the partition table of partitions.csv and an
+app in both OTA slots (by default a synthetic one that loops at its entry point), boots it a
+few times in qemu-system-xtensa and reads the boot_stats_t the bootloader leaves in RTC
+memory (see include/boot_stats.h) through the QEMU monitor. The statistics don't depend on
+the log configuration, so deferred or tokenized log lines are no obstacle.
+
+The median of each phase is compared with the baseline in test/qemu/boot_baseline.json and
+the run fails when a phase takes longer than the baseline plus its threshold, or has no
+baseline to compare with; --no-baseline only prints the measurement. Record the baseline
+with --update on the reference QEMU (`pio run -t boot_bench_update`). QEMU counts
+instructions (-icount), not flash or UART wait states, so the numbers track the code path
+rather than the time on a board.
+
+Usage: betterota_qemu_bench.py [--bootloader BIN] [--app BIN] [--runs N] [--update]
+                               [--baseline JSON | --no-baseline] [--write-flash FILE]
+                               [--qemu PATH]
+"""
+import argparse
+import csv
+import hashlib
+import json
+import os
+import shutil
+import socket
+import statistics
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+import zlib
+
+import betterota_pack
+
+PROJECT_DIR = os.path.normpath(os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+DEFAULT_BOOTLOADER = os.path.join(PROJECT_DIR, ".pio", "build", "esp32dev", "bootloader.bin")
+DEFAULT_PARTITIONS = os.path.join(PROJECT_DIR, "partitions.csv")
+DEFAULT_BASELINE = os.path.join(PROJECT_DIR, "test", "qemu", "boot_baseline.json")
+
+FLASH_SIZE = 0x400000
+BOOTLOADER_OFFSET = 0x1000
+PARTITION_TABLE_OFFSET = 0x8000
+PARTITION_TABLE_LEN = 0xC00
+
+# Must match esp_flash_partitions.h
+PARTITION_MAGIC = 0x50AA
+PARTITION_MAGIC_MD5 = 0xEBEB
+PARTITION_TYPES = {"app": 0x00, "data": 0x01}
+PARTITION_SUBTYPES = {
+    "app": {"factory": 0x00, "test": 0x20, **{f"ota_{i}": 0x10 + i for i in range(16)}},
+    "data": {"ota": 0x00, "phy": 0x01, "nvs": 0x02, "coredump": 0x03, "nvs_keys": 0x04},
+}
+APP_ALIGN = 0x10000
+DATA_ALIGN = 0x1000
+
+# RTC fast memory, data bus, where the bootloader's RTC retain memory lives
+RTC_DRAM_LOW = 0x3FF80000
+RTC_DRAM_SIZE = 0x2000
+
+# Must match include/boot_stats.h
+BOOT_STATS_MAGIC = 0x4F544142
+BOOT_STATS_VERSION = 7
+BOOT_STATS_FORMAT = "<IHHI5IiIIIIIBBBBI"
+PHASES = ("init", "ptable", "patch", "select", "load")
+
+# The synthetic app: an IRAM segment starting with "j ." and a DRAM segment
+SYNTHETIC_IRAM = (0x40080000, 32 * 1024)
+SYNTHETIC_DRAM = (0x3FFB0000, 16 * 1024)
+XTENSA_JUMP_TO_SELF = b"\x06\xff\xff"
+
+QEMU_ARGS = ["-machine", "esp32", "-display", "none", "-icount", "3"]
+
+
+class BenchError(Exception):
+    pass
+
+
+def parse_size(text):
+    text = text.strip().upper()
+    for suffix, factor in (("K", 1024), ("M", 1024 * 1024)):
+        if text.endswith(suffix):
+            return int(text[:-1], 0) * factor
+    return int(text, 0)
+
+
+def partition_table(path):
+    """
+    Returns the binary partition table and the (offset, size) of each OTA slot, laid out as
+    ESP-IDF's gen_esp32part.py does for a CSV without explicit offsets.
+    """
+    entries = b""
+    ota_slots = []
+    offset = PARTITION_TABLE_OFFSET + 0x1000
+    with open(path, newline="") as f:
+        for row in csv.reader(line for line in f if not line.lstrip().startswith("#")):
+            row = [field.strip() for field in row]
+            if not any(row):
+                continue
+            name, kind, subtype, start, size = row[:5]
+            align = APP_ALIGN if kind == "app" else DATA_ALIGN
+            offset = parse_size(start) if start else (offset + align - 1) // align * align
+            size = parse_size(size)
+            subtype = PARTITION_SUBTYPES[kind].get(subtype) if subtype in PARTITION_SUBTYPES[kind] else int(subtype, 0)
+            entries += struct.pack("<HBBII16sI", PARTITION_MAGIC, PARTITION_TYPES[kind], subtype, offset, size,
+                                   name.encode(), 0)
+            if kind == "app" and 0x10 <= subtype < 0x20:
+                ota_slots.append((offset, size))
+            offset += size
+    table = entries + struct.pack("<H14s", PARTITION_MAGIC_MD5, b"\xff" * 14) + hashlib.md5(entries).digest()
+    return table + b"\xff" * (PARTITION_TABLE_LEN - len(table)), ota_slots
+
+
+def synthetic_app():
+    """Returns an app image the bootloader verifies and loads like any other, and that then idles."""
+    segments = []
+    for (addr, size), seed in ((SYNTHETIC_IRAM, 1), (SYNTHETIC_DRAM, 2)):
+        # Code-like filler: compresses somewhat, as real code does
+        data = bytearray(hashlib.sha256(bytes([seed, i % 64])).digest()[i % 8] for i in range(size))
+        segments.append((addr, data))
+    segments[0][1][:len(XTENSA_JUMP_TO_SELF)] = XTENSA_JUMP_TO_SELF
+
+    # DIO, 40 MHz, 4 MB; any chip revision up to v3.99
+    header = struct.pack("<BBBBIB3sHBHH4sB", betterota_pack.IMAGE_MAGIC, len(segments), 2, 0x20, SYNTHETIC_IRAM[0],
+                         0xEE, b"\0\0\0", 0, 0, 0, 399, b"\0\0\0\0", 1)
+    out = bytearray(header)
+    checksum = betterota_pack.CHECKSUM_INITIAL
+    for addr, data in segments:
+        out += struct.pack("<II", addr, len(data)) + data
+        for b in data:
+            checksum ^= b
+    out += b"\0" * (15 - len(out) % 16)
+    out.append(checksum)
+    out += hashlib.sha256(out).digest()
+    return bytes(out)
+
+
+def flash_image(bootloader, app, partitions):
+    table, ota_slots = partition_table(partitions)
+    if not ota_slots:
+        raise BenchError(f"{partitions}: no OTA slots")
+    flash = bytearray(b"\xff" * FLASH_SIZE)
+    if BOOTLOADER_OFFSET + len(bootloader) > PARTITION_TABLE_OFFSET:
+        raise BenchError("the bootloader overlaps the partition table")
+    flash[BOOTLOADER_OFFSET:BOOTLOADER_OFFSET + len(bootloader)] = bootloader
+    flash[PARTITION_TABLE_OFFSET:PARTITION_TABLE_OFFSET + len(table)] = table
+    for offset, size in ota_slots:
+        if len(app) > size:
+            raise BenchError(f"the app doesn't fit the OTA slot at 0x{offset:x}")
+        flash[offset:offset + len(app)] = app
+    return bytes(flash)
+
+
+def find_boot_stats(rtc):
+    """Returns the phase times of the boot_stats_t in a dump of RTC fast memory, None without one."""
+    size = struct.calcsize(BOOT_STATS_FORMAT)
+    magic = struct.pack("<I", BOOT_STATS_MAGIC)
+    pos = rtc.find(magic)
+    while pos >= 0:
+        record = rtc[pos:pos + size]
+        if len(record) == size:
+            fields = struct.unpack(BOOT_STATS_FORMAT, record)
+            if fields[1] == BOOT_STATS_VERSION and fields[2] == size and \
+                    fields[-1] == zlib.crc32(record[:-4], 0xFFFFFFFF):
+                rom_us, phase_end = fields[3], fields[4:9]
+                result = {"rom": rom_us, "total": phase_end[-1]}
+                for i, name in enumerate(PHASES):
+                    result[name] = phase_end[i] - (phase_end[i - 1] if i > 0 else 0) if phase_end[i] else 0
+                return result
+        pos = rtc.find(magic, pos + 4)
+    return None
+
+
+class Monitor:
+    """The QEMU human monitor, on a UNIX socket."""
+
+    def __init__(self, path, timeout):
+        deadline = time.monotonic() + timeout
+        while True:
+            try:
+                self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+                self.sock.connect(path)
+                break
+            except OSError:
+                self.sock.close()
+                if time.monotonic() > deadline:
+                    raise BenchError("QEMU monitor didn't come up")
+                time.sleep(0.05)
+        self.sock.settimeout(timeout)
+        self._read_prompt()
+
+    def _read_prompt(self):
+        data = b""
+        while not data.endswith(b"(qemu) "):
+            chunk = self.sock.recv(4096)
+            if not chunk:
+                raise BenchError("QEMU monitor closed")
+            data += chunk
+        return data
+
+    def command(self, text):
+        self.sock.sendall(text.encode() + b"\n")
+        return self._read_prompt()
+
+    def close(self):
+        self.sock.close()
+
+
+def boot_once(qemu, flash_path, workdir, timeout):
+    """Boots the flash image once and returns its phase times."""
+    monitor_path = os.path.join(workdir, "monitor.sock")
+    serial_path = os.path.join(workdir, "serial.log")
+    rtc_path = os.path.join(workdir, "rtc.bin")
+    for path in (monitor_path, rtc_path):
+        if os.path.exists(path):
+            os.remove(path)
+    # QEMU writes back to an MTD drive, so every boot gets a fresh copy of the flash
+    drive = os.path.join(workdir, "flash.bin")
+    shutil.copy(flash_path, drive)
+
+    proc = subprocess.Popen([qemu, *QEMU_ARGS, "-drive", f"file={drive},if=mtd,format=raw",
+                             "-serial", f"file:{serial_path}", "-monitor", f"unix:{monitor_path},server,nowait"],
+                            stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    try:
+        monitor = Monitor(monitor_path, timeout)
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline:
+            monitor.command(f'pmemsave 0x{RTC_DRAM_LOW:x} {RTC_DRAM_SIZE} "{rtc_path}"')
+            with open(rtc_path, "rb") as f:
+                stats = find_boot_stats(f.read())
+            if stats is not None:
+                monitor.command("quit")
+                monitor.close()
+                return stats
+            time.sleep(0.1)
+        monitor.close()
+    finally:
+        proc.kill()
+        proc.wait()
+
+    tail = ""
+    if os.path.exists(serial_path):
+        with open(serial_path, errors="replace") as f:
+            tail = "".join(f.readlines()[-20:])
+    raise BenchError(f"no boot statistics in RTC memory after {timeout} s; serial output:\n{tail}")
+
+
+def show(measured):
+    """Prints the measurement alone."""
+    for name, value in measured.items():
+        print(f"  {name:7} {value:8} us")
+
+
+def compare(measured, baseline):
+    """Prints the measurement against the baseline and returns the phases over their threshold or
+    without a baseline."""
+    percent = baseline.get("threshold_percent", 10)
+    slack = baseline.get("slack_us", 0)
+    reference = baseline.get("phases_us") or {}
+    failed = []
+    for name, value in measured.items():
+        base = reference.get(name)
+        if base is None:
+            print(f"  {name:7} {value:8} us  no baseline")
+            failed.append(name)
+            continue
+        limit = base * (100 + percent) // 100 + slack
+        verdict = "REGRESSION" if value > limit else "ok"
+        print(f"  {name:7} {value:8} us  baseline {base:8} us  limit {limit:8} us  {verdict}")
+        if value > limit:
+            failed.append(name)
+    return failed
+
+
+def main(argv):
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--bootloader", default=DEFAULT_BOOTLOADER, help="bootloader binary (default: PlatformIO build)")
+    parser.add_argument("--app", help="app image to boot (default: a synthetic app)")
+    parser.add_argument("--partitions", default=DEFAULT_PARTITIONS, help="partition table CSV")
+    parser.add_argument("--baseline", default=DEFAULT_BASELINE, help="baseline JSON to compare with")
+    parser.add_argument("--runs", type=int, default=5, help="boots to take the median of (default 5)")
+    mode = parser.add_mutually_exclusive_group()
+    mode.add_argument("--update", action="store_true", help="write the measurement to the baseline instead")
+    mode.add_argument("--no-baseline", action="store_true", help="only print the measurement, e.g. on a new machine")
+    parser.add_argument("--write-flash", metavar="FILE", help="only write the flash image to FILE")
+    parser.add_argument("--qemu", default="qemu-system-xtensa", help="QEMU binary with the esp32 machine")
+    parser.add_argument("--timeout", type=float, default=20, help="seconds to wait for each boot (default 20)")
+    args = parser.parse_args(argv[1:])
+
+    try:
+        with open(args.bootloader, "rb") as f:
+            bootloader = f.read()
+        if args.app:
+            with open(args.app, "rb") as f:
+                app = f.read()
+        else:
+            app = synthetic_app()
+        flash = flash_image(bootloader, app, args.partitions)
+        if args.write_flash:
+            with open(args.write_flash, "wb") as f:
+                f.write(flash)
+            print(f"{args.write_flash}: {len(app)} byte app in each OTA slot")
+            return 0
+
+        if shutil.which(args.qemu) is None:
+            raise BenchError(f"{args.qemu} not found; install Espressif's QEMU fork (idf_tools.py install qemu-xtensa)")
+        runs = []
+        with tempfile.TemporaryDirectory() as workdir:
+            flash_path = os.path.join(workdir, "flash.orig.bin")
+            with open(flash_path, "wb") as f:
+                f.write(flash)
+            for _ in range(args.runs):
+                runs.append(boot_once(args.qemu, flash_path, workdir, args.timeout))
+        measured = {name: int(statistics.median(run[name] for run in runs)) for name in ("rom", *PHASES, "total")}
+
+        if args.no_baseline:
+            print(f"Boot phases, median of {args.runs} boots:")
+            show(measured)
+            return 0
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        if args.update:
+            baseline["phases_us"] = measured
+            with open(args.baseline, "w") as f:
+                json.dump(baseline, f, indent=4)
+                f.write("\n")
+            print(f"{args.baseline}: updated")
+            show(measured)
+            return 0
+
+        print(f"Boot phases, median of {args.runs} boots:")
+        failed = compare(measured, baseline)
+        if not baseline.get("phases_us"):
+            # Passing without numbers to compare with would hide every regression
+            print(f"{args.baseline} has no measurement; record one with --update, or pass --no-baseline",
+                  file=sys.stderr)
+            return 1
+        if failed:
+            print(f"Boot time regression or no baseline in: {', '.join(failed)}", file=sys.stderr)
+            return 1
+        return 0
+    except (BenchError, OSError, ValueError, KeyError) as e:
+        print(e, file=sys.stderr)
+        return 1
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))